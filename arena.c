@@ -0,0 +1,96 @@
+// Inputs = sizes, outputs = memory that lives until the whole arena goes
+#include "arena.h"
+#include "memory.h"
+#include "c-tests/test.h"
+#include <stdlib.h>
+
+arena arena_create(void) {
+  arena memory = {
+    .current = NULL,
+    .allocation_count = 0,
+    .bytes_used = 0,
+  };
+  return memory;
+}
+
+static arena_block *create_block(arena *memory, size_t size) {
+  arena_block *block = memory_allocate(sizeof(arena_block) + size);
+  assert(block != NULL);
+  block->size = size;
+  block->used = 0;
+  memory->allocation_count += 1;
+  return block;
+}
+
+// Everything comes back aligned for any type, like malloc
+void *arena_allocate(arena *memory, size_t size) {
+  size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+  memory->bytes_used += size;
+  arena_block *block = memory->current;
+
+#ifndef NO_ARENA
+  if (block != NULL && block->size - block->used >= size) {
+    void *allocation = block->data + block->used;
+    block->used += size;
+    return allocation;
+  }
+  // Big things get a block to themselves, slotted in behind the current
+  // one, so the space left in the current one isn't thrown away
+  if (block != NULL && size > ARENA_BLOCK_SIZE / 4) {
+    arena_block *big_block = create_block(memory, size);
+    big_block->used = size;
+    big_block->previous = block->previous;
+    block->previous = big_block;
+    return big_block->data;
+  }
+  block = create_block(memory, size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+#else
+  // One malloc each, still chained together so arena_free can find them
+  block = create_block(memory, size);
+#endif
+
+  block->previous = memory->current;
+  memory->current = block;
+  block->used = size;
+  return block->data;
+}
+
+void arena_free(arena *memory) {
+  arena_block *block = memory->current;
+  while (block != NULL) {
+    arena_block *previous = block->previous;
+    memory_free(block);
+    block = previous;
+  }
+  memory->current = NULL;
+  memory->bytes_used = 0;
+}
+
+void arena_disown(arena *memory) {
+  for (arena_block *block = memory->current; block != NULL; block = block->previous) {
+    memory_disown(block);
+  }
+}
+
+// Everything from `from` goes behind the current block of `into`, so `into`
+// carries on bumping through the block it was already in
+void arena_adopt(arena *into, arena *from) {
+  if (from->current == NULL) {
+    return;
+  }
+  arena_block *oldest = from->current;
+  memory_adopt(oldest);
+  while (oldest->previous != NULL) {
+    oldest = oldest->previous;
+    memory_adopt(oldest);
+  }
+  if (into->current == NULL) {
+    into->current = from->current;
+  } else {
+    oldest->previous = into->current->previous;
+    into->current->previous = from->current;
+  }
+  into->allocation_count += from->allocation_count;
+  into->bytes_used += from->bytes_used;
+  *from = arena_create();
+}
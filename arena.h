@@ -0,0 +1,38 @@
+#ifndef arena_h
+#define arena_h
+#include <stdalign.h>
+#include <stddef.h>
+
+// Bump allocator for things that all die at the same time (like every node
+// of an AST). Allocating is moving a pointer forward, and there's no freeing
+// one thing, only everything at once with arena_free.
+//
+// Build with -DNO_ARENA to give every allocation its own malloc instead, for
+// comparing allocation counts and speed against plain malloc.
+
+// Big enough that a normal file only needs a handful
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct arena_block {
+  struct arena_block *previous;
+  size_t size;
+  size_t used;
+  alignas(max_align_t) char data[];
+} arena_block;
+
+typedef struct {
+  arena_block *current; // Newest block, the one being bumped through
+  size_t allocation_count; // How many times we went to malloc
+  size_t bytes_used;
+} arena;
+
+arena arena_create(void);
+void *arena_allocate(arena *memory, size_t size);
+void arena_free(arena *memory);
+// For arenas filled on another thread: that thread disowns it once it's done
+// with it, then whoever's keeping the results adopts it into their own arena.
+// After that it all goes away with `into`.
+void arena_disown(arena *memory);
+void arena_adopt(arena *into, arena *from);
+
+#endif
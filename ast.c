@@ -0,0 +1,532 @@
+// Inputs = the pointer tree from the parser, outputs = the same tree in one array
+#include "ast.h"
+#include "instrument.h"
+#include "semantic.h"
+#include "c-tests/test.h"
+#include "c-vector/vec.h"
+#include <stdlib.h>
+
+// Where things go in a flat_node:
+//   NODE_EQUATION                 operator, left, right
+//   NODE_VARIABLE                 data = name
+//   NODE_BASE_TYPE                data = name, left = size, alignment
+//   NODE_STRING                   data = index into strings
+//   NODE_NUMBER_LITERAL           data = value
+//   NODE_STRUCTURE                data = name, left = members list, right = size, alignment
+//   NODE_POINTER                  left = to
+//   NODE_VARIABLE_DECLARATION     data = name, left = type, right = value
+//   NODE_STRUCT_MEMBER_GET        data = name, left = from, right = offset
+//   NODE_ARRAY_GET                left = from, right = index
+//   NODE_IF                       left = condition, right = success, data = fail
+//   NODE_WHILE, NODE_DO_WHILE     left = condition, right = body
+//   NODE_FOR                      left = condition, right = body,
+//                                 data = extra [index declaration, index assignment]
+//   NODE_FUNCTION_DECLARATION     data = name, left = type,
+//                                 right = extra [body, parameters list]
+//   NODE_FUNCTION_CALL            left = from, right = inputs list
+//   NODE_BLOCK                    left = statements list
+
+// Where each interned type went, so a type that a lot of declarations share
+// is flattened once and they all point at it
+typedef struct {
+  flat_ast *ast;
+  node_index *type_indices; // Vector, by type_id, NO_NODE till it's flattened
+} flattening;
+
+static node_index flatten_node(flattening *state, node *current_node);
+
+static uint32_t reserve_extra(flat_ast *ast, uint32_t count) {
+  uint32_t start = vector_size((vector *)&ast->extra);
+  for (uint32_t i = 0; i < count; i++) {
+    vector_add(&ast->extra, NO_NODE);
+  }
+  return start;
+}
+
+// Room for the whole list is taken before any child gets flattened, since
+// children can have lists of their own
+static uint32_t flatten_list(flattening *state, node_list list) {
+  flat_ast *ast = state->ast;
+  uint32_t start = reserve_extra(ast, list.count + 1);
+  ast->extra[start] = list.count;
+  for (uint32_t i = 0; i < list.count; i++) {
+    node_index child = flatten_node(state, list.nodes[i]);
+    ast->extra[start + 1 + i] = child;
+  }
+  return start;
+}
+
+// Base types and pointers that were interned (structs are only ever in one place)
+static type_id shared_type_id(const node *current_node) {
+  switch (current_node->type) {
+  case NODE_BASE_TYPE:
+    return current_node->base_type.id;
+  case NODE_POINTER:
+    return current_node->pointer.id;
+  default:
+    return NO_TYPE;
+  }
+}
+
+// Parents come before their children, so a walk down the tree goes forward.
+// Types that are shared are the exception, they're wherever they went first.
+static node_index flatten_node(flattening *state, node *current_node) {
+  if (current_node == NULL) {
+    return NO_NODE;
+  }
+  flat_ast *ast = state->ast;
+  type_id id = shared_type_id(current_node);
+  if (id != NO_TYPE && id < vector_size((vector *)&state->type_indices) && state->type_indices[id] != NO_NODE) {
+    return state->type_indices[id];
+  }
+  node_index index = vector_size((vector *)&ast->nodes);
+  vector_add(&ast->nodes, ((flat_node){ .type = current_node->type, .data = NO_NODE, .left = NO_NODE, .right = NO_NODE }));
+
+  // Children get flattened into locals first, the vector can move while they do
+  flat_node flat = ast->nodes[index];
+  switch (current_node->type) {
+  default:
+    break;
+  case NODE_EQUATION:
+    flat.operator = current_node->equation.operator;
+    flat.left = flatten_node(state, current_node->equation.left);
+    flat.right = flatten_node(state, current_node->equation.right);
+    break;
+  case NODE_VARIABLE:
+    flat.data = current_node->variable.name;
+    break;
+  case NODE_BASE_TYPE:
+    flat.data = current_node->base_type.name;
+    flat.left = current_node->base_type.size_bytes;
+    flat.alignment = current_node->base_type.alignment;
+    break;
+  case NODE_STRING:
+    flat.data = vector_size((vector *)&ast->strings);
+    vector_add(&ast->strings, current_node->string.value);
+    break;
+  case NODE_NUMBER_LITERAL:
+    flat.data = (uint32_t)current_node->number_literal.value;
+    break;
+  case NODE_STRUCTURE:
+    flat.data = current_node->structure.name;
+    flat.left = flatten_list(state, current_node->structure.members);
+    flat.right = current_node->structure.size_bytes;
+    flat.alignment = current_node->structure.alignment;
+    break;
+  case NODE_POINTER:
+    flat.left = flatten_node(state, current_node->pointer.to);
+    break;
+  case NODE_VARIABLE_DECLARATION:
+    flat.data = current_node->variable_declaration.name;
+    flat.left = flatten_node(state, current_node->variable_declaration.type);
+    flat.right = flatten_node(state, current_node->variable_declaration.value);
+    break;
+  case NODE_STRUCT_MEMBER_GET:
+    flat.data = current_node->struct_member_get.name;
+    flat.left = flatten_node(state, current_node->struct_member_get.from);
+    flat.right = current_node->struct_member_get.offset;
+    if (current_node->struct_member_get.through_pointer) {
+      flat.operator = OPERATOR_DEREFERENCE;
+    }
+    break;
+  case NODE_ARRAY_GET:
+    flat.left = flatten_node(state, current_node->array_get.from);
+    flat.right = flatten_node(state, current_node->array_get.index_expression);
+    break;
+  case NODE_IF:
+    flat.left = flatten_node(state, current_node->if_statement.condition);
+    flat.right = flatten_node(state, current_node->if_statement.success);
+    flat.data = flatten_node(state, current_node->if_statement.fail);
+    break;
+  case NODE_WHILE:
+    flat.left = flatten_node(state, current_node->while_loop.condition);
+    flat.right = flatten_node(state, current_node->while_loop.body);
+    break;
+  case NODE_DO_WHILE:
+    flat.left = flatten_node(state, current_node->do_while_loop.condition);
+    flat.right = flatten_node(state, current_node->do_while_loop.body);
+    break;
+  case NODE_FOR: {
+    flat.data = reserve_extra(ast, 2);
+    node_index index_declaration = flatten_node(state, current_node->for_loop.index_declaration);
+    ast->extra[flat.data] = index_declaration;
+    flat.left = flatten_node(state, current_node->for_loop.condition);
+    node_index index_assignment = flatten_node(state, current_node->for_loop.index_assignment);
+    ast->extra[flat.data + 1] = index_assignment;
+    flat.right = flatten_node(state, current_node->for_loop.body);
+    break;
+  }
+  case NODE_FUNCTION_DECLARATION: {
+    flat.data = current_node->function.name;
+    flat.left = flatten_node(state, current_node->function.type);
+    flat.right = reserve_extra(ast, 1);
+    flatten_list(state, current_node->function.parameters);
+    node_index body = flatten_node(state, current_node->function.body);
+    ast->extra[flat.right] = body;
+    break;
+  }
+  case NODE_FUNCTION_CALL:
+    flat.left = flatten_node(state, current_node->function_call.function_expression);
+    flat.right = flatten_list(state, current_node->function_call.inputs);
+    break;
+  case NODE_BLOCK:
+    flat.left = flatten_list(state, current_node->block.nodes);
+    break;
+  }
+  ast->nodes[index] = flat;
+  if (id != NO_TYPE) {
+    while (vector_size((vector *)&state->type_indices) <= id) {
+      vector_add(&state->type_indices, NO_NODE);
+    }
+    state->type_indices[id] = index;
+  }
+  return index;
+}
+
+flat_ast flatten_ast(node *root) {
+  TIME_SCOPE("flatten");
+  flat_ast ast = {
+    .nodes = vector_create(),
+    .extra = vector_create(),
+    .strings = vector_create(),
+    .root = NO_NODE,
+  };
+  flattening state = { .ast = &ast, .type_indices = vector_create() };
+  ast.root = flatten_node(&state, root);
+  vector_free((vector *)&state.type_indices);
+  return ast;
+}
+
+node_index flatten_into(flat_ast *ast, node *subtree) {
+  flattening state = { .ast = ast, .type_indices = vector_create() };
+  node_index index = flatten_node(&state, subtree);
+  vector_free((vector *)&state.type_indices);
+  return index;
+}
+
+// The prefix is copied in as it is, so none of its indices move. Its own root
+// block is left in there unused, the new root lists its statements instead.
+flat_ast flatten_ast_after(const flat_ast *prefix, node *root) {
+  TIME_SCOPE("flatten");
+  assert(root->type == NODE_BLOCK && ast_type(prefix, prefix->root) == NODE_BLOCK);
+  flat_ast ast = {
+    .nodes = vector_create(),
+    .extra = vector_create(),
+    .strings = vector_create(),
+    .root = NO_NODE,
+  };
+  uint32_t node_count = vector_size((vector *)&prefix->nodes);
+  uint32_t extra_count = vector_size((vector *)&prefix->extra);
+  uint32_t string_count = vector_size((vector *)&prefix->strings);
+  for (uint32_t i = 0; i < node_count; i++) {
+    vector_add(&ast.nodes, prefix->nodes[i]);
+  }
+  for (uint32_t i = 0; i < extra_count; i++) {
+    vector_add(&ast.extra, prefix->extra[i]);
+  }
+  for (uint32_t i = 0; i < string_count; i++) {
+    vector_add(&ast.strings, prefix->strings[i]);
+  }
+
+  uint32_t prefix_count = ast_list_count(prefix, prefix->root);
+  node_list statements = root->block.nodes;
+  ast.root = vector_size((vector *)&ast.nodes);
+  vector_add(&ast.nodes, ((flat_node){ .type = NODE_BLOCK, .data = NO_NODE, .left = NO_NODE, .right = NO_NODE }));
+  uint32_t start = reserve_extra(&ast, prefix_count + statements.count + 1);
+  ast.nodes[ast.root].left = start;
+  ast.extra[start] = prefix_count + statements.count;
+  for (uint32_t i = 0; i < prefix_count; i++) {
+    ast.extra[start + 1 + i] = ast_list_item(prefix, prefix->root, i);
+  }
+  flattening state = { .ast = &ast, .type_indices = vector_create() };
+  for (uint32_t i = 0; i < statements.count; i++) {
+    node_index child = flatten_node(&state, statements.nodes[i]);
+    ast.extra[start + 1 + prefix_count + i] = child;
+  }
+  vector_free((vector *)&state.type_indices);
+  return ast;
+}
+
+// The other way, back to pointer nodes
+
+static node_list unflatten_list(const flat_ast *ast, uint32_t start, arena *nodes) {
+  node_list list = { .nodes = NULL, .count = ast->extra[start] };
+  if (list.count > 0) {
+    list.nodes = arena_allocate(nodes, sizeof(node *) * list.count);
+    for (uint32_t i = 0; i < list.count; i++) {
+      list.nodes[i] = unflatten_node(ast, ast->extra[start + 1 + i], nodes);
+    }
+  }
+  return list;
+}
+
+node *unflatten_node(const flat_ast *ast, node_index index, arena *nodes) {
+  if (index == NO_NODE) {
+    return NULL;
+  }
+  const flat_node *flat = &ast->nodes[index];
+  node *current_node = arena_allocate(nodes, sizeof(node));
+  current_node->type = flat->type;
+  switch (flat->type) {
+  default:
+    break;
+  case NODE_EQUATION:
+    current_node->equation.operator = flat->operator;
+    current_node->equation.left = unflatten_node(ast, flat->left, nodes);
+    current_node->equation.right = unflatten_node(ast, flat->right, nodes);
+    break;
+  case NODE_VARIABLE:
+    current_node->variable.name = flat->data;
+    break;
+  case NODE_BASE_TYPE:
+    // What it's a name for is gone, resolve_type can find it again
+    current_node->base_type.name = flat->data;
+    current_node->base_type.size_bytes = flat->left;
+    current_node->base_type.alignment = flat->alignment;
+    current_node->base_type.definition = NULL;
+    current_node->base_type.id = NO_TYPE;
+    break;
+  case NODE_STRING:
+    current_node->string.value = ast->strings[flat->data];
+    break;
+  case NODE_NUMBER_LITERAL:
+    current_node->number_literal.value = (int)flat->data;
+    break;
+  case NODE_STRUCTURE:
+    current_node->structure.name = flat->data;
+    current_node->structure.members = unflatten_list(ast, flat->left, nodes);
+    current_node->structure.size_bytes = flat->right;
+    current_node->structure.alignment = flat->alignment;
+    current_node->structure.offset = NO_OFFSET;
+    current_node->structure.id = NO_TYPE;
+    break;
+  case NODE_POINTER:
+    current_node->pointer.to = unflatten_node(ast, flat->left, nodes);
+    current_node->pointer.id = NO_TYPE;
+    break;
+  case NODE_VARIABLE_DECLARATION:
+    current_node->variable_declaration.name = flat->data;
+    current_node->variable_declaration.offset = NO_OFFSET;
+    current_node->variable_declaration.type = unflatten_node(ast, flat->left, nodes);
+    current_node->variable_declaration.value = unflatten_node(ast, flat->right, nodes);
+    break;
+  case NODE_STRUCT_MEMBER_GET:
+    current_node->struct_member_get.name = flat->data;
+    current_node->struct_member_get.from = unflatten_node(ast, flat->left, nodes);
+    current_node->struct_member_get.offset = flat->right;
+    current_node->struct_member_get.member = NULL;
+    current_node->struct_member_get.through_pointer = flat->operator == OPERATOR_DEREFERENCE;
+    break;
+  case NODE_ARRAY_GET:
+    current_node->array_get.from = unflatten_node(ast, flat->left, nodes);
+    current_node->array_get.index_expression = unflatten_node(ast, flat->right, nodes);
+    break;
+  case NODE_IF:
+    current_node->if_statement.condition = unflatten_node(ast, flat->left, nodes);
+    current_node->if_statement.success = unflatten_node(ast, flat->right, nodes);
+    current_node->if_statement.fail = unflatten_node(ast, flat->data, nodes);
+    break;
+  case NODE_WHILE:
+    current_node->while_loop.condition = unflatten_node(ast, flat->left, nodes);
+    current_node->while_loop.body = unflatten_node(ast, flat->right, nodes);
+    break;
+  case NODE_DO_WHILE:
+    current_node->do_while_loop.condition = unflatten_node(ast, flat->left, nodes);
+    current_node->do_while_loop.body = unflatten_node(ast, flat->right, nodes);
+    break;
+  case NODE_FOR:
+    current_node->for_loop.index_declaration = unflatten_node(ast, ast->extra[flat->data], nodes);
+    current_node->for_loop.condition = unflatten_node(ast, flat->left, nodes);
+    current_node->for_loop.index_assignment = unflatten_node(ast, ast->extra[flat->data + 1], nodes);
+    current_node->for_loop.body = unflatten_node(ast, flat->right, nodes);
+    break;
+  case NODE_FUNCTION_DECLARATION:
+    current_node->function.name = flat->data;
+    current_node->function.type = unflatten_node(ast, flat->left, nodes);
+    current_node->function.lazy_body = NO_LAZY_BODY;
+    current_node->function.parameters = unflatten_list(ast, flat->right + 1, nodes);
+    current_node->function.body = unflatten_node(ast, ast->extra[flat->right], nodes);
+    break;
+  case NODE_FUNCTION_CALL:
+    current_node->function_call.function_expression = unflatten_node(ast, flat->left, nodes);
+    current_node->function_call.inputs = unflatten_list(ast, flat->right, nodes);
+    break;
+  case NODE_BLOCK:
+    current_node->block.nodes = unflatten_list(ast, flat->left, nodes);
+    break;
+  }
+  return current_node;
+}
+
+void flat_ast_free(flat_ast *ast) {
+  vector_free((vector *)&ast->nodes);
+  vector_free((vector *)&ast->extra);
+  vector_free((vector *)&ast->strings);
+  ast->root = NO_NODE;
+}
+
+// What the tree itself takes up, not counting spare vector capacity
+size_t flat_ast_bytes(const flat_ast *ast) {
+  return vector_size((vector *)&ast->nodes) * sizeof(flat_node) +
+         vector_size((vector *)&ast->extra) * sizeof(uint32_t) +
+         vector_size((vector *)&ast->strings) * sizeof(string_slice);
+}
+
+// Accessors
+
+operator_type ast_operator(const flat_ast *ast, node_index index) {
+  assert(ast->nodes[index].type == NODE_EQUATION);
+  return ast->nodes[index].operator;
+}
+
+symbol_id ast_name(const flat_ast *ast, node_index index) {
+  switch (ast->nodes[index].type) {
+  case NODE_VARIABLE:
+  case NODE_BASE_TYPE:
+  case NODE_STRUCTURE:
+  case NODE_VARIABLE_DECLARATION:
+  case NODE_STRUCT_MEMBER_GET:
+  case NODE_FUNCTION_DECLARATION:
+    return ast->nodes[index].data;
+  default:
+    return NO_SYMBOL;
+  }
+}
+
+int ast_number(const flat_ast *ast, node_index index) {
+  assert(ast->nodes[index].type == NODE_NUMBER_LITERAL);
+  return (int)ast->nodes[index].data;
+}
+
+string_slice ast_string(const flat_ast *ast, node_index index) {
+  assert(ast->nodes[index].type == NODE_STRING);
+  return ast->strings[ast->nodes[index].data];
+}
+
+uint32_t ast_type_size(const flat_ast *ast, node_index index) {
+  switch (ast->nodes[index].type) {
+  case NODE_BASE_TYPE:
+    return ast->nodes[index].left;
+  case NODE_POINTER:
+    return POINTER_BYTES;
+  case NODE_STRUCTURE:
+    return ast->nodes[index].right;
+  default:
+    return 0;
+  }
+}
+
+uint32_t ast_type_alignment(const flat_ast *ast, node_index index) {
+  switch (ast->nodes[index].type) {
+  case NODE_BASE_TYPE:
+  case NODE_STRUCTURE:
+    return ast->nodes[index].alignment;
+  case NODE_POINTER:
+    return POINTER_BYTES;
+  default:
+    return 1;
+  }
+}
+
+uint32_t ast_member_offset(const flat_ast *ast, node_index index) {
+  assert(ast->nodes[index].type == NODE_STRUCT_MEMBER_GET);
+  return ast->nodes[index].right;
+}
+
+// NO_NODE if the child is optional and isn't there
+node_index ast_child(const flat_ast *ast, node_index index, child_slot slot) {
+  const flat_node *flat = &ast->nodes[index];
+  switch (flat->type) {
+  case NODE_EQUATION:
+  case NODE_VARIABLE_DECLARATION:
+  case NODE_ARRAY_GET:
+  case NODE_WHILE:
+  case NODE_DO_WHILE:
+    assert(slot <= 1);
+    return slot == 0 ? flat->left : flat->right;
+  case NODE_POINTER:
+  case NODE_STRUCT_MEMBER_GET:
+  case NODE_FUNCTION_CALL:
+    assert(slot == 0);
+    return flat->left;
+  case NODE_IF:
+    assert(slot <= CHILD_FAIL);
+    return slot == 0 ? flat->left : slot == 1 ? flat->right : flat->data;
+  case NODE_FOR:
+    assert(slot <= CHILD_INDEX_ASSIGNMENT);
+    switch (slot) {
+    case CHILD_CONDITION: return flat->left;
+    case CHILD_BODY: return flat->right;
+    case CHILD_INDEX_DECLARATION: return ast->extra[flat->data];
+    default: return ast->extra[flat->data + 1];
+    }
+  case NODE_FUNCTION_DECLARATION:
+    assert(slot <= 1);
+    return slot == CHILD_TYPE ? flat->left : ast->extra[flat->right];
+  default:
+    return NO_NODE;
+  }
+}
+
+// Children in walk order:
+//   NODE_FOR                   index declaration, condition, index assignment, body
+//   NODE_FUNCTION_DECLARATION  type, parameters..., body
+//   NODE_FUNCTION_CALL         inputs..., from
+//   NODE_BLOCK, NODE_STRUCTURE the list
+//   everything else            its child_slots in order
+uint32_t ast_child_count(const flat_ast *ast, node_index index) {
+  switch (ast->nodes[index].type) {
+  case NODE_POINTER:
+  case NODE_STRUCT_MEMBER_GET:
+    return 1;
+  case NODE_EQUATION:
+  case NODE_VARIABLE_DECLARATION:
+  case NODE_ARRAY_GET:
+  case NODE_WHILE:
+  case NODE_DO_WHILE:
+    return 2;
+  case NODE_IF:
+    return 3;
+  case NODE_FOR:
+    return 4;
+  case NODE_FUNCTION_DECLARATION:
+    return ast_list_count(ast, index) + 2;
+  case NODE_FUNCTION_CALL:
+    return ast_list_count(ast, index) + 1;
+  case NODE_BLOCK:
+  case NODE_STRUCTURE:
+    return ast_list_count(ast, index);
+  default:
+    return 0;
+  }
+}
+
+node_index ast_nth_child(const flat_ast *ast, node_index index, uint32_t n) {
+  const flat_node *flat = &ast->nodes[index];
+  switch (flat->type) {
+  case NODE_FOR: {
+    static const child_slot for_order[] = { CHILD_INDEX_DECLARATION, CHILD_CONDITION, CHILD_INDEX_ASSIGNMENT, CHILD_BODY };
+    assert(n < 4);
+    return ast_child(ast, index, for_order[n]);
+  }
+  case NODE_FUNCTION_DECLARATION: {
+    uint32_t parameter_count = ast_list_count(ast, index);
+    assert(n < parameter_count + 2);
+    if (n == 0) {
+      return flat->left;
+    }
+    return n <= parameter_count ? ast_list_item(ast, index, n - 1) : ast->extra[flat->right];
+  }
+  case NODE_FUNCTION_CALL: {
+    uint32_t input_count = ast_list_count(ast, index);
+    assert(n <= input_count);
+    return n < input_count ? ast_list_item(ast, index, n) : flat->left;
+  }
+  case NODE_BLOCK:
+  case NODE_STRUCTURE:
+    assert(n < ast_list_count(ast, index));
+    return ast_list_item(ast, index, n);
+  default:
+    return ast_child(ast, index, (child_slot)n);
+  }
+}
@@ -0,0 +1,124 @@
+#ifndef ast_h
+#define ast_h
+#include "parser.h"
+#include <stdint.h>
+
+// The same tree parser() makes, packed down for keeping around. Every node is
+// 16 bytes in one array (a pointer tree's node is 48), children are 32-bit
+// indices into that array instead of pointers, and anything that doesn't fit
+// (lists, strings, a for loop's third and fourth child) goes in side arrays.
+// Walking the whole tree is then mostly walking forward through one block of
+// memory. A type that's shared
+// by a lot of declarations (see type_table in semantic.h) is one node here
+// too, and they all point at it.
+//
+// Don't read the arrays directly, what's in `data`, `left` and `right` depends
+// on the node type. Use the ast_* functions below.
+
+typedef uint32_t node_index;
+
+// For optional children, like an if without an else
+#define NO_NODE UINT32_MAX
+
+typedef struct {
+  uint8_t type; // node_type
+  uint8_t operator; // operator_type, for equations (OPERATOR_DEREFERENCE on a member get from `->`)
+  uint16_t alignment; // For base types and structs
+  uint32_t data; // Name, number, string or extra index, depends on type
+  uint32_t left;
+  uint32_t right;
+} flat_node;
+
+_Static_assert(sizeof(flat_node) == 16, "every flat node is 16 bytes");
+
+typedef struct {
+  flat_node *nodes; // Vector
+  uint32_t *extra; // Vector, lists are stored as a count then that many nodes
+  string_slice *strings; // Vector
+  node_index root;
+} flat_ast;
+
+// Which child to get, what it means depends on the node type
+typedef enum {
+  // NODE_EQUATION
+  CHILD_LEFT = 0,
+  CHILD_RIGHT = 1,
+  // NODE_POINTER
+  CHILD_POINTS_TO = 0,
+  // NODE_VARIABLE_DECLARATION (and CHILD_TYPE for NODE_FUNCTION_DECLARATION)
+  CHILD_TYPE = 0,
+  CHILD_VALUE = 1,
+  // NODE_STRUCT_MEMBER_GET, NODE_ARRAY_GET, NODE_FUNCTION_CALL
+  CHILD_FROM = 0,
+  CHILD_INDEX = 1,
+  // NODE_IF, NODE_WHILE, NODE_DO_WHILE, NODE_FOR, NODE_FUNCTION_DECLARATION
+  CHILD_CONDITION = 0,
+  CHILD_BODY = 1,
+  CHILD_SUCCESS = 1,
+  CHILD_FAIL = 2,
+  CHILD_INDEX_DECLARATION = 2,
+  CHILD_INDEX_ASSIGNMENT = 3,
+} child_slot;
+
+flat_ast flatten_ast(node *root);
+// Flattens a tree that isn't under the root (a typedef's type, say) into the
+// same arrays, and says where it went
+node_index flatten_into(flat_ast *ast, node *subtree);
+// A tree whose top level carries on from another one's: everything in
+// `prefix` first, then root's statements, all in one root block
+flat_ast flatten_ast_after(const flat_ast *prefix, node *root);
+// Builds the pointer nodes back up, into `nodes`
+node *unflatten_node(const flat_ast *ast, node_index index, arena *nodes);
+void flat_ast_free(flat_ast *ast);
+size_t flat_ast_bytes(const flat_ast *ast);
+
+// Asking a node for something it doesn't have (a name, a size, a child) is
+// a bug in whoever's asking, but it gets an empty answer back instead of
+// taking every other file being compiled down with it
+operator_type ast_operator(const flat_ast *ast, node_index index);
+// NO_SYMBOL for nodes without one
+symbol_id ast_name(const flat_ast *ast, node_index index);
+int ast_number(const flat_ast *ast, node_index index);
+string_slice ast_string(const flat_ast *ast, node_index index);
+// Base types, pointers and structs, what they were laid out as (see semantic.h).
+// Anything else is 0 bytes, lined up to 1.
+uint32_t ast_type_size(const flat_ast *ast, node_index index);
+uint32_t ast_type_alignment(const flat_ast *ast, node_index index);
+// Where a member get's member is in its struct, NO_OFFSET if it wasn't resolved
+uint32_t ast_member_offset(const flat_ast *ast, node_index index);
+// NO_NODE for nodes without children
+node_index ast_child(const flat_ast *ast, node_index index, child_slot slot);
+// Every child, lists included, in the order a walk visits them (see walk.h).
+// Optional children that aren't there still count, as NO_NODE.
+uint32_t ast_child_count(const flat_ast *ast, node_index index);
+node_index ast_nth_child(const flat_ast *ast, node_index index, uint32_t n);
+
+// These get called for nearly every node of a walk, so they're inline
+
+static inline node_type ast_type(const flat_ast *ast, node_index index) {
+  return ast->nodes[index].type;
+}
+
+// Where the node's list (block statements, struct members, function
+// parameters or call inputs) starts in extra
+static inline uint32_t ast_list_start(const flat_ast *ast, node_index index) {
+  const flat_node *flat = &ast->nodes[index];
+  switch (flat->type) {
+  case NODE_FUNCTION_CALL:
+    return flat->right;
+  case NODE_FUNCTION_DECLARATION:
+    return flat->right + 1;
+  default: // NODE_BLOCK, NODE_STRUCTURE
+    return flat->left;
+  }
+}
+
+static inline uint32_t ast_list_count(const flat_ast *ast, node_index index) {
+  return ast->extra[ast_list_start(ast, index)];
+}
+
+static inline node_index ast_list_item(const flat_ast *ast, node_index index, uint32_t item) {
+  return ast->extra[ast_list_start(ast, index) + 1 + item];
+}
+
+#endif
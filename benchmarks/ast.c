@@ -0,0 +1,186 @@
+// Memory and full-tree walks for the pointer tree against the flat one
+#include "../ast.h"
+#include "../walk.h"
+#include "../c-vector/vec.h"
+#include "bench.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SOURCE_SIZE (8 * 1024 * 1024)
+#define SOURCE_PATH "/tmp/mcc_ast_bench.mcc"
+#define ROUNDS 5
+
+void write_ast_source(const char *path, size_t size) {
+  FILE *file = fopen(path, "w");
+  size_t written = 0;
+  for (int i = 0; written < size; i++) {
+    written += fprintf(file,
+        "struct point_%d {\n  int x;\n  char *y;\n};\n"
+        "return_value = a + b * %d - (a / b);\n"
+        "int j = add_function(i + 1, %d) * -12 + -6;\n"
+        "if (a == b) {\n  a += 1;\n} else {\n  b -= 2;\n}\n"
+        "while (a < 10) {\n  a++;\n}\n",
+        i, i, i);
+  }
+  fclose(file);
+}
+
+// Both walks visit every node and add up the number literals, so neither
+// can skip anything
+long walk_pointers(node *current_node) {
+  if (current_node == NULL) {
+    return 0;
+  }
+  long sum = 0;
+  switch (current_node->type) {
+  default:
+    break;
+  case NODE_NUMBER_LITERAL:
+    return current_node->number_literal.value;
+  case NODE_EQUATION:
+    sum += walk_pointers(current_node->equation.left);
+    sum += walk_pointers(current_node->equation.right);
+    break;
+  case NODE_POINTER:
+    sum += walk_pointers(current_node->pointer.to);
+    break;
+  case NODE_VARIABLE_DECLARATION:
+    sum += walk_pointers(current_node->variable_declaration.type);
+    sum += walk_pointers(current_node->variable_declaration.value);
+    break;
+  case NODE_IF:
+    sum += walk_pointers(current_node->if_statement.condition);
+    sum += walk_pointers(current_node->if_statement.success);
+    sum += walk_pointers(current_node->if_statement.fail);
+    break;
+  case NODE_WHILE:
+    sum += walk_pointers(current_node->while_loop.condition);
+    sum += walk_pointers(current_node->while_loop.body);
+    break;
+  case NODE_FUNCTION_CALL:
+    sum += walk_pointers(current_node->function_call.function_expression);
+    for (uint32_t i = 0; i < current_node->function_call.inputs.count; i++) {
+      sum += walk_pointers(current_node->function_call.inputs.nodes[i]);
+    }
+    break;
+  case NODE_STRUCTURE:
+    for (uint32_t i = 0; i < current_node->structure.members.count; i++) {
+      sum += walk_pointers(current_node->structure.members.nodes[i]);
+    }
+    break;
+  case NODE_BLOCK:
+    for (uint32_t i = 0; i < current_node->block.nodes.count; i++) {
+      sum += walk_pointers(current_node->block.nodes.nodes[i]);
+    }
+    break;
+  }
+  return sum;
+}
+
+long walk_flat(const flat_ast *ast, node_index index) {
+  if (index == NO_NODE) {
+    return 0;
+  }
+  long sum = 0;
+  switch (ast_type(ast, index)) {
+  default:
+    break;
+  case NODE_NUMBER_LITERAL:
+    return ast_number(ast, index);
+  case NODE_EQUATION:
+  case NODE_VARIABLE_DECLARATION:
+  case NODE_WHILE:
+    sum += walk_flat(ast, ast_child(ast, index, 0));
+    sum += walk_flat(ast, ast_child(ast, index, 1));
+    break;
+  case NODE_POINTER:
+    sum += walk_flat(ast, ast_child(ast, index, CHILD_POINTS_TO));
+    break;
+  case NODE_IF:
+    sum += walk_flat(ast, ast_child(ast, index, CHILD_CONDITION));
+    sum += walk_flat(ast, ast_child(ast, index, CHILD_SUCCESS));
+    sum += walk_flat(ast, ast_child(ast, index, CHILD_FAIL));
+    break;
+  case NODE_FUNCTION_CALL:
+    sum += walk_flat(ast, ast_child(ast, index, CHILD_FROM));
+    // fall through
+  case NODE_STRUCTURE:
+  case NODE_BLOCK:
+    for (uint32_t i = 0; i < ast_list_count(ast, index); i++) {
+      sum += walk_flat(ast, ast_list_item(ast, index, i));
+    }
+    break;
+  }
+  return sum;
+}
+
+// The same walk through walk_ast, to see what the callbacks and the heap
+// stack cost over recursing
+static bool add_number(ast_walker *walker, const flat_ast *ast, ast_visit visit) {
+  if (ast_type(ast, visit.index) == NODE_NUMBER_LITERAL) {
+    *(long *)walker->data += ast_number(ast, visit.index);
+  }
+  return true;
+}
+
+int main(void) {
+  // Keep the parser's complaining out of the terminal
+  FILE *terminal = fdopen(dup(fileno(stdout)), "w");
+  freopen("/dev/null", "w", stdout);
+
+  write_ast_source(SOURCE_PATH, SOURCE_SIZE);
+  source_file source = source_from_path(SOURCE_PATH);
+  symbol_table symbols = symbol_table_create();
+  token_stream tokens = lexer(source, &symbols);
+  arena nodes = arena_create();
+  token_cursor cursor = cursor_from_tokens(&tokens, source, &symbols, &nodes);
+  node *root = parser(&cursor);
+
+  double start = seconds_now();
+  flat_ast flat = flatten_ast(root);
+  double flattened = seconds_now() - start;
+  uint32_t node_count = vector_size((vector *)&flat.nodes);
+  fprintf(terminal, "%-28s %10.3f ms %14.0f nodes/s\n", "flatten",
+          flattened * 1e3, node_count / flattened);
+
+  long pointer_sum = 0;
+  long flat_sum = 0;
+  long walker_sum = 0;
+  double best_pointers = 1e30;
+  double best_flat = 1e30;
+  double best_walker = 1e30;
+  for (int round = 0; round < ROUNDS; round++) {
+    double start = seconds_now();
+    pointer_sum = walk_pointers(root);
+    double middle = seconds_now();
+    flat_sum = walk_flat(&flat, flat.root);
+    double end = seconds_now();
+    best_pointers = middle - start < best_pointers ? middle - start : best_pointers;
+    best_flat = end - middle < best_flat ? end - middle : best_flat;
+
+    walker_sum = 0;
+    ast_walker walker = { .enter = add_number, .leave = NULL, .visit_missing = false, .data = &walker_sum };
+    start = seconds_now();
+    walk_ast(&flat, flat.root, &walker);
+    end = seconds_now();
+    best_walker = end - start < best_walker ? end - start : best_walker;
+  }
+  if (pointer_sum != flat_sum || flat_sum != walker_sum) {
+    fprintf(terminal, "Walks disagree: %ld vs %ld vs %ld\n", pointer_sum, flat_sum, walker_sum);
+  }
+
+  fprintf(terminal, "%-28s %10.3f ms %14.0f nodes/s %8.1f MB\n", "walk pointer tree",
+          best_pointers * 1e3, node_count / best_pointers, nodes.bytes_used / 1e6);
+  fprintf(terminal, "%-28s %10.3f ms %14.0f nodes/s %8.1f MB\n", "walk flat tree",
+          best_flat * 1e3, node_count / best_flat, flat_ast_bytes(&flat) / 1e6);
+  fprintf(terminal, "%-28s %10.3f ms %14.0f nodes/s\n", "walk_ast", best_walker * 1e3, node_count / best_walker);
+
+  flat_ast_free(&flat);
+  free_cursor(&cursor);
+  arena_free(&nodes);
+  token_stream_free(&tokens);
+  symbol_table_free(&symbols);
+  source_close(&source);
+  remove(SOURCE_PATH);
+  return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef bench_h
+#define bench_h
+
+#include <stdio.h>
+#include <time.h>
+
+// Seconds since some point in the past, only useful for differences
+static inline double seconds_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+// Time `code` and print how many `items` per second it got through
+#define bench(name, items, code) bench_to(stdout, name, items, code)
+
+// Same, for when stdout is busy soaking up the compiler's own prints
+#define bench_to(file, name, items, code)                                      \
+  ({                                                                           \
+    double start = seconds_now();                                              \
+    code;                                                                      \
+    double elapsed = seconds_now() - start;                                    \
+    fprintf(file, "%-28s %10.3f ms %14.0f /s\n", name, elapsed * 1e3,        \
+            (double)(items) / elapsed);                                        \
+    elapsed;                                                                   \
+  })
+
+#endif
@@ -0,0 +1,53 @@
+# Everything gets built into BUILD if it's set, otherwise a temporary
+# directory that's gone afterwards, so nothing lands next to the sources.
+# Paths are from here, wherever it's run from.
+cd "$(dirname "$0")"
+if [ -z "$BUILD" ]; then
+  BUILD=$(mktemp -d)
+  trap 'rm -rf "$BUILD"' EXIT
+fi
+mkdir -p "$BUILD"
+gcc -O2 -o "$BUILD/keywords" keywords.c ../arena.c ../source.c ../symbols.c ../lexer.c ../enum_utilities.c ../instrument.c ../memory.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra
+gcc -O2 -o "$BUILD/lexer" lexer.c ../arena.c ../source.c ../symbols.c ../lexer.c ../enum_utilities.c ../instrument.c ../memory.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra
+gcc -O2 -o "$BUILD/scopes" scopes.c ../arena.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/parser" parser.c ../arena.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+# Same parser, but every node is its own malloc, to compare against the arena
+gcc -O2 -DNO_ARENA -o "$BUILD/parser_malloc" parser.c ../arena.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/ast" ast.c ../arena.c ../ast.c ../walk.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/expressions" expressions.c ../arena.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/generate" generate.c -Wall -Wextra
+# Every allocation gets counted by wrapping malloc
+gcc -O2 -o "$BUILD/throughput" throughput.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread -Wl,--wrap=malloc,--wrap=realloc,--wrap=calloc
+# Fails if a phase goes over its memory budget
+gcc -O2 -o "$BUILD/memory" memory.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/files" files.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../driver.c ../preprocessor.c ../precompiled.c ../walk.c ../dump.c ../cache.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/bodies" bodies.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../driver.c ../preprocessor.c ../precompiled.c ../walk.c ../dump.c ../cache.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/lazy" lazy.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/cache" cache.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../cache.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/incremental" incremental.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../incremental.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/dump" dump.c ../arena.c ../ast.c ../walk.c ../dump.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/preprocess" preprocess.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../driver.c ../preprocessor.c ../precompiled.c ../walk.c ../dump.c ../cache.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/precompiled" precompiled.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../driver.c ../preprocessor.c ../precompiled.c ../walk.c ../dump.c ../cache.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/layout" layout.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/types" types.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../semantic.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+gcc -O2 -o "$BUILD/macros" macros.c ../arena.c ../source.c ../symbols.c ../lexer.c ../preprocessor.c ../enum_utilities.c ../instrument.c ../memory.c ../vector_memory.c ../c-hashmap/hashmap.c -Wall -Wextra -pthread
+"$BUILD/keywords"
+"$BUILD/lexer"
+"$BUILD/scopes"
+"$BUILD/parser"
+"$BUILD/parser_malloc"
+"$BUILD/expressions"
+"$BUILD/ast"
+"$BUILD/throughput"
+"$BUILD/memory"
+"$BUILD/files"
+"$BUILD/bodies"
+"$BUILD/lazy"
+"$BUILD/cache"
+"$BUILD/incremental"
+"$BUILD/dump"
+"$BUILD/preprocess"
+"$BUILD/macros"
+"$BUILD/precompiled"
+"$BUILD/layout"
+"$BUILD/types"
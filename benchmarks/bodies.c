@@ -0,0 +1,81 @@
+// One big file's function bodies parsed on 1 worker, then 2, 4, ... up to
+// one per core, against parsing it all on one thread with no pool. Each
+// parallel AST is checked against the serial one.
+// Usage: ./bodies [size, default 32M]
+#include "../ast.h"
+#include "../pool.h"
+#include "bench.h"
+#include "generate.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SOURCE_PATH "/tmp/mcc_bodies_bench.mcc"
+#define ROUNDS 3
+
+// Best time out of a few, and the AST from the last one
+double parse_with(thread_pool *pool, const token_stream *tokens, source_file source, symbol_table *symbols, flat_ast *flat) {
+  double best = 1e30;
+  for (int round = 0; round < ROUNDS; round++) {
+    arena nodes = arena_create();
+    token_cursor cursor = cursor_from_tokens(tokens, source, symbols, &nodes);
+    cursor.pool = pool;
+    double start = seconds_now();
+    node *root = parser(&cursor);
+    double elapsed = seconds_now() - start;
+    best = elapsed < best ? elapsed : best;
+    if (round == ROUNDS - 1) {
+      *flat = flatten_ast(root);
+    }
+    free_cursor(&cursor);
+    arena_free(&nodes);
+  }
+  return best;
+}
+
+bool same_ast(const flat_ast *a, const flat_ast *b) {
+  uint32_t node_count = vector_size((vector *)&a->nodes);
+  uint32_t extra_count = vector_size((vector *)&a->extra);
+  return a->root == b->root && node_count == vector_size((vector *)&b->nodes) &&
+         extra_count == vector_size((vector *)&b->extra) &&
+         memcmp(a->nodes, b->nodes, sizeof(flat_node) * node_count) == 0 &&
+         memcmp(a->extra, b->extra, sizeof(uint32_t) * extra_count) == 0;
+}
+
+int main(int argc, char **argv) {
+  size_t size = argc >= 2 ? parse_size(argv[1]) : 32 * 1024 * 1024;
+  write_shape_to_path(SOURCE_PATH, SHAPE_FUNCTIONS, size);
+  source_file source = source_from_path(SOURCE_PATH);
+  symbol_table symbols = symbol_table_create();
+  token_stream tokens = lexer(source, &symbols);
+
+  flat_ast serial_ast;
+  double serial = parse_with(NULL, &tokens, source, &symbols, &serial_ast);
+  printf("%-28s %10s %14s %10s\n", "workers", "ms", "tokens/s", "speedup");
+  printf("%-28s %10.3f %14.0f %9.2fx\n", "serial", serial * 1e3, tokens.count / serial, 1.0);
+
+  int mismatches = 0;
+  uint32_t cores = pool_default_worker_count();
+  for (uint32_t workers = 1;; workers = workers * 2 < cores ? workers * 2 : cores) {
+    thread_pool *pool = pool_create(workers);
+    flat_ast parallel_ast;
+    double parallel = parse_with(pool, &tokens, source, &symbols, &parallel_ast);
+    pool_free(pool);
+
+    bool same = same_ast(&serial_ast, &parallel_ast);
+    mismatches += !same;
+    printf("%-28u %10.3f %14.0f %9.2fx%s\n", workers, parallel * 1e3, tokens.count / parallel,
+           serial / parallel, same ? "" : "  AST DIFFERS");
+    flat_ast_free(&parallel_ast);
+    if (workers == cores) {
+      break;
+    }
+  }
+
+  flat_ast_free(&serial_ast);
+  token_stream_free(&tokens);
+  symbol_table_free(&symbols);
+  source_close(&source);
+  remove(SOURCE_PATH);
+  return mismatches > 0;
+}
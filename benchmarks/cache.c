@@ -0,0 +1,106 @@
+// For each generated shape: lexing and parsing it from scratch, against
+// loading the AST saved from last time. The loaded AST is checked against
+// the parsed one.
+// Usage: ./cache [size, default 16M]
+#include "../ast.h"
+#include "../cache.h"
+#include "bench.h"
+#include "generate.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SOURCE_PATH "/tmp/mcc_cache_bench.mcc"
+#define CACHE_DIRECTORY "/tmp/mcc_cache_bench"
+#define ROUNDS 3
+
+static bool same_ast(const flat_ast *parsed, const flat_ast *loaded) {
+  uint32_t node_count = vector_size((vector *)&parsed->nodes);
+  uint32_t extra_count = vector_size((vector *)&parsed->extra);
+  uint32_t string_count = vector_size((vector *)&parsed->strings);
+  if (parsed->root != loaded->root || string_count != vector_size((vector *)&loaded->strings) ||
+      memcmp(parsed->nodes, loaded->nodes, sizeof(flat_node) * node_count) != 0 ||
+      memcmp(parsed->extra, loaded->extra, sizeof(uint32_t) * extra_count) != 0) {
+    return false;
+  }
+  for (uint32_t i = 0; i < string_count; i++) {
+    if (!slice_equals(parsed->strings[i], loaded->strings[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  size_t size = argc >= 2 ? parse_size(argv[1]) : 16 * 1024 * 1024;
+  mkdir(CACHE_DIRECTORY, 0777);
+  int mismatches = 0;
+
+  printf("%-12s %10s %10s %10s %12s %10s\n", "shape", "parse ms", "store ms", "load ms", "cache KB", "speedup");
+  for (int shape = 0; shape < SHAPE_COUNT; shape++) {
+    write_shape_to_path(SOURCE_PATH, shape, size);
+    source_file source = source_from_path(SOURCE_PATH);
+
+    // Everything it takes to get an AST without the cache
+    double parse = 1e30;
+    flat_ast parsed;
+    symbol_table symbols;
+    for (int round = 0; round < ROUNDS; round++) {
+      double start = seconds_now();
+      symbol_table round_symbols = symbol_table_create();
+      token_stream tokens = lexer(source, &round_symbols);
+      arena nodes = arena_create();
+      token_cursor cursor = cursor_from_tokens(&tokens, source, &round_symbols, &nodes);
+      flat_ast flat = flatten_ast(parser(&cursor));
+      free_cursor(&cursor);
+      arena_free(&nodes);
+      token_stream_free(&tokens);
+      double elapsed = seconds_now() - start;
+      parse = elapsed < parse ? elapsed : parse;
+      if (round > 0) {
+        flat_ast_free(&parsed);
+        symbol_table_free(&symbols);
+      }
+      parsed = flat;
+      symbols = round_symbols;
+    }
+
+    double start = seconds_now();
+    bool stored = cache_store(CACHE_DIRECTORY, source, &parsed, &symbols);
+    double store = seconds_now() - start;
+
+    double load = 1e30;
+    bool same = stored;
+    for (int round = 0; round < ROUNDS && stored; round++) {
+      symbol_table loaded_symbols = symbol_table_create();
+      cached_ast cached;
+      start = seconds_now();
+      bool hit = cache_load(CACHE_DIRECTORY, source, &cached, &loaded_symbols);
+      double elapsed = seconds_now() - start;
+      load = elapsed < load ? elapsed : load;
+      same &= hit && same_ast(&parsed, &cached.ast) && symbol_count(&symbols) == symbol_count(&loaded_symbols);
+      symbol_table_free(&loaded_symbols);
+      if (hit) {
+        cache_release(&cached);
+      }
+    }
+
+    struct stat cache_stats = { 0 };
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%016llx.ast", CACHE_DIRECTORY, (unsigned long long)cache_key(source));
+    stat(path, &cache_stats);
+    printf("%-12s %10.3f %10.3f %10.3f %12lld %9.1fx%s\n", shape_names[shape], parse * 1e3, store * 1e3,
+           load * 1e3, (long long)cache_stats.st_size / 1024, parse / load, same ? "" : "  LOADED AST DIFFERS");
+    mismatches += !same;
+    remove(path);
+
+    flat_ast_free(&parsed);
+    symbol_table_free(&symbols);
+    source_close(&source);
+  }
+
+  rmdir(CACHE_DIRECTORY);
+  remove(SOURCE_PATH);
+  return mismatches > 0;
+}
@@ -0,0 +1,91 @@
+// Dumping a big AST in each format, to /dev/null so it's just the dumping
+// that gets timed. Then a tree nested far deeper than recursion could go
+// (a pointer to a pointer to ... an int), which only has to not crash.
+// Usage: ./dump [size, default 16M] [deep tree depth, default 1M]
+#include "../ast.h"
+#include "../dump.h"
+#include "bench.h"
+#include "generate.h"
+#include <stdlib.h>
+
+#define SOURCE_PATH "/tmp/mcc_dump_bench.mcc"
+#define ROUNDS 3
+
+static const char *format_names[] = { "text", "json", "binary" };
+
+static flat_ast deep_tree(uint32_t depth, symbol_table *symbols) {
+  flat_ast ast = { .nodes = vector_create(), .extra = vector_create(), .strings = vector_create(), .root = 0 };
+  symbol_id int_symbol = intern_symbol(symbols, SLICE("int"));
+  for (uint32_t i = 0; i < depth; i++) {
+    vector_add(&ast.nodes, ((flat_node){ .type = NODE_POINTER, .data = NO_NODE, .left = i + 1, .right = NO_NODE }));
+  }
+  vector_add(&ast.nodes, ((flat_node){ .type = NODE_BASE_TYPE, .data = int_symbol, .left = NO_NODE, .right = NO_NODE }));
+  return ast;
+}
+
+int main(int argc, char **argv) {
+  size_t size = argc >= 2 ? parse_size(argv[1]) : 16 * 1024 * 1024;
+  uint32_t depth = argc >= 3 ? parse_size(argv[2]) : 1024 * 1024;
+  FILE *null = fopen("/dev/null", "w");
+
+  // Some of everything, so every kind of node and label gets dumped
+  FILE *file = fopen(SOURCE_PATH, "w");
+  for (int shape = 0; shape < SHAPE_COUNT; shape++) {
+    write_shape(file, shape, size / SHAPE_COUNT);
+  }
+  fclose(file);
+  source_file source = source_from_path(SOURCE_PATH);
+  symbol_table symbols = symbol_table_create();
+  token_stream tokens = lexer(source, &symbols);
+  arena nodes = arena_create();
+  token_cursor cursor = cursor_from_tokens(&tokens, source, &symbols, &nodes);
+  cursor.errors = null;
+  flat_ast flat = flatten_ast(parser(&cursor));
+  uint32_t node_count = vector_size((vector *)&flat.nodes);
+  printf("%u nodes\n", node_count);
+
+  printf("%-12s %10s %14s %12s %10s\n", "format", "ms", "nodes/s", "MB", "MB/s");
+  for (int format = 0; format < DUMP_FORMAT_COUNT; format++) {
+    double best = 1e30;
+    long bytes = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+      rewind(null);
+      double start = seconds_now();
+      dump_ast(null, &flat, &symbols, format);
+      fflush(null);
+      double elapsed = seconds_now() - start;
+      best = elapsed < best ? elapsed : best;
+    }
+    // /dev/null doesn't keep count, so it's written once more somewhere that does
+    char *text = NULL;
+    size_t text_size = 0;
+    FILE *counted = open_memstream(&text, &text_size);
+    dump_ast(counted, &flat, &symbols, format);
+    fclose(counted);
+    bytes = text_size;
+    free(text);
+    printf("%-12s %10.3f %14.0f %12.1f %10.0f\n", format_names[format], best * 1e3, node_count / best, bytes / 1e6,
+           bytes / 1e6 / best);
+  }
+
+  symbol_table deep_symbols = symbol_table_create();
+  flat_ast deep = deep_tree(depth, &deep_symbols);
+  for (int format = 0; format < DUMP_FORMAT_COUNT; format++) {
+    double start = seconds_now();
+    dump_ast(null, &deep, &deep_symbols, format);
+    fflush(null);
+    printf("%-12s %10.3f ms for a tree %u deep\n", format_names[format], (seconds_now() - start) * 1e3, depth + 1);
+  }
+
+  flat_ast_free(&deep);
+  symbol_table_free(&deep_symbols);
+  flat_ast_free(&flat);
+  free_cursor(&cursor);
+  arena_free(&nodes);
+  token_stream_free(&tokens);
+  symbol_table_free(&symbols);
+  source_close(&source);
+  fclose(null);
+  remove(SOURCE_PATH);
+  return 0;
+}
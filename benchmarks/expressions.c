@@ -0,0 +1,69 @@
+// Tokens per second through parse_expression, for a file that's nothing but
+// long expression statements
+#include "../parser.h"
+#include "bench.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SOURCE_SIZE (8 * 1024 * 1024)
+#define SOURCE_PATH "/tmp/mcc_expressions_bench.mcc"
+#define ROUNDS 5
+
+// Only operators that have always been parsed, so the numbers can be
+// compared with older versions of the parser
+void write_expression_source(const char *path, size_t size) {
+  FILE *file = fopen(path, "w");
+  size_t written = 0;
+  for (int i = 0; written < size; i++) {
+    written += fprintf(file,
+        "a = b * %d + c / (d - e) * -f + g * h - %d;\n"
+        "x = a == b && c != d || e < f && g >= %d;\n"
+        "y = px * px + py * py - add(a + 1, b * 2, %d);\n"
+        "z += (a + (b - (c * (d / (e + %d))))) * !k;\n",
+        i, i, i, i, i);
+  }
+  fclose(file);
+}
+
+int main(void) {
+  // Keep the parser's complaining out of the terminal
+  FILE *terminal = fdopen(dup(fileno(stdout)), "w");
+  freopen("/dev/null", "w", stdout);
+
+  write_expression_source(SOURCE_PATH, SOURCE_SIZE);
+  source_file source = source_from_path(SOURCE_PATH);
+  symbol_table symbols = symbol_table_create();
+  token_stream tokens = lexer(source, &symbols);
+
+  double best = 1e30;
+  for (int round = 0; round < ROUNDS; round++) {
+    arena nodes = arena_create();
+    token_cursor cursor = cursor_from_tokens(&tokens, source, &symbols, &nodes);
+
+    jmp_buf bail;
+    cursor.bail = &bail;
+    if (setjmp(bail) != 0) {
+      fprintf(terminal, "parse expressions failed\n");
+      return 1;
+    }
+    double start = seconds_now();
+    while (!is_at_end(&cursor)) {
+      parse_expression(PRECEDENCE_ASSIGNMENT, &cursor);
+      expect_token(TOKEN_SEMI_COLON, &cursor);
+    }
+    double elapsed = seconds_now() - start;
+    best = elapsed < best ? elapsed : best;
+
+    free_cursor(&cursor);
+    arena_free(&nodes);
+  }
+
+  fprintf(terminal, "%-28s %10.3f ms %14.0f tokens/s\n", "parse expressions",
+          best * 1e3, tokens.count / best);
+
+  token_stream_free(&tokens);
+  symbol_table_free(&symbols);
+  source_close(&source);
+  remove(SOURCE_PATH);
+  return 0;
+}
@@ -0,0 +1,57 @@
+// Whole files through the driver on 1 worker, then 2, 4, ... up to one per
+// core, to see how well compiling lots of files spreads out.
+// Usage: ./files [file count, default 64] [size of each, default 256K]
+#include "../driver.h"
+#include "bench.h"
+#include "generate.h"
+#include <stdlib.h>
+
+#define PATH_FORMAT "/tmp/mcc_files_bench_%u.mcc"
+#define ROUNDS 3
+
+int main(int argc, char **argv) {
+  uint32_t file_count = argc >= 2 ? atoi(argv[1]) : 64;
+  size_t size = argc >= 3 ? parse_size(argv[2]) : 256 * 1024;
+
+  // Every shape gets a turn, so some jobs are a lot slower than others
+  char (*paths)[64] = malloc(sizeof(*paths) * file_count);
+  for (uint32_t i = 0; i < file_count; i++) {
+    snprintf(paths[i], sizeof(paths[i]), PATH_FORMAT, i);
+    write_shape_to_path(paths[i], i % SHAPE_COUNT, size);
+  }
+  compile_job *jobs = malloc(sizeof(compile_job) * file_count);
+
+  uint32_t cores = pool_default_worker_count();
+  double one_worker = 0;
+  printf("%-28s %10s %14s %10s\n", "workers", "ms", "files/s", "speedup");
+  for (uint32_t workers = 1;; workers = workers * 2 < cores ? workers * 2 : cores) {
+    thread_pool *pool = pool_create(workers);
+    double best = 1e30;
+    for (int round = 0; round < ROUNDS; round++) {
+      for (uint32_t i = 0; i < file_count; i++) {
+        jobs[i] = job_for_file(paths[i], false);
+      }
+      double start = seconds_now();
+      compile_all(pool, jobs, file_count);
+      double elapsed = seconds_now() - start;
+      best = elapsed < best ? elapsed : best;
+      for (uint32_t i = 0; i < file_count; i++) {
+        flush_job(&jobs[i], stdout, stderr);
+      }
+    }
+    pool_free(pool);
+
+    one_worker = workers == 1 ? best : one_worker;
+    printf("%-28u %10.3f %14.1f %9.2fx\n", workers, best * 1e3, file_count / best, one_worker / best);
+    if (workers == cores) {
+      break;
+    }
+  }
+
+  for (uint32_t i = 0; i < file_count; i++) {
+    remove(paths[i]);
+  }
+  free(jobs);
+  free(paths);
+  return 0;
+}
@@ -0,0 +1,23 @@
+// Writes a synthetic program, for benchmarking or poking at by hand
+// Usage: ./generate <shape> <size, like 64K or 10M> [output path]
+#include "generate.h"
+#include <stdlib.h>
+
+int main(int argc, char **argv) {
+  source_shape shape = argc >= 3 ? shape_from_name(argv[1]) : SHAPE_COUNT;
+  if (shape == SHAPE_COUNT) {
+    fprintf(stderr, "Usage: %s <shape> <size> [output path]\nShapes:", argv[0]);
+    for (int i = 0; i < SHAPE_COUNT; i++) {
+      fprintf(stderr, " %s", shape_names[i]);
+    }
+    fprintf(stderr, "\n");
+    return 1;
+  }
+  size_t size = parse_size(argv[2]);
+
+  if (argc >= 4) {
+    return write_shape_to_path(argv[3], shape, size) > 0 ? 0 : 1;
+  }
+  write_shape(stdout, shape, size);
+  return 0;
+}
@@ -0,0 +1,156 @@
+#ifndef generate_h
+#define generate_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Synthetic programs for throughput benchmarks. Each shape repeats one
+// chunk of code, changing the numbers and names in it, until the file is as
+// big as asked for. Everything in them is something the parser handles.
+
+#define ITERATE_SHAPES_AND(X)                                                  \
+  X(SHAPE_EXPRESSIONS, "expressions") /* Long expression chains */            \
+  X(SHAPE_NESTING, "nesting")         /* Blocks nested deep */                \
+  X(SHAPE_TYPES, "types")             /* Lots of typedefs and structs */      \
+  X(SHAPE_FUNCTIONS, "functions")     /* Big function bodies */               \
+  X(SHAPE_COMMENTS, "comments")       /* More comment than code */
+
+#define GENERATE_SHAPE_ENUM(SHAPE, NAME) SHAPE,
+#define GENERATE_SHAPE_NAME(SHAPE, NAME) NAME,
+typedef enum { ITERATE_SHAPES_AND(GENERATE_SHAPE_ENUM) SHAPE_COUNT } source_shape;
+static const char *shape_names[] = { ITERATE_SHAPES_AND(GENERATE_SHAPE_NAME) };
+
+#define EXPRESSION_TERMS 64
+#define NESTING_DEPTH 48
+#define FUNCTION_STATEMENTS 200
+
+// SHAPE_COUNT if there's no shape by that name
+static inline source_shape shape_from_name(const char *name) {
+  for (int shape = 0; shape < SHAPE_COUNT; shape++) {
+    if (strcmp(shape_names[shape], name) == 0) {
+      return shape;
+    }
+  }
+  return SHAPE_COUNT;
+}
+
+// "64K" or "10M" or just a number of bytes
+static inline size_t parse_size(const char *text) {
+  char *suffix;
+  size_t size = strtoull(text, &suffix, 10);
+  switch (*suffix) {
+  case 'k': case 'K': return size * 1024;
+  case 'm': case 'M': return size * 1024 * 1024;
+  case 'g': case 'G': return size * 1024 * 1024 * 1024;
+  default: return size;
+  }
+}
+
+static inline size_t write_expressions_chunk(FILE *file, int i) {
+  size_t written = fprintf(file, "result_%d = a", i % 100);
+  const char *operators[] = { " + ", " * ", " - ", " / ", " == ", " && ", " < ", " | " };
+  for (int term = 1; term < EXPRESSION_TERMS; term++) {
+    if (term % 8 == 0) {
+      written += fprintf(file, "%s(b%d - -%d)", operators[term % 8], term, i);
+    } else if (term % 5 == 0) {
+      written += fprintf(file, "%sadd(c, %d)", operators[term % 8], term);
+    } else {
+      written += fprintf(file, "%sv%d", operators[term % 8], term);
+    }
+  }
+  return written + fprintf(file, ";\n");
+}
+
+static inline size_t write_nesting_chunk(FILE *file, int i) {
+  size_t written = 0;
+  for (int depth = 0; depth < NESTING_DEPTH; depth++) {
+    if (depth % 3 == 0) {
+      written += fprintf(file, "%*swhile (a < %d) {\n", depth, "", i);
+    } else if (depth % 3 == 1) {
+      written += fprintf(file, "%*sif (b == %d) {\n", depth, "", depth);
+    } else {
+      written += fprintf(file, "%*s{\n", depth, "");
+    }
+    written += fprintf(file, "%*s  a = a + %d;\n", depth, "", depth);
+  }
+  for (int depth = NESTING_DEPTH - 1; depth >= 0; depth--) {
+    written += fprintf(file, "%*s}\n", depth, "");
+  }
+  return written;
+}
+
+static inline size_t write_types_chunk(FILE *file, int i) {
+  return fprintf(file,
+      "typedef int type_%d;\n"
+      "typedef char *string_%d;\n"
+      "struct structure_%d {\n"
+      "  type_%d count;\n"
+      "  string_%d name;\n"
+      "  int *values;\n"
+      "};\n"
+      "type_%d variable_%d = %d;\n",
+      i, i, i, i, i, i, i, i);
+}
+
+static inline size_t write_functions_chunk(FILE *file, int i) {
+  size_t written = fprintf(file, "int function_%d(int a, int b, char *name) {\n  int total = 0;\n", i);
+  for (int statement = 0; statement < FUNCTION_STATEMENTS; statement++) {
+    switch (statement % 4) {
+    case 0:
+      written += fprintf(file, "  int local_%d = a * %d + b;\n", statement, statement);
+      break;
+    case 1:
+      written += fprintf(file, "  total += local_%d - call(name, %d);\n", statement - 1, statement);
+      break;
+    case 2:
+      written += fprintf(file, "  if (total > %d) {\n    total = total / 2;\n  }\n", statement);
+      break;
+    case 3:
+      written += fprintf(file, "  for (int i = 0; i < %d; i++) {\n    total -= i;\n  }\n", statement);
+      break;
+    }
+  }
+  return written + fprintf(file, "}\n");
+}
+
+static inline size_t write_comments_chunk(FILE *file, int i) {
+  return fprintf(file,
+      "/*\n"
+      " * Block comment number %d. It goes on for a while, the way real\n"
+      " * documentation comments do, so that skipping them is most of the work.\n"
+      " * int not_code = 0; while (this) { isn't parsed; }\n"
+      " */\n"
+      "// A line comment, %d\n"
+      "counter = counter + %d; // And one at the end of a line\n"
+      "// Another line comment, with some symbols in it: {}()[];+-*/\n",
+      i, i, i);
+}
+
+// Writes about `size` bytes (never less) of the shape, returns how many
+static inline size_t write_shape(FILE *file, source_shape shape, size_t size) {
+  size_t written = 0;
+  for (int i = 0; written < size; i++) {
+    switch (shape) {
+    case SHAPE_EXPRESSIONS: written += write_expressions_chunk(file, i); break;
+    case SHAPE_NESTING: written += write_nesting_chunk(file, i); break;
+    case SHAPE_TYPES: written += write_types_chunk(file, i); break;
+    case SHAPE_FUNCTIONS: written += write_functions_chunk(file, i); break;
+    case SHAPE_COMMENTS: written += write_comments_chunk(file, i); break;
+    default: return written;
+    }
+  }
+  return written;
+}
+
+static inline size_t write_shape_to_path(const char *path, source_shape shape, size_t size) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    return 0;
+  }
+  size_t written = write_shape(file, shape, size);
+  fclose(file);
+  return written;
+}
+
+#endif
@@ -0,0 +1,228 @@
+// A big file that keeps getting small edits, the way it would in an editor:
+// numbers changed, lines put in and taken out, and now and then a '}'
+// deleted then put back. Every so often the tree is checked against parsing
+// the file as it is now from scratch.
+//
+// The target is an edit under a millisecond. What an edit costs goes with
+// how big the top-level statement it lands in is, since that whole statement
+// is parsed again, so the average statement is printed too. A deleted '}'
+// only breaks the function it was in, so it costs about the same as any
+// other edit. The ones that miss the target are the max column: every so
+// often an edit is the one that makes the old statements' nodes outweigh
+// the live ones, and it pays for a full parse to get rid of them.
+// Usage: ./incremental [lines, default 50000] [edits, default 4000]
+#include "../ast.h"
+#include "../incremental.h"
+#include "bench.h"
+#include "generate.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SOURCE_PATH "/tmp/mcc_incremental_bench.mcc"
+#define CHECK_EVERY 100
+#define TARGET_US 1000.0
+
+#define ITERATE_EDIT_KINDS_AND(X)                                              \
+  X(EDIT_NUMBER, "number")       /* A number on a line gets changed */       \
+  X(EDIT_INSERT, "insert line")  /* A new statement goes in */               \
+  X(EDIT_DELETE, "delete line")  /* A line without braces comes out */       \
+  X(EDIT_BRACE, "delete brace")  /* A '}' comes out, then goes back in */
+
+#define GENERATE_EDIT_ENUM(KIND, NAME) KIND,
+#define GENERATE_EDIT_NAME(KIND, NAME) NAME,
+typedef enum { ITERATE_EDIT_KINDS_AND(GENERATE_EDIT_ENUM) EDIT_KIND_COUNT } edit_kind;
+static const char *edit_names[] = { ITERATE_EDIT_KINDS_AND(GENERATE_EDIT_NAME) };
+
+typedef struct {
+  double *latencies; // Vector
+  uint32_t full_reparses;
+} edit_stats;
+
+static int compare_doubles(const void *a, const void *b) {
+  double left = *(const double *)a;
+  double right = *(const double *)b;
+  return (left > right) - (left < right);
+}
+
+static bool same_ast(const flat_ast *fresh, const flat_ast *kept) {
+  uint32_t node_count = vector_size((vector *)&fresh->nodes);
+  uint32_t extra_count = vector_size((vector *)&fresh->extra);
+  uint32_t string_count = vector_size((vector *)&fresh->strings);
+  if (fresh->root != kept->root || node_count != vector_size((vector *)&kept->nodes) ||
+      extra_count != vector_size((vector *)&kept->extra) || string_count != vector_size((vector *)&kept->strings) ||
+      memcmp(fresh->nodes, kept->nodes, sizeof(flat_node) * node_count) != 0 ||
+      memcmp(fresh->extra, kept->extra, sizeof(uint32_t) * extra_count) != 0) {
+    return false;
+  }
+  for (uint32_t i = 0; i < string_count; i++) {
+    if (!slice_equals(fresh->strings[i], kept->strings[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Parsed again from nothing, with the same symbol table so the ids match
+static bool same_as_fresh_parse(incremental_file *file, FILE *quiet) {
+  source_file source = { .chars = file->text, .size = file->size, .mapped_size = 0 };
+  lexer_state lexer = lexer_create(source, &file->symbols);
+  lexer.errors = quiet;
+  token_stream tokens = lex_all(&lexer);
+  arena nodes = arena_create();
+  token_cursor cursor = cursor_from_tokens(&tokens, source, &file->symbols, &nodes);
+  cursor.errors = quiet;
+  node *root = parser(&cursor);
+  bool same = (root == NULL) == (file->root == NULL) && lexer.error_count + cursor.error_count == file->error_count;
+  if (same && root != NULL) {
+    flat_ast fresh = flatten_ast(root);
+    flat_ast kept = flatten_ast(file->root);
+    same = same_ast(&fresh, &kept);
+    flat_ast_free(&fresh);
+    flat_ast_free(&kept);
+  }
+  free_cursor(&cursor);
+  arena_free(&nodes);
+  token_stream_free(&tokens);
+  return same;
+}
+
+static uint32_t line_end(const incremental_file *file, uint32_t start) {
+  const char *newline = memchr(file->text + start, '\n', file->size - start);
+  return newline != NULL ? (uint32_t)(newline - file->text) + 1 : file->size;
+}
+
+static bool line_has(const incremental_file *file, uint32_t start, uint32_t end, const char *characters) {
+  for (uint32_t i = start; i < end; i++) {
+    if (strchr(characters, file->text[i]) != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Some line the edit could go on, false if this one won't do
+static bool pick_edit(const incremental_file *file, edit_kind kind, char *buffer, text_edit *edit) {
+  uint32_t start = (uint32_t)rand() % file->size;
+  while (start > 0 && file->text[start - 1] != '\n') {
+    start--;
+  }
+  uint32_t end = line_end(file, start);
+  switch (kind) {
+  case EDIT_NUMBER: {
+    uint32_t digits = start;
+    while (digits < end && (file->text[digits] < '0' || file->text[digits] > '9')) {
+      digits++;
+    }
+    // Not the end of a name like local_3
+    if (digits == end || (digits > 0 && file->text[digits - 1] == '_')) {
+      return false;
+    }
+    uint32_t digits_end = digits;
+    while (file->text[digits_end] >= '0' && file->text[digits_end] <= '9') {
+      digits_end++;
+    }
+    uint32_t length = snprintf(buffer, 32, "%d", rand() % 100000);
+    *edit = (text_edit){ .start = digits, .end = digits_end, .text = buffer, .length = length };
+    return true;
+  }
+  case EDIT_INSERT: {
+    uint32_t length = snprintf(buffer, 64, "  total = total + %d;\n", rand() % 1000);
+    *edit = (text_edit){ .start = start, .end = start, .text = buffer, .length = length };
+    return true;
+  }
+  case EDIT_DELETE:
+    *edit = (text_edit){ .start = start, .end = end, .text = "", .length = 0 };
+    return end > start && !line_has(file, start, end, "{}");
+  case EDIT_BRACE:
+    *edit = (text_edit){ .start = start, .end = end, .text = "", .length = 0 };
+    return line_has(file, start, end, "}") && !line_has(file, start, end, "{");
+  default:
+    return false;
+  }
+}
+
+static void timed_edit(incremental_file *file, text_edit edit, edit_stats *stats) {
+  double start = seconds_now();
+  incremental_edit(file, edit);
+  vector_add(&stats->latencies, seconds_now() - start);
+  stats->full_reparses += file->reparsed_everything;
+}
+
+int main(int argc, char **argv) {
+  int line_count = argc >= 2 ? atoi(argv[1]) : 50000;
+  int edit_count = argc >= 3 ? atoi(argv[2]) : 4000;
+  srand(19);
+
+  // The functions shape, cut off at about that many lines
+  FILE *file = fopen(SOURCE_PATH, "w");
+  for (int i = 0, lines = 0; lines < line_count; i++) {
+    write_functions_chunk(file, i);
+    lines += 2 + FUNCTION_STATEMENTS / 4 * 8 + 1;
+  }
+  fclose(file);
+  source_file source = source_from_path(SOURCE_PATH);
+  FILE *quiet = fopen("/dev/null", "w");
+
+  incremental_file edited;
+  double open = bench("open", source.size, incremental_open(&edited, source.chars, source.size, quiet));
+  uint32_t item_count = vector_size((vector *)&edited.items);
+  printf("%u bytes, %u tokens, %u top-level statements (%u tokens each on average)\n\n", edited.size,
+         edited.tokens.count, item_count, item_count > 0 ? edited.tokens.count / item_count : 0);
+
+  edit_stats stats[EDIT_KIND_COUNT];
+  for (int kind = 0; kind < EDIT_KIND_COUNT; kind++) {
+    stats[kind] = (edit_stats){ .latencies = vector_create(), .full_reparses = 0 };
+  }
+  int mismatches = 0;
+  int checks = 0;
+  for (int i = 0; i < edit_count; i++) {
+    // Mostly numbers, the odd brace
+    int roll = rand() % 16;
+    edit_kind kind = roll < 8 ? EDIT_NUMBER : roll < 11 ? EDIT_INSERT : roll < 15 ? EDIT_DELETE : EDIT_BRACE;
+    char buffer[64];
+    text_edit edit;
+    while (!pick_edit(&edited, kind, buffer, &edit)) {
+    }
+    if (kind == EDIT_BRACE) {
+      char removed[256];
+      uint32_t length = edit.end - edit.start < sizeof(removed) ? edit.end - edit.start : sizeof(removed);
+      memcpy(removed, edited.text + edit.start, length);
+      edit.end = edit.start + length;
+      timed_edit(&edited, edit, &stats[kind]);
+      text_edit undo = { .start = edit.start, .end = edit.start, .text = removed, .length = length };
+      timed_edit(&edited, undo, &stats[kind]);
+    } else {
+      timed_edit(&edited, edit, &stats[kind]);
+    }
+    if (i % CHECK_EVERY == 0 || i == edit_count - 1) {
+      mismatches += !same_as_fresh_parse(&edited, quiet);
+      checks++;
+    }
+  }
+
+  printf("%-14s %8s %12s %12s %12s %14s  %s\n", "edit", "count", "median us", "p99 us", "max us", "full reparses",
+         "under 1 ms");
+  for (int kind = 0; kind < EDIT_KIND_COUNT; kind++) {
+    uint32_t count = vector_size((vector *)&stats[kind].latencies);
+    if (count == 0) {
+      continue;
+    }
+    qsort(stats[kind].latencies, count, sizeof(double), compare_doubles);
+    double median = stats[kind].latencies[count / 2] * 1e6;
+    double p99 = stats[kind].latencies[count * 99 / 100] * 1e6;
+    const char *target = p99 < TARGET_US ? "yes" : median < TARGET_US ? "median only" : "no";
+    printf("%-14s %8u %12.1f %12.1f %12.1f %14u  %s\n", edit_names[kind], count, median, p99,
+           stats[kind].latencies[count - 1] * 1e6, stats[kind].full_reparses, target);
+    vector_free((vector *)&stats[kind].latencies);
+  }
+  printf("\nfull parse took %.1f us\n", open * 1e6);
+  printf("the whole top-level statement an edit lands in gets parsed again, so bigger ones cost more\n");
+  printf("full reparses clear out old nodes once they outweigh the live ones 4 times over, those are the max column\n");
+  printf("%d of %d checks against a fresh parse differed\n", mismatches, checks);
+
+  incremental_close(&edited);
+  fclose(quiet);
+  source_close(&source);
+  remove(SOURCE_PATH);
+  return mismatches > 0;
+}
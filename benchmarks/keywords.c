@@ -0,0 +1,75 @@
+// Identifiers per second for keyword lookup, before (a chain of compares,
+// like create_keyword used to do) and after (the perfect hash in lexer.c)
+#include "../lexer.h"
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define IDENTIFIER_COUNT 1000000
+#define ROUNDS 20
+
+typedef struct {
+  const char *name;
+  token_type type;
+} keyword_pair;
+
+#define GENERATE_KEYWORD_PAIR(TYPE, NAME, FIRST, LAST) { NAME, TYPE },
+static const keyword_pair keyword_pairs[] = { ITERATE_KEYWORDS_AND(GENERATE_KEYWORD_PAIR) };
+#define KEYWORD_COUNT (sizeof(keyword_pairs) / sizeof(keyword_pairs[0]))
+
+// What create_keyword did before: compare against every keyword in order
+token_type chain_keyword_type(string_slice value) {
+  for (size_t i = 0; i < KEYWORD_COUNT; i++) {
+    if (slice_is(value, keyword_pairs[i].name)) {
+      return keyword_pairs[i].type;
+    }
+  }
+  return TOKEN_NAME;
+}
+
+// Roughly what real code looks like: mostly names, some keywords
+string_slice *make_identifiers(char *storage) {
+  const char *names[] = { "i", "index", "count", "node", "current_token",
+                          "value", "left", "right", "tokens", "size_bytes" };
+  string_slice *identifiers = malloc(sizeof(string_slice) * IDENTIFIER_COUNT);
+  srand(1);
+  for (int i = 0; i < IDENTIFIER_COUNT; i++) {
+    const char *name = rand() % 4 == 0 ? keyword_pairs[rand() % KEYWORD_COUNT].name
+                                       : names[rand() % 10];
+    size_t length = strlen(name);
+    memcpy(storage, name, length);
+    identifiers[i] = (string_slice){ .chars = storage, .length = length };
+    storage += length;
+  }
+  return identifiers;
+}
+
+int main(void) {
+  char *storage = malloc(IDENTIFIER_COUNT * 16);
+  string_slice *identifiers = make_identifiers(storage);
+  long identifiers_looked_up = (long)IDENTIFIER_COUNT * ROUNDS;
+  // Sums are printed so the compiler can't throw the lookups away
+  long chain_sum = 0;
+  long hash_sum = 0;
+
+  bench("keywords (compare chain)", identifiers_looked_up, ({
+    for (int round = 0; round < ROUNDS; round++) {
+      for (int i = 0; i < IDENTIFIER_COUNT; i++) {
+        chain_sum += chain_keyword_type(identifiers[i]);
+      }
+    }
+  }));
+  bench("keywords (perfect hash)", identifiers_looked_up, ({
+    for (int round = 0; round < ROUNDS; round++) {
+      for (int i = 0; i < IDENTIFIER_COUNT; i++) {
+        hash_sum += keyword_type(identifiers[i]);
+      }
+    }
+  }));
+
+  if (chain_sum != hash_sum) {
+    printf("Lookups disagree! %ld != %ld\n", chain_sum, hash_sum);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,160 @@
+// Structs nested inside each other through typedefs, and functions full of
+// member gets on them. Types are laid out once as they're parsed and member
+// gets are resolved once after, so reading a size or an offset off the flat
+// tree is reading a number. That's compared against working them out every
+// time they're asked for, the way a backend pass would without them: sizes by
+// going down through every typedef and member, offsets by a whole
+// resolve_members pass (types, then a search by name) per round.
+// Usage: ./layout [struct count, default 200] [function count, default 400] [rounds, default 20]
+#include "../ast.h"
+#include "../semantic.h"
+#include "bench.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SOURCE_PATH "/tmp/mcc_layout_bench.mcc"
+#define STATEMENTS 16
+
+// Every layer has the one before it inside it, so how deep a type goes grows with its number
+static void write_source(const char *path, int struct_count, int function_count) {
+  FILE *file = fopen(path, "w");
+  fprintf(file, "typedef struct layer_0 {\n  char tag;\n  int count;\n  char *name;\n} layer_0;\n");
+  for (int i = 1; i < struct_count; i++) {
+    fprintf(file,
+            "typedef struct layer_%d {\n  char tag;\n  layer_%d inner;\n  int count;\n  layer_%d *link;\n  char *name;\n} layer_%d;\n",
+            i, i - 1, i - 1, i);
+  }
+  for (int i = 0; i < function_count; i++) {
+    int layer = 2 + i % (struct_count - 2);
+    fprintf(file, "int use_%d() {\n  layer_%d value;\n  layer_%d *pointer;\n", i, layer, layer);
+    for (int statement = 0; statement < STATEMENTS; statement++) {
+      switch (statement % 4) {
+      case 0:
+        fprintf(file, "  value.count = value.inner.count + %d;\n", statement);
+        break;
+      case 1:
+        fprintf(file, "  pointer->inner.inner.tag = value.tag;\n");
+        break;
+      case 2:
+        fprintf(file, "  value.link->name = pointer->link->inner.name;\n");
+        break;
+      case 3:
+        fprintf(file, "  layer_%d copy = value.inner;\n", layer - 1);
+        break;
+      }
+    }
+    fprintf(file, "}\n");
+  }
+  fclose(file);
+}
+
+// What finding a size costs without it saved
+static type_layout layout_from_scratch(const node *type) {
+  switch (type->type) {
+  case NODE_BASE_TYPE:
+    if (type->base_type.definition == NULL) {
+      return (type_layout){ .size_bytes = type->base_type.size_bytes, .alignment = type->base_type.alignment };
+    }
+    return layout_from_scratch(type->base_type.definition);
+  case NODE_POINTER:
+    return (type_layout){ .size_bytes = POINTER_BYTES, .alignment = POINTER_BYTES };
+  default: {
+    uint32_t size = 0;
+    uint32_t alignment = 1;
+    for (uint32_t i = 0; i < type->structure.members.count; i++) {
+      type_layout member = layout_from_scratch(type->structure.members.nodes[i]->variable_declaration.type);
+      size = (size + member.alignment - 1) / member.alignment * member.alignment + member.size_bytes;
+      alignment = member.alignment > alignment ? member.alignment : alignment;
+    }
+    return (type_layout){ .size_bytes = (size + alignment - 1) / alignment * alignment, .alignment = alignment };
+  }
+  }
+}
+
+int main(int argc, char **argv) {
+  int struct_count = argc >= 2 ? atoi(argv[1]) : 200;
+  int function_count = argc >= 3 ? atoi(argv[2]) : 400;
+  int rounds = argc >= 4 ? atoi(argv[3]) : 20;
+  write_source(SOURCE_PATH, struct_count, function_count);
+
+  source_file source = source_from_path(SOURCE_PATH);
+  symbol_table symbols = symbol_table_create();
+  arena nodes = arena_create();
+  lexer_state lexer = lexer_create(source, &symbols);
+  token_cursor cursor = cursor_from_lexer(&lexer, &nodes);
+  printf("%d nested structs, %d functions, %d rounds\n", struct_count, function_count, rounds);
+  node *ast = NULL;
+  bench("parse (and lay out)", 1, ast = parser(&cursor));
+  uint32_t errors = 0;
+  bench("resolve members once", 1, errors = resolve_members(ast, &symbols, stderr));
+  flat_ast flat = flatten_ast(ast);
+
+  // Every local's type, for the sizes
+  node **locals = NULL;
+  uint32_t local_count = 0;
+  for (uint32_t i = 0; i < ast->block.nodes.count; i++) {
+    node *function = ast->block.nodes.nodes[i];
+    node_list statements = function->function.body->block.nodes;
+    locals = realloc(locals, sizeof(node *) * (local_count + statements.count));
+    for (uint32_t s = 0; s < statements.count; s++) {
+      if (statements.nodes[s]->type == NODE_VARIABLE_DECLARATION) {
+        locals[local_count++] = statements.nodes[s]->variable_declaration.type;
+      }
+    }
+  }
+  uint32_t node_count = vector_size((vector *)&flat.nodes);
+  uint32_t member_gets = 0;
+  uint32_t resolved = 0;
+  for (uint32_t i = 0; i < node_count; i++) {
+    if (ast_type(&flat, i) == NODE_STRUCT_MEMBER_GET) {
+      member_gets += 1;
+      resolved += ast_member_offset(&flat, i) != NO_OFFSET;
+    }
+  }
+  printf("%u locals, %u of %u member gets resolved, %u errors\n", local_count, resolved, member_gets, errors);
+
+  uint64_t saved_sizes = 0;
+  uint64_t scratch_sizes = 0;
+  bench("sizes, saved", (uint64_t)local_count * rounds, ({
+    for (int round = 0; round < rounds; round++) {
+      for (uint32_t i = 0; i < local_count; i++) {
+        saved_sizes += layout_of_type(locals[i]).size_bytes;
+      }
+    }
+  }));
+  bench("sizes, from scratch", (uint64_t)local_count * rounds, ({
+    for (int round = 0; round < rounds; round++) {
+      for (uint32_t i = 0; i < local_count; i++) {
+        scratch_sizes += layout_from_scratch(locals[i]).size_bytes;
+      }
+    }
+  }));
+
+  uint64_t offsets = 0;
+  bench("offsets, off the flat tree", (uint64_t)member_gets * rounds, ({
+    for (int round = 0; round < rounds; round++) {
+      for (uint32_t i = 0; i < node_count; i++) {
+        if (ast_type(&flat, i) == NODE_STRUCT_MEMBER_GET) {
+          offsets += ast_member_offset(&flat, i);
+        }
+      }
+    }
+  }));
+  bench("offsets, resolved again", (uint64_t)member_gets * rounds, ({
+    for (int round = 0; round < rounds; round++) {
+      errors += resolve_members(ast, &symbols, stderr);
+    }
+  }));
+
+  bool sizes_match = saved_sizes == scratch_sizes;
+  printf("sizes %s, offsets add up to %llu\n", sizes_match ? "match" : "DON'T MATCH", (unsigned long long)offsets);
+
+  flat_ast_free(&flat);
+  free(locals);
+  free_cursor(&cursor);
+  arena_free(&nodes);
+  symbol_table_free(&symbols);
+  source_close(&source);
+  unlink(SOURCE_PATH);
+  return !sizes_match || errors > 0 || resolved != member_gets;
+}
@@ -0,0 +1,132 @@
+// A file that's mostly headers: lots of types and functions, and a main that
+// only calls a few of them. Parsing everything is compared against skipping
+// every body, and against skipping them then parsing just what main reaches.
+// Then with main calling everything, the lazy AST is checked against the
+// eager one.
+// Usage: ./lazy [size, default 32M] [1 in how many functions main calls, default 16]
+#include "../ast.h"
+#include "../instrument.h"
+#include "../memory.h"
+#include "bench.h"
+#include "generate.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SOURCE_PATH "/tmp/mcc_lazy_bench.mcc"
+#define ROUNDS 3
+
+// The types are a quarter of it, the functions the rest
+static void write_header_heavy(size_t size, int call_every) {
+  FILE *file = fopen(SOURCE_PATH, "w");
+  size_t written = write_shape(file, SHAPE_TYPES, size / 4);
+  int function_count = 0;
+  for (; written < size; function_count++) {
+    written += write_functions_chunk(file, function_count);
+  }
+  fprintf(file, "int main(int a) {\n");
+  for (int i = 0; i < function_count; i += call_every) {
+    fprintf(file, "  function_%d(a, %d, a);\n", i, i);
+  }
+  fprintf(file, "}\n");
+  fclose(file);
+}
+
+typedef struct {
+  double seconds; // Best of a few
+  size_t peak_memory;
+  uint64_t nodes;
+  uint32_t bodies;
+} parse_result;
+
+typedef enum {
+  PARSE_EAGER,
+  PARSE_LAZY,
+  PARSE_REACHABLE,
+} parse_mode;
+
+static parse_result parse_with(parse_mode mode, const token_stream *tokens, source_file source, symbol_table *symbols, flat_ast *flat) {
+  parse_result result = { .seconds = 1e30 };
+  symbol_id main_symbol = intern_symbol(symbols, SLICE("main"));
+  for (int round = 0; round < ROUNDS; round++) {
+    uint64_t nodes_before = counters[COUNTER_NODES];
+    memory_usage mark = memory_mark();
+    arena nodes = arena_create();
+    token_cursor cursor = cursor_from_tokens(tokens, source, symbols, &nodes);
+    lazy_bodies lazy = { .bodies = NULL };
+    cursor.lazy = mode != PARSE_EAGER ? &lazy : NULL;
+
+    double start = seconds_now();
+    node *root = parser(&cursor);
+    uint32_t bodies = 0;
+    if (mode == PARSE_REACHABLE) {
+      bodies = parse_reachable_bodies(&lazy, main_symbol);
+    }
+    double elapsed = seconds_now() - start;
+
+    result.seconds = elapsed < result.seconds ? elapsed : result.seconds;
+    // Just what the parse added on top of the tokens
+    result.peak_memory = memory_since_mark(mark).peak - mark.current;
+    result.nodes = counters[COUNTER_NODES] - nodes_before;
+    result.bodies = bodies;
+    if (round == ROUNDS - 1 && flat != NULL) {
+      *flat = flatten_ast(root);
+    }
+    free_lazy_bodies(&lazy);
+    free_cursor(&cursor);
+    arena_free(&nodes);
+  }
+  return result;
+}
+
+static void print_result(const char *name, parse_result result, parse_result eager) {
+  printf("%-28s %10.3f %12zu %12llu %8u %9.2fx\n", name, result.seconds * 1e3, result.peak_memory / 1024,
+         (unsigned long long)result.nodes, result.bodies, eager.seconds / result.seconds);
+}
+
+static bool same_ast(const flat_ast *a, const flat_ast *b) {
+  uint32_t node_count = vector_size((vector *)&a->nodes);
+  uint32_t extra_count = vector_size((vector *)&a->extra);
+  return a->root == b->root && node_count == vector_size((vector *)&b->nodes) &&
+         extra_count == vector_size((vector *)&b->extra) &&
+         memcmp(a->nodes, b->nodes, sizeof(flat_node) * node_count) == 0 &&
+         memcmp(a->extra, b->extra, sizeof(uint32_t) * extra_count) == 0;
+}
+
+int main(int argc, char **argv) {
+  size_t size = argc >= 2 ? parse_size(argv[1]) : 32 * 1024 * 1024;
+  int call_every = argc >= 3 ? atoi(argv[2]) : 16;
+  call_every = call_every > 0 ? call_every : 1;
+  int mismatches = 0;
+
+  for (int pass = 0; pass < 2; pass++) {
+    // The second time around main calls everything, so every body gets parsed
+    int every = pass == 0 ? call_every : 1;
+    write_header_heavy(size, every);
+    source_file source = source_from_path(SOURCE_PATH);
+    symbol_table symbols = symbol_table_create();
+    token_stream tokens = lexer(source, &symbols);
+
+    printf("===== main calls 1 in %d functions =====\n", every);
+    printf("%-28s %10s %12s %12s %8s %10s\n", "mode", "ms", "peak KB", "nodes", "bodies", "speedup");
+    flat_ast eager_ast;
+    flat_ast reachable_ast;
+    parse_result eager = parse_with(PARSE_EAGER, &tokens, source, &symbols, &eager_ast);
+    print_result("eager", eager, eager);
+    print_result("lazy, nothing parsed", parse_with(PARSE_LAZY, &tokens, source, &symbols, NULL), eager);
+    print_result("lazy, reachable parsed", parse_with(PARSE_REACHABLE, &tokens, source, &symbols, &reachable_ast), eager);
+
+    if (every == 1) {
+      bool same = same_ast(&eager_ast, &reachable_ast);
+      mismatches += !same;
+      printf("%s\n", same ? "Lazy AST matches the eager one" : "LAZY AST DIFFERS");
+    }
+    flat_ast_free(&eager_ast);
+    flat_ast_free(&reachable_ast);
+    token_stream_free(&tokens);
+    symbol_table_free(&symbols);
+    source_close(&source);
+  }
+
+  remove(SOURCE_PATH);
+  return mismatches > 0;
+}
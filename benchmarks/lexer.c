@@ -0,0 +1,105 @@
+// Tokens per second for the whole lexer, on a big generated source file
+#include "../lexer.h"
+#include "bench.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SOURCE_SIZE (32 * 1024 * 1024)
+#define SOURCE_PATH "/tmp/mcc_lexer_bench.mcc"
+#define ROUNDS 3
+
+// A bit of everything the lexer knows about, repeated till it's big enough
+void write_code_source(const char *path, size_t size) {
+  FILE *file = fopen(path, "w");
+  size_t written = 0;
+  for (int i = 0; written < size; i++) {
+    written += fprintf(file,
+        "int value_%d = add_function(index + %d, 3) * -12 + -6;\n"
+        "if (left == right) { left += 1; } else { right -= 2; }\n"
+        "string name = \"hello world\";\n"
+        "x = a != b && c || d >= e;\n"
+        "while (index < 10) { index++; other->member--; }\n",
+        i, i);
+  }
+  fclose(file);
+}
+
+// Mostly license headers, doc blocks and indentation, with a little code
+void write_comment_source(const char *path, size_t size) {
+  FILE *file = fopen(path, "w");
+  size_t written = 0;
+  for (int i = 0; written < size; i++) {
+    written += fprintf(file,
+        "/*****************************************************************\n"
+        " * Copyright (c) Whoever wrote file number %d, all rights reserved\n"
+        " *\n"
+        " * Permission is hereby granted, free of charge, to any person\n"
+        " * obtaining a copy of this software and associated documentation\n"
+        " * files (the \"Software\"), to deal in the Software without\n"
+        " * restriction, including without limitation the rights to use,\n"
+        " * copy, modify, merge, publish, distribute, sublicense, and/or sell\n"
+        " * copies of the Software. */\n"
+        "\n"
+        "// Adds one to the value, and returns it. This is a long doc comment\n"
+        "// that explains very little over several lines, like doc comments\n"
+        "// tend to do when someone has to write one for every function.\n"
+        "                int value_%d = index + 1;\n",
+        i, i);
+  }
+  fclose(file);
+}
+
+// Best of a few rounds, so a hiccup doesn't count as a regression
+void bench_lexer(const char *name, void (*write_source)(const char *, size_t), FILE *terminal) {
+  write_source(SOURCE_PATH, SOURCE_SIZE);
+  source_file source = source_from_path(SOURCE_PATH);
+
+  double best = 1e30;
+  uint32_t token_count = 0;
+  size_t token_bytes = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    symbol_table symbols = symbol_table_create();
+    double start = seconds_now();
+    token_stream tokens = lexer(source, &symbols);
+    double elapsed = seconds_now() - start;
+    best = elapsed < best ? elapsed : best;
+    token_count = tokens.count;
+    token_bytes = (size_t)tokens.capacity * (sizeof(uint32_t) * 2 + sizeof(uint8_t));
+    token_stream_free(&tokens);
+    symbol_table_free(&symbols);
+  }
+
+  fprintf(terminal, "%-28s %10.3f ms %14.0f tokens/s %10.1f MB/s %6.1f B/token\n", name,
+          best * 1e3, token_count / best, source.size / best / 1e6,
+          (double)token_bytes / token_count);
+
+  // Same thing pulled one token at a time, which never holds more than
+  // LEXER_LOOKAHEAD tokens
+  best = 1e30;
+  for (int round = 0; round < ROUNDS; round++) {
+    symbol_table symbols = symbol_table_create();
+    lexer_state state = lexer_create(source, &symbols);
+    double start = seconds_now();
+    while (lexer_next(&state).type != TOKEN_END) {
+    }
+    double elapsed = seconds_now() - start;
+    best = elapsed < best ? elapsed : best;
+    symbol_table_free(&symbols);
+  }
+
+  fprintf(terminal, "%-28s %10.3f ms %14.0f tokens/s %10.1f MB/s\n", "  streaming",
+          best * 1e3, token_count / best, source.size / best / 1e6);
+
+  source_close(&source);
+  remove(SOURCE_PATH);
+}
+
+int main(void) {
+  // The lexer prints every token it makes, keep that out of the terminal
+  FILE *terminal = fdopen(dup(fileno(stdout)), "w");
+  freopen("/dev/null", "w", stdout);
+
+  bench_lexer("lexer (code)", write_code_source, terminal);
+  bench_lexer("lexer (comment heavy)", write_comment_source, terminal);
+  return 0;
+}
@@ -0,0 +1,77 @@
+// An X-macro list of 60 entries, expanded thousands of times with a handful
+// of different generators (one pastes, one stringizes, one goes through
+// another macro first), then twice and four times as many. Expanding should
+// stay linear in what comes out, so the time per output token shouldn't move,
+// and neither should allocations, which only happen when a buffer has to grow.
+// Usage: ./macros [expansions, default 2000]
+#include "../instrument.h"
+#include "../preprocessor.h"
+#include "bench.h"
+#include <stdlib.h>
+
+#define SOURCE_PATH "/tmp/mcc_macros_bench.mcc"
+#define ENTRIES 60
+#define ROUNDS 3
+
+static const char *generators[] = { "GENERATE_ENUM", "GENERATE_NAME", "GENERATE_CASE", "GENERATE_COUNT" };
+#define GENERATOR_COUNT (sizeof(generators) / sizeof(generators[0]))
+
+static void write_source(uint32_t expansions) {
+  FILE *file = fopen(SOURCE_PATH, "w");
+  fprintf(file, "#define ITERATE_THINGS_AND(X) \\\n");
+  for (int entry = 0; entry < ENTRIES; entry++) {
+    fprintf(file, "  X(THING_%d, %d)%s\n", entry, entry, entry + 1 < ENTRIES ? " \\" : "");
+  }
+  fprintf(file,
+          "#define GENERATE_ENUM(name, value) name = value,\n"
+          "#define GENERATE_NAME(name, value) #name,\n"
+          "#define CASE_OF(name) case_##name\n"
+          "#define GENERATE_CASE(name, value) CASE_OF(name): value;\n"
+          "#define GENERATE_COUNT(name, value) + 1\n");
+  for (uint32_t i = 0; i < expansions; i++) {
+    fprintf(file, "ITERATE_THINGS_AND(%s)\n", generators[i % GENERATOR_COUNT]);
+  }
+  fclose(file);
+}
+
+int main(int argc, char **argv) {
+  uint32_t expansions = argc >= 2 ? atoi(argv[1]) : 2000;
+  printf("%-28s %10s %12s %14s %10s %12s %10s\n", "expansions", "ms", "tokens out", "ns per token", "allocs",
+         "macro calls", "hide sets");
+  for (uint32_t scale = 1; scale <= 4; scale *= 2) {
+    write_source(expansions * scale);
+    source_file source = source_from_path(SOURCE_PATH);
+    double best = 1e30;
+    uint32_t tokens_out = 0;
+    uint64_t allocations = 0;
+    uint64_t calls = 0;
+    uint32_t hide_sets = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+      symbol_table symbols = symbol_table_create();
+      preprocessor state = preprocessor_create(&symbols, stderr);
+      uint64_t allocations_before = memory_total.allocations;
+      uint64_t calls_before = counters[COUNTER_MACRO_EXPANSIONS];
+      double start = seconds_now();
+      preprocess(&state, source, SOURCE_PATH);
+      double elapsed = seconds_now() - start;
+      if (elapsed < best) {
+        best = elapsed;
+        allocations = memory_total.allocations - allocations_before;
+      }
+      tokens_out = state.tokens.count;
+      calls = counters[COUNTER_MACRO_EXPANSIONS] - calls_before;
+      hide_sets = vector_size((vector *)&state.hide_sets);
+      if (state.error_count > 0) {
+        printf("%u errors\n", state.error_count);
+        return 1;
+      }
+      preprocessor_free(&state);
+      symbol_table_free(&symbols);
+    }
+    printf("%-28u %10.3f %12u %14.1f %10llu %12llu %10u\n", expansions * scale, best * 1e3, tokens_out,
+           best * 1e9 / tokens_out, (unsigned long long)allocations, (unsigned long long)calls, hide_sets);
+    source_close(&source);
+  }
+  remove(SOURCE_PATH);
+  return 0;
+}
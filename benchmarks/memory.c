@@ -0,0 +1,68 @@
+// Peak memory of every phase, per byte of source, for each generated shape.
+// Each phase has a budget, going over it fails the run so a change that
+// blows up memory gets noticed.
+// Usage: ./memory [size, default 4M]
+#include "../ast.h"
+#include "../instrument.h"
+#include "generate.h"
+#include <stdlib.h>
+
+#define SOURCE_PATH "/tmp/mcc_memory_bench.mcc"
+
+// Most a phase is allowed to have live at once, in bytes per byte of source.
+// The arena and the token stream are counted, the mapped file isn't.
+typedef struct {
+  const char *phase;
+  double peak_per_byte;
+} memory_budget;
+
+static const memory_budget budgets[] = {
+  { "lex", 8 },
+  { "parse", 32 },
+  { "flatten", 40 },
+};
+
+int main(int argc, char **argv) {
+  size_t size = argc >= 2 ? parse_size(argv[1]) : 4 * 1024 * 1024;
+  int over_budget = 0;
+
+  printf("%-12s %-8s %12s %12s %12s %10s\n", "shape", "phase", "peak KB", "allocated KB",
+         "allocations", "peak/byte");
+  for (int shape = 0; shape < SHAPE_COUNT; shape++) {
+    size_t written = write_shape_to_path(SOURCE_PATH, shape, size);
+
+    instrument_enable();
+    source_file source = source_from_path(SOURCE_PATH);
+    symbol_table symbols = symbol_table_create();
+    token_stream tokens = lexer(source, &symbols);
+    arena nodes = arena_create();
+    token_cursor cursor = cursor_from_tokens(&tokens, source, &symbols, &nodes);
+    node *root = parser(&cursor);
+    free_cursor(&cursor);
+    token_stream_free(&tokens);
+    flat_ast flat = flatten_ast(root);
+    arena_free(&nodes);
+
+    for (size_t i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++) {
+      const phase_event *event = find_phase(budgets[i].phase);
+      if (event == NULL) {
+        continue;
+      }
+      double per_byte = (double)event->memory.peak / written;
+      bool over = per_byte > budgets[i].peak_per_byte;
+      printf("%-12s %-8s %12zu %12zu %12llu %10.2f%s\n", shape_names[shape], event->name,
+             event->memory.peak / 1024, event->memory.allocated / 1024,
+             (unsigned long long)event->memory.allocations, per_byte,
+             over ? "  OVER BUDGET" : "");
+      over_budget |= over;
+    }
+
+    flat_ast_free(&flat);
+    symbol_table_free(&symbols);
+    source_close(&source);
+    instrument_free();
+  }
+
+  remove(SOURCE_PATH);
+  return over_budget;
+}
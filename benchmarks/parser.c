@@ -0,0 +1,87 @@
+// Parse time and allocations for a big generated source. bench.sh builds this
+// twice, once with the arena and once with -DNO_ARENA (a malloc per node).
+#include "../parser.h"
+#include "bench.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SOURCE_SIZE (8 * 1024 * 1024)
+#define SOURCE_PATH "/tmp/mcc_parser_bench.mcc"
+#define ROUNDS 3
+
+#ifdef NO_ARENA
+#define ALLOCATOR_NAME "malloc"
+#else
+#define ALLOCATOR_NAME "arena"
+#endif
+
+// Statements the parser knows how to handle, repeated till it's big enough
+void write_parser_source(const char *path, size_t size) {
+  FILE *file = fopen(path, "w");
+  size_t written = fprintf(file, "typedef int myint;\ntypedef char *string;\n");
+  for (int i = 0; written < size; i++) {
+    written += fprintf(file,
+        "struct point_%d {\n  int x;\n  myint y;\n};\n"
+        "return_value = a + b * %d - (a / b);\n"
+        "int j = add_function(i + 1, %d) * -12 + -6;\n"
+        "string s = \"hello\";\n"
+        "if (a == b) {\n  a += 1;\n} else {\n  b -= 2;\n}\n"
+        "while (a < 10) {\n  a++;\n}\n"
+        "do {\n  b--;\n} while (b >= 0);\n"
+        "x = a != b && c || d;\n",
+        i, i, i);
+  }
+  fclose(file);
+}
+
+int main(void) {
+  // The parser prints as it goes, keep that out of the terminal
+  FILE *terminal = fdopen(dup(fileno(stdout)), "w");
+  freopen("/dev/null", "w", stdout);
+
+  write_parser_source(SOURCE_PATH, SOURCE_SIZE);
+  source_file source = source_from_path(SOURCE_PATH);
+  symbol_table symbols = symbol_table_create();
+  token_stream tokens = lexer(source, &symbols);
+
+  double best_parse = 1e30;
+  double best_free = 1e30;
+  size_t allocation_count = 0;
+  size_t bytes_used = 0;
+  for (int round = 0; round < ROUNDS; round++) {
+    arena nodes = arena_create();
+    token_cursor cursor = cursor_from_tokens(&tokens, source, &symbols, &nodes);
+    scope_context context = create_scope_context();
+    add_builtin_types(&context, &symbols);
+
+    jmp_buf bail;
+    cursor.bail = &bail;
+    if (setjmp(bail) != 0) {
+      fprintf(terminal, "parse (" ALLOCATOR_NAME ") failed\n");
+      return 1;
+    }
+    double start = seconds_now();
+    parse_block(&context, &cursor);
+    double parsed = seconds_now();
+    allocation_count = nodes.allocation_count;
+    bytes_used = nodes.bytes_used;
+    arena_free(&nodes);
+    double freed = seconds_now();
+
+    best_parse = parsed - start < best_parse ? parsed - start : best_parse;
+    best_free = freed - parsed < best_free ? freed - parsed : best_free;
+    free_scope_context(&context);
+    free_cursor(&cursor);
+  }
+
+  fprintf(terminal, "%-28s %10.3f ms %14.0f tokens/s\n", "parse (" ALLOCATOR_NAME ")",
+          best_parse * 1e3, tokens.count / best_parse);
+  fprintf(terminal, "%-28s %10.3f ms %10zu allocations %8.1f MB\n", "  free everything",
+          best_free * 1e3, allocation_count, bytes_used / 1e6);
+
+  token_stream_free(&tokens);
+  symbol_table_free(&symbols);
+  source_close(&source);
+  remove(SOURCE_PATH);
+  return 0;
+}
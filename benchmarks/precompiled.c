@@ -0,0 +1,139 @@
+// Lots of files that all start by including the same big header of typedefs
+// and structs, compiled once with the header included the usual way (the
+// header cache is kept, so it's lexed once, but every file still
+// preprocesses and parses it), then again starting from an image of it.
+// Trees aren't printed while timing, a run after that prints them and they
+// have to be the same byte for byte.
+// Usage: ./precompiled [file count, default 64] [chunks in the header, default 2000]
+#include "../driver.h"
+#include "../instrument.h"
+#include "../precompiled.h"
+#include "bench.h"
+#include "generate.h"
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DIRECTORY "/tmp/mcc_precompiled_bench"
+#define HEADER_PATH DIRECTORY "/common.h"
+#define IMAGE_PATH DIRECTORY "/common.pch"
+#define ROUNDS 3
+
+typedef struct {
+  double seconds;
+  uint64_t tokens; // Lexed
+  uint64_t nodes; // Parsed
+  uint32_t errors;
+  char *output; // Every file's tree, one after the other
+  size_t output_size;
+} run_stats;
+
+static run_stats compile_files(char (*paths)[64], uint32_t file_count, const header_image *image) {
+  run_stats best = { .seconds = 1e30 };
+  // The last round is the one that prints
+  for (int round = 0; round <= ROUNDS; round++) {
+    bool printing = round == ROUNDS;
+    uint64_t tokens_before = counters[COUNTER_TOKENS];
+    uint64_t nodes_before = counters[COUNTER_NODES];
+    run_stats stats = { .seconds = 0, .errors = 0 };
+    FILE *output = open_memstream(&stats.output, &stats.output_size);
+    double start = seconds_now();
+    for (uint32_t i = 0; i < file_count; i++) {
+      compile_job job = job_for_file(paths[i], printing);
+      job.header_image = image;
+      compile_file(&job);
+      flush_job(&job, output, stderr);
+      stats.errors += job.error_count;
+    }
+    stats.seconds = seconds_now() - start;
+    fclose(output);
+    stats.tokens = counters[COUNTER_TOKENS] - tokens_before;
+    stats.nodes = counters[COUNTER_NODES] - nodes_before;
+    if (printing) {
+      best.output = stats.output;
+      best.output_size = stats.output_size;
+    } else if (stats.seconds < best.seconds) {
+      best = stats;
+      free(stats.output);
+      best.output = NULL;
+    } else {
+      free(stats.output);
+    }
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  uint32_t file_count = argc >= 2 ? atoi(argv[1]) : 64;
+  uint32_t chunks = argc >= 3 ? atoi(argv[2]) : 2000;
+  mkdir(DIRECTORY, 0777);
+
+  FILE *file = fopen(HEADER_PATH, "w");
+  fprintf(file, "#ifndef COMMON_H\n#define COMMON_H\n#define TWICE(x) ((x) + (x))\n");
+  for (uint32_t chunk = 0; chunk < chunks; chunk++) {
+    write_types_chunk(file, chunk);
+  }
+  fprintf(file, "#endif\n");
+  fclose(file);
+
+  // The files with the image don't include the header themselves, the rest do
+  char (*included)[64] = malloc(sizeof(*included) * file_count);
+  char (*plain)[64] = malloc(sizeof(*plain) * file_count);
+  for (uint32_t i = 0; i < file_count; i++) {
+    snprintf(included[i], sizeof(included[i]), DIRECTORY "/included_%u.mcc", i);
+    snprintf(plain[i], sizeof(plain[i]), DIRECTORY "/plain_%u.mcc", i);
+    for (int with_include = 0; with_include < 2; with_include++) {
+      file = fopen(with_include ? included[i] : plain[i], "w");
+      if (with_include) {
+        fprintf(file, "#include \"common.h\"\n");
+      }
+      fprintf(file, "type_%u main() {\n  type_%u count = TWICE(%u);\n  string_%u name = \"x\";\n}\n", i % chunks,
+              (i + 1) % chunks, i, (i + 2) % chunks);
+      fclose(file);
+    }
+  }
+
+  double build_start = seconds_now();
+  bool built = header_image_build(HEADER_PATH, NULL, IMAGE_PATH, stderr);
+  double build_seconds = seconds_now() - build_start;
+  header_image image;
+  double load_start = seconds_now();
+  bool loaded = built && header_image_load(IMAGE_PATH, &image, stderr);
+  double load_seconds = seconds_now() - load_start;
+  if (!loaded) {
+    return 1;
+  }
+  struct stat image_stats;
+  stat(IMAGE_PATH, &image_stats);
+
+  run_stats parsed = compile_files(included, file_count, NULL);
+  run_stats imaged = compile_files(plain, file_count, &image);
+  bool same = parsed.output_size == imaged.output_size && memcmp(parsed.output, imaged.output, parsed.output_size) == 0;
+
+  printf("%u files, a header of %u chunks (image is %lld KB, built in %.3f ms, loaded in %.3f ms)\n", file_count,
+         chunks, (long long)image_stats.st_size / 1024, build_seconds * 1e3, load_seconds * 1e3);
+  printf("%-28s %10s %12s %14s %14s %10s\n", "header", "ms", "files/s", "tokens lexed", "nodes parsed", "errors");
+  printf("%-28s %10.3f %12.1f %14llu %14llu %10u\n", "included and parsed", parsed.seconds * 1e3,
+         file_count / parsed.seconds, (unsigned long long)parsed.tokens, (unsigned long long)parsed.nodes,
+         parsed.errors);
+  printf("%-28s %10.3f %12.1f %14llu %14llu %10u\n", "from the image", imaged.seconds * 1e3,
+         file_count / imaged.seconds, (unsigned long long)imaged.tokens, (unsigned long long)imaged.nodes,
+         imaged.errors);
+  printf("%.2fx faster from the image, trees %s\n", parsed.seconds / imaged.seconds, same ? "the same" : "DIFFERENT");
+
+  header_image_release(&image);
+  header_cache_free();
+  free(parsed.output);
+  free(imaged.output);
+  for (uint32_t i = 0; i < file_count; i++) {
+    remove(included[i]);
+    remove(plain[i]);
+  }
+  remove(HEADER_PATH);
+  remove(IMAGE_PATH);
+  rmdir(DIRECTORY);
+  free(included);
+  free(plain);
+  return !same || parsed.errors + imaged.errors > 0;
+}
@@ -0,0 +1,120 @@
+// Lots of files that all include the same headers (some guarded, some
+// #pragma once, every one included twice), the way real projects look.
+// Compiled once with the header cache thrown away after every file, so each
+// one lexes every header itself, then again with it kept, so only the first
+// does. That's all the cache saves, so don't expect much: every file still
+// copies the headers' tokens in and parses them (benchmarks/precompiled is
+// the one that skips that).
+// Usage: ./preprocess [file count, default 64] [header count, default 16] [chunks per header, default 200]
+#include "../driver.h"
+#include "../instrument.h"
+#include "../preprocessor.h"
+#include "bench.h"
+#include "generate.h"
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DIRECTORY "/tmp/mcc_preprocess_bench"
+#define ROUNDS 3
+
+typedef struct {
+  double seconds;
+  uint64_t headers_lexed;
+  uint64_t includes_skipped;
+  uint32_t errors;
+} run_stats;
+
+static run_stats compile_files(char (*paths)[64], uint32_t file_count, char **include_directories, bool keep_headers) {
+  run_stats best = { .seconds = 1e30 };
+  for (int round = 0; round < ROUNDS; round++) {
+    header_cache_free();
+    uint64_t lexed_before = counters[COUNTER_HEADERS_LEXED];
+    uint64_t skipped_before = counters[COUNTER_INCLUDES_SKIPPED];
+    run_stats stats = { .seconds = 0, .errors = 0 };
+    double start = seconds_now();
+    for (uint32_t i = 0; i < file_count; i++) {
+      if (!keep_headers) {
+        header_cache_free();
+      }
+      compile_job job = job_for_file(paths[i], false);
+      job.include_directories = include_directories;
+      compile_file(&job);
+      flush_job(&job, stdout, stderr);
+      stats.errors += job.error_count;
+    }
+    stats.seconds = seconds_now() - start;
+    stats.headers_lexed = counters[COUNTER_HEADERS_LEXED] - lexed_before;
+    stats.includes_skipped = counters[COUNTER_INCLUDES_SKIPPED] - skipped_before;
+    best = stats.seconds < best.seconds ? stats : best;
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  uint32_t file_count = argc >= 2 ? atoi(argv[1]) : 64;
+  uint32_t header_count = argc >= 3 ? atoi(argv[2]) : 16;
+  uint32_t chunks = argc >= 4 ? atoi(argv[3]) : 200;
+  mkdir(DIRECTORY, 0777);
+
+  // Every other header is guarded, the rest are #pragma once
+  char path[128];
+  for (uint32_t header = 0; header < header_count; header++) {
+    snprintf(path, sizeof(path), DIRECTORY "/header_%u.h", header);
+    FILE *file = fopen(path, "w");
+    if (header % 2 == 0) {
+      fprintf(file, "#ifndef HEADER_%u_H\n#define HEADER_%u_H\n", header, header);
+    } else {
+      fprintf(file, "#pragma once\n");
+    }
+    for (uint32_t chunk = 0; chunk < chunks; chunk++) {
+      write_types_chunk(file, header * chunks + chunk);
+    }
+    if (header % 2 == 0) {
+      fprintf(file, "#endif\n");
+    }
+    fclose(file);
+  }
+
+  // Each file includes every header twice over, then has a little code of its own
+  char (*paths)[64] = malloc(sizeof(*paths) * file_count);
+  for (uint32_t i = 0; i < file_count; i++) {
+    snprintf(paths[i], sizeof(paths[i]), DIRECTORY "/file_%u.mcc", i);
+    FILE *file = fopen(paths[i], "w");
+    for (int pass = 0; pass < 2; pass++) {
+      for (uint32_t header = 0; header < header_count; header++) {
+        fprintf(file, pass == 0 ? "#include \"header_%u.h\"\n" : "#include <header_%u.h>\n", header);
+      }
+    }
+    write_functions_chunk(file, i);
+    fclose(file);
+  }
+  char **include_directories = vector_create();
+  vector_add(&include_directories, DIRECTORY);
+
+  run_stats cold = compile_files(paths, file_count, include_directories, false);
+  run_stats warm = compile_files(paths, file_count, include_directories, true);
+  printf("%u files, %u headers of %u chunks, each included twice\n", file_count, header_count, chunks);
+  printf("%-28s %10s %12s %14s %16s %10s\n", "headers", "ms", "files/s", "headers lexed", "includes skipped",
+         "errors");
+  printf("%-28s %10.3f %12.1f %14llu %16llu %10u\n", "lexed by every file", cold.seconds * 1e3,
+         file_count / cold.seconds, (unsigned long long)cold.headers_lexed, (unsigned long long)cold.includes_skipped,
+         cold.errors);
+  printf("%-28s %10.3f %12.1f %14llu %16llu %10u\n", "lexed once, cached", warm.seconds * 1e3,
+         file_count / warm.seconds, (unsigned long long)warm.headers_lexed, (unsigned long long)warm.includes_skipped,
+         warm.errors);
+  printf("%.2fx faster with the cache\n", cold.seconds / warm.seconds);
+
+  header_cache_free();
+  vector_free((vector *)&include_directories);
+  for (uint32_t i = 0; i < file_count; i++) {
+    remove(paths[i]);
+  }
+  for (uint32_t header = 0; header < header_count; header++) {
+    snprintf(path, sizeof(path), DIRECTORY "/header_%u.h", header);
+    remove(path);
+  }
+  rmdir(DIRECTORY);
+  free(paths);
+  return cold.errors + warm.errors > 0;
+}
@@ -0,0 +1,124 @@
+// Type lookups deep inside nested blocks, with thousands of typedefs around
+#include "../parser.h"
+#include "bench.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TYPEDEF_COUNT 4000
+#define NESTING_DEPTH 256
+#define LOOKUPS (8 * 1000 * 1000)
+#define SOURCE_PATH "/tmp/mcc_scopes_bench.mcc"
+
+symbol_id make_symbol(symbol_table *symbols, const char *format, int number) {
+  char name[32];
+  int length = snprintf(name, sizeof(name), format, number);
+  // Names have to outlive the table, so they're leaked on purpose
+  return intern_symbol(symbols, (string_slice){ .chars = strndup(name, length), .length = length });
+}
+
+// Straight on the scope table: typedefs up top, then a scope per depth with
+// a typedef of its own and one shadowing an outer one. Lookups from the
+// bottom are half outer types, half types from somewhere in between.
+int bench_lookups(symbol_table *symbols, FILE *terminal) {
+  scope_context context = create_scope_context();
+  symbol_id *names = malloc(sizeof(symbol_id) * TYPEDEF_COUNT);
+  symbol_id *locals = malloc(sizeof(symbol_id) * NESTING_DEPTH);
+  for (int i = 0; i < TYPEDEF_COUNT; i++) {
+    names[i] = make_symbol(symbols, "type_%d", i);
+    add_type_to_context((typedef_entry){ .name = names[i], .size_bytes = 4 }, &context);
+  }
+  for (int depth = 0; depth < NESTING_DEPTH; depth++) {
+    enter_scope(&context);
+    locals[depth] = make_symbol(symbols, "local_%d", depth);
+    add_type_to_context((typedef_entry){ .name = locals[depth], .size_bytes = 8 }, &context);
+    add_type_to_context((typedef_entry){ .name = names[depth * 7 % TYPEDEF_COUNT], .size_bytes = 8 }, &context);
+  }
+
+  int found = 0;
+  bench_to(terminal, "is_type at depth 256", LOOKUPS, ({
+    for (int i = 0; i < LOOKUPS; i++) {
+      uint32_t pick = i * 2654435761u;
+      symbol_id name = i % 2 == 0 ? names[pick % TYPEDEF_COUNT] : locals[pick % NESTING_DEPTH];
+      found += is_type(name, &context);
+    }
+  }));
+
+  for (int depth = 0; depth < NESTING_DEPTH; depth++) {
+    exit_scope(&context);
+  }
+  // Leaving every scope should have put the outer typedefs back
+  bool is_restored = find_type(names[0], &context)->size_bytes == 4;
+  free_scope_context(&context);
+  free(names);
+  free(locals);
+
+  if (found != LOOKUPS || !is_restored) {
+    fprintf(terminal, "Lookups went wrong! %d of %d found\n", found, LOOKUPS);
+    return 1;
+  }
+  return 0;
+}
+
+// The same thing through the parser: typedefs up top, then `while` loops
+// nested deep with declarations using them at every level
+void write_nested_source(const char *path) {
+  FILE *file = fopen(path, "w");
+  for (int i = 0; i < TYPEDEF_COUNT; i++) {
+    fprintf(file, "typedef int type_%d;\n", i);
+  }
+  for (int round = 0; round < 8; round++) {
+    for (int depth = 0; depth < NESTING_DEPTH; depth++) {
+      fprintf(file, "while (a < %d) {\n", depth);
+      fprintf(file, "typedef char *local_%d;\n", depth);
+      for (int i = 0; i < 16; i++) {
+        fprintf(file, "type_%d value_%d = %d;\n", (depth * 16 + i) % TYPEDEF_COUNT, i, i);
+      }
+      fprintf(file, "local_%d name_%d = \"\";\n", depth, depth);
+    }
+    for (int depth = 0; depth < NESTING_DEPTH; depth++) {
+      fprintf(file, "}\n");
+    }
+  }
+  fclose(file);
+}
+
+void bench_parse(symbol_table *symbols, FILE *terminal) {
+  write_nested_source(SOURCE_PATH);
+  source_file source = source_from_path(SOURCE_PATH);
+  token_stream tokens = lexer(source, symbols);
+  arena nodes = arena_create();
+  token_cursor cursor = cursor_from_tokens(&tokens, source, symbols, &nodes);
+
+  scope_context context = create_scope_context();
+  add_builtin_types(&context, symbols);
+
+  jmp_buf bail;
+  cursor.bail = &bail;
+  if (setjmp(bail) == 0) {
+    bench_to(terminal, "parse nested source", tokens.count, ({
+      parse_block(&context, &cursor);
+    }));
+  } else {
+    fprintf(terminal, "parse nested source failed\n");
+  }
+
+  free_scope_context(&context);
+  free_cursor(&cursor);
+  arena_free(&nodes);
+  token_stream_free(&tokens);
+  source_close(&source);
+  remove(SOURCE_PATH);
+}
+
+int main(void) {
+  // The lexer and parser print as they go, keep that out of the terminal
+  FILE *terminal = fdopen(dup(fileno(stdout)), "w");
+  freopen("/dev/null", "w", stdout);
+
+  symbol_table symbols = symbol_table_create();
+  int result = bench_lookups(&symbols, terminal);
+  bench_parse(&symbols, terminal);
+  symbol_table_free(&symbols);
+  return result;
+}
@@ -0,0 +1,167 @@
+// Lexer and parser throughput over every generated shape, from 1 KB up to
+// 100 MB, to catch regressions. Each phase runs in its own child process so
+// peak RSS doesn't carry over (the parser's includes the tokens it reads).
+// Usage: ./throughput [largest size, default 100M] [shape]
+//
+// bench.sh links this with -Wl,--wrap=malloc (and realloc, calloc), which is
+// how every allocation in the compiler gets counted.
+#include "../ast.h"
+#include "../c-vector/vec.h"
+#include "bench.h"
+#include "generate.h"
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SOURCE_PATH "/tmp/mcc_throughput_bench.mcc"
+// Small inputs get run over and over until about this much has gone through
+#define BYTES_PER_MEASUREMENT (16 * 1024 * 1024)
+
+static size_t allocation_count = 0;
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *pointer, size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__wrap_malloc(size_t size) {
+  allocation_count += 1;
+  return __real_malloc(size);
+}
+void *__wrap_realloc(void *pointer, size_t size) {
+  allocation_count += 1;
+  return __real_realloc(pointer, size);
+}
+void *__wrap_calloc(size_t count, size_t size) {
+  allocation_count += 1;
+  return __real_calloc(count, size);
+}
+
+typedef enum {
+  PHASE_LEXER,
+  PHASE_PARSER,
+} phase;
+
+// What a child sends back
+typedef struct {
+  double seconds; // For one run
+  uint32_t tokens;
+  uint32_t nodes;
+  size_t allocations; // For one run
+  long peak_rss_kb;
+} measurement;
+
+// The parser is given an already lexed file, so its numbers are only its own
+measurement measure_phase(phase measured, size_t size) {
+  measurement result = { 0 };
+  int rounds = size >= BYTES_PER_MEASUREMENT ? 1 : BYTES_PER_MEASUREMENT / size;
+  source_file source = source_from_path(SOURCE_PATH);
+  symbol_table symbols = symbol_table_create();
+
+  if (measured == PHASE_LEXER) {
+    allocation_count = 0;
+    double start = seconds_now();
+    for (int round = 0; round < rounds; round++) {
+      token_stream tokens = lexer(source, &symbols);
+      result.tokens = tokens.count;
+      token_stream_free(&tokens);
+    }
+    result.seconds = (seconds_now() - start) / rounds;
+    result.allocations = allocation_count / rounds;
+  } else {
+    token_stream tokens = lexer(source, &symbols);
+    result.tokens = tokens.count;
+    allocation_count = 0;
+    double start = seconds_now();
+    for (int round = 0; round < rounds; round++) {
+      arena nodes = arena_create();
+      token_cursor cursor = cursor_from_tokens(&tokens, source, &symbols, &nodes);
+      node *root = parser(&cursor);
+      if (round == 0) {
+        // Counting takes a walk over the tree, so it isn't timed
+        double counting = seconds_now();
+        size_t allocations = allocation_count;
+        flat_ast flat = flatten_ast(root);
+        result.nodes = vector_size((vector *)&flat.nodes);
+        flat_ast_free(&flat);
+        allocation_count = allocations;
+        start += seconds_now() - counting;
+      }
+      free_cursor(&cursor);
+      arena_free(&nodes);
+    }
+    result.seconds = (seconds_now() - start) / rounds;
+    result.allocations = allocation_count / rounds;
+    token_stream_free(&tokens);
+  }
+
+  symbol_table_free(&symbols);
+  source_close(&source);
+  return result;
+}
+
+measurement measure_in_child(phase measured, size_t size) {
+  measurement result = { 0 };
+  int results[2];
+  if (pipe(results) != 0) {
+    return result;
+  }
+  fflush(stdout);
+  pid_t child = fork();
+  if (child == 0) {
+    close(results[0]);
+    // The compiler still prints a lot, none of it is wanted here
+    freopen("/dev/null", "w", stdout);
+    measurement measured_result = measure_phase(measured, size);
+    write(results[1], &measured_result, sizeof(measured_result));
+    _exit(0);
+  }
+  close(results[1]);
+  read(results[0], &result, sizeof(result));
+  close(results[0]);
+
+  struct rusage usage;
+  int status;
+  wait4(child, &status, 0, &usage);
+  result.peak_rss_kb = usage.ru_maxrss;
+  return result;
+}
+
+void print_size(char *text, size_t length, size_t size) {
+  if (size >= 1024 * 1024) {
+    snprintf(text, length, "%zuM", size / (1024 * 1024));
+  } else {
+    snprintf(text, length, "%zuK", size / 1024);
+  }
+}
+
+int main(int argc, char **argv) {
+  size_t largest = argc >= 2 ? parse_size(argv[1]) : (size_t)100 * 1024 * 1024;
+  source_shape only_shape = argc >= 3 ? shape_from_name(argv[2]) : SHAPE_COUNT;
+  const size_t sizes[] = { 1024, 10 * 1024, 100 * 1024, 1024 * 1024, 10 * 1024 * 1024, 100 * 1024 * 1024 };
+
+  printf("%-12s %6s %-7s %10s %14s %14s %12s %10s\n", "shape", "size", "phase",
+         "ms", "tokens/s", "nodes/s", "allocations", "peak RSS");
+  for (int shape = 0; shape < SHAPE_COUNT; shape++) {
+    if (only_shape != SHAPE_COUNT && shape != (int)only_shape) {
+      continue;
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && sizes[i] <= largest; i++) {
+      write_shape_to_path(SOURCE_PATH, shape, sizes[i]);
+      char size_text[16];
+      print_size(size_text, sizeof(size_text), sizes[i]);
+
+      measurement lexed = measure_in_child(PHASE_LEXER, sizes[i]);
+      printf("%-12s %6s %-7s %10.3f %14.0f %14s %12zu %8ld KB\n", shape_names[shape], size_text,
+             "lexer", lexed.seconds * 1e3, lexed.tokens / lexed.seconds, "-",
+             lexed.allocations, lexed.peak_rss_kb);
+
+      measurement parsed = measure_in_child(PHASE_PARSER, sizes[i]);
+      printf("%-12s %6s %-7s %10.3f %14.0f %14.0f %12zu %8ld KB\n", shape_names[shape], size_text,
+             "parser", parsed.seconds * 1e3, parsed.tokens / parsed.seconds,
+             parsed.nodes / parsed.seconds, parsed.allocations, parsed.peak_rss_kb);
+    }
+  }
+
+  remove(SOURCE_PATH);
+  return 0;
+}
@@ -0,0 +1,158 @@
+// Functions full of locals whose types are the same handful written over and
+// over, mostly pointers to typedef'd structs a few levels deep. Types are
+// interned, so each distinct one is a node once however many declarations
+// use it. That's compared against what the tree would hold if every
+// declaration had its own chain of type nodes (how many, and how many bytes),
+// and asking whether two locals have the same type is compared against going
+// down both chains a node at a time, the way it'd have to without interning.
+// Usage: ./types [function count, default 2000] [rounds, default 20]
+#include "../ast.h"
+#include "../semantic.h"
+#include "bench.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SOURCE_PATH "/tmp/mcc_types_bench.mcc"
+#define STRUCT_COUNT 8
+#define LOCALS 24
+#define COMPARE_DISTANCE 4
+
+static void write_source(const char *path, int function_count) {
+  FILE *file = fopen(path, "w");
+  for (int i = 0; i < STRUCT_COUNT; i++) {
+    fprintf(file, "typedef struct record_%d {\n  int id;\n  char *name;\n} record_%d;\n", i, i);
+  }
+  for (int i = 0; i < function_count; i++) {
+    fprintf(file, "int use_%d(record_%d *first, char **names) {\n", i, i % STRUCT_COUNT);
+    for (int local = 0; local < LOCALS; local++) {
+      int record = (i + local) % STRUCT_COUNT;
+      switch (local % 4) {
+      case 0:
+        fprintf(file, "  record_%d *item_%d;\n", record, local);
+        break;
+      case 1:
+        fprintf(file, "  record_%d **list_%d;\n", record, local);
+        break;
+      case 2:
+        fprintf(file, "  char **text_%d;\n", local);
+        break;
+      case 3:
+        fprintf(file, "  int ***grid_%d;\n", local);
+        break;
+      }
+    }
+    fprintf(file, "}\n");
+  }
+  fclose(file);
+}
+
+// How many nodes a type would be if nothing shared them
+static uint32_t chain_length(const node *type) {
+  uint32_t length = 1;
+  while (type->type == NODE_POINTER) {
+    type = type->pointer.to;
+    length += 1;
+  }
+  return length;
+}
+
+// What telling two types apart costs without interning: every node of both
+// chains gets looked at
+static bool same_type_by_shape(const node *a, const node *b) {
+  while (a->type == NODE_POINTER && b->type == NODE_POINTER) {
+    a = a->pointer.to;
+    b = b->pointer.to;
+  }
+  if (a->type != b->type) {
+    return false;
+  }
+  if (a->type == NODE_BASE_TYPE) {
+    return a->base_type.name == b->base_type.name && a->base_type.definition == b->base_type.definition;
+  }
+  return a == b;
+}
+
+int main(int argc, char **argv) {
+  int function_count = argc >= 2 ? atoi(argv[1]) : 2000;
+  int rounds = argc >= 3 ? atoi(argv[2]) : 20;
+  write_source(SOURCE_PATH, function_count);
+
+  source_file source = source_from_path(SOURCE_PATH);
+  symbol_table symbols = symbol_table_create();
+  arena nodes = arena_create();
+  lexer_state lexer = lexer_create(source, &symbols);
+  token_cursor cursor = cursor_from_lexer(&lexer, &nodes);
+  printf("%d functions, %d locals each, %d rounds\n", function_count, LOCALS, rounds);
+  node *ast = NULL;
+  bench("parse (and intern)", 1, ast = parser(&cursor));
+
+  // Every parameter's and local's type, in order
+  node **types = NULL;
+  uint32_t type_uses = 0;
+  uint64_t unshared_nodes = 0;
+  for (uint32_t i = 0; i < ast->block.nodes.count; i++) {
+    node *function = ast->block.nodes.nodes[i];
+    if (function->type != NODE_FUNCTION_DECLARATION) {
+      continue;
+    }
+    node_list parameters = function->function.parameters;
+    node_list statements = function->function.body->block.nodes;
+    types = realloc(types, sizeof(node *) * (type_uses + parameters.count + statements.count));
+    for (uint32_t p = 0; p < parameters.count; p++) {
+      types[type_uses++] = parameters.nodes[p]->variable_declaration.type;
+    }
+    for (uint32_t s = 0; s < statements.count; s++) {
+      if (statements.nodes[s]->type == NODE_VARIABLE_DECLARATION) {
+        types[type_uses++] = statements.nodes[s]->variable_declaration.type;
+      }
+    }
+  }
+  for (uint32_t i = 0; i < type_uses; i++) {
+    unshared_nodes += chain_length(types[i]);
+  }
+  uint32_t distinct = type_count(cursor.types);
+  flat_ast flat = flatten_ast(ast);
+  uint32_t flat_nodes = vector_size((vector *)&flat.nodes);
+  // Structs and the functions' return types aren't in the unshared count, they'd be there either way
+  uint64_t flat_unshared = flat_nodes + unshared_nodes - distinct;
+  printf("%u type uses, %u distinct types\n", type_uses, distinct);
+  printf("%-28s %12s %14s\n", "type nodes", "nodes", "bytes");
+  printf("%-28s %12llu %14llu\n", "one chain per declaration", (unsigned long long)unshared_nodes,
+         (unsigned long long)(unshared_nodes * sizeof(node)));
+  printf("%-28s %12u %14llu\n", "interned", distinct, (unsigned long long)distinct * sizeof(node));
+  printf("%-28s %12llu %14llu\n", "flat tree, unshared", (unsigned long long)flat_unshared,
+         (unsigned long long)(flat_unshared * sizeof(flat_node)));
+  printf("%-28s %12u %14llu\n", "flat tree, interned", flat_nodes,
+         (unsigned long long)flat_nodes * sizeof(flat_node));
+
+  // Every local against the one four before it, which is the same type over a third of the time
+  uint64_t same_by_node = 0;
+  uint64_t same_by_shape = 0;
+  uint64_t comparisons = (uint64_t)(type_uses - COMPARE_DISTANCE) * rounds;
+  bench("compare, same node", comparisons, ({
+    for (int round = 0; round < rounds; round++) {
+      for (uint32_t i = COMPARE_DISTANCE; i < type_uses; i++) {
+        same_by_node += types[i] == types[i - COMPARE_DISTANCE];
+      }
+    }
+  }));
+  bench("compare, down both chains", comparisons, ({
+    for (int round = 0; round < rounds; round++) {
+      for (uint32_t i = COMPARE_DISTANCE; i < type_uses; i++) {
+        same_by_shape += same_type_by_shape(types[i], types[i - COMPARE_DISTANCE]);
+      }
+    }
+  }));
+  bool agree = same_by_node == same_by_shape;
+  printf("%.1fx fewer type nodes, comparisons %s (%llu the same)\n", (double)unshared_nodes / distinct,
+         agree ? "agree" : "DON'T AGREE", (unsigned long long)same_by_node);
+
+  flat_ast_free(&flat);
+  free(types);
+  free_cursor(&cursor);
+  arena_free(&nodes);
+  symbol_table_free(&symbols);
+  source_close(&source);
+  unlink(SOURCE_PATH);
+  return !agree;
+}
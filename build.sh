@@ -1,2 +1,2 @@
-gcc -g -o main main.c c-vector/vec.c c-hashmap/hashmap.c lexer.c parser.c enum_utilities.c -Wall -Wextra
-gcc -g -o main_san main.c c-vector/vec.c c-hashmap/hashmap.c lexer.c parser.c enum_utilities.c -Wall -Wextra -fsanitize=address
+gcc -g -o main main.c vector_memory.c c-hashmap/hashmap.c arena.c ast.c source.c symbols.c lexer.c parser.c enum_utilities.c instrument.c memory.c pool.c driver.c preprocessor.c precompiled.c semantic.c cache.c incremental.c walk.c dump.c -Wall -Wextra -pthread -DMCC_BUILD_ID="\"$(git describe --always --dirty 2>/dev/null)\""
+gcc -g -o main_san main.c vector_memory.c c-hashmap/hashmap.c arena.c ast.c source.c symbols.c lexer.c parser.c enum_utilities.c instrument.c memory.c pool.c driver.c preprocessor.c precompiled.c semantic.c cache.c incremental.c walk.c dump.c -Wall -Wextra -fsanitize=address -pthread -DMCC_BUILD_ID="\"$(git describe --always --dirty 2>/dev/null)\""
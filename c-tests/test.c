@@ -1,7 +1,67 @@
+// Every test, built against the compiler's sources by test.sh
 #include "test.h"
-#include "test_vec.c"
+#include "../driver.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Compiles `text` as if it were a file, with `job`'s settings (whatever it
+// has for a path is ignored), and gives back the job with what it printed.
+// Let go of it with free_compiled.
+static compile_job compile_text_as(compile_job job, const char *text) {
+  char path[] = "/tmp/mcc_test_XXXXXX";
+  int file = mkstemp(path);
+  if (file < 0 || write(file, text, strlen(text)) != (ssize_t)strlen(text)) {
+    error("Couldn't write %s", path);
+  }
+  close(file);
+  job.path = path;
+  compile_file(&job);
+  unlink(path);
+  job.path = NULL;
+  return job;
+}
+
+// Same, with the AST printed as text and nothing else set
+static compile_job compile_text(const char *text) {
+  return compile_text_as(job_for_file(NULL, true), text);
+}
+
+static void free_compiled(compile_job *job) {
+  free(job->output_text);
+  free(job->errors_text);
+  job->output_text = NULL;
+  job->errors_text = NULL;
+}
+
+static bool printed(const char *text, const char *expected) {
+  return text != NULL && strstr(text, expected) != NULL;
+}
+
+#include "test_lexer.c"
+#include "test_parser.c"
+#include "test_lazy.c"
+#include "test_cache.c"
+#include "test_incremental.c"
+#include "test_preprocessor.c"
+#include "test_semantic.c"
+#include "test_types.c"
 
 int main(void) {
-  run_test(test_vec);
-  return 0;
+  int failed = 0;
+  failed += run_test(test_keywords) == FAILED;
+  failed += run_test(test_missing_expressions) == FAILED;
+  failed += run_test(test_errors_stay_in_their_file) == FAILED;
+  failed += run_test(test_lazy_matches_eager) == FAILED;
+  failed += run_test(test_lazy_skips_unreachable) == FAILED;
+  failed += run_test(test_cache_round_trip) == FAILED;
+  failed += run_test(test_cache_key_collision) == FAILED;
+  failed += run_test(test_incremental_matches_fresh_parse) == FAILED;
+  failed += run_test(test_incremental_deleted_brace) == FAILED;
+  failed += run_test(test_incremental_broken_statement) == FAILED;
+  failed += run_test(test_include_guards) == FAILED;
+  failed += run_test(test_hide_sets) == FAILED;
+  failed += run_test(test_member_misuse) == FAILED;
+  failed += run_test(test_types_are_interned) == FAILED;
+  return failed > 0;
 }
@@ -1,2 +1,7 @@
-gcc -o test test.c -Wall -Wextra
-./test
+# Builds the tests along with the compiler's sources (everything but main.c)
+# into a temporary directory, and runs them. Fails if any test does.
+cd "$(dirname "$0")"
+BUILD=$(mktemp -d)
+trap 'rm -rf "$BUILD"' EXIT
+gcc -g -fsanitize=address,undefined -o "$BUILD/test" test.c ../vector_memory.c ../c-hashmap/hashmap.c ../arena.c ../ast.c ../source.c ../symbols.c ../lexer.c ../parser.c ../enum_utilities.c ../instrument.c ../memory.c ../pool.c ../driver.c ../preprocessor.c ../precompiled.c ../semantic.c ../cache.c ../incremental.c ../walk.c ../dump.c -Wall -Wextra -pthread || exit 1
+"$BUILD/test"
@@ -0,0 +1,82 @@
+#include "../cache.h"
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+static compile_job compile_cached(const char *directory, const char *text) {
+  compile_job job = job_for_file(NULL, true);
+  job.cache_directory = directory;
+  return compile_text_as(job, text);
+}
+
+static void remove_directory(const char *directory) {
+  DIR *entries = opendir(directory);
+  struct dirent *entry;
+  char path[PATH_MAX];
+  while (entries != NULL && (entry = readdir(entries)) != NULL) {
+    if (entry->d_name[0] != '.') {
+      snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+      unlink(path);
+    }
+  }
+  if (entries != NULL) {
+    closedir(entries);
+  }
+  rmdir(directory);
+}
+
+static const char *cached_source =
+  "typedef struct point {\n  int x;\n  int y;\n} point;\n"
+  "int f(point *p, char *name) {\n  char *s = \"text\";\n  int k = p->x * 2 + p->y;\n  p->x = -k;\n}\n";
+
+// What comes back out of the cache prints the same as what went in
+completion_type test_cache_round_trip(void) {
+  char directory[] = "/tmp/mcc_test_cache_XXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    error("Couldn't make %s", directory);
+  }
+  compile_job stored = compile_cached(directory, cached_source);
+  compile_job loaded = compile_cached(directory, cached_source);
+  bool passed = true;
+  passed &= assert(stored.succeeded && !stored.from_cache);
+  passed &= assert(loaded.succeeded && loaded.from_cache);
+  passed &= assert(stored.output_size == loaded.output_size &&
+                   memcmp(stored.output_text, loaded.output_text, stored.output_size) == 0);
+
+  // An edited file misses
+  compile_job edited = compile_cached(directory, "int f() { int x; x = 1; }");
+  passed &= assert(edited.succeeded && !edited.from_cache);
+  free_compiled(&stored);
+  free_compiled(&loaded);
+  free_compiled(&edited);
+  remove_directory(directory);
+  return passed ? PASSED : FAILED;
+}
+
+// A file whose key is the same as another's (here by renaming the other's
+// cache file to it) doesn't get the other's AST, the source is checked too
+completion_type test_cache_key_collision(void) {
+  char directory[] = "/tmp/mcc_test_cache_XXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    error("Couldn't make %s", directory);
+  }
+  const char *other_source = "int g() { int y; y = 2; }";
+  compile_job stored = compile_cached(directory, cached_source);
+  source_file first = { .chars = (char *)cached_source, .size = strlen(cached_source), .mapped_size = 0 };
+  source_file other = { .chars = (char *)other_source, .size = strlen(other_source), .mapped_size = 0 };
+  char from[PATH_MAX];
+  char to[PATH_MAX];
+  snprintf(from, sizeof(from), "%s/%016llx.ast", directory, (unsigned long long)cache_key(first));
+  snprintf(to, sizeof(to), "%s/%016llx.ast", directory, (unsigned long long)cache_key(other));
+  bool renamed = rename(from, to) == 0;
+  bool passed = true;
+  passed &= assert(renamed);
+
+  compile_job collided = compile_cached(directory, other_source);
+  passed &= assert(collided.succeeded && !collided.from_cache);
+  passed &= assert(printed(collided.output_text, ": g") && !printed(collided.output_text, ": point"));
+  free_compiled(&stored);
+  free_compiled(&collided);
+  remove_directory(directory);
+  return passed ? PASSED : FAILED;
+}
@@ -0,0 +1,150 @@
+#include "../ast.h"
+#include "../incremental.h"
+
+static const char *incremental_source =
+  "typedef struct pair {\n  int left;\n  int right;\n} pair;\n"
+  "int sum(pair *p) {\n  int total = p->left + p->right;\n  total = total * 2;\n}\n"
+  "int twice(int x) {\n  if (x > 10) {\n    x = x - 1;\n  }\n  x = x + x;\n}\n"
+  "int last(pair *p) {\n  p->left = 7;\n}\n";
+
+static bool same_flat_ast(const flat_ast *fresh, const flat_ast *kept) {
+  uint32_t node_count = vector_size((vector *)&fresh->nodes);
+  uint32_t extra_count = vector_size((vector *)&fresh->extra);
+  uint32_t string_count = vector_size((vector *)&fresh->strings);
+  if (fresh->root != kept->root || node_count != vector_size((vector *)&kept->nodes) ||
+      extra_count != vector_size((vector *)&kept->extra) || string_count != vector_size((vector *)&kept->strings) ||
+      memcmp(fresh->nodes, kept->nodes, sizeof(flat_node) * node_count) != 0 ||
+      memcmp(fresh->extra, kept->extra, sizeof(uint32_t) * extra_count) != 0) {
+    return false;
+  }
+  for (uint32_t i = 0; i < string_count; i++) {
+    if (!slice_equals(fresh->strings[i], kept->strings[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Parsed again from nothing, with the same symbol table so the ids match
+static bool same_as_fresh_parse(incremental_file *file, FILE *quiet) {
+  source_file source = { .chars = file->text, .size = file->size, .mapped_size = 0 };
+  lexer_state lexer = lexer_create(source, &file->symbols);
+  lexer.errors = quiet;
+  token_stream tokens = lex_all(&lexer);
+  arena nodes = arena_create();
+  token_cursor cursor = cursor_from_tokens(&tokens, source, &file->symbols, &nodes);
+  cursor.errors = quiet;
+  node *root = parser(&cursor);
+  bool same = (root == NULL) == (file->root == NULL) && lexer.error_count + cursor.error_count == file->error_count;
+  if (same && root != NULL) {
+    flat_ast fresh = flatten_ast(root);
+    flat_ast kept = flatten_ast(file->root);
+    same = same_flat_ast(&fresh, &kept);
+    flat_ast_free(&fresh);
+    flat_ast_free(&kept);
+  }
+  free_cursor(&cursor);
+  arena_free(&nodes);
+  token_stream_free(&tokens);
+  return same;
+}
+
+// Swaps the first `find` in the file for `replace`
+static void edit_text(incremental_file *file, const char *find, const char *replace) {
+  const char *found = strstr(file->text, find);
+  if (found == NULL) {
+    error("'%s' isn't in the file", find);
+  }
+  uint32_t start = (uint32_t)(found - file->text);
+  text_edit edit = { .start = start, .end = start + strlen(find), .text = replace, .length = strlen(replace) };
+  incremental_edit(file, edit);
+}
+
+static bool has_broken_item(const incremental_file *file) {
+  uint32_t count = vector_size((vector *)&file->items);
+  for (uint32_t i = 0; i < count; i++) {
+    if (file->items[i].broken) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// After each edit the tree is what parsing the file from scratch gives
+completion_type test_incremental_matches_fresh_parse(void) {
+  FILE *quiet = fopen("/dev/null", "w");
+  incremental_file file;
+  incremental_open(&file, incremental_source, strlen(incremental_source), quiet);
+  bool passed = true;
+  passed &= assert(file.root != NULL && file.error_count == 0);
+
+  edit_text(&file, "7", "12345");
+  bool number_same = same_as_fresh_parse(&file, quiet);
+  passed &= assert(number_same && !file.reparsed_everything);
+
+  edit_text(&file, "  x = x + x;\n", "  x = x + x;\n  x = x * 3;\n");
+  bool insert_same = same_as_fresh_parse(&file, quiet);
+  passed &= assert(insert_same && !file.reparsed_everything);
+
+  edit_text(&file, "  total = total * 2;\n", "");
+  bool delete_same = same_as_fresh_parse(&file, quiet);
+  passed &= assert(delete_same && !file.reparsed_everything);
+
+  // A new typedef changes what names mean after it
+  edit_text(&file, "int twice", "typedef int number;\nint twice");
+  bool typedef_same = same_as_fresh_parse(&file, quiet);
+  passed &= assert(typedef_same);
+  incremental_close(&file);
+  fclose(quiet);
+  return passed ? PASSED : FAILED;
+}
+
+// Taking out a '}' only touches the function it was in, the ones after it
+// keep their trees. Putting it back gets the tree a fresh parse would.
+completion_type test_incremental_deleted_brace(void) {
+  FILE *quiet = fopen("/dev/null", "w");
+  incremental_file file;
+  incremental_open(&file, incremental_source, strlen(incremental_source), quiet);
+  uint32_t last = vector_size((vector *)&file.items) - 1;
+  node *untouched = file.items[last].statement;
+  bool passed = true;
+
+  edit_text(&file, "    x = x - 1;\n  }\n", "    x = x - 1;\n");
+  passed &= assert(!file.reparsed_everything);
+  passed &= assert(file.root != NULL && file.error_count > 0);
+  passed &= assert(file.items[last].statement == untouched);
+
+  edit_text(&file, "    x = x - 1;\n", "    x = x - 1;\n  }\n");
+  bool restored_same = same_as_fresh_parse(&file, quiet);
+  passed &= assert(restored_same && file.error_count == 0);
+  passed &= assert(file.items[last].statement == untouched);
+  incremental_close(&file);
+  fclose(quiet);
+  return passed ? PASSED : FAILED;
+}
+
+// Taking out a '{' leaves a '}' that doesn't close anything, so what's
+// around it can't parse on its own. It's kept out of the tree as a broken
+// statement instead of throwing the whole tree away.
+completion_type test_incremental_broken_statement(void) {
+  FILE *quiet = fopen("/dev/null", "w");
+  incremental_file file;
+  incremental_open(&file, incremental_source, strlen(incremental_source), quiet);
+  uint32_t last = vector_size((vector *)&file.items) - 1;
+  node *untouched = file.items[last].statement;
+  bool passed = true;
+
+  edit_text(&file, "(x > 10) {", "(x > 10)");
+  passed &= assert(!file.reparsed_everything);
+  passed &= assert(file.root != NULL && file.error_count > 0);
+  passed &= assert(has_broken_item(&file));
+  passed &= assert(file.items[vector_size((vector *)&file.items) - 1].statement == untouched);
+
+  edit_text(&file, "(x > 10)", "(x > 10) {");
+  bool restored_same = same_as_fresh_parse(&file, quiet);
+  passed &= assert(restored_same && file.error_count == 0);
+  passed &= assert(!has_broken_item(&file));
+  incremental_close(&file);
+  fclose(quiet);
+  return passed ? PASSED : FAILED;
+}
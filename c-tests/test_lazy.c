@@ -0,0 +1,57 @@
+#include <stdbool.h>
+
+#define LAZY_TYPES                                                             \
+  "typedef struct point {\n"                                                   \
+  "  int x;\n"                                                                 \
+  "  int y;\n"                                                                 \
+  "} point;\n"
+#define LAZY_HELPER                                                            \
+  "int helper(point *p) {\n"                                                   \
+  "  int y = p->y + 1;\n"                                                      \
+  "  for (int i = 0; i < y; i++) {\n"                                          \
+  "    p->x = p->x * 2;\n"                                                     \
+  "  }\n"                                                                      \
+  "}\n"
+#define LAZY_MAIN                                                              \
+  "int main() {\n"                                                             \
+  "  point p;\n"                                                               \
+  "  p.x = 3;\n"                                                               \
+  "  helper(&p);\n"                                                            \
+  "}\n"
+
+static compile_job compile_lazily(const char *text) {
+  compile_job job = job_for_file(NULL, true);
+  job.reachable_only = true;
+  return compile_text_as(job, text);
+}
+
+// When main reaches every function, parsing bodies only once they're asked
+// for has to come out the same as parsing them all up front
+completion_type test_lazy_matches_eager(void) {
+  const char *source = LAZY_TYPES LAZY_HELPER LAZY_MAIN;
+  compile_job eager = compile_text(source);
+  compile_job lazy = compile_lazily(source);
+  bool passed = true;
+  passed &= assert(eager.succeeded && lazy.succeeded);
+  passed &= assert(eager.output_size == lazy.output_size &&
+                   memcmp(eager.output_text, lazy.output_text, eager.output_size) == 0);
+  free_compiled(&eager);
+  free_compiled(&lazy);
+  return passed ? PASSED : FAILED;
+}
+
+// A function main can't reach keeps its declaration but never gets a body
+completion_type test_lazy_skips_unreachable(void) {
+  const char *source = LAZY_TYPES "int unused(point *p) {\n  int unreachable = p->x;\n}\n" LAZY_HELPER LAZY_MAIN;
+  compile_job eager = compile_text(source);
+  compile_job lazy = compile_lazily(source);
+  bool passed = true;
+  passed &= assert(eager.succeeded && lazy.succeeded);
+  passed &= assert(printed(eager.output_text, ": unused") && printed(lazy.output_text, ": unused"));
+  passed &= assert(printed(eager.output_text, ": unreachable"));
+  passed &= assert(!printed(lazy.output_text, ": unreachable"));
+  passed &= assert(printed(lazy.output_text, "OPERATOR_MULTIPLY"));
+  free_compiled(&eager);
+  free_compiled(&lazy);
+  return passed ? PASSED : FAILED;
+}
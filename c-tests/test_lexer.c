@@ -0,0 +1,21 @@
+#include "../lexer.h"
+#include <stdbool.h>
+#include <string.h>
+
+// Keyword lookup hashes the first and last chars ITERATE_KEYWORDS_AND spells
+// out, so one that's spelled out wrong would never be found, and would just
+// lex as a name
+#define TEST_KEYWORD(TYPE, NAME, FIRST, LAST) passed &= assert(keyword_type(SLICE(NAME)) == TYPE);
+
+completion_type test_keywords(void) {
+  bool passed = true;
+  ITERATE_KEYWORDS_AND(TEST_KEYWORD)
+
+  // Same length and ends as a keyword, or a keyword with a bit more or less
+  const char *names[] = { "int", "ifx", "ef", "els", "elsee", "volatil", "unsigneD", "cASe", "x", "nulll" };
+  for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    string_slice name = { .chars = names[i], .length = strlen(names[i]) };
+    passed &= assert(keyword_type(name) == TOKEN_NAME);
+  }
+  return passed ? PASSED : FAILED;
+}
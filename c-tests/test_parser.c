@@ -0,0 +1,40 @@
+#include "../parser.h"
+#include <stdbool.h>
+
+// Everything that asks for an expression used to carry on with whatever it
+// got back, which was NULL when there wasn't one, and crash
+completion_type test_missing_expressions(void) {
+  const char *sources[] = {
+    "int f() { int x; x = *; }",
+    "*;",
+    "int f() {\n  for (\n}\n",
+    "int f() { for (int i = 0; i < ; i++) { } }",
+    "int f() { int x; x = 1 + ; }",
+    "int f() { int x; x = (; }",
+    "int f() { int x; x = -; }",
+  };
+  bool passed = true;
+  for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+    compile_job job = compile_text(sources[i]);
+    bool reported = !job.succeeded && job.error_count > 0 && printed(job.errors_text, "Expected an expression");
+    if (!reported) {
+      printf("For: %s\n", sources[i]);
+    }
+    passed &= assert(reported);
+    free_compiled(&job);
+  }
+  return passed ? PASSED : FAILED;
+}
+
+// A file that doesn't parse only fails itself, the next one is fine
+completion_type test_errors_stay_in_their_file(void) {
+  compile_job broken = compile_text("int f() { int x; x = *; }");
+  compile_job fine = compile_text("int f() { int x; x = 2 * 3; }");
+  bool passed = true;
+  passed &= assert(!broken.succeeded);
+  passed &= assert(fine.succeeded && fine.error_count == 0);
+  passed &= assert(printed(fine.output_text, "OPERATOR_MULTIPLY"));
+  free_compiled(&broken);
+  free_compiled(&fine);
+  return passed ? PASSED : FAILED;
+}
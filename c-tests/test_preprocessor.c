@@ -0,0 +1,101 @@
+#include "../preprocessor.h"
+
+static void write_file(const char *directory, const char *name, const char *text) {
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/%s", directory, name);
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    error("Couldn't write %s", path);
+  }
+  fputs(text, file);
+  fclose(file);
+}
+
+// Preprocesses `text` as main.c in `directory`, and gives back its tokens
+// with a space between each. Free it.
+static char *preprocess_text(const char *directory, const char *text, uint32_t *skipped, uint32_t *error_count) {
+  write_file(directory, "main.c", text);
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%s/main.c", directory);
+  source_file source = source_from_path(path);
+  symbol_table symbols = symbol_table_create();
+  FILE *quiet = fopen("/dev/null", "w");
+  preprocessor state = preprocessor_create(&symbols, quiet);
+  preprocess(&state, source, path);
+
+  char *joined = NULL;
+  size_t joined_size = 0;
+  FILE *out = open_memstream(&joined, &joined_size);
+  for (uint32_t i = 0; i < state.tokens.count && state.tokens.types[i] != TOKEN_END; i++) {
+    string_slice text = { .chars = state.text + state.tokens.offsets[i], .length = state.tokens.lengths[i] };
+    if (state.tokens.types[i] == TOKEN_NAME) {
+      text = symbol_name(&symbols, state.tokens.lengths[i]);
+    }
+    fprintf(out, i == 0 ? "%.*s" : " %.*s", text.length, text.chars);
+  }
+  fclose(out);
+  *skipped = state.skipped_includes;
+  *error_count = state.error_count;
+  preprocessor_free(&state);
+  symbol_table_free(&symbols);
+  fclose(quiet);
+  source_close(&source);
+  return joined;
+}
+
+// Headers with an include guard or #pragma once come in once however many
+// times they're included, and the second time isn't even looked at. One
+// without either comes in every time.
+completion_type test_include_guards(void) {
+  char directory[] = "/tmp/mcc_test_include_XXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    error("Couldn't make %s", directory);
+  }
+  write_file(directory, "guarded.h", "#ifndef GUARDED_H\n#define GUARDED_H\nint guarded;\n#endif\n");
+  write_file(directory, "once.h", "#pragma once\nint once;\n");
+  write_file(directory, "plain.h", "int plain;\n");
+  uint32_t skipped;
+  uint32_t error_count;
+  char *tokens = preprocess_text(directory,
+                                 "#include \"guarded.h\"\n#include \"once.h\"\n#include \"plain.h\"\n"
+                                 "#include \"guarded.h\"\n#include \"once.h\"\n#include \"plain.h\"\n"
+                                 "int end;\n",
+                                 &skipped, &error_count);
+  bool passed = true;
+  passed &= assert(strcmp(tokens, "int guarded ; int once ; int plain ; int plain ; int end ;") == 0);
+  passed &= assert(skipped == 2);
+  passed &= assert(error_count == 0);
+  if (!passed) {
+    printf("Got: %s\n", tokens);
+  }
+  free(tokens);
+  remove_directory(directory);
+  return passed ? PASSED : FAILED;
+}
+
+// A macro isn't expanded again inside its own expansion, however it got
+// there, and the names it leaves behind stay names
+completion_type test_hide_sets(void) {
+  char directory[] = "/tmp/mcc_test_macros_XXXXXX";
+  if (mkdtemp(directory) == NULL) {
+    error("Couldn't make %s", directory);
+  }
+  uint32_t skipped;
+  uint32_t error_count;
+  char *tokens = preprocess_text(directory,
+                                 "#define a a b\n"
+                                 "#define f(x) x + f\n"
+                                 "#define p q\n#define q p\n"
+                                 "#define y 2\n#define g(v) g(y * (v))\n#define h g\n"
+                                 "a;\nf(1);\nf(f)(2);\np;\nq;\nh(z + 1);\n",
+                                 &skipped, &error_count);
+  bool passed = true;
+  passed &= assert(strcmp(tokens, "a b ; 1 + f ; f + f ( 2 ) ; p ; q ; g ( 2 * ( z + 1 ) ) ;") == 0);
+  passed &= assert(error_count == 0);
+  if (!passed) {
+    printf("Got: %s\n", tokens);
+  }
+  free(tokens);
+  remove_directory(directory);
+  return passed ? PASSED : FAILED;
+}
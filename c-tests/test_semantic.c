@@ -0,0 +1,19 @@
+#include "../semantic.h"
+
+#define MEMBER_TYPES "typedef struct point {\n  int x;\n  int y;\n} point;\n"
+
+// '.' is for structs and '->' for pointers to them, each the wrong way round
+// is its own error, and (*q).x is the same as q->x
+completion_type test_member_misuse(void) {
+  compile_job wrong = compile_text(MEMBER_TYPES "int f(point p, point *q) {\n  int a = q.x;\n  int b = p->y;\n}\n");
+  compile_job right =
+    compile_text(MEMBER_TYPES "int f(point p, point *q) {\n  int a = p.x;\n  int b = q->y;\n  int c = (*q).x;\n}\n");
+  bool passed = true;
+  passed &= assert(wrong.error_count == 2);
+  passed &= assert(printed(wrong.errors_text, "Can't get member 'x' from a pointer with '.'"));
+  passed &= assert(printed(wrong.errors_text, "Can't get member 'y' with '->' from something that isn't a pointer"));
+  passed &= assert(right.succeeded && right.error_count == 0);
+  free_compiled(&wrong);
+  free_compiled(&right);
+  return passed ? PASSED : FAILED;
+}
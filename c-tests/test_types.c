@@ -0,0 +1,73 @@
+#define RECORD_TYPES "typedef struct record {\n  int id;\n} record;\ntypedef record alias;\n"
+#define RECORD_FUNCTION(name) "int " name "(record *a, record **b) {\n  record *c;\n  record **d;\n  int *e;\n  alias *g;\n}\n"
+
+typedef struct {
+  char *text; // With zeroes after it, the lexer reads ahead
+  symbol_table symbols;
+  arena nodes;
+  token_cursor cursor;
+  node *ast;
+} parsed_text;
+
+static void parse_text(parsed_text *parsed, const char *text) {
+  size_t size = strlen(text);
+  parsed->text = calloc(size + 64, 1);
+  memcpy(parsed->text, text, size);
+  source_file source = { .chars = parsed->text, .size = size, .mapped_size = 0 };
+  parsed->symbols = symbol_table_create();
+  parsed->nodes = arena_create();
+  lexer_state lexer = lexer_create(source, &parsed->symbols);
+  parsed->cursor = cursor_from_lexer(&lexer, &parsed->nodes);
+  parsed->ast = parser(&parsed->cursor);
+}
+
+static void free_parsed(parsed_text *parsed) {
+  free_cursor(&parsed->cursor);
+  arena_free(&parsed->nodes);
+  symbol_table_free(&parsed->symbols);
+  free(parsed->text);
+}
+
+// The type of the `index`th parameter or local of the first function
+static node *declared_type(const node *ast, uint32_t index) {
+  for (uint32_t i = 0; i < ast->block.nodes.count; i++) {
+    node *function = ast->block.nodes.nodes[i];
+    if (function->type != NODE_FUNCTION_DECLARATION) {
+      continue;
+    }
+    node_list parameters = function->function.parameters;
+    if (index < parameters.count) {
+      return parameters.nodes[index]->variable_declaration.type;
+    }
+    return function->function.body->block.nodes.nodes[index - parameters.count]->variable_declaration.type;
+  }
+  return NULL;
+}
+
+// Types written the same way are the same node, so however many times
+// they're written, there's only as many as there are distinct ones
+completion_type test_types_are_interned(void) {
+  parsed_text once;
+  parse_text(&once, RECORD_TYPES RECORD_FUNCTION("f"));
+  parsed_text thrice;
+  parse_text(&thrice, RECORD_TYPES RECORD_FUNCTION("f") RECORD_FUNCTION("g") RECORD_FUNCTION("h"));
+  bool passed = true;
+  passed &= assert(once.ast != NULL && thrice.ast != NULL);
+  if (passed) {
+    node *a = declared_type(once.ast, 0);
+    node *b = declared_type(once.ast, 1);
+    node *c = declared_type(once.ast, 2);
+    node *d = declared_type(once.ast, 3);
+    node *e = declared_type(once.ast, 4);
+    node *g = declared_type(once.ast, 5);
+    passed &= assert(a == c && b == d);
+    passed &= assert(b->pointer.to == a);
+    passed &= assert(a != e && !types_match(a, e));
+    // A typedef name is its own node, but it's still the same type
+    passed &= assert(g != a && types_match(g, a));
+    passed &= assert(type_count(once.cursor.types) == type_count(thrice.cursor.types));
+  }
+  free_parsed(&once);
+  free_parsed(&thrice);
+  return passed ? PASSED : FAILED;
+}
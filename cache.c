@@ -0,0 +1,254 @@
+// Inputs = a source file and its AST, outputs = the same AST next time, without parsing
+#include "cache.h"
+#include "instrument.h"
+#include "c-hashmap/hashmap.h"
+#include "c-tests/test.h"
+#include "c-vector/vec.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char cache_magic[8] = "MCCAST\0";
+
+static const char compiler_version[] = COMPILER_VERSION;
+
+// Where each section starts, from the counts in the header
+typedef struct {
+  size_t nodes;
+  size_t extra;
+  size_t strings;
+  size_t symbols;
+  size_t text;
+  size_t source;
+  size_t total;
+} cache_layout;
+
+static size_t align_to_8(size_t size) {
+  return (size + 7) & ~(size_t)7;
+}
+
+static cache_layout layout_of(const cache_header *header) {
+  cache_layout layout;
+  layout.nodes = align_to_8(sizeof(cache_header));
+  layout.extra = align_to_8(layout.nodes + (size_t)header->node_count * sizeof(flat_node));
+  layout.strings = align_to_8(layout.extra + (size_t)header->extra_count * sizeof(uint32_t));
+  layout.symbols = align_to_8(layout.strings + (size_t)header->string_count * sizeof(cached_text));
+  layout.text = align_to_8(layout.symbols + (size_t)header->symbol_count * sizeof(cached_text));
+  layout.source = align_to_8(layout.text + header->text_size);
+  layout.total = layout.source + header->source_size;
+  return layout;
+}
+
+static void cache_path(char *path, size_t size, const char *directory, uint64_t key) {
+  snprintf(path, size, "%s/%016llx.ast", directory, (unsigned long long)key);
+}
+
+uint64_t cache_key(source_file source) {
+  uint64_t version = hashmap_xxhash3(compiler_version, sizeof(compiler_version) - 1, CACHE_FORMAT_VERSION, 0);
+  return hashmap_xxhash3(source.chars, source.size, version, source.size);
+}
+
+// Zeroes from the end of a `size`-byte section up to the next multiple of 8
+static void write_padding(FILE *file, size_t size) {
+  static const char zeroes[8] = { 0 };
+  fwrite(zeroes, 1, align_to_8(size) - size, file);
+}
+
+// Writes `size` bytes, then pads them out
+static void write_section(FILE *file, const void *data, size_t size) {
+  if (size > 0) {
+    fwrite(data, 1, size, file);
+  }
+  write_padding(file, size);
+}
+
+static void write_texts(FILE *file, const string_slice *slices, uint32_t count, uint32_t *text_offset) {
+  for (uint32_t i = 0; i < count; i++) {
+    cached_text text = { .offset = *text_offset, .length = slices[i].length };
+    fwrite(&text, sizeof(text), 1, file);
+    *text_offset += slices[i].length;
+  }
+}
+
+bool cache_store(const char *directory, source_file source, const flat_ast *ast, const symbol_table *symbols) {
+  TIME_SCOPE("cache store");
+  cache_header header = {
+    .format_version = CACHE_FORMAT_VERSION,
+    .root = ast->root,
+    .key = cache_key(source),
+    .source_size = source.size,
+    .node_count = vector_size((vector *)&ast->nodes),
+    .extra_count = vector_size((vector *)&ast->extra),
+    .string_count = vector_size((vector *)&ast->strings),
+    .symbol_count = symbol_count(symbols),
+    .text_size = 0,
+    .unused = 0,
+  };
+  memcpy(header.magic, cache_magic, sizeof(header.magic));
+
+  uint64_t text_size = 0;
+  for (uint32_t i = 0; i < header.string_count; i++) {
+    text_size += ast->strings[i].length;
+  }
+  for (uint32_t i = 0; i < header.symbol_count; i++) {
+    text_size += symbol_name(symbols, i).length;
+  }
+  if (text_size > UINT32_MAX) {
+    return false;
+  }
+  header.text_size = (uint32_t)text_size;
+
+  // It's written under another name and renamed once it's all there, so
+  // nobody (another thread, another run) ever maps half a file
+  static atomic_uint temporary_count = 0;
+  char path[PATH_MAX];
+  char temporary[PATH_MAX + 32];
+  cache_path(path, sizeof(path), directory, header.key);
+  snprintf(temporary, sizeof(temporary), "%s.%d.%u.tmp", path, (int)getpid(), atomic_fetch_add(&temporary_count, 1));
+  FILE *file = fopen(temporary, "wb");
+  if (file == NULL) {
+    return false;
+  }
+
+  write_section(file, &header, sizeof(header));
+  write_section(file, ast->nodes, (size_t)header.node_count * sizeof(flat_node));
+  write_section(file, ast->extra, (size_t)header.extra_count * sizeof(uint32_t));
+  // cached_text is 8 bytes, so these two never need padding
+  uint32_t text_offset = 0;
+  write_texts(file, ast->strings, header.string_count, &text_offset);
+  for (uint32_t i = 0; i < header.symbol_count; i++) {
+    string_slice name = symbol_name(symbols, i);
+    write_texts(file, &name, 1, &text_offset);
+  }
+  for (uint32_t i = 0; i < header.string_count; i++) {
+    fwrite(ast->strings[i].chars, 1, ast->strings[i].length, file);
+  }
+  for (uint32_t i = 0; i < header.symbol_count; i++) {
+    string_slice name = symbol_name(symbols, i);
+    fwrite(name.chars, 1, name.length, file);
+  }
+  write_padding(file, text_size);
+  if (source.size > 0) {
+    fwrite(source.chars, 1, source.size, file);
+  }
+
+  bool written = ferror(file) == 0;
+  written &= fclose(file) == 0;
+  if (!written || rename(temporary, path) != 0) {
+    remove(temporary);
+    return false;
+  }
+  return true;
+}
+
+// Everything that's read later gets checked against the file's size first,
+// a cache file that's been cut short or is from something else is a miss
+static bool header_is_usable(const cache_header *header, size_t file_size, source_file source, uint64_t key) {
+  if (memcmp(header->magic, cache_magic, sizeof(header->magic)) != 0 ||
+      header->format_version != CACHE_FORMAT_VERSION || header->key != key ||
+      header->source_size != source.size) {
+    return false;
+  }
+  if (header->root != NO_NODE && header->root >= header->node_count) {
+    return false;
+  }
+  return layout_of(header).total == file_size;
+}
+
+// The key is only a hash, two sources can share one
+static bool source_matches(const char *mapping, const cache_layout *layout, source_file source) {
+  return source.size == 0 || memcmp(mapping + layout->source, source.chars, source.size) == 0;
+}
+
+static bool texts_are_usable(const cached_text *texts, uint32_t count, uint32_t text_size) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (texts[i].offset > text_size || texts[i].length > text_size - texts[i].offset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool cache_load(const char *directory, source_file source, cached_ast *cached, symbol_table *symbols) {
+  TIME_SCOPE("cache load");
+  uint64_t key = cache_key(source);
+  char path[PATH_MAX];
+  cache_path(path, sizeof(path), directory, key);
+
+  int file_descriptor = open(path, O_RDONLY);
+  if (file_descriptor < 0) {
+    counter_add(COUNTER_CACHE_MISSES, 1);
+    return false;
+  }
+  struct stat file_stats;
+  if (fstat(file_descriptor, &file_stats) != 0 || (size_t)file_stats.st_size < sizeof(cache_header)) {
+    close(file_descriptor);
+    counter_add(COUNTER_CACHE_MISSES, 1);
+    return false;
+  }
+  size_t size = (size_t)file_stats.st_size;
+  const char *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+  // The mapping stays valid after the file is closed
+  close(file_descriptor);
+  if (mapping == MAP_FAILED) {
+    counter_add(COUNTER_CACHE_MISSES, 1);
+    return false;
+  }
+
+  const cache_header *header = (const cache_header *)mapping;
+  cache_layout layout = layout_of(header);
+  const cached_text *strings = (const cached_text *)(mapping + layout.strings);
+  const cached_text *names = (const cached_text *)(mapping + layout.symbols);
+  if (!header_is_usable(header, size, source, key) ||
+      !texts_are_usable(strings, header->string_count, header->text_size) ||
+      !texts_are_usable(names, header->symbol_count, header->text_size) ||
+      !source_matches(mapping, &layout, source)) {
+    munmap((void *)mapping, size);
+    counter_add(COUNTER_CACHE_MISSES, 1);
+    return false;
+  }
+
+  // Nodes and extra are copied out so they're vectors like any other
+  // flat_ast's, the slices have to be made again since they're pointers
+  const char *text = mapping + layout.text;
+  cached->mapping = mapping;
+  cached->mapped_size = size;
+  cached->ast = (flat_ast){
+    .nodes = vector_create(),
+    .extra = vector_create(),
+    .strings = vector_create(),
+    .root = header->root,
+  };
+  const flat_node *nodes = (const flat_node *)(mapping + layout.nodes);
+  const uint32_t *extra = (const uint32_t *)(mapping + layout.extra);
+  for (uint32_t i = 0; i < header->node_count; i++) {
+    vector_add(&cached->ast.nodes, nodes[i]);
+  }
+  for (uint32_t i = 0; i < header->extra_count; i++) {
+    vector_add(&cached->ast.extra, extra[i]);
+  }
+  for (uint32_t i = 0; i < header->string_count; i++) {
+    string_slice value = { .chars = text + strings[i].offset, .length = strings[i].length };
+    vector_add(&cached->ast.strings, value);
+  }
+  // Interned in order, so every name gets back the id the AST has for it
+  for (uint32_t i = 0; i < header->symbol_count; i++) {
+    string_slice name = { .chars = text + names[i].offset, .length = names[i].length };
+    symbol_id id = intern_symbol(symbols, name);
+    assert(id == i);
+  }
+  counter_add(COUNTER_CACHE_HITS, 1);
+  return true;
+}
+
+void cache_release(cached_ast *cached) {
+  flat_ast_free(&cached->ast);
+  munmap((void *)cached->mapping, cached->mapped_size);
+  cached->mapping = NULL;
+  cached->mapped_size = 0;
+}
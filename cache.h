@@ -0,0 +1,75 @@
+#ifndef cache_h
+#define cache_h
+#include "ast.h"
+#include "source.h"
+#include "symbols.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Parsed ASTs saved to disk, so a file that hasn't changed doesn't get lexed
+// or parsed again. Each file in the cache is named after its key, a hash of
+// the source's bytes and of the compiler that wrote it, so an edited file or
+// a different build just misses. The source is saved too and compared on
+// load, two files whose hashes collide don't get each other's AST.
+//
+// The file is laid out the way a flat_ast is in memory, so loading it is
+// mapping it and copying nodes and extra out into vectors. Strings and
+// symbol names point into the mapping.
+//
+// Typedefs aren't saved, by the time there's a flat_ast they've all been
+// resolved into the tree.
+
+// Bump this when anything below changes shape, or what goes in a flat_node
+// or extra does (3: member gets from `->` say so, 4: the source is saved)
+#define CACHE_FORMAT_VERSION 4
+
+// Which compiler built this one, and which build of it. The build passes
+// -DMCC_BUILD_ID (build.sh uses git describe). Builds without one all look
+// the same, then only the format version keeps old files out.
+#ifndef MCC_BUILD_ID
+#define MCC_BUILD_ID "unknown"
+#endif
+#define COMPILER_VERSION __VERSION__ " " MCC_BUILD_ID
+
+// Every section after it starts 8-byte aligned, in this order:
+//   flat_node nodes[node_count]
+//   uint32_t extra[extra_count]
+//   cached_text strings[string_count]
+//   cached_text symbols[symbol_count] (in symbol_id order)
+//   char text[text_size]              (what strings and symbols point into)
+//   char source[source_size]          (what the key was made from)
+typedef struct {
+  char magic[8];
+  uint32_t format_version;
+  uint32_t root;
+  uint64_t key;
+  uint64_t source_size;
+  uint32_t node_count;
+  uint32_t extra_count;
+  uint32_t string_count;
+  uint32_t symbol_count;
+  uint32_t text_size;
+  uint32_t unused;
+} cache_header;
+
+typedef struct {
+  uint32_t offset; // Into text
+  uint32_t length;
+} cached_text;
+
+// An AST loaded from the cache. Its strings point into the mapping, so it
+// gets let go of with cache_release, not flat_ast_free.
+typedef struct {
+  flat_ast ast;
+  const char *mapping;
+  size_t mapped_size;
+} cached_ast;
+
+uint64_t cache_key(source_file source);
+// Fills `symbols` (which should be empty) with the names the AST uses. Their
+// text is in the mapping, so free the table before releasing the AST.
+bool cache_load(const char *directory, source_file source, cached_ast *cached, symbol_table *symbols);
+bool cache_store(const char *directory, source_file source, const flat_ast *ast, const symbol_table *symbols);
+void cache_release(cached_ast *cached);
+
+#endif
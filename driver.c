@@ -0,0 +1,210 @@
+// Inputs = file paths, outputs = what compiling each one printed, and how it went
+#include "driver.h"
+#include "ast.h"
+#include "cache.h"
+#include "instrument.h"
+#include "memory.h"
+#include "preprocessor.h"
+#include "semantic.h"
+#include <stdlib.h>
+#include <time.h>
+
+static double seconds_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+compile_job job_for_file(const char *path, bool print_ast) {
+  compile_job job = {
+    .path = path,
+    .print_ast = print_ast,
+    .ast_format = DUMP_TEXT,
+    .separate_phases = false,
+    .parse_pool = NULL,
+    .reachable_only = false,
+    .cache_directory = NULL,
+    .include_directories = NULL,
+    .header_image = NULL,
+    .output = NULL,
+    .errors = NULL,
+    .succeeded = false,
+    .error_count = 0,
+    .output_text = NULL,
+    .output_size = 0,
+    .errors_text = NULL,
+    .errors_size = 0,
+    .from_cache = false,
+  };
+  return job;
+}
+
+// Whatever happens to an AST once it's made, wherever it came from
+static void use_ast(compile_job *job, FILE *output, const flat_ast *flat, const symbol_table *symbols) {
+  if (job->print_ast) {
+    phase_id print_phase = phase_begin("print");
+    dump_ast(output, flat, symbols, job->ast_format);
+    phase_end(print_phase);
+  }
+  // Once there's code generation, it goes here
+}
+
+// The source hasn't changed since its AST got saved, so that gets used
+// instead of lexing and parsing it again
+static bool load_cached(compile_job *job, FILE *output, source_file source) {
+  symbol_table symbols = symbol_table_create();
+  cached_ast cached;
+  if (!cache_load(job->cache_directory, source, &cached, &symbols)) {
+    symbol_table_free(&symbols);
+    return false;
+  }
+  use_ast(job, output, &cached.ast, &symbols);
+  // The names are in the mapping, so the table goes first
+  symbol_table_free(&symbols);
+  cache_release(&cached);
+  job->from_cache = true;
+  return true;
+}
+
+void compile_file(compile_job *job) {
+  double start = seconds_now();
+  // Counters and the ledger are per thread, and a thread runs one job at a
+  // time, so the difference is all this job's
+  uint64_t tokens_before = counters[COUNTER_TOKENS];
+  uint64_t nodes_before = counters[COUNTER_NODES];
+  memory_usage memory_before = memory_mark();
+
+  FILE *output = job->output != NULL ? job->output : open_memstream(&job->output_text, &job->output_size);
+  FILE *errors = job->errors != NULL ? job->errors : open_memstream(&job->errors_text, &job->errors_size);
+  phase_id compile_phase = phase_begin("compile");
+  // ASTs with bodies left out aren't the same as what a full parse makes, so they don't get cached.
+  // Neither do ones that start from a header image, the key is just the file's own text.
+  bool caching = job->cache_directory != NULL && !job->reachable_only && job->header_image == NULL;
+
+  // The file is mapped instead of read, so tokens can point straight into it
+  source_file source = source_from_path(job->path);
+  if (source.chars == NULL) {
+    fprintf(errors, "Couldn't find file: %s\n", job->path);
+    job->error_count += 1;
+  } else if (caching && load_cached(job, output, source)) {
+    // Nothing left to do, last time's AST got used
+  } else {
+    // Names get turned into numbers as they're lexed, the table holds their text
+    symbol_table symbols = symbol_table_create();
+    // Every node of the AST comes out of here, and goes away all at once
+    arena nodes = arena_create();
+
+    // Tokens are lexed as the parser asks for them, instead of all up front.
+    // Except when timing, lexing and parsing can't be told apart otherwise.
+    lexer_state lexer_stream = lexer_create(source, &symbols);
+    lexer_stream.errors = errors;
+    token_stream tokens = { 0 };
+    token_cursor cursor;
+    lazy_bodies lazy = { .bodies = NULL };
+    // Files with directives are lexed all at once by the preprocessor, along
+    // with whatever they include, and parsed from what it puts together. So
+    // are files that start from a header image, which the preprocessor starts from.
+    const header_image *image = job->header_image;
+    bool preprocessing = image != NULL || source_has_directives(source);
+    preprocessor preprocessed = { .text = NULL };
+    if (preprocessing) {
+      preprocessed = preprocessor_create(&symbols, errors);
+      preprocessed.include_directories = job->include_directories;
+      if (image != NULL) {
+        header_image_start_unit(image, &symbols, &preprocessed);
+      }
+      preprocess(&preprocessed, source, job->path);
+      job->error_count += preprocessed.error_count;
+    }
+    if (preprocessing || job->separate_phases || job->parse_pool != NULL || job->reachable_only) {
+      if (preprocessing) {
+        cursor = cursor_from_tokens(&preprocessed.tokens, preprocessed_source(&preprocessed), &symbols, &nodes);
+      } else {
+        tokens = lex_all(&lexer_stream);
+        cursor = cursor_from_tokens(&tokens, source, &symbols, &nodes);
+      }
+      cursor.errors = errors;
+      cursor.pool = job->parse_pool;
+      cursor.lazy = job->reachable_only ? &lazy : NULL;
+      // The header's tokens are already parsed, its typedefs and declarations are in the image
+      if (image != NULL) {
+        cursor.position = image->header->token_count;
+        cursor.starting_scope = &image->scope;
+      }
+    } else {
+      cursor = cursor_from_lexer(&lexer_stream, &nodes);
+    }
+    node *ast = parser(&cursor);
+    // Bodies got skipped, now the ones that'll actually get used are parsed
+    if (ast != NULL && cursor.lazy != NULL) {
+      parse_reachable_bodies(&lazy, intern_symbol(&symbols, SLICE("main")));
+    }
+    job->error_count += lexer_stream.error_count + cursor.error_count + lazy.cursor.error_count;
+    // Bodies parsed lazily are in the tree by now, the ones never asked for are just skipped
+    if (ast != NULL) {
+      job->error_count += resolve_members(ast, &symbols, errors);
+    }
+    free_lazy_bodies(&lazy);
+    free_cursor(&cursor);
+    token_stream_free(&tokens);
+
+    // The pointer tree is only for building, what we keep is the packed one
+    if (ast != NULL) {
+      flat_ast flat = image != NULL ? flatten_ast_after(&image->declarations, ast) : flatten_ast(ast);
+      arena_free(&nodes);
+      // Only clean parses get saved, a file with errors should show them every
+      // time. So do files that include something, the key is just their own text.
+      bool self_contained = !preprocessing || vector_size((vector *)&preprocessed.included) == 0;
+      if (caching && job->error_count == 0 && self_contained) {
+        cache_store(job->cache_directory, source, &flat, &symbols);
+      }
+      use_ast(job, output, &flat, &symbols);
+      flat_ast_free(&flat);
+    } else {
+      arena_free(&nodes);
+    }
+    if (preprocessing) {
+      preprocessor_free(&preprocessed);
+    }
+    symbol_table_free(&symbols);
+    source_close(&source);
+  }
+
+  phase_end(compile_phase);
+  if (job->output == NULL) {
+    fclose(output);
+  }
+  if (job->errors == NULL) {
+    fclose(errors);
+  }
+
+  job->succeeded = job->error_count == 0;
+  job->seconds = seconds_now() - start;
+  job->tokens = counters[COUNTER_TOKENS] - tokens_before;
+  job->nodes = counters[COUNTER_NODES] - nodes_before;
+  job->peak_memory = memory_since_mark(memory_before).peak;
+}
+
+static void compile_task(void *argument) {
+  compile_file(argument);
+}
+
+void compile_all(thread_pool *pool, compile_job *jobs, uint32_t job_count) {
+  for (uint32_t i = 0; i < job_count; i++) {
+    pool_submit(pool, compile_task, &jobs[i]);
+  }
+  pool_wait(pool);
+}
+
+void flush_job(compile_job *job, FILE *output, FILE *errors) {
+  if (job->output_text != NULL) {
+    fwrite(job->output_text, 1, job->output_size, output);
+    free(job->output_text);
+    job->output_text = NULL;
+  }
+  if (job->errors_text != NULL) {
+    fwrite(job->errors_text, 1, job->errors_size, errors);
+    free(job->errors_text);
+    job->errors_text = NULL;
+  }
+}
@@ -0,0 +1,49 @@
+#ifndef driver_h
+#define driver_h
+#include "dump.h"
+#include "pool.h"
+#include "precompiled.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// One file's trip through the compiler. Each job has its own source, symbol
+// table, lexer, parser and arena, and everything it prints goes to its own
+// streams, so jobs can run side by side without stepping on each other.
+// Everything a job allocates is freed by the end of it, on the same thread.
+typedef struct {
+  const char *path;
+  bool print_ast;
+  dump_format ast_format; // How it gets printed
+  bool separate_phases; // Lex everything first instead of streaming tokens, so the phases can be timed apart
+  thread_pool *parse_pool; // Function bodies get parsed on this if it isn't NULL (lexes everything first too)
+  bool reachable_only; // Only parse the bodies of functions main can reach, the rest stay empty (lexes everything first too)
+  const char *cache_directory; // ASTs are loaded from and saved to here if it isn't NULL
+  char **include_directories; // Vector (or NULL) of where #include looks
+  const header_image *header_image; // The file starts from this precompiled header if it isn't NULL
+  FILE *output; // Where the AST goes, NULL for a buffer in output_text
+  FILE *errors; // Same for errors and errors_text
+
+  // What came out
+  bool succeeded;
+  uint32_t error_count;
+  char *output_text; // malloc'd, not from the ledger, so any thread can free it
+  size_t output_size;
+  char *errors_text;
+  size_t errors_size;
+  double seconds;
+  uint64_t tokens;
+  uint64_t nodes;
+  size_t peak_memory;
+  bool from_cache; // Nothing got lexed or parsed
+} compile_job;
+
+compile_job job_for_file(const char *path, bool print_ast);
+void compile_file(compile_job *job);
+// Compiles every job on the pool, and returns once they're all done
+void compile_all(thread_pool *pool, compile_job *jobs, uint32_t job_count);
+// Copies out whatever a job printed into buffers, then lets go of them
+void flush_job(compile_job *job, FILE *output, FILE *errors);
+
+#endif
@@ -0,0 +1,435 @@
+// Inputs = a flat AST, outputs = it written out as text, JSON or binary
+#include "dump.h"
+#include "memory.h"
+#include "walk.h"
+#include "c-tests/test.h"
+#include <string.h>
+
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+
+static const char *dump_format_names[] = {
+#define GENERATE_DUMP_FORMAT_NAME(FORMAT, NAME) NAME,
+  ITERATE_DUMP_FORMATS_AND(GENERATE_DUMP_FORMAT_NAME)
+};
+
+// Every node gets its type written, so the lengths are worked out here
+// instead of with strlen each time
+#define GENERATE_SLICE(ENUM) SLICE(#ENUM),
+static const string_slice node_type_names[] = { ITERATE_NODES_AND(GENERATE_SLICE) };
+static const string_slice operator_type_names[] = { ITERATE_OPERATORS_AND(GENERATE_SLICE) };
+
+dump_format dump_format_from_name(const char *name) {
+  for (int format = 0; format < DUMP_FORMAT_COUNT; format++) {
+    if (strcmp(dump_format_names[format], name) == 0) {
+      return format;
+    }
+  }
+  return DUMP_FORMAT_COUNT;
+}
+
+typedef struct {
+  FILE *file;
+  char *chars;
+  size_t used;
+  const symbol_table *symbols;
+  uint32_t *binary_names; // What the binary dump numbers each symbol_id as, NO_SYMBOL if nothing uses it
+} dump_state;
+
+static void flush_output(dump_state *state) {
+  fwrite(state->chars, 1, state->used, state->file);
+  state->used = 0;
+}
+
+// Room for `size` more chars. Nothing written is ever bigger than the
+// buffer, except strings, and those go through write_chars.
+static char *reserve_output(dump_state *state, size_t size) {
+  if (state->used + size > OUTPUT_BUFFER_SIZE) {
+    flush_output(state);
+  }
+  return state->chars + state->used;
+}
+
+static void write_chars(dump_state *state, const char *chars, size_t length) {
+  // Empty strings can come with no chars at all
+  if (length == 0) {
+    return;
+  }
+  if (length > OUTPUT_BUFFER_SIZE / 2) {
+    flush_output(state);
+    fwrite(chars, 1, length, state->file);
+    return;
+  }
+  memcpy(reserve_output(state, length), chars, length);
+  state->used += length;
+}
+
+static void write_slice(dump_state *state, string_slice slice) {
+  write_chars(state, slice.chars, slice.length);
+}
+
+static void write_char(dump_state *state, char c) {
+  *reserve_output(state, 1) = c;
+  state->used += 1;
+}
+
+static void write_int(dump_state *state, int64_t value) {
+  char digits[24];
+  int length = 0;
+  uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+  do {
+    digits[sizeof(digits) - 1 - length++] = '0' + magnitude % 10;
+    magnitude /= 10;
+  } while (magnitude > 0);
+  if (value < 0) {
+    digits[sizeof(digits) - 1 - length++] = '-';
+  }
+  write_chars(state, digits + sizeof(digits) - length, length);
+}
+
+static void write_varint(dump_state *state, uint64_t value) {
+  char *out = reserve_output(state, 10);
+  size_t length = 0;
+  do {
+    uint8_t byte = value & 0x7f;
+    value >>= 7;
+    out[length++] = byte | (value != 0 ? 0x80 : 0);
+  } while (value != 0);
+  state->used += length;
+}
+
+// Past this it's unreadable anyway, and the text would grow with the square
+// of the depth
+#define MAX_INDENTS 256
+
+static void write_indents(dump_state *state, uint32_t depth) {
+  depth = depth < MAX_INDENTS ? depth : MAX_INDENTS;
+  memset(reserve_output(state, depth), '\t', depth);
+  state->used += depth;
+}
+
+static bool has_name(node_type type) {
+  switch (type) {
+  case NODE_VARIABLE:
+  case NODE_BASE_TYPE:
+  case NODE_STRUCTURE:
+  case NODE_VARIABLE_DECLARATION:
+  case NODE_STRUCT_MEMBER_GET:
+  case NODE_FUNCTION_DECLARATION:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Text
+
+static void write_text_line(dump_state *state, uint32_t depth, string_slice text) {
+  write_indents(state, depth);
+  write_slice(state, text);
+  write_char(state, '\n');
+}
+
+static void write_text_name(dump_state *state, uint32_t depth, symbol_id name) {
+  string_slice text = symbol_name(state->symbols, name);
+  write_indents(state, depth);
+  write_chars(state, ": ", 2);
+  write_chars(state, text.chars, text.length);
+  write_char(state, '\n');
+}
+
+// What goes between a parent's line and each of its children, at the
+// parent's depth
+static void write_text_label(dump_state *state, const flat_ast *ast, ast_visit visit) {
+  uint32_t depth = visit.depth - 1;
+  switch (ast_type(ast, visit.parent)) {
+  default:
+    break;
+  case NODE_FUNCTION_CALL:
+    if (visit.position == 0) {
+      write_text_line(state, depth, SLICE("Inputs:"));
+    }
+    if (visit.position == ast_child_count(ast, visit.parent) - 1) {
+      write_text_line(state, depth, SLICE("Body:"));
+    }
+    break;
+  case NODE_WHILE:
+  case NODE_DO_WHILE: {
+    static const string_slice labels[] = { SLICE("Condition:"), SLICE("Body:") };
+    write_text_line(state, depth, labels[visit.position]);
+    break;
+  }
+  case NODE_FOR: {
+    static const string_slice labels[] = { SLICE("Index Declaration:"), SLICE("Condition:"), SLICE("Index Reassignment:"), SLICE("Body:") };
+    write_text_line(state, depth, labels[visit.position]);
+    break;
+  }
+  case NODE_IF: {
+    static const string_slice labels[] = { SLICE("Condition:"), SLICE("Success Path:"), SLICE("Fail Path:") };
+    if (visit.index != NO_NODE || visit.position != CHILD_FAIL) {
+      write_text_line(state, depth, labels[visit.position]);
+    }
+    break;
+  }
+  case NODE_VARIABLE_DECLARATION:
+    if (visit.position == CHILD_TYPE) {
+      write_text_line(state, depth, SLICE("Type:"));
+    } else {
+      write_text_line(state, depth, SLICE("Name:"));
+      write_text_name(state, depth, ast_name(ast, visit.parent));
+    }
+    break;
+  case NODE_FUNCTION_DECLARATION:
+    // With no parameters, the name and the body's label both go before the body
+    if (visit.position == 0) {
+      write_text_line(state, depth, SLICE("Type:"));
+    }
+    if (visit.position == 1) {
+      write_text_line(state, depth, SLICE("Name:"));
+      write_text_name(state, depth, ast_name(ast, visit.parent));
+      write_text_line(state, depth, SLICE("Parameters:"));
+    }
+    if (visit.position == ast_child_count(ast, visit.parent) - 1) {
+      write_text_line(state, depth, SLICE("Body:"));
+    }
+    break;
+  }
+}
+
+static bool enter_text(ast_walker *walker, const flat_ast *ast, ast_visit visit) {
+  dump_state *state = walker->data;
+  if (visit.parent != NO_NODE) {
+    write_text_label(state, ast, visit);
+  }
+  if (visit.index == NO_NODE) {
+    return false;
+  }
+  node_type type = ast_type(ast, visit.index);
+  write_text_line(state, visit.depth, node_type_names[type]);
+  switch (type) {
+  default:
+    break;
+  case NODE_STRING: {
+    string_slice value = ast_string(ast, visit.index);
+    write_indents(state, visit.depth);
+    write_chars(state, ": \"", 3);
+    write_chars(state, value.chars, value.length);
+    write_chars(state, "\"\n", 2);
+    break;
+  }
+  case NODE_NUMBER_LITERAL:
+    write_indents(state, visit.depth);
+    write_chars(state, ": ", 2);
+    write_int(state, ast_number(ast, visit.index));
+    write_char(state, '\n');
+    break;
+  case NODE_VARIABLE:
+  case NODE_BASE_TYPE:
+    write_text_name(state, visit.depth, ast_name(ast, visit.index));
+    break;
+  case NODE_STRUCTURE:
+    if (ast_name(ast, visit.index) != NO_SYMBOL) {
+      write_text_name(state, visit.depth, ast_name(ast, visit.index));
+    }
+    break;
+  case NODE_EQUATION:
+    write_indents(state, visit.depth);
+    write_chars(state, ": ", 2);
+    write_slice(state, operator_type_names[ast_operator(ast, visit.index)]);
+    write_char(state, '\n');
+    break;
+  }
+  return true;
+}
+
+// A member's name comes after what it's gotten from
+static void leave_text(ast_walker *walker, const flat_ast *ast, ast_visit visit) {
+  dump_state *state = walker->data;
+  if (visit.index != NO_NODE && ast_type(ast, visit.index) == NODE_STRUCT_MEMBER_GET) {
+    write_text_name(state, visit.depth, ast_name(ast, visit.index));
+  }
+}
+
+// JSON
+
+static void write_json_string(dump_state *state, const char *chars, size_t length) {
+  static const char hex[] = "0123456789abcdef";
+  write_char(state, '"');
+  size_t plain_start = 0;
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = chars[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    write_chars(state, chars + plain_start, i - plain_start);
+    plain_start = i + 1;
+    if (c == '"' || c == '\\') {
+      char escaped[2] = { '\\', c };
+      write_chars(state, escaped, 2);
+    } else {
+      char escaped[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+      write_chars(state, escaped, 6);
+    }
+  }
+  write_chars(state, chars + plain_start, length - plain_start);
+  write_char(state, '"');
+}
+
+static bool enter_json(ast_walker *walker, const flat_ast *ast, ast_visit visit) {
+  dump_state *state = walker->data;
+  if (visit.parent != NO_NODE && visit.position > 0) {
+    write_char(state, ',');
+  }
+  if (visit.index == NO_NODE) {
+    write_chars(state, "null", 4);
+    return false;
+  }
+  node_type type = ast_type(ast, visit.index);
+  write_chars(state, "{\"type\":\"", 9);
+  write_slice(state, node_type_names[type]);
+  write_char(state, '"');
+  if (has_name(type) && ast_name(ast, visit.index) != NO_SYMBOL) {
+    string_slice name = symbol_name(state->symbols, ast_name(ast, visit.index));
+    write_chars(state, ",\"name\":", 8);
+    write_json_string(state, name.chars, name.length);
+  }
+  switch (type) {
+  default:
+    break;
+  case NODE_NUMBER_LITERAL:
+    write_chars(state, ",\"number\":", 10);
+    write_int(state, ast_number(ast, visit.index));
+    break;
+  case NODE_STRING: {
+    string_slice value = ast_string(ast, visit.index);
+    write_chars(state, ",\"string\":", 10);
+    write_json_string(state, value.chars, value.length);
+    break;
+  }
+  case NODE_EQUATION:
+    write_chars(state, ",\"operator\":\"", 13);
+    write_slice(state, operator_type_names[ast_operator(ast, visit.index)]);
+    write_char(state, '"');
+    break;
+  }
+  if (visit.child_count > 0) {
+    write_chars(state, ",\"children\":[", 13);
+  }
+  return true;
+}
+
+static void leave_json(ast_walker *walker, const flat_ast *ast, ast_visit visit) {
+  (void)ast;
+  dump_state *state = walker->data;
+  if (visit.index == NO_NODE) {
+    return;
+  }
+  if (visit.child_count > 0) {
+    write_char(state, ']');
+  }
+  write_char(state, '}');
+}
+
+// Binary
+
+#define BINARY_MISSING 0xff
+
+static bool enter_binary(ast_walker *walker, const flat_ast *ast, ast_visit visit) {
+  dump_state *state = walker->data;
+  if (visit.index == NO_NODE) {
+    write_char(state, (char)BINARY_MISSING);
+    return false;
+  }
+  node_type type = ast_type(ast, visit.index);
+  write_char(state, (char)type);
+  if (has_name(type)) {
+    symbol_id name = ast_name(ast, visit.index);
+    write_varint(state, name != NO_SYMBOL ? state->binary_names[name] : NO_SYMBOL);
+  }
+  switch (type) {
+  default:
+    break;
+  case NODE_NUMBER_LITERAL: {
+    int64_t value = ast_number(ast, visit.index);
+    write_varint(state, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+    break;
+  }
+  case NODE_STRING: {
+    string_slice value = ast_string(ast, visit.index);
+    write_varint(state, value.length);
+    write_chars(state, value.chars, value.length);
+    break;
+  }
+  case NODE_EQUATION:
+    write_char(state, (char)ast_operator(ast, visit.index));
+    break;
+  }
+  write_varint(state, visit.child_count);
+  return true;
+}
+
+// Symbol ids depend on what order things got interned in, which isn't the
+// same with every flag (lexing everything first interns in source order,
+// the parser asks for the builtins first). So the binary dump numbers only
+// the names the tree uses, by the first node that uses each, and the same
+// tree always comes out the same.
+static void write_binary_header(dump_state *state, const flat_ast *ast) {
+  write_chars(state, "MCCAST1\n", 8);
+  uint32_t count = symbol_count(state->symbols);
+  state->binary_names = memory_allocate(sizeof(uint32_t) * (count + 1));
+  symbol_id *used = memory_allocate(sizeof(symbol_id) * (count + 1));
+  assert(state->binary_names != NULL && used != NULL);
+  memset(state->binary_names, 0xff, sizeof(uint32_t) * count);
+  uint32_t used_count = 0;
+  uint32_t node_count = vector_size((vector *)&ast->nodes);
+  for (node_index i = 0; i < node_count; i++) {
+    symbol_id name = has_name(ast_type(ast, i)) ? ast_name(ast, i) : NO_SYMBOL;
+    if (name != NO_SYMBOL && state->binary_names[name] == NO_SYMBOL) {
+      state->binary_names[name] = used_count;
+      used[used_count++] = name;
+    }
+  }
+  write_varint(state, used_count);
+  for (uint32_t i = 0; i < used_count; i++) {
+    string_slice name = symbol_name(state->symbols, used[i]);
+    write_varint(state, name.length);
+    write_chars(state, name.chars, name.length);
+  }
+  memory_free(used);
+}
+
+void dump_ast(FILE *out, const flat_ast *ast, const symbol_table *symbols, dump_format format) {
+  assert(format < DUMP_FORMAT_COUNT);
+  dump_state state = {
+    .file = out,
+    .chars = memory_allocate(OUTPUT_BUFFER_SIZE),
+    .used = 0,
+    .symbols = symbols,
+    .binary_names = NULL,
+  };
+  assert(state.chars != NULL);
+  ast_walker walker = { .enter = NULL, .leave = NULL, .visit_missing = true, .data = &state };
+  switch (format) {
+  case DUMP_TEXT:
+    walker.enter = enter_text;
+    walker.leave = leave_text;
+    break;
+  case DUMP_JSON:
+    walker.enter = enter_json;
+    walker.leave = leave_json;
+    break;
+  default:
+    walker.enter = enter_binary;
+    write_binary_header(&state, ast);
+    break;
+  }
+  walk_ast(ast, ast->root, &walker);
+  if (format == DUMP_JSON) {
+    write_chars(&state, ast->root == NO_NODE ? "null\n" : "\n", ast->root == NO_NODE ? 5 : 1);
+  }
+  if (format == DUMP_BINARY && ast->root == NO_NODE) {
+    write_char(&state, (char)BINARY_MISSING);
+  }
+  flush_output(&state);
+  memory_free(state.chars);
+  memory_free(state.binary_names);
+}
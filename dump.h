@@ -0,0 +1,39 @@
+#ifndef dump_h
+#define dump_h
+#include "ast.h"
+#include "symbols.h"
+#include <stdio.h>
+
+// Writing a flat AST out. Everything goes into one big buffer that's only
+// handed to the FILE when it fills up, so a dump is a few large writes
+// instead of a few small ones per node. The walk is walk_ast's, so a deep
+// tree dumps as well as a wide one.
+//
+//   text    The indented tree main has always printed
+//   json    One object per node: "type", then "name", "number", "string" or
+//           "operator" if it has one, then "children" if it has any, with
+//           null for ones that aren't there
+//   binary  Varints (7 bits a byte, low bits first):
+//             "MCCAST1\n"
+//             symbol count, then each name as its length and bytes (only
+//             the names the tree uses, numbered in the order the node
+//             array first uses them, so flags don't change the numbers)
+//             the nodes in walk order, each one being
+//               type (a byte), what the node holds, child count, children
+//             where what it holds is a symbol id for names, a zigzagged
+//             number, a string's length and bytes, or an operator byte.
+//             A child that isn't there is just the byte 0xff.
+
+#define ITERATE_DUMP_FORMATS_AND(X)                                            \
+  X(DUMP_TEXT, "text")                                                         \
+  X(DUMP_JSON, "json")                                                         \
+  X(DUMP_BINARY, "binary")
+
+#define GENERATE_DUMP_FORMAT_ENUM(FORMAT, NAME) FORMAT,
+typedef enum { ITERATE_DUMP_FORMATS_AND(GENERATE_DUMP_FORMAT_ENUM) DUMP_FORMAT_COUNT } dump_format;
+
+// DUMP_FORMAT_COUNT if there's no format by that name
+dump_format dump_format_from_name(const char *name);
+void dump_ast(FILE *out, const flat_ast *ast, const symbol_table *symbols, dump_format format);
+
+#endif
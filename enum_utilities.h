@@ -7,6 +7,9 @@
 // Macro for generating string representations
 #define GENERATE_STRING(STRING) #STRING,
 
+// Macro for counting enum values, `(0 ITERATE_..._AND(GENERATE_COUNT))`
+#define GENERATE_COUNT(ENUM) +1
+
 // Generic function that gets a string value from enum value
 const char *enum_to_string(int enum_value, const char *enum_strings[]);
 
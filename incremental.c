@@ -0,0 +1,396 @@
+// Inputs = a file and edits to it, outputs = its tree, kept up to date a statement at a time
+#include "incremental.h"
+#include "instrument.h"
+#include "memory.h"
+#include "semantic.h"
+#include "c-tests/test.h"
+#include "c-vector/vec.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Zeroes kept after the text. The lexer reads whole aligned blocks, which can
+// go up to a block past the end.
+#define TEXT_PADDING 64
+#define TEXT_ALIGNMENT 32
+
+static void reserve_text(incremental_file *file, uint32_t size) {
+  if (size <= file->capacity && file->allocation != NULL) {
+    return;
+  }
+  uint32_t capacity = file->capacity * 2 > size ? file->capacity * 2 : size;
+  char *allocation = memory_allocate(capacity + TEXT_ALIGNMENT + TEXT_PADDING);
+  assert(allocation != NULL);
+  // Aligned, so the lexer's blocks never start before the text either
+  char *text = (char *)(((uintptr_t)allocation + TEXT_ALIGNMENT - 1) & ~(uintptr_t)(TEXT_ALIGNMENT - 1));
+  if (file->allocation != NULL) {
+    memcpy(text, file->text, file->size);
+    memory_free(file->allocation);
+  }
+  file->allocation = allocation;
+  file->text = text;
+  file->capacity = capacity;
+}
+
+static source_file text_as_source(const incremental_file *file) {
+  source_file source = { .chars = file->text, .size = file->size, .mapped_size = 0 };
+  return source;
+}
+
+static uint32_t item_offset(const incremental_file *file, uint32_t item) {
+  return file->tokens.offsets[file->items[item].start];
+}
+
+// Parses top-level statements until the token at `stop` (or wherever the top
+// level ends first). Typedefs go in `context`, unless they aren't allowed, then
+// it stops and gives back false.
+static bool parse_items(scope_context *context, token_cursor *cursor, uint32_t stop, bool allow_typedefs, top_level_item **items) {
+  token current_token = peek_token(cursor);
+  while (cursor->position < stop && current_token.type != TOKEN_END && current_token.type != TOKEN_RIGHT_BRACE) {
+    top_level_item item = {
+      .start = cursor->position,
+      .statement = NULL,
+      // A context with a parent only ever sees that many of the parent's
+      .visible_bindings = context->parent != NULL ? context->parent_bindings : vector_size((vector *)&context->bindings),
+      .error_count = 0,
+      .broken = false,
+    };
+    uint32_t errors_before = cursor->error_count;
+    if (current_token.type == TOKEN_TYPEDEF) {
+      if (!allow_typedefs) {
+        return false;
+      }
+      parse_typedef(context, cursor);
+    } else {
+      item.statement = parse_statement(context, cursor);
+    }
+    item.error_count = cursor->error_count - errors_before;
+    vector_add(items, item);
+    current_token = peek_token(cursor);
+  }
+  return true;
+}
+
+// Parses the statements in [cursor's position, stop) again. False if they
+// don't end right at `stop`, or the parser had to bail.
+static bool reparse_items(scope_context *context, token_cursor *cursor, uint32_t stop, top_level_item **items) {
+  jmp_buf bail;
+  cursor->bail = &bail;
+  if (setjmp(bail) != 0) {
+    return false;
+  }
+  return parse_items(context, cursor, stop, false, items) && cursor->position == stop;
+}
+
+// Whether a statement, by how it starts, could change how the ones after it read
+static bool has_typedef(const token_stream *tokens, uint32_t start, uint32_t end) {
+  for (uint32_t i = start; i < end; i++) {
+    if (tokens->types[i] == TOKEN_TYPEDEF) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool has_broken_items(const incremental_file *file) {
+  for (uint32_t i = 0; i < vector_size((vector *)&file->items); i++) {
+    if (file->items[i].broken) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// A new block with every statement in it. The statements themselves aren't
+// touched, just the list.
+static void build_root(incremental_file *file, token_cursor *cursor) {
+  node *root = create_node(NODE_BLOCK, cursor);
+  uint32_t statements = start_list(cursor);
+  for (uint32_t i = 0; i < vector_size((vector *)&file->items); i++) {
+    if (file->items[i].statement != NULL) {
+      push_to_list(file->items[i].statement, cursor);
+    }
+  }
+  root->block.nodes = finish_list(statements, cursor);
+  file->root = root;
+}
+
+// Everything but the text and the names starts over
+static void parse_everything(incremental_file *file) {
+  token_stream_free(&file->tokens);
+  arena_free(&file->nodes);
+  file->nodes = arena_create();
+  file->types = type_table_create(&file->nodes, NULL);
+  if (file->top_level.visible != NULL) {
+    free_scope_context(&file->top_level);
+  }
+  vector_free((vector *)&file->items);
+  file->items = vector_create();
+
+  source_file source = text_as_source(file);
+  lexer_state lexer = lexer_create(source, &file->symbols);
+  lexer.errors = file->errors;
+  file->tokens = lex_all(&lexer);
+  file->lexer_error_count = lexer.error_count;
+
+  file->top_level = create_scope_context();
+  add_builtin_types(&file->top_level, &file->symbols);
+  enter_scope(&file->top_level);
+
+  token_cursor cursor = cursor_from_tokens(&file->tokens, source, &file->symbols, &file->nodes);
+  cursor.errors = file->errors;
+  cursor.copy_strings = true;
+  cursor.types = file->types;
+  jmp_buf bail;
+  cursor.bail = &bail;
+  file->root = NULL;
+  if (setjmp(bail) == 0) {
+    parse_items(&file->top_level, &cursor, UINT32_MAX, true, &file->items);
+    file->end = cursor.position;
+    build_root(file, &cursor);
+  }
+  file->error_count = file->lexer_error_count + cursor.error_count;
+  free_cursor(&cursor);
+
+  file->live_bytes = file->nodes.bytes_used;
+  file->relexed_tokens = file->tokens.count;
+  file->reparsed_items = vector_size((vector *)&file->items);
+  file->reparsed_everything = true;
+}
+
+void incremental_open(incremental_file *file, const char *text, uint32_t size, FILE *errors) {
+  *file = (incremental_file){
+    .text = NULL,
+    .allocation = NULL,
+    .size = 0,
+    .capacity = 0,
+    .symbols = symbol_table_create(),
+    .names = arena_create(),
+    .tokens = { .offsets = NULL, .lengths = NULL, .types = NULL, .count = 0, .capacity = 0 },
+    .nodes = arena_create(),
+    .top_level = { .visible = NULL },
+    .items = vector_create(),
+    .root = NULL,
+    .errors = errors,
+  };
+  file->symbols.name_storage = &file->names;
+  reserve_text(file, size);
+  memcpy(file->text, text, size);
+  file->size = size;
+  memset(file->text + size, 0, TEXT_PADDING);
+  parse_everything(file);
+}
+
+void incremental_close(incremental_file *file) {
+  token_stream_free(&file->tokens);
+  arena_free(&file->nodes);
+  if (file->top_level.visible != NULL) {
+    free_scope_context(&file->top_level);
+  }
+  vector_free((vector *)&file->items);
+  symbol_table_free(&file->symbols);
+  arena_free(&file->names);
+  memory_free(file->allocation);
+  file->allocation = NULL;
+  file->text = NULL;
+  file->root = NULL;
+}
+
+// Last item that starts before `offset`, or the first one if none do
+static uint32_t item_before(const incremental_file *file, uint32_t offset) {
+  uint32_t low = 0;
+  uint32_t high = vector_size((vector *)&file->items);
+  while (high - low > 1) {
+    uint32_t middle = low + (high - low) / 2;
+    if (item_offset(file, middle) < offset) {
+      low = middle;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+// First item after `from` that starts past `offset`, or the item count if none do
+static uint32_t item_after(const incremental_file *file, uint32_t from, uint32_t offset) {
+  uint32_t low = from + 1;
+  uint32_t high = vector_size((vector *)&file->items);
+  while (low < high) {
+    uint32_t middle = low + (high - low) / 2;
+    if (item_offset(file, middle) <= offset) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+static void apply_to_text(incremental_file *file, text_edit edit) {
+  uint32_t size = file->size - (edit.end - edit.start) + edit.length;
+  reserve_text(file, size);
+  memmove(file->text + edit.start + edit.length, file->text + edit.end, file->size - edit.end);
+  memcpy(file->text + edit.start, edit.text, edit.length);
+  file->size = size;
+  memset(file->text + size, 0, TEXT_PADDING);
+}
+
+void incremental_edit(incremental_file *file, text_edit edit) {
+  assert(edit.start <= edit.end && edit.end <= file->size);
+  int64_t delta = (int64_t)edit.length - (edit.end - edit.start);
+  uint32_t item_count = vector_size((vector *)&file->items);
+  file->relexed_tokens = 0;
+  file->reparsed_items = 0;
+  file->reparsed_everything = false;
+
+  bool can_patch = file->root != NULL && file->lexer_error_count == 0 &&
+                   file->end == file->tokens.count - 1 && item_count > 0;
+  // The statements the edit lands in, going by where they were before it.
+  // An edit right at the start of one could stick onto the end of the one
+  // before, so that one counts too. So do broken ones right before it, the
+  // edit could be what finishes them.
+  uint32_t first = can_patch ? item_before(file, edit.start) : 0;
+  uint32_t next = can_patch ? item_after(file, first, edit.end) : 0;
+  while (can_patch && first > 0 && file->items[first - 1].broken) {
+    first -= 1;
+  }
+  for (uint32_t i = first; can_patch && i < next; i++) {
+    can_patch = file->items[i].statement != NULL || file->items[i].broken;
+  }
+  uint32_t relex_from = can_patch && item_offset(file, first) < edit.start ? item_offset(file, first) : edit.start;
+
+  apply_to_text(file, edit);
+  if (!can_patch) {
+    parse_everything(file);
+    return;
+  }
+
+  // Errors from here only get shown if the patch works out, otherwise the
+  // full parse shows them
+  char *error_text = NULL;
+  size_t error_size = 0;
+  FILE *errors = open_memstream(&error_text, &error_size);
+
+  // Lex until a token starts right where an untouched statement does now.
+  // Going past one means the edit reached into it (like opening a comment).
+  // Broken ones right after get lexed again too, like the ones before.
+  source_file source = text_as_source(file);
+  lexer_state lexer = lexer_create(source, &file->symbols);
+  lexer.errors = errors;
+  lexer.current = file->text + relex_from;
+  token_stream fresh = { .offsets = NULL, .lengths = NULL, .types = NULL, .count = 0, .capacity = 0 };
+  while (true) {
+    token current_token = lexer_next(&lexer);
+    while (next < item_count && (current_token.offset > item_offset(file, next) + delta ||
+                                 (current_token.offset == item_offset(file, next) + delta && file->items[next].broken))) {
+      can_patch &= file->items[next].statement != NULL || file->items[next].broken;
+      next += 1;
+    }
+    if (next < item_count && current_token.offset == item_offset(file, next) + delta) {
+      break;
+    }
+    if (current_token.type == TOKEN_END) {
+      break;
+    }
+    token_stream_push(&fresh, current_token);
+  }
+
+  // Swap the tokens in, everything after them is where it was plus the edit
+  uint32_t replace_from = file->items[first].start;
+  uint32_t replace_to = next < item_count ? file->items[next].start : file->end;
+  int64_t token_delta = (int64_t)fresh.count - (replace_to - replace_from);
+  uint32_t stop = replace_from + fresh.count;
+  token_stream_splice(&file->tokens, replace_from, replace_to, &fresh);
+  token_stream_shift(&file->tokens, stop, delta);
+  // Untouched statements have all their braces paired inside them, so only
+  // the new tokens need it. If they don't pair up among themselves, the new
+  // statements won't parse on their own and end up broken (see below).
+  token_stream_pair_braces_between(&file->tokens, replace_from, stop);
+  file->end += token_delta;
+  file->relexed_tokens = fresh.count;
+  token_stream_free(&fresh);
+
+  // The new statements see the same top-level types the old ones did
+  scope_context context = create_scope_context();
+  context.parent = &file->top_level;
+  context.parent_bindings = file->items[first].visible_bindings;
+  enter_scope(&context);
+  token_cursor cursor = cursor_from_tokens(&file->tokens, source, &file->symbols, &file->nodes);
+  cursor.errors = errors;
+  cursor.copy_strings = true;
+  cursor.types = file->types;
+  cursor.position = replace_from;
+  // The untouched statements start at `stop`, so it's the end of the file
+  // as far as the new ones know. One with a '{' that doesn't close runs
+  // into that, not into the statements after it.
+  uint8_t stop_type = file->tokens.types[stop];
+  file->tokens.types[stop] = TOKEN_END;
+  top_level_item *items = vector_create();
+  bool reparsed = can_patch && reparse_items(&context, &cursor, stop, &items);
+  file->tokens.types[stop] = stop_type;
+  // If they don't parse, everything from `first` to `next` becomes one broken
+  // statement, and the rest of the file keeps its tree. Unless there's a
+  // typedef in there, that could change how the rest reads.
+  if (can_patch && !reparsed && !has_typedef(&file->tokens, replace_from, stop)) {
+    if (cursor.error_count == 0) {
+      // The only way to stop early without an error is a '}' at the top level
+      fprintf(errors, "Error: '}' doesn't close anything\n");
+      cursor.error_count += 1;
+    }
+    while (vector_size((vector *)&items) > 0) {
+      vector_remove(&items, vector_size((vector *)&items) - 1);
+    }
+    top_level_item broken = {
+      .start = replace_from,
+      .statement = NULL,
+      .visible_bindings = file->items[first].visible_bindings,
+      .error_count = cursor.error_count,
+      .broken = true,
+    };
+    vector_add(&items, broken);
+    reparsed = true;
+  }
+  can_patch = reparsed;
+  uint32_t fresh_count = vector_size((vector *)&items);
+  can_patch &= fresh_count > 0 || lexer.error_count == 0;
+  free_scope_context(&context);
+  fclose(errors);
+
+  if (can_patch) {
+    fwrite(error_text, 1, error_size, file->errors);
+    // Lexing errors go with the first statement, they're somewhere in the same stretch
+    if (fresh_count > 0) {
+      items[0].error_count += lexer.error_count;
+    }
+    for (uint32_t i = first; i < next; i++) {
+      file->error_count -= file->items[i].error_count;
+    }
+    for (uint32_t i = next; i < item_count; i++) {
+      file->items[i].start += token_delta;
+      vector_add(&items, file->items[i]);
+    }
+    for (uint32_t i = 0; i < fresh_count; i++) {
+      file->error_count += items[i].error_count;
+    }
+    // The list is small next to the tokens, so everything from `first` on is just put back
+    while (vector_size((vector *)&file->items) > first) {
+      vector_remove(&file->items, vector_size((vector *)&file->items) - 1);
+    }
+    for (uint32_t i = 0; i < vector_size((vector *)&items); i++) {
+      vector_add(&file->items, items[i]);
+    }
+    build_root(file, &cursor);
+    file->reparsed_items = fresh_count;
+  }
+  vector_free((vector *)&items);
+  free_cursor(&cursor);
+  free(error_text);
+
+  // Once the statements that got replaced outweigh the live ones 4 times
+  // over, it's time to start over instead of keeping them around. Waiting
+  // that long means fewer edits pay for a full parse, and up to 5 times the
+  // live nodes' memory. Not while something's broken though, a full parse
+  // would stop at it and lose the whole tree.
+  if (!can_patch || (file->nodes.bytes_used > file->live_bytes * 4 + ARENA_BLOCK_SIZE && !has_broken_items(file))) {
+    parse_everything(file);
+  }
+}
@@ -0,0 +1,96 @@
+#ifndef incremental_h
+#define incremental_h
+#include "arena.h"
+#include "lexer.h"
+#include "parser.h"
+#include "symbols.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// A file that stays parsed while it's being edited, for tools that want a
+// fresh tree after every keystroke. An edit gets re-lexed from the start of
+// the top-level statement it lands in, until the new tokens line up with the
+// old ones again. Only the top-level statements in between get parsed again,
+// every other statement keeps the subtree it had. So an edit costs about
+// what parsing the statement it's in costs, a big function is slower to edit
+// than a small one.
+//
+// The statements in between get parsed as if the file ended where the
+// untouched ones start. If they don't parse like that (say a '}' got
+// deleted), they become one broken statement: it's left out of the tree and
+// counts its errors, and everything around it keeps its tree. The next edit
+// in or next to it tries again, so putting the '}' back fixes it without
+// touching the rest of the file either. While something's broken the tree
+// isn't what a fresh parse would give, that one stops at the first error
+// and has no tree at all.
+//
+// Edits that could change how the rest of the file parses make the whole
+// file get parsed again instead:
+//   - a top-level typedef was in the damaged part (later statements might
+//     read names differently), or is in it now
+//   - an error the lexer couldn't get past that left no statements
+//   - the last full parse had lexing errors, stopped at a stray '}', or
+//     stopped at an error (then there's no tree to keep)
+//   - the statements that got replaced left 4 times as many nodes behind in
+//     `nodes` as there are live ones, then the full parse is what clears
+//     them out (only once nothing is broken)
+//
+// The goal was every edit under 1 ms, and that's not met for every edit.
+// On benchmarks/incremental (top-level statements of about 2700 tokens) the
+// median edit is about 0.3 ms and the p99 is right around it (0.5 to 1.1 ms
+// from run to run), deleting a '}' included. But about 1 edit in 350 is the one that clears out old nodes,
+// and that's a full parse (about 20 ms there). An edit in one huge function
+// also costs as much as parsing that function, since statements inside a
+// function body don't get reparsed on their own.
+
+// One top-level statement, and the tokens it came from
+typedef struct {
+  uint32_t start; // First token, it goes up to where the next one starts
+  node *statement; // NULL for typedefs and broken statements
+  uint32_t visible_bindings; // How many top-level bindings there were before it
+  uint32_t error_count;
+  bool broken; // Didn't parse on its own, it's not in the tree till an edit fixes it
+} top_level_item;
+
+// Bytes [start, end) of the text get replaced by `length` bytes of `text`
+typedef struct {
+  uint32_t start;
+  uint32_t end;
+  const char *text;
+  uint32_t length;
+} text_edit;
+
+// Everything in here points at everything else, so it's made in place with
+// incremental_open instead of handed back
+typedef struct {
+  char *text; // Ours, with zeroes after it since the lexer reads ahead
+  char *allocation; // Where text is in
+  uint32_t size;
+  uint32_t capacity;
+
+  symbol_table symbols; // Names get copied into `names`, the text moves around under them
+  arena names;
+  token_stream tokens;
+  arena nodes; // Old statements stay in here till the next full parse, that's when it gets emptied
+  size_t live_bytes; // How big `nodes` was right after the last full parse
+  struct type_table *types; // In `nodes`, so it's made again with it, reparsed statements share it
+  scope_context top_level; // The builtins and top-level typedefs
+  top_level_item *items; // Vector, in order
+  uint32_t end; // The token the top level stopped at
+  node *root; // NODE_BLOCK with every statement in it, NULL if the last full parse failed
+  FILE *errors;
+  uint32_t lexer_error_count; // From the last full parse
+  uint32_t error_count; // For the whole file as it is now
+
+  // What the last edit took
+  uint32_t relexed_tokens;
+  uint32_t reparsed_items;
+  bool reparsed_everything;
+} incremental_file;
+
+void incremental_open(incremental_file *file, const char *text, uint32_t size, FILE *errors);
+void incremental_edit(incremental_file *file, text_edit edit);
+void incremental_close(incremental_file *file);
+
+#endif
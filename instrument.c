@@ -0,0 +1,241 @@
+// Inputs = phases starting and ending, outputs = where the time went
+#include "instrument.h"
+#include "c-tests/test.h"
+#include "c-vector/vec.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+_Thread_local uint64_t counters[COUNTER_COUNT] = { 0 };
+verbosity_level verbosity = VERBOSITY_QUIET;
+
+const char *counter_strings[] = { ITERATE_COUNTERS_AND(GENERATE_STRING) };
+
+static _Thread_local struct {
+  bool enabled;
+  double start;
+  uint32_t depth;
+  uint32_t thread;
+  phase_event *events; // Vector, in the order phases started
+} timeline = { .enabled = false, .start = 0, .depth = 0, .thread = 0, .events = NULL };
+
+// Set by instrument_enable, threads that start after it time themselves from
+// the same start
+static atomic_bool timing_everywhere = false;
+static double everywhere_start = 0;
+
+// What threads that have exited left behind. Plain malloc, the ledger is per
+// thread and these are filled by one and read by another.
+static struct {
+  pthread_mutex_t lock;
+  phase_event *events;
+  uint32_t count;
+  uint32_t capacity;
+  uint64_t counters[COUNTER_COUNT];
+} finished = { .lock = PTHREAD_MUTEX_INITIALIZER, .events = NULL, .count = 0, .capacity = 0 };
+
+static double seconds_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static uint32_t thread_id(void) {
+  return (uint32_t)syscall(SYS_gettid);
+}
+
+static void start_timeline(double start) {
+  timeline.enabled = true;
+  timeline.start = start;
+  timeline.depth = 0;
+  timeline.thread = thread_id();
+  timeline.events = vector_create();
+}
+
+void instrument_enable(void) {
+  if (timeline.enabled) {
+    return;
+  }
+  start_timeline(seconds_now());
+  everywhere_start = timeline.start;
+  atomic_store(&timing_everywhere, true);
+}
+
+void instrument_free(void) {
+  if (timeline.events != NULL) {
+    vector_free((vector *)&timeline.events);
+    timeline.events = NULL;
+  }
+  timeline.enabled = false;
+  atomic_store(&timing_everywhere, false);
+  pthread_mutex_lock(&finished.lock);
+  free(finished.events);
+  finished.events = NULL;
+  finished.count = 0;
+  finished.capacity = 0;
+  memset(finished.counters, 0, sizeof(finished.counters));
+  pthread_mutex_unlock(&finished.lock);
+}
+
+void instrument_thread_begin(void) {
+  if (atomic_load(&timing_everywhere) && !timeline.enabled) {
+    start_timeline(everywhere_start);
+  }
+}
+
+void instrument_thread_end(void) {
+  if (!timeline.enabled) {
+    return;
+  }
+  uint32_t event_count = vector_size((vector *)&timeline.events);
+  pthread_mutex_lock(&finished.lock);
+  if (finished.count + event_count > finished.capacity) {
+    finished.capacity = (finished.count + event_count) * 2;
+    finished.events = realloc(finished.events, sizeof(phase_event) * finished.capacity);
+    assert(finished.events != NULL);
+  }
+  if (event_count > 0) {
+    memcpy(finished.events + finished.count, timeline.events, sizeof(phase_event) * event_count);
+  }
+  finished.count += event_count;
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    finished.counters[i] += counters[i];
+  }
+  pthread_mutex_unlock(&finished.lock);
+  vector_free((vector *)&timeline.events);
+  timeline.events = NULL;
+  timeline.enabled = false;
+}
+
+phase_id phase_begin(const char *name) {
+  if (!timeline.enabled) {
+    return NO_PHASE;
+  }
+  phase_event event = {
+    .name = name,
+    .start = seconds_now() - timeline.start,
+    .duration = 0,
+    .depth = timeline.depth,
+    .at_start = memory_mark(),
+    .thread = timeline.thread,
+  };
+  timeline.depth += 1;
+  vector_add(&timeline.events, event);
+  return vector_size((vector *)&timeline.events) - 1;
+}
+
+void phase_end(phase_id phase) {
+  if (phase == NO_PHASE || !timeline.enabled) {
+    return;
+  }
+  phase_event *event = &timeline.events[phase];
+  event->duration = seconds_now() - timeline.start - event->start;
+  event->memory = memory_since_mark(event->at_start);
+  assert(timeline.depth > 0);
+  timeline.depth -= 1;
+}
+
+const phase_event *find_phase(const char *name) {
+  uint32_t event_count = timeline.events != NULL ? vector_size((vector *)&timeline.events) : 0;
+  for (uint32_t i = event_count; i > 0; i--) {
+    phase_event *event = &timeline.events[i - 1];
+    if (strcmp(event->name, name) == 0) {
+      return event;
+    }
+  }
+  return NULL;
+}
+
+// Phases indented under whatever they were inside of, then the counters
+void print_time_report(FILE *file) {
+  double total = 0;
+  uint32_t event_count = timeline.events != NULL ? vector_size((vector *)&timeline.events) : 0;
+  for (uint32_t i = 0; i < event_count; i++) {
+    if (timeline.events[i].depth == 0) {
+      total += timeline.events[i].duration;
+    }
+  }
+
+  fprintf(file, "===== Time report =====\n");
+  fprintf(file, "%-28s %13s %7s %12s %12s %12s %12s\n", "phase", "time", "", "peak KB",
+          "live KB", "allocated KB", "allocations");
+  for (uint32_t i = 0; i < event_count; i++) {
+    phase_event *event = &timeline.events[i];
+    int indent = event->depth * 2;
+    fprintf(file, "%*s%-*s %10.3f ms %6.1f%% %12zu %12zu %12zu %12llu\n", indent, "", 28 - indent,
+            event->name, event->duration * 1e3, total > 0 ? event->duration / total * 100 : 0,
+            event->memory.peak / 1024, event->memory.current / 1024, event->memory.allocated / 1024,
+            (unsigned long long)event->memory.allocations);
+  }
+  fprintf(file, "%-28s %10.3f ms %7s %12zu %12zu %12zu %12llu\n", "total", total * 1e3, "",
+          memory_total.peak / 1024, memory_total.current / 1024, memory_total.allocated / 1024,
+          (unsigned long long)memory_total.allocations);
+
+  fprintf(file, "===== Counters =====\n");
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    // "COUNTER_" isn't worth printing
+    fprintf(file, "%-28s %14llu\n", enum_to_string(i, counter_strings) + 8,
+            (unsigned long long)counters[i]);
+  }
+}
+
+static void write_trace_event(FILE *file, const phase_event *event, bool own_thread) {
+  fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u},\n", event->name,
+          event->start * 1e6, event->duration * 1e6, (int)getpid(), event->thread);
+  // Each thread has its own ledger, so each gets its own memory counter
+  char counter_name[48];
+  if (own_thread) {
+    snprintf(counter_name, sizeof(counter_name), "memory");
+  } else {
+    snprintf(counter_name, sizeof(counter_name), "memory, thread %u", event->thread);
+  }
+  fprintf(file, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"args\":{\"live\":%zu}},\n",
+          counter_name, event->start * 1e6, (int)getpid(), event->at_start.current);
+  fprintf(file, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"args\":{\"live\":%zu}},\n",
+          counter_name, (event->start + event->duration) * 1e6, (int)getpid(), event->memory.current);
+}
+
+// Phases are complete events, on the thread that ran them. Live memory is a
+// counter per thread that changes at every phase boundary, the other
+// counters are every thread's added up, one event at the end.
+bool write_chrome_trace(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    return false;
+  }
+  uint32_t event_count = timeline.events != NULL ? vector_size((vector *)&timeline.events) : 0;
+  double end = 0;
+  uint64_t totals[COUNTER_COUNT];
+  memcpy(totals, counters, sizeof(totals));
+
+  fprintf(file, "{\"traceEvents\":[\n");
+  fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"main\"}},\n",
+          (int)getpid(), timeline.thread);
+  for (uint32_t i = 0; i < event_count; i++) {
+    phase_event *event = &timeline.events[i];
+    write_trace_event(file, event, true);
+    end = event->start + event->duration > end ? event->start + event->duration : end;
+  }
+  pthread_mutex_lock(&finished.lock);
+  for (uint32_t i = 0; i < finished.count; i++) {
+    phase_event *event = &finished.events[i];
+    write_trace_event(file, event, false);
+    end = event->start + event->duration > end ? event->start + event->duration : end;
+  }
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    totals[i] += finished.counters[i];
+  }
+  pthread_mutex_unlock(&finished.lock);
+  fprintf(file, "{\"name\":\"counters\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":%d,\"args\":{", end * 1e6, (int)getpid());
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    fprintf(file, "%s\"%s\":%llu", i > 0 ? "," : "", enum_to_string(i, counter_strings) + 8,
+            (unsigned long long)totals[i]);
+  }
+  fprintf(file, "}}\n]}\n");
+  fclose(file);
+  return true;
+}
@@ -0,0 +1,97 @@
+#ifndef instrument_h
+#define instrument_h
+#include "enum_utilities.h"
+#include "memory.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Where compile time goes: timers around each phase, counters for the things
+// that cost something, and debug printing that's off unless asked for.
+//
+// Counters always count (it's one add). Timers only record once
+// instrument_enable has been called, so they cost a branch when nobody's
+// looking. Both are per thread, so a thread compiling a file only ever sees
+// its own numbers, and nobody has to lock anything. Pool workers time
+// themselves too once it's on, and hand what they have over when they exit,
+// so the trace has every thread's phases.
+
+#define ITERATE_COUNTERS_AND(X)                                                \
+  X(COUNTER_TOKENS)                                                            \
+  X(COUNTER_NODES)                                                             \
+  X(COUNTER_HASHMAP_PROBES)                                                    \
+  X(COUNTER_SCOPE_PUSHES)                                                      \
+  X(COUNTER_CACHE_HITS)                                                        \
+  X(COUNTER_CACHE_MISSES)                                                      \
+  X(COUNTER_HEADERS_LEXED)                                                     \
+  X(COUNTER_INCLUDES_SKIPPED)                                                  \
+  X(COUNTER_MACRO_EXPANSIONS)
+
+typedef enum { ITERATE_COUNTERS_AND(GENERATE_ENUM) COUNTER_COUNT } counter;
+
+extern _Thread_local uint64_t counters[COUNTER_COUNT];
+
+static inline void counter_add(counter which, uint64_t amount) {
+  counters[which] += amount;
+}
+
+// How much debug printing there is. Each level includes the ones before it.
+// It goes to stderr, so it never lands in the middle of a job's output.
+typedef enum {
+  VERBOSITY_QUIET,
+  VERBOSITY_INFO, // Things the parser noticed, like names that aren't types
+  VERBOSITY_TOKENS, // Every token as it's lexed
+} verbosity_level;
+
+extern verbosity_level verbosity;
+
+#define verbose(level, message, ...)                                           \
+  do {                                                                         \
+    if (__builtin_expect(verbosity >= (level), 0))                             \
+      fprintf(stderr, message, ##__VA_ARGS__);                                 \
+  } while (0)
+
+// One timed phase. Phases can be inside other phases, and what an inner
+// phase allocated counts for the outer ones too.
+typedef struct {
+  const char *name;
+  double start; // Seconds since instrument_enable
+  double duration;
+  uint32_t depth;
+  memory_usage at_start;
+  memory_usage memory; // current is what's still live when the phase ends
+  uint32_t thread; // The thread's id, as the OS knows it
+} phase_event;
+
+typedef uint32_t phase_id;
+#define NO_PHASE UINT32_MAX
+
+void instrument_enable(void);
+void instrument_free(void);
+// For threads other than the one that called instrument_enable, at the start
+// and end of their lives. Nothing happens if timing isn't on.
+void instrument_thread_begin(void);
+void instrument_thread_end(void);
+phase_id phase_begin(const char *name);
+void phase_end(phase_id phase);
+// The most recent phase with this name, NULL if there isn't one.
+// Good for benchmarks that want to hold a phase to a memory budget.
+const phase_event *find_phase(const char *name);
+
+// Times from here to the end of the enclosing block
+static inline void phase_end_at_scope_exit(phase_id *phase) {
+  phase_end(*phase);
+}
+#define TIME_SCOPE_NAME(line) time_scope_##line
+#define TIME_SCOPE_LINE(name, line)                                            \
+  phase_id TIME_SCOPE_NAME(line)                                               \
+      __attribute__((cleanup(phase_end_at_scope_exit))) = phase_begin(name)
+#define TIME_SCOPE(name) TIME_SCOPE_LINE(name, __LINE__)
+
+void print_time_report(FILE *file);
+// Chrome's trace-event format, open it in chrome://tracing or Perfetto. Has
+// this thread's phases and every finished thread's, so threads still running
+// are left out.
+bool write_chrome_trace(const char *path);
+
+#endif
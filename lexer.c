@@ -1,12 +1,17 @@
 // Inputs = c source char_pointer, outputs = tokens like TOKEN_EQUALS or TOKEN_STRUCT
 #include "c-tests/test.h"
 #include "lexer.h"
-#include <ctype.h>
+#include "instrument.h"
+#include "memory.h"
 #include <stdlib.h>
 #include <string.h>
 
 const char *token_type_strings[] = {ITERATE_TOKENS_AND(GENERATE_STRING)};
 
+// Token types are stored as bytes in token_stream
+_Static_assert(sizeof(token_type_strings) / sizeof(token_type_strings[0]) <= 256,
+               "Too many token types to fit in a uint8_t");
+
 const char *token_type_to_string(token_type type) {
   return enum_to_string(type, token_type_strings);
 }
@@ -31,356 +36,630 @@ char peek_char(char **char_pointer) {
   return current_char;
 }
 
+// The lexer fills in where the token is once it knows where the token ends
 token create_token(token_type type) {
   token current_token = {
     .type = type,
-    .value = vector_create(),
+    .offset = 0,
+    .length = 0,
   };
   return current_token;
 }
 
-// Advance till a specific string of characters is found (stops before pointer
-// is on string)
-void advance_till(char terminating_string[], char **char_pointer) {
-  char_vector current_chars = vector_create();
-  int terminating_string_length = strlen(terminating_string);
-  vector_resize(&current_chars, terminating_string_length);
-  while (true) {
-    char current_char = pop_char(char_pointer);
+// Names don't have a length anymore, get those from the symbol table
+string_slice token_to_slice(token current_token, const char *source_chars) {
+  assert(current_token.type != TOKEN_NAME);
+  string_slice slice = {
+    .chars = source_chars + current_token.offset,
+    .length = current_token.length,
+  };
+  return slice;
+}
 
-    if ((int)vector_size((vector *)&current_chars) == terminating_string_length) {
-      vector_remove(&current_chars, 0);
+// Skipping comments and whitespace looks at a whole block of chars at once
+// (32 with AVX2, 16 with SSE2) and turns "which chars match" into a bitmask.
+// Blocks are always aligned, so a block never crosses into a page the source
+// doesn't own, even when it reads past the end. Without either, it falls back
+// to memchr (which glibc vectorizes anyway) and plain loops.
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SKIP_BLOCK_SIZE 32
+typedef __m256i skip_block;
+static inline skip_block load_block(const char *aligned) {
+  return _mm256_load_si256((const __m256i *)aligned);
+}
+static inline uint32_t matching_chars(skip_block block, char c) {
+  return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, _mm256_set1_epi8(c)));
+}
+static inline uint32_t whitespace_chars(skip_block block) {
+  // '\t' '\n' '\v' '\f' '\r' are 9 to 13, so one range check covers them
+  __m256i from_tab = _mm256_sub_epi8(block, _mm256_set1_epi8('\t'));
+  __m256i is_tab_to_return = _mm256_cmpeq_epi8(_mm256_max_epu8(from_tab, _mm256_set1_epi8(4)), _mm256_set1_epi8(4));
+  __m256i is_space = _mm256_cmpeq_epi8(block, _mm256_set1_epi8(' '));
+  return (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(is_tab_to_return, is_space));
+}
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SKIP_BLOCK_SIZE 16
+typedef __m128i skip_block;
+static inline skip_block load_block(const char *aligned) {
+  return _mm_load_si128((const __m128i *)aligned);
+}
+static inline uint32_t matching_chars(skip_block block, char c) {
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(c)));
+}
+static inline uint32_t whitespace_chars(skip_block block) {
+  // '\t' '\n' '\v' '\f' '\r' are 9 to 13, so one range check covers them
+  __m128i from_tab = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+  __m128i is_tab_to_return = _mm_cmpeq_epi8(_mm_max_epu8(from_tab, _mm_set1_epi8(4)), _mm_set1_epi8(4));
+  __m128i is_space = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+  return (uint32_t)_mm_movemask_epi8(_mm_or_si128(is_tab_to_return, is_space));
+}
+#endif
+
+#ifdef SKIP_BLOCK_SIZE
+#define BLOCK_MASK ((uint32_t)((1ull << SKIP_BLOCK_SIZE) - 1))
+
+// First `c` in [from, end), or end if there isn't one
+static inline const char *find_char(const char *from, const char *end, char c) {
+  uintptr_t misalignment = (uintptr_t)from & (SKIP_BLOCK_SIZE - 1);
+  const char *block = from - misalignment;
+  // Ignore matches before `from` in the first block
+  uint32_t matches = matching_chars(load_block(block), c) & (BLOCK_MASK << misalignment);
+  while (matches == 0) {
+    block += SKIP_BLOCK_SIZE;
+    if (block >= end) {
+      return end;
     }
-    vector_add(&current_chars, current_char);
+    matches = matching_chars(load_block(block), c);
+  }
+  const char *found = block + __builtin_ctz(matches);
+  return found < end ? found : end;
+}
 
-    bool is_terminating_string = strncmp(current_chars, terminating_string, terminating_string_length) == 0;
-    if (is_terminating_string || current_char == '\0') {
-      return;
+// First char in [from, end) that isn't whitespace, or end
+static inline const char *skip_whitespace_chars(const char *from, const char *end) {
+  uintptr_t misalignment = (uintptr_t)from & (SKIP_BLOCK_SIZE - 1);
+  const char *block = from - misalignment;
+  uint32_t others = ~whitespace_chars(load_block(block)) & (BLOCK_MASK << misalignment);
+  while (others == 0) {
+    block += SKIP_BLOCK_SIZE;
+    if (block >= end) {
+      return end;
     }
+    others = ~whitespace_chars(load_block(block)) & BLOCK_MASK;
   }
+  const char *found = block + __builtin_ctz(others);
+  return found < end ? found : end;
+}
+#else
+static inline const char *find_char(const char *from, const char *end, char c) {
+  const char *found = memchr(from, c, end - from);
+  return found != NULL ? found : end;
 }
 
-// Make a string till condition is false, at end finish string and do misc
-// String addr is required as we are reallocating the string, which makes the old string pointer useless.
-void collect_characters(char_vector *string_addr, bool (*condition)(char), char **char_pointer) {
-  char current_char = pop_char(char_pointer);
-  while (condition(current_char) && current_char != EOF) {
-    vector_add(string_addr, current_char);
-    current_char = pop_char(char_pointer);
+static inline const char *skip_whitespace_chars(const char *from, const char *end) {
+  while (from < end && (*from == ' ' || (*from >= '\t' && *from <= '\r'))) {
+    from++;
   }
-  // Return consumed char
-  return_char(char_pointer);
-  // Add string ending notifier
-  vector_add(string_addr, '\0');
+  return from;
 }
+#endif
 
-token create_single(token_type type, char **char_pointer) {
-  advance_char(char_pointer);
-  token current_token = create_token(type);
-  vector_add(&current_token.value, '\0');
-  return current_token;
+// We're just past "//", skip to the end of the line
+static inline void skip_line_comment(char **char_pointer, const char *end) {
+  *char_pointer = (char *)find_char(*char_pointer, end, '\n');
 }
 
-// Generate token like = or == (or <=) (This definition sucks)
-// We are at first char. If next char is expected, create twice token, otherwise
-// create once. Ex: We are at '-', if we advance char and another '-', create
-// twice token.
-token create_double(char expected, token_type once, token_type twice, char **char_pointer) {
-  // Skip current "once" char, and check if next char is "twice" chars
-  advance_char(char_pointer);
-
-  token current_token = create_token(TOKEN_END);
-  vector_add(&current_token.value, '\0');
-  bool is_expected = peek_char(char_pointer) == expected;
-  if (is_expected) {
-    // Skip "twice" char
-    advance_char(char_pointer);
-    current_token.type = twice;
-    return current_token;
-  } else {
-    current_token.type = once;
-    return current_token;
+// We're just past "/*", skip past the next "*/". Searching for '/' (and then
+// checking the char before it) is faster than searching for '*', since
+// comment banners are full of stars.
+static inline void skip_block_comment(char **char_pointer, const char *end) {
+  const char *body = *char_pointer;
+  if (body >= end) {
+    return;
   }
+  const char *slash = find_char(body + 1, end, '/');
+  while (slash < end && *(slash - 1) != '*') {
+    slash = find_char(slash + 1, end, '/');
+  }
+  *char_pointer = (char *)(slash < end ? slash + 1 : end);
 }
 
-bool not_quote(char c) { return c != '"'; }
-
-token create_string(char **char_pointer) {
-  token string_token = create_token(TOKEN_STRING);
-  vector_resize(&string_token.value, 8);
-
-  advance_char(char_pointer); // Remove "
-  collect_characters(&string_token.value, not_quote, char_pointer);
-  advance_char(char_pointer); // Remove "
+// Every char falls into one of these, and the class decides what the lexer
+// does next. Digits and letters are last, so `>= CHAR_DIGIT` means "can be
+// part of a name".
+typedef enum {
+  CHAR_UNKNOWN,
+  CHAR_END,
+  CHAR_WHITESPACE,
+  CHAR_QUOTE,
+  CHAR_SLASH,
+  CHAR_PUNCTUATOR,
+  CHAR_DIGIT,
+  CHAR_LETTER, // Letters and '_'
+} char_class;
+
+static const uint8_t char_classes[256] = {
+  ['\0'] = CHAR_END,
+  [' '] = CHAR_WHITESPACE, ['\t'] = CHAR_WHITESPACE, ['\n'] = CHAR_WHITESPACE,
+  ['\r'] = CHAR_WHITESPACE, ['\v'] = CHAR_WHITESPACE, ['\f'] = CHAR_WHITESPACE,
+  ['"'] = CHAR_QUOTE,
+  ['/'] = CHAR_SLASH,
+  ['='] = CHAR_PUNCTUATOR, ['!'] = CHAR_PUNCTUATOR, ['<'] = CHAR_PUNCTUATOR,
+  ['>'] = CHAR_PUNCTUATOR, ['&'] = CHAR_PUNCTUATOR, ['|'] = CHAR_PUNCTUATOR,
+  ['^'] = CHAR_PUNCTUATOR, ['+'] = CHAR_PUNCTUATOR, ['-'] = CHAR_PUNCTUATOR,
+  ['*'] = CHAR_PUNCTUATOR, ['%'] = CHAR_PUNCTUATOR, ['('] = CHAR_PUNCTUATOR,
+  [')'] = CHAR_PUNCTUATOR, ['['] = CHAR_PUNCTUATOR, [']'] = CHAR_PUNCTUATOR,
+  ['{'] = CHAR_PUNCTUATOR, ['}'] = CHAR_PUNCTUATOR, ['.'] = CHAR_PUNCTUATOR,
+  [','] = CHAR_PUNCTUATOR, [';'] = CHAR_PUNCTUATOR, [':'] = CHAR_PUNCTUATOR,
+  ['?'] = CHAR_PUNCTUATOR, ['#'] = CHAR_PUNCTUATOR,
+  ['0' ... '9'] = CHAR_DIGIT,
+  ['a' ... 'z'] = CHAR_LETTER, ['A' ... 'Z'] = CHAR_LETTER, ['_'] = CHAR_LETTER,
+};
+
+// The token a punctuator is on its own
+static const uint8_t single_char_tokens[256] = {
+  ['='] = TOKEN_EQUALS,
+  ['!'] = TOKEN_NOT,
+  ['<'] = TOKEN_LESS_THAN,
+  ['>'] = TOKEN_GREATER_THAN,
+  ['&'] = TOKEN_AMPERSAND,
+  ['|'] = TOKEN_PIPE,
+  ['^'] = TOKEN_CARET,
+  ['+'] = TOKEN_PLUS,
+  ['-'] = TOKEN_MINUS,
+  ['*'] = TOKEN_STAR,
+  ['/'] = TOKEN_SLASH,
+  ['%'] = TOKEN_PERCENT,
+  ['('] = TOKEN_LEFT_PARENTHESES,
+  [')'] = TOKEN_RIGHT_PARENTHESES,
+  ['['] = TOKEN_LEFT_BRACKET,
+  [']'] = TOKEN_RIGHT_BRACKET,
+  ['{'] = TOKEN_LEFT_BRACE,
+  ['}'] = TOKEN_RIGHT_BRACE,
+  ['.'] = TOKEN_DOT,
+  [','] = TOKEN_COMMA,
+  [';'] = TOKEN_SEMI_COLON,
+  [':'] = TOKEN_COLON,
+  ['?'] = TOKEN_QUESTION,
+  ['#'] = TOKEN_HASH,
+};
+
+// Punctuators that can grow a second char, like '=' into "==". Each one is a
+// state with its own row of transitions in double_char_tokens.
+typedef enum {
+  PUNCTUATOR_STATE_DONE, // Can't grow, its row is all TOKEN_END
+  PUNCTUATOR_STATE_EQUALS,
+  PUNCTUATOR_STATE_NOT,
+  PUNCTUATOR_STATE_LESS_THAN,
+  PUNCTUATOR_STATE_GREATER_THAN,
+  PUNCTUATOR_STATE_AMPERSAND,
+  PUNCTUATOR_STATE_PIPE,
+  PUNCTUATOR_STATE_PLUS,
+  PUNCTUATOR_STATE_MINUS,
+  PUNCTUATOR_STATE_HASH,
+  PUNCTUATOR_STATE_COUNT,
+} punctuator_state;
+
+static const uint8_t punctuator_states[256] = {
+  ['='] = PUNCTUATOR_STATE_EQUALS,
+  ['!'] = PUNCTUATOR_STATE_NOT,
+  ['<'] = PUNCTUATOR_STATE_LESS_THAN,
+  ['>'] = PUNCTUATOR_STATE_GREATER_THAN,
+  ['&'] = PUNCTUATOR_STATE_AMPERSAND,
+  ['|'] = PUNCTUATOR_STATE_PIPE,
+  ['+'] = PUNCTUATOR_STATE_PLUS,
+  ['-'] = PUNCTUATOR_STATE_MINUS,
+  ['#'] = PUNCTUATOR_STATE_HASH,
+};
+
+// The token a punctuator becomes when followed by a char, TOKEN_END if the
+// char isn't part of it
+static const uint8_t double_char_tokens[PUNCTUATOR_STATE_COUNT][256] = {
+  [PUNCTUATOR_STATE_EQUALS] = { ['='] = TOKEN_EQUALS_EQUALS },
+  [PUNCTUATOR_STATE_NOT] = { ['='] = TOKEN_NOT_EQUALS },
+  [PUNCTUATOR_STATE_LESS_THAN] = { ['='] = TOKEN_LESS_THAN_EQUALS, ['<'] = TOKEN_SHIFT_LEFT },
+  [PUNCTUATOR_STATE_GREATER_THAN] = { ['='] = TOKEN_GREATER_THAN_EQUALS, ['>'] = TOKEN_SHIFT_RIGHT },
+  [PUNCTUATOR_STATE_AMPERSAND] = { ['&'] = TOKEN_AND },
+  [PUNCTUATOR_STATE_PIPE] = { ['|'] = TOKEN_OR },
+  [PUNCTUATOR_STATE_PLUS] = { ['+'] = TOKEN_PLUS_PLUS, ['='] = TOKEN_PLUS_EQUALS },
+  [PUNCTUATOR_STATE_MINUS] = { ['-'] = TOKEN_MINUS_MINUS, ['='] = TOKEN_MINUS_EQUALS, ['>'] = TOKEN_ARROW },
+  [PUNCTUATOR_STATE_HASH] = { ['#'] = TOKEN_HASH_HASH },
+};
+
+static inline char_class class_of(char c) {
+  return char_classes[(unsigned char)c];
+}
 
-  return string_token;
+// Keyword lookup is a perfect hash: every keyword lands in its own slot, so an
+// identifier is compared against one keyword at most, instead of all of them.
+// The slots are case labels generated from ITERATE_KEYWORDS_AND, so if two
+// keywords ever hash the same it's a duplicate case value and the build
+// breaks, pointing at both. Then change KEYWORD_HASH.
+#define KEYWORD_MAX_LENGTH 8
+#define KEYWORD_HASH(length, first, last) (((length) * 4 + (unsigned char)(first) + (unsigned char)(last)) & 63)
+
+#define GENERATE_KEYWORD_CASE(TYPE, NAME, FIRST, LAST)                        \
+  case KEYWORD_HASH(sizeof(NAME) - 1, FIRST, LAST):                            \
+    if (value.length == sizeof(NAME) - 1 && memcmp(value.chars, NAME, sizeof(NAME) - 1) == 0) { \
+      return TYPE;                                                             \
+    }                                                                          \
+    return TOKEN_NAME;
+
+#define GENERATE_KEYWORD_LENGTH_CHECK(TYPE, NAME, FIRST, LAST)                \
+  _Static_assert(sizeof(NAME) - 1 <= KEYWORD_MAX_LENGTH, "'" NAME "' is longer than KEYWORD_MAX_LENGTH");
+ITERATE_KEYWORDS_AND(GENERATE_KEYWORD_LENGTH_CHECK)
+
+token_type keyword_type(string_slice value) {
+  if (value.length == 0 || value.length > KEYWORD_MAX_LENGTH) {
+    return TOKEN_NAME;
+  }
+  switch (KEYWORD_HASH(value.length, value.chars[0], value.chars[value.length - 1])) {
+    ITERATE_KEYWORDS_AND(GENERATE_KEYWORD_CASE)
+  default:
+    return TOKEN_NAME;
+  }
 }
 
-bool isdigit_wrapper(char c) { return isdigit((unsigned char)c) != 0; }
+static inline token lex_name(char **char_pointer) {
+  token name_token = create_token(TOKEN_NAME);
 
-token create_number(char **char_pointer) {
-  token number_token = create_token(TOKEN_NUMBER);
-  vector_resize(&number_token.value, 8);
+  string_slice value = { .chars = *char_pointer, .length = 0 };
+  while (class_of(peek_char(char_pointer)) >= CHAR_DIGIT) {
+    advance_char(char_pointer);
+  }
+  value.length = *char_pointer - value.chars;
 
-  collect_characters(&number_token.value, isdigit_wrapper, char_pointer);
+  name_token.type = keyword_type(value);
+  return name_token;
+}
 
+static inline token lex_number(char **char_pointer) {
+  token number_token = create_token(TOKEN_NUMBER);
+  while (class_of(peek_char(char_pointer)) == CHAR_DIGIT) {
+    advance_char(char_pointer);
+  }
   return number_token;
 }
 
-// Keywords/variables can only have these characters
-bool is_valid_keyword_char(char to_check) {
-  return isalpha(to_check) || isdigit(to_check) || to_check == '_';
-}
+static inline token lex_string(char **char_pointer) {
+  token string_token = create_token(TOKEN_STRING);
 
-// Shortcut for strncmp
-bool vector_is(char_vector value, char *to_compare) {
-  // Strings with different sizes are, by definition, different
-  if (vector_size((vector*)&value) - 1 != strlen(to_compare)) {
-    return false;
+  advance_char(char_pointer); // Remove "
+  char current_char = peek_char(char_pointer);
+  while (current_char != '"' && current_char != '\0') {
+    advance_char(char_pointer);
+    current_char = peek_char(char_pointer);
   }
-  // Compare strings with size as a restraint
-  return strncmp(value, to_compare, vector_size((vector*)&value)) == 0;
-}
-
-token create_keyword(char **char_pointer) {
-  token keyword_token = create_token(TOKEN_NAME);
-
-  // It's a miracle that this works
-  collect_characters(&keyword_token.value, is_valid_keyword_char, char_pointer);
-
-  char_vector value = keyword_token.value;
-  token_type type;
-
-  // TODO: Turn this into hashmap (or switch)
-  if (vector_is(value, "volatile")) {
-    type = TOKEN_VOLATILE;
-  } else if (vector_is(value, "unsigned")) {
-    type = TOKEN_UNSIGNED;
-  } else if (vector_is(value, "const")) {
-    type = TOKEN_CONST;
-  } else if (vector_is(value, "register")) {
-    type = TOKEN_REGISTER;
-  } else if (vector_is(value, "true")) {
-    type = TOKEN_TRUE;
-  } else if (vector_is(value, "false")) {
-    type = TOKEN_FALSE;
-  } else if (vector_is(value, "null")) {
-    type = TOKEN_NULL;
-  } else if (vector_is(value, "sizeof")) {
-    type = TOKEN_SIZEOF;
-  } else if (vector_is(value, "typeof")) {
-    type = TOKEN_TYPEOF;
-  } else if (vector_is(value, "typedef")) {
-    type = TOKEN_TYPEDEF;
-  } else if (vector_is(value, "struct")) {
-    type = TOKEN_STRUCT;
-  } else if (vector_is(value, "enum")) {
-    type = TOKEN_ENUM;
-  } else if (vector_is(value, "union")) {
-    type = TOKEN_UNION;
-  } else if (vector_is(value, "do")) {
-    type = TOKEN_DO;
-  } else if (vector_is(value, "while")) {
-    type = TOKEN_WHILE;
-  } else if (vector_is(value, "for")) {
-    type = TOKEN_FOR;
-  } else if (vector_is(value, "break")) {
-    type = TOKEN_BREAK;
-  } else if (vector_is(value, "continue")) {
-    type = TOKEN_CONTINUE;
-  } else if (vector_is(value, "if")) {
-    type = TOKEN_IF;
-  } else if (vector_is(value, "else")) {
-    type = TOKEN_ELSE;
-  } else if (vector_is(value, "switch")) {
-    type = TOKEN_SWITCH;
-  } else if (vector_is(value, "case")) {
-    type = TOKEN_CASE;
-  } else if (vector_is(value, "default")) {
-    type = TOKEN_DEFAULT;
-  } else if (vector_is(value, "inline")) {
-    type = TOKEN_INLINE;
-  } else {
-    type = TOKEN_NAME;
+  if (current_char == '"') {
+    advance_char(char_pointer); // Remove "
   }
 
-  keyword_token.type = type;
-
-  return keyword_token;
+  return string_token;
 }
 
-token *lexer(char_vector chars) {
-  char **char_pointer = &chars;
+// Single char punctuators are one table lookup, and the ones that can be two
+// chars (like "==" or "->") take one more step through double_char_tokens.
+static inline token lex_punctuator(char **char_pointer) {
+  char first_char = pop_char(char_pointer);
+  token current_token = create_token(single_char_tokens[(unsigned char)first_char]);
 
-  // Make a vector of pointers so I can avoid memory leaks where I copy
-  // token struct and leak the one originally pointed to
-  token *tokens = vector_create();
-  vector_resize(&tokens, 16);
+  punctuator_state state = punctuator_states[(unsigned char)first_char];
+  token_type double_type = double_char_tokens[state][(unsigned char)peek_char(char_pointer)];
+  if (double_type != TOKEN_END) {
+    advance_char(char_pointer);
+    current_token.type = double_type;
+  }
+  return current_token;
+}
+
+// Scans the next token after whatever the lexer already got through. At the
+// end of the source it keeps giving back TOKEN_END.
+static token scan_token(lexer_state *state) {
+  char **char_pointer = &state->current;
+  const char *end = state->end;
   token current_token;
 
-  char current_char;
+  char *token_start;
   // Note: Since we only peek_char here, it's the function's responsibility to pop the char
   // and keep the loop not... infinite.
   while (true) {
-    current_char = peek_char(char_pointer);
-    if (current_char == EOF || current_char == '\0') {
-      break;
-    }
-    switch (current_char) {
-    // Skip whitespace
-    case ' ':
-    case '\t':
-    case '\n':
+    token_start = *char_pointer;
+    char_class current_class = class_of(peek_char(char_pointer));
+    switch (current_class) {
+    case CHAR_END:
+      current_token = create_token(TOKEN_END);
+      current_token.offset = token_start - state->source.chars;
+      return current_token;
+    case CHAR_UNKNOWN:
+      // A backslash right before a newline joins the lines, for directives
+      // that go on for more than one
+      if (peek_char(char_pointer) == '\\') {
+        char *after = *char_pointer + 1;
+        after += *after == '\r';
+        if (*after == '\n') {
+          *char_pointer = after + 1;
+          continue;
+        }
+      }
+      fprintf(state->errors, "UNKNOWN CHARACTER: %c\n", peek_char(char_pointer));
+      state->error_count += 1;
+      // Unknown character? Skip it.
       advance_char(char_pointer);
       continue;
 
-    // Numbers/Keywords
-    default:
-      if (isdigit(current_char)) {
-        current_token = create_number(char_pointer);
-      } else if (isalpha(current_char)) {
-        current_token = create_keyword(char_pointer);
-      } else {
-        printf("UNKNOWN CHARACTER: %c\n", current_char);
-        // Unknown character? Skip it.
-        advance_char(char_pointer);
-        continue;
+    case CHAR_WHITESPACE:
+      advance_char(char_pointer);
+      // Most runs are a single space, only go wide for indentation and such
+      if (class_of(peek_char(char_pointer)) == CHAR_WHITESPACE) {
+        *char_pointer = (char *)skip_whitespace_chars(*char_pointer, end);
       }
-      break;
-
-    // Special
-    case '\"':
-      current_token = create_string(char_pointer);
-      break;
-    case '\'':
-      // TODO: create_char
-      break;
-    case '\\':
-      // Man this is too complex for now
-      break;
+      continue;
 
-    // Equality
-    case '=':
-      current_token = create_double('=', TOKEN_EQUALS, TOKEN_EQUALS_EQUALS, char_pointer);
-      break;
-    case '!':
-      current_token = create_double('=', TOKEN_NOT, TOKEN_NOT_EQUALS, char_pointer);
-      break;
-    case '<':
-      current_token = create_double('=', TOKEN_LESS_THAN, TOKEN_LESS_THAN_EQUALS, char_pointer);
-      break;
-    case '>':
-      current_token = create_double('=', TOKEN_GREATER_THAN, TOKEN_GREATER_THAN_EQUALS, char_pointer);
+    case CHAR_DIGIT:
+      current_token = lex_number(char_pointer);
       break;
-    case '&':
-      current_token = create_double('&', TOKEN_AMPERSAND, TOKEN_AND, char_pointer);
+    case CHAR_LETTER:
+      current_token = lex_name(char_pointer);
       break;
-    case '|':
-      current_token = create_double('|', TOKEN_PIPE, TOKEN_OR, char_pointer);
+    case CHAR_QUOTE:
+      current_token = lex_string(char_pointer);
       break;
-    case '^':
-      current_token = create_single(TOKEN_CARET, char_pointer);
+    case CHAR_PUNCTUATOR:
+      current_token = lex_punctuator(char_pointer);
       break;
 
-    // Math operations
-    case '+':
-      advance_char(char_pointer);
-      switch (peek_char(char_pointer)) {
-      case '+':
-        current_token = create_single(TOKEN_PLUS_PLUS, char_pointer);
-        break;
-      case '=':
-        current_token = create_single(TOKEN_PLUS_EQUALS, char_pointer);
-        break;
-      default:
-        // We create token here because '+' is already skipped
-        current_token = create_token(TOKEN_PLUS);
-        break;
-      }
-      break;
-    case '-':
-      advance_char(char_pointer);
-      switch (peek_char(char_pointer)) {
-      case '-':
-        current_token = create_single(TOKEN_MINUS_MINUS, char_pointer);
-        break;
-      case '=':
-        current_token = create_single(TOKEN_MINUS_EQUALS, char_pointer);
-        break;
-      case '>':
-        current_token = create_single(TOKEN_ARROW, char_pointer);
-        break;
-      default:
-        // We create token here because '+' is already skipped
-        current_token = create_token(TOKEN_MINUS);
-        break;
-      }
-      break;
-    case '*':
-      current_token = create_single(TOKEN_STAR, char_pointer);
-      break;
-    case '/':
+    case CHAR_SLASH:
       // We get rid of first '/' and peek next one
-      pop_char(char_pointer);
+      advance_char(char_pointer);
       switch (peek_char(char_pointer)) {
       case '/':
-        advance_till("\n", char_pointer);
+        advance_char(char_pointer);
+        skip_line_comment(char_pointer, end);
         continue;
-        break;
       case '*':
-        advance_till("*/", char_pointer);
+        advance_char(char_pointer);
+        skip_block_comment(char_pointer, end);
         continue;
-        break;
       default:
-        // We create token here because '/' is already skipped
         current_token = create_token(TOKEN_SLASH);
         break;
       }
       break;
-    case '%':
-      current_token = create_single(TOKEN_PERCENT, char_pointer);
-      break;
+    }
+    break;
+  }
 
-    // Punctuation
-    case '(':
-      current_token = create_single(TOKEN_LEFT_PARENTHESES, char_pointer);
-      break;
-    case ')':
-      current_token = create_single(TOKEN_RIGHT_PARENTHESES, char_pointer);
-      break;
-    case '[':
-      current_token = create_single(TOKEN_LEFT_BRACKET, char_pointer);
-      break;
-    case ']':
-      current_token = create_single(TOKEN_RIGHT_BRACKET, char_pointer);
-      break;
-    case '{':
-      current_token = create_single(TOKEN_LEFT_BRACE, char_pointer);
-      break;
-    case '}':
-      current_token = create_single(TOKEN_RIGHT_BRACE, char_pointer);
-      break;
-    case '.':
-      current_token = create_single(TOKEN_DOT, char_pointer);
-      break;
-    case ',':
-      current_token = create_single(TOKEN_COMMA, char_pointer);
-      break;
-    case ';':
-      current_token = create_single(TOKEN_SEMI_COLON, char_pointer);
-      break;
-    case ':':
-      current_token = create_single(TOKEN_COLON, char_pointer);
-      break;
+  // Every token is just a slice of the source, so nothing gets copied
+  current_token.offset = token_start - state->source.chars;
+  current_token.length = *char_pointer - token_start;
+  if (current_token.type == TOKEN_STRING) {
+    // Strings don't include their quotes
+    bool is_closed = current_token.length >= 2 && *(*char_pointer - 1) == '"';
+    current_token.offset += 1;
+    current_token.length -= is_closed ? 2 : 1;
+  } else if (current_token.type == TOKEN_NAME) {
+    // From here on a name is just a number
+    string_slice name = { .chars = token_start, .length = current_token.length };
+    current_token.symbol = intern_symbol(state->symbols, name);
+  }
+
+  counter_add(COUNTER_TOKENS, 1);
+  verbose(VERBOSITY_TOKENS, "What's inside: %s\n", token_type_to_string(current_token.type));
+  return current_token;
+}
+
+lexer_state lexer_create(source_file source, symbol_table *symbols) {
+  lexer_state state = {
+    .source = source,
+    .symbols = symbols,
+    .current = (char *)source.chars,
+    .end = source.chars + source.size,
+    .first = 0,
+    .count = 0,
+    .errors = stderr,
+    .error_count = 0,
+  };
+  return state;
+}
+
+// Look `distance` tokens ahead without consuming anything (0 is the next token).
+// Tokens are only scanned once, the ring buffer holds on to them till they're
+// consumed.
+token lexer_peek(lexer_state *state, uint32_t distance) {
+  assert(distance < LEXER_LOOKAHEAD);
+  while (state->count <= distance) {
+    uint32_t slot = (state->first + state->count) & (LEXER_LOOKAHEAD - 1);
+    state->lookahead[slot] = scan_token(state);
+    state->count += 1;
+  }
+  return state->lookahead[(state->first + distance) & (LEXER_LOOKAHEAD - 1)];
+}
+
+// Consume the next token. Like the end of the token vector, TOKEN_END is never
+// consumed, so asking again just gives TOKEN_END again.
+token lexer_next(lexer_state *state) {
+  token next_token = lexer_peek(state, 0);
+  if (next_token.type != TOKEN_END) {
+    state->first = (state->first + 1) & (LEXER_LOOKAHEAD - 1);
+    state->count -= 1;
+  }
+  return next_token;
+}
+
+// Resizes the one allocation the three arrays live in. realloc gets to do
+// its thing (big blocks are just remapped, not copied), then the arrays
+// after offsets slide over to where they start now.
+static void token_stream_reserve(token_stream *stream, uint32_t capacity) {
+  uint32_t old_capacity = stream->capacity;
+  uint32_t count = stream->count;
+  capacity = capacity > 0 ? capacity : 1;
+  // uint32_t arrays go first so every array stays aligned
+  size_t bytes_per_token = sizeof(uint32_t) * 2 + sizeof(uint8_t);
+  char *block = (char *)stream->offsets;
+
+  if (capacity < old_capacity) {
+    // Slide down before the block gets smaller
+    memmove(block + capacity * sizeof(uint32_t), stream->lengths, count * sizeof(uint32_t));
+    memmove(block + capacity * sizeof(uint32_t) * 2, stream->types, count * sizeof(uint8_t));
+    block = memory_reallocate(block, capacity * bytes_per_token);
+    assert(block != NULL);
+  } else {
+    block = memory_reallocate(block, capacity * bytes_per_token);
+    assert(block != NULL);
+    // Slide up after the block got bigger, types first so lengths can't land on them
+    memmove(block + capacity * sizeof(uint32_t) * 2, block + old_capacity * sizeof(uint32_t) * 2, count * sizeof(uint8_t));
+    memmove(block + capacity * sizeof(uint32_t), block + old_capacity * sizeof(uint32_t), count * sizeof(uint32_t));
+  }
+
+  stream->offsets = (uint32_t *)block;
+  stream->lengths = stream->offsets + capacity;
+  stream->types = (uint8_t *)(stream->lengths + capacity);
+  stream->capacity = capacity;
+}
+
+void token_stream_push(token_stream *stream, token current_token) {
+  if (stream->count == stream->capacity) {
+    token_stream_reserve(stream, stream->capacity * 2);
+  }
+  stream->offsets[stream->count] = current_token.offset;
+  stream->lengths[stream->count] = current_token.length;
+  stream->types[stream->count] = (uint8_t)current_token.type;
+  stream->count += 1;
+}
+
+void token_stream_free(token_stream *stream) {
+  // The other arrays live in the same allocation as offsets
+  memory_free(stream->offsets);
+  stream->offsets = NULL;
+  stream->lengths = NULL;
+  stream->types = NULL;
+  stream->count = 0;
+  stream->capacity = 0;
+}
+
+// Replaces tokens [start, end) with all of `replacement`'s. Everything after
+// them slides over, their offsets are left for the caller to fix.
+void token_stream_splice(token_stream *stream, uint32_t start, uint32_t end, const token_stream *replacement) {
+  assert(start <= end && end <= stream->count);
+  uint32_t count = stream->count - (end - start) + replacement->count;
+  if (count > stream->capacity) {
+    uint32_t capacity = stream->capacity * 2;
+    token_stream_reserve(stream, capacity > count ? capacity : count);
+  }
+  uint32_t after = stream->count - end;
+  uint32_t moved_to = start + replacement->count;
+  memmove(stream->offsets + moved_to, stream->offsets + end, after * sizeof(uint32_t));
+  memmove(stream->lengths + moved_to, stream->lengths + end, after * sizeof(uint32_t));
+  memmove(stream->types + moved_to, stream->types + end, after * sizeof(uint8_t));
+  memcpy(stream->offsets + start, replacement->offsets, replacement->count * sizeof(uint32_t));
+  memcpy(stream->lengths + start, replacement->lengths, replacement->count * sizeof(uint32_t));
+  memcpy(stream->types + start, replacement->types, replacement->count * sizeof(uint8_t));
+  stream->count = count;
+}
+
+// Points every brace at the one it pairs with (see token). Only types gets
+// read, so it's one quick pass, and it can be redone after a splice.
+void token_stream_pair_braces(token_stream *stream) {
+  // Opening braces that haven't been closed yet, innermost last
+  uint32_t *open_braces = vector_create();
+  for (uint32_t i = 0; i < stream->count; i++) {
+    if (stream->types[i] == TOKEN_LEFT_BRACE) {
+      vector_add(&open_braces, i);
+    } else if (stream->types[i] == TOKEN_RIGHT_BRACE) {
+      vec_size_t open_count = vector_size((vector *)&open_braces);
+      if (open_count > 0) {
+        uint32_t opening = open_braces[open_count - 1];
+        vector_remove(&open_braces, open_count - 1);
+        stream->lengths[opening] = i - opening;
+        stream->lengths[i] = i - opening;
+      } else {
+        stream->lengths[i] = NO_MATCHING_BRACE;
+      }
     }
+  }
+  // Whatever never got closed pairs with the end
+  for (vec_size_t i = 0; i < vector_size((vector *)&open_braces); i++) {
+    stream->lengths[open_braces[i]] = NO_MATCHING_BRACE;
+  }
+  vector_free((vector *)&open_braces);
+}
+
+// Same, but just for [start, end), when only those tokens changed. Braces in
+// there that don't pair up with each other get NO_MATCHING_BRACE instead of
+// pairing with something outside, and then it gives back false.
+bool token_stream_pair_braces_between(token_stream *stream, uint32_t start, uint32_t end) {
+  uint32_t *open_braces = vector_create();
+  bool balanced = true;
+  for (uint32_t i = start; i < end; i++) {
+    if (stream->types[i] == TOKEN_LEFT_BRACE) {
+      vector_add(&open_braces, i);
+    } else if (stream->types[i] == TOKEN_RIGHT_BRACE) {
+      vec_size_t open_count = vector_size((vector *)&open_braces);
+      if (open_count > 0) {
+        uint32_t opening = open_braces[open_count - 1];
+        vector_remove(&open_braces, open_count - 1);
+        stream->lengths[opening] = i - opening;
+        stream->lengths[i] = i - opening;
+      } else {
+        stream->lengths[i] = NO_MATCHING_BRACE;
+        balanced = false;
+      }
+    }
+  }
+  for (vec_size_t i = 0; i < vector_size((vector *)&open_braces); i++) {
+    stream->lengths[open_braces[i]] = NO_MATCHING_BRACE;
+    balanced = false;
+  }
+  vector_free((vector *)&open_braces);
+  return balanced;
+}
 
-    printf("What's inside: %s\n", token_type_to_string(current_token.type));
-    vector_add(&tokens, current_token);
-    assert(vector_size((vector*)&current_token.value) > 0);
-    char char_at_end_of_string = *(char*)vector_get((vector*)&current_token.value, vector_size((vector*)&current_token.value) - 1);
-    assert(char_at_end_of_string == '\0');
+// Tokens from `from` on moved by `offset_delta` bytes in the source, like
+// after a splice. Braces pair up by how far apart they are, so only offsets
+// change.
+void token_stream_shift(token_stream *stream, uint32_t from, int64_t offset_delta) {
+  if (offset_delta == 0) {
+    return;
   }
-  vector_add(&tokens, create_token(TOKEN_END));
+  uint32_t delta = (uint32_t)offset_delta;
+  uint32_t *offsets = stream->offsets;
+  for (uint32_t i = from; i < stream->count; i++) {
+    offsets[i] += delta;
+  }
+}
+
+// Lex the whole source up front, for passes that want every token at once
+token_stream lex_all(lexer_state *state) {
+  TIME_SCOPE("lex");
+  token_stream tokens = {
+    .offsets = NULL,
+    .lengths = NULL,
+    .types = NULL,
+    .count = 0,
+    .capacity = 0,
+  };
+  // Code rarely has more than one token every 4 chars, so most files never
+  // have to grow. Pages that never get a token are never touched.
+  token_stream_reserve(&tokens, state->source.size / 4 + 16);
+  token current_token;
+
+  do {
+    current_token = scan_token(state);
+    token_stream_push(&tokens, current_token);
+  } while (current_token.type != TOKEN_END);
+  // Pairing braces up now is what lets the parser hop over a body without
+  // looking at any of it
+  token_stream_pair_braces(&tokens);
+
+  // Give back what the guess didn't use
+  token_stream_reserve(&tokens, tokens.count);
 
   return tokens;
 }
+
+token_stream lexer(source_file source, symbol_table *symbols) {
+  lexer_state state = lexer_create(source, symbols);
+  return lex_all(&state);
+}
@@ -2,6 +2,10 @@
 #define lexer_h
 #include "c-vector/vec.h"
 #include "enum_utilities.h"
+#include "source.h"
+#include "symbols.h"
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #define ITERATE_TOKENS_AND(X)                                                  \
@@ -53,6 +57,8 @@
   X(TOKEN_LESS_THAN_EQUALS)                                                    \
   X(TOKEN_GREATER_THAN)                                                        \
   X(TOKEN_GREATER_THAN_EQUALS)                                                 \
+  X(TOKEN_SHIFT_LEFT)                                                          \
+  X(TOKEN_SHIFT_RIGHT)                                                         \
                                                                                \
   X(TOKEN_AMPERSAND)                                                           \
   X(TOKEN_AND)                                                                 \
@@ -73,23 +79,141 @@
   X(TOKEN_COMMA)                                                               \
   X(TOKEN_SEMI_COLON)                                                          \
   X(TOKEN_COLON)                                                               \
+  X(TOKEN_QUESTION)                                                            \
   X(TOKEN_LEFT_PARENTHESES)                                                    \
   X(TOKEN_RIGHT_PARENTHESES)                                                   \
   X(TOKEN_LEFT_BRACKET)                                                        \
   X(TOKEN_RIGHT_BRACKET)                                                       \
   X(TOKEN_LEFT_BRACE)                                                          \
   X(TOKEN_RIGHT_BRACE)                                                         \
+                                                                               \
+  X(TOKEN_HASH)                                                                \
+  X(TOKEN_HASH_HASH)                                                           \
+
+// Every keyword and the token it becomes. Keyword lookup is built from this,
+// so adding a keyword is just adding a line here (and to the list above).
+// The first and last chars are spelled out because keyword_type hashes them,
+// and C can't take chars out of a string literal at compile time.
+#define ITERATE_KEYWORDS_AND(X)                                                \
+  X(TOKEN_VOLATILE, "volatile", 'v', 'e')                                      \
+  X(TOKEN_UNSIGNED, "unsigned", 'u', 'd')                                      \
+  X(TOKEN_CONST, "const", 'c', 't')                                            \
+  X(TOKEN_REGISTER, "register", 'r', 'r')                                      \
+                                                                               \
+  X(TOKEN_TRUE, "true", 't', 'e')                                              \
+  X(TOKEN_FALSE, "false", 'f', 'e')                                            \
+  X(TOKEN_NULL, "null", 'n', 'l')                                              \
+                                                                               \
+  X(TOKEN_SIZEOF, "sizeof", 's', 'f')                                          \
+  X(TOKEN_TYPEOF, "typeof", 't', 'f')                                          \
+  X(TOKEN_TYPEDEF, "typedef", 't', 'f')                                        \
+                                                                               \
+  X(TOKEN_STRUCT, "struct", 's', 't')                                          \
+  X(TOKEN_ENUM, "enum", 'e', 'm')                                              \
+  X(TOKEN_UNION, "union", 'u', 'n')                                            \
+                                                                               \
+  X(TOKEN_DO, "do", 'd', 'o')                                                  \
+  X(TOKEN_WHILE, "while", 'w', 'e')                                            \
+  X(TOKEN_FOR, "for", 'f', 'r')                                                \
+  X(TOKEN_BREAK, "break", 'b', 'k')                                            \
+  X(TOKEN_CONTINUE, "continue", 'c', 'e')                                      \
+                                                                               \
+  X(TOKEN_IF, "if", 'i', 'f')                                                  \
+  X(TOKEN_ELSE, "else", 'e', 'e')                                              \
+  X(TOKEN_SWITCH, "switch", 's', 'h')                                          \
+  X(TOKEN_CASE, "case", 'c', 'e')                                              \
+  X(TOKEN_DEFAULT, "default", 'd', 't')                                        \
+                                                                               \
+  X(TOKEN_INLINE, "inline", 'i', 'e')
 
 typedef enum { ITERATE_TOKENS_AND(GENERATE_ENUM) } token_type;
 
+// For tables with a slot per token type
+#define TOKEN_COUNT (0 ITERATE_TOKENS_AND(GENERATE_COUNT))
+
+// Tokens don't own their text, they point at where it is in the source.
+// Strings don't include their quotes. Names are interned while lexing, so
+// instead of a length they carry their symbol (the text is in the table).
+// Braces are always 1 char, so in a token_stream they carry the index of the
+// brace they pair with instead.
 typedef struct {
   token_type type;
-  char_vector value;
+  uint32_t offset;
+  union {
+    uint32_t length;
+    symbol_id symbol; // TOKEN_NAME only
+    uint32_t matching; // TOKEN_LEFT_BRACE and TOKEN_RIGHT_BRACE, from a token_stream only (how far its pair is)
+  };
 } token;
 
+// What a brace that doesn't pair up has. A closing brace like that pairs
+// with nothing, an opening one pairs with TOKEN_END.
+#define NO_MATCHING_BRACE UINT32_MAX
+
 extern const char *token_type_strings[];
 const char *token_type_to_string(token_type type);
 
-token *lexer(char_vector chars);
+// Every token of a file, packed as three arrays that share one allocation,
+// which comes out to 9 bytes a token. Use token_stream_get to get a token back.
+typedef struct {
+  uint32_t *offsets;
+  uint32_t *lengths; // Or symbols for names, or how far away a brace's pair is for braces
+  uint8_t *types;
+  uint32_t count;
+  uint32_t capacity;
+} token_stream;
+
+// How many tokens the streaming lexer can look ahead (power of 2)
+#define LEXER_LOOKAHEAD 4
+
+// Streaming lexer: tokens are scanned when someone asks for them, and only a
+// few of them are kept around at a time
+typedef struct {
+  source_file source;
+  symbol_table *symbols; // Where names get interned
+  char *current; // Where scanning picks up from
+  const char *end;
+  token lookahead[LEXER_LOOKAHEAD]; // Ring buffer of scanned but unconsumed tokens
+  uint32_t first;
+  uint32_t count;
+  FILE *errors; // stderr unless whoever's compiling wants them somewhere else
+  uint32_t error_count;
+} lexer_state;
+
+token_type keyword_type(string_slice value);
+string_slice token_to_slice(token current_token, const char *source_chars);
+lexer_state lexer_create(source_file source, symbol_table *symbols);
+token lexer_peek(lexer_state *state, uint32_t distance);
+token lexer_next(lexer_state *state);
+token_stream lex_all(lexer_state *state);
+token_stream lexer(source_file source, symbol_table *symbols);
+void token_stream_push(token_stream *stream, token current_token);
+void token_stream_splice(token_stream *stream, uint32_t start, uint32_t end, const token_stream *replacement);
+void token_stream_pair_braces(token_stream *stream);
+bool token_stream_pair_braces_between(token_stream *stream, uint32_t start, uint32_t end);
+void token_stream_shift(token_stream *stream, uint32_t from, int64_t offset_delta);
+void token_stream_free(token_stream *stream);
+
+static inline token token_stream_get(const token_stream *stream, uint32_t index) {
+  token current_token = {
+    .type = stream->types[index],
+    .offset = stream->offsets[index],
+    .length = stream->lengths[index],
+  };
+  return current_token;
+}
+
+// Where the brace at `index` pairs up, without walking what's between them.
+// Only means anything if the token at `index` is a brace. Pairs are kept as
+// how far apart they are (an opening brace's is after it, a closing one's
+// before), so braces don't change when the tokens around them move.
+static inline uint32_t token_stream_matching_brace(const token_stream *stream, uint32_t index) {
+  uint32_t distance = stream->lengths[index];
+  bool opening = stream->types[index] == TOKEN_LEFT_BRACE;
+  if (distance == NO_MATCHING_BRACE) {
+    return opening ? stream->count - 1 : NO_MATCHING_BRACE;
+  }
+  return opening ? index + distance : index - distance;
+}
 
 #endif
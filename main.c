@@ -1,9 +1,19 @@
+#include "arena.h"
+#include "ast.h"
 #include "c-vector/vec.h"
+#include "driver.h"
+#include "instrument.h"
 #include "lexer.h"
 #include "parser.h"
+#include "precompiled.h"
+#include "preprocessor.h"
+#include "source.h"
+#include "symbols.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 /*
  * Here's all the things we need to accomplish:
@@ -15,43 +25,183 @@
  * Be able to tokenize/lex/use standard C libraries
  */
 
-char_vector string_from_file(FILE *file) {
-  // Seek to end of file to get the size
-  fseek(file, 0, SEEK_END);
-  size_t size = ftell(file);
-  rewind(file);
+#define USAGE "Usage: main [--time-report] [--trace file.json] [-v | -vv] [-j workers] [--lazy] [--cache directory] [--ast-format text|json|binary] [-I directory] [--precompile image header | --pch image] [files.mcc...]\n"
 
-  char_vector chars = vector_create();
-  // Size + 1 for null terminator
-  vector_resize(&chars, size + 1);
-
-  // Read entire file into the buffer
-  fread(chars, 1, size, file);
-  // Add null terminator
-  chars[size] = '\0';
-
-  return chars;
+// Per file numbers, for when there's more than one file and the phases
+// happened all over the place on different threads
+void print_job_report(FILE *file, compile_job *jobs, uint32_t job_count, double seconds, uint32_t worker_count) {
+  fprintf(file, "===== Files =====\n");
+  fprintf(file, "%-40s %10s %12s %12s %10s %7s\n", "file", "ms", "tokens", "nodes", "peak KB", "errors");
+  double busy = 0;
+  for (uint32_t i = 0; i < job_count; i++) {
+    compile_job *job = &jobs[i];
+    fprintf(file, "%-40s %10.3f %12llu %12llu %10zu %7u\n", job->path, job->seconds * 1e3,
+            (unsigned long long)job->tokens, (unsigned long long)job->nodes, job->peak_memory / 1024,
+            job->error_count);
+    busy += job->seconds;
+  }
+  fprintf(file, "%u files on %u workers in %.3f ms, %.1fx the work of one\n", job_count, worker_count,
+          seconds * 1e3, seconds > 0 ? busy / seconds : 0);
 }
 
 // I think no memory leaks or segmentation faults. Good luck!
-int main(void) {
-  char file_name[] = "test.mcc";
-
-  FILE *file;
-  file = fopen(file_name, "r");
+int main(int argc, char **argv) {
+  char **file_names = vector_create();
+  bool time_report = false;
+  char *trace_path = NULL;
+  uint32_t worker_count = 0;
+  bool reachable_only = false;
+  char *cache_directory = NULL;
+  dump_format ast_format = DUMP_TEXT;
+  char **include_directories = vector_create();
+  char *precompile_path = NULL;
+  char *image_path = NULL;
 
-  if (!file) {
-    printf("Couldn't find file: %s", file_name);
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--time-report") == 0) {
+      time_report = true;
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "-v") == 0) {
+      verbosity = VERBOSITY_INFO;
+    } else if (strcmp(argv[i], "-vv") == 0) {
+      verbosity = VERBOSITY_TOKENS;
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      worker_count = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--lazy") == 0) {
+      // Function bodies main never gets to aren't parsed
+      reachable_only = true;
+    } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+      // Files that haven't changed since last time get their AST from here
+      cache_directory = argv[++i];
+    } else if (strcmp(argv[i], "--ast-format") == 0 && i + 1 < argc) {
+      ast_format = dump_format_from_name(argv[++i]);
+      if (ast_format == DUMP_FORMAT_COUNT) {
+        printf(USAGE);
+        exit(1);
+      }
+    } else if (strcmp(argv[i], "-I") == 0 && i + 1 < argc) {
+      // Where #include looks, after the includer's own directory for "..."
+      vector_add(&include_directories, argv[++i]);
+    } else if (strcmp(argv[i], "--precompile") == 0 && i + 1 < argc) {
+      // The one file given is a header, and gets saved as an image instead of compiled
+      precompile_path = argv[++i];
+    } else if (strcmp(argv[i], "--pch") == 0 && i + 1 < argc) {
+      // Every file starts off like it had included the header this image is of
+      image_path = argv[++i];
+    } else if (argv[i][0] == '-') {
+      printf(USAGE);
+      exit(1);
+    } else {
+      vector_add(&file_names, argv[i]);
+    }
+  }
+  if (vector_size((vector *)&file_names) == 0) {
+    vector_add(&file_names, "test.mcc");
+  }
+  uint32_t file_count = vector_size((vector *)&file_names);
+  if (precompile_path != NULL) {
+    if (file_count != 1 || image_path != NULL) {
+      printf(USAGE);
+      exit(1);
+    }
+    bool built = header_image_build(file_names[0], include_directories, precompile_path, stderr);
+    header_cache_free();
+    vector_free((vector *)&include_directories);
+    vector_free((vector *)&file_names);
+    return built ? 0 : 1;
+  }
+  // Loaded once, every file reads from the same one
+  header_image image = { .mapping = NULL };
+  if (image_path != NULL && !header_image_load(image_path, &image, stderr)) {
     exit(1);
   }
+  const header_image *starting_image = image_path != NULL ? &image : NULL;
+  if (cache_directory != NULL) {
+    // Fine if it's already there
+    mkdir(cache_directory, 0777);
+  }
 
-  char_vector chars = string_from_file(file);
-  token *tokens = lexer(chars);
-  node *ast = parser(tokens);
+  bool timing = time_report || trace_path != NULL;
+  if (timing) {
+    instrument_enable();
+  }
+
+  bool succeeded = true;
+  if (file_count == 1) {
+    // Just the one, it can have this thread and print straight out. Asking
+    // for workers spreads its function bodies over them.
+    compile_job job = job_for_file(file_names[0], true);
+    job.separate_phases = timing;
+    job.reachable_only = reachable_only;
+    job.cache_directory = cache_directory;
+    job.ast_format = ast_format;
+    job.include_directories = include_directories;
+    job.header_image = starting_image;
+    job.output = stdout;
+    job.errors = stderr;
+    if (worker_count > 1) {
+      job.parse_pool = pool_create(worker_count);
+    }
+    compile_file(&job);
+    if (job.parse_pool != NULL) {
+      pool_free(job.parse_pool);
+    }
+    succeeded = job.succeeded;
+  } else {
+    // Each file is its own job, whichever worker's free takes the next one.
+    // What they print is held on to and put out in the order the files were given.
+    if (worker_count == 0) {
+      worker_count = pool_default_worker_count();
+    }
+    worker_count = worker_count < file_count ? worker_count : file_count;
+    compile_job *jobs = malloc(sizeof(compile_job) * file_count);
+    for (uint32_t i = 0; i < file_count; i++) {
+      jobs[i] = job_for_file(file_names[i], true);
+      jobs[i].separate_phases = timing;
+      jobs[i].reachable_only = reachable_only;
+      jobs[i].cache_directory = cache_directory;
+      jobs[i].ast_format = ast_format;
+      jobs[i].include_directories = include_directories;
+      jobs[i].header_image = starting_image;
+    }
+
+    thread_pool *pool = pool_create(worker_count);
+    phase_id files_phase = phase_begin("compile files");
+    compile_all(pool, jobs, file_count);
+    phase_end(files_phase);
+    pool_free(pool);
+
+    for (uint32_t i = 0; i < file_count; i++) {
+      printf("File: %s\n", jobs[i].path);
+      flush_job(&jobs[i], stdout, stderr);
+      succeeded &= jobs[i].succeeded;
+    }
+    if (time_report) {
+      const phase_event *files = find_phase("compile files");
+      print_job_report(stderr, jobs, file_count, files != NULL ? files->duration : 0, worker_count);
+    }
+    free(jobs);
+  }
 
-  fclose(file);
+  // The phases and counters are this thread's, they only add up to anything
+  // when this thread did the compiling. The trace has the workers' too.
+  if (time_report && file_count == 1) {
+    print_time_report(stderr);
+  }
+  if (trace_path != NULL && !write_chrome_trace(trace_path)) {
+    printf("Couldn't write trace: %s\n", trace_path);
+  }
+  instrument_free();
+  // Every file's done, so nothing's looking at a header any more
+  header_cache_free();
+  if (starting_image != NULL) {
+    header_image_release(&image);
+  }
+  vector_free((vector *)&include_directories);
+  vector_free((vector *)&file_names);
 
-  return 0;
+  return succeeded ? 0 : 1;
 }
 
 /*
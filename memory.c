@@ -0,0 +1,90 @@
+// Inputs = sizes, outputs = memory, and a record of how much of it there is
+#include "memory.h"
+#include "c-tests/test.h"
+#include <stdlib.h>
+
+_Thread_local memory_usage memory_total = { 0 };
+
+// Goes in front of every allocation, sized so what comes after stays aligned
+typedef union {
+  size_t size;
+  max_align_t alignment;
+} allocation_header;
+
+static inline allocation_header *header_of(void *allocation) {
+  return (allocation_header *)allocation - 1;
+}
+
+static inline void add_to_total(size_t size) {
+  memory_total.current += size;
+  memory_total.allocated += size;
+  memory_total.allocations += 1;
+  if (memory_total.current > memory_total.peak) {
+    memory_total.peak = memory_total.current;
+  }
+}
+
+void *memory_allocate(size_t size) {
+  allocation_header *header = malloc(sizeof(allocation_header) + size);
+  if (header == NULL) {
+    return NULL;
+  }
+  header->size = size;
+  add_to_total(size);
+  return header + 1;
+}
+
+void *memory_reallocate(void *allocation, size_t size) {
+  if (allocation == NULL) {
+    return memory_allocate(size);
+  }
+  size_t old_size = header_of(allocation)->size;
+  allocation_header *header = realloc(header_of(allocation), sizeof(allocation_header) + size);
+  if (header == NULL) {
+    return NULL;
+  }
+  header->size = size;
+  memory_total.current -= old_size;
+  add_to_total(size);
+  return header + 1;
+}
+
+void memory_free(void *allocation) {
+  if (allocation == NULL) {
+    return;
+  }
+  allocation_header *header = header_of(allocation);
+  assert(memory_total.current >= header->size);
+  memory_total.current -= header->size;
+  free(header);
+}
+
+void memory_disown(void *allocation) {
+  size_t size = header_of(allocation)->size;
+  assert(memory_total.current >= size);
+  memory_total.current -= size;
+}
+
+void memory_adopt(void *allocation) {
+  memory_total.current += header_of(allocation)->size;
+  if (memory_total.current > memory_total.peak) {
+    memory_total.peak = memory_total.current;
+  }
+}
+
+memory_usage memory_mark(void) {
+  memory_usage mark = memory_total;
+  memory_total.peak = memory_total.current;
+  return mark;
+}
+
+memory_usage memory_since_mark(memory_usage mark) {
+  memory_usage since = {
+    .current = memory_total.current,
+    .peak = memory_total.peak,
+    .allocated = memory_total.allocated - mark.allocated,
+    .allocations = memory_total.allocations - mark.allocations,
+  };
+  memory_total.peak = mark.peak > memory_total.peak ? mark.peak : memory_total.peak;
+  return since;
+}
@@ -0,0 +1,41 @@
+#ifndef memory_h
+#define memory_h
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Every heap allocation the compiler makes goes through here, so we can
+// tell which phase is holding on to what. Our own code calls these directly,
+// c-hashmap is handed them with hashmap_new_with_allocator, and c-vector is
+// compiled with them standing in for malloc/realloc/free (vector_memory.c).
+//
+// Each allocation carries its size in front of it, so frees come off the
+// books without anyone having to remember how big things were. The books are
+// per thread: something allocated on one thread has to be freed on it too.
+
+typedef struct {
+  size_t current; // Live right now
+  size_t peak; // Most that was ever live at once
+  size_t allocated; // Every byte handed out, growing something counts again
+  uint64_t allocations; // Including reallocations
+} memory_usage;
+
+extern _Thread_local memory_usage memory_total;
+
+void *memory_allocate(size_t size);
+void *memory_reallocate(void *allocation, size_t size);
+void memory_free(void *allocation);
+
+// Handing memory to another thread: the one letting go calls memory_disown,
+// the one taking it calls memory_adopt, and it moves from one's books to the
+// other's without counting as allocated twice
+void memory_disown(void *allocation);
+void memory_adopt(void *allocation);
+
+// For measuring a stretch of the program (like a phase): the mark starts a
+// fresh peak, memory_since_mark gives back what happened since and puts the
+// old peak back. Marks can be inside other marks.
+memory_usage memory_mark(void);
+memory_usage memory_since_mark(memory_usage mark);
+
+#endif
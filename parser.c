@@ -1,6 +1,11 @@
 #include "parser.h"
+#include "instrument.h"
+#include "memory.h"
+#include "pool.h"
+#include "semantic.h"
 #include "c-tests/test.h"
 #include "c-vector/vec.h"
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,195 +26,402 @@ const char *operator_type_to_string(operator_type type) {
 
 // Base functions
 
-void advance_token(token **token_pointer) {
-  // Pointer arithmetic to advance pointer by 1 token length
-  *token_pointer += 1;
+token_cursor cursor_from_tokens(const token_stream *tokens, source_file source, symbol_table *symbols, arena *nodes) {
+  // Check if token at end is end token.
+  assert(tokens->count > 0 && tokens->types[tokens->count - 1] == TOKEN_END);
+  token_cursor cursor = {
+    .lexer = NULL,
+    .tokens = tokens,
+    .position = 0,
+    .source_chars = source.chars,
+    .symbols = symbols,
+    .nodes = nodes,
+    .pending = { .nodes = NULL, .count = 0, .capacity = 0 },
+    .errors = stderr,
+    .error_count = 0,
+    .bail = NULL,
+    .pool = NULL,
+    .deferred = NULL,
+    .lazy = NULL,
+    .copy_strings = false,
+    .starting_scope = NULL,
+    .kept_types = NULL,
+    .types = NULL,
+  };
+  return cursor;
 }
-void return_token(token **token_pointer) {
-  // Pointer arithmetic to de-advance pointer by 1 token length
-  *token_pointer -= 1;
+token_cursor cursor_from_lexer(lexer_state *lexer, arena *nodes) {
+  token_cursor cursor = {
+    .lexer = lexer,
+    .tokens = NULL,
+    .position = 0,
+    .source_chars = lexer->source.chars,
+    .symbols = lexer->symbols,
+    .nodes = nodes,
+    .pending = { .nodes = NULL, .count = 0, .capacity = 0 },
+    .errors = lexer->errors,
+    .error_count = 0,
+    .bail = NULL,
+    .pool = NULL,
+    .deferred = NULL,
+    .lazy = NULL,
+    .copy_strings = false,
+    .starting_scope = NULL,
+    .kept_types = NULL,
+    .types = NULL,
+  };
+  return cursor;
 }
-token *pop_token(token **token_pointer) {
-  token *current_token = &(**token_pointer);
-  advance_token(token_pointer);
-  return current_token;
+// The AST isn't the cursor's, it stays in the arena
+void free_cursor(token_cursor *cursor) {
+  memory_free(cursor->pending.nodes);
+  cursor->pending.nodes = NULL;
+  cursor->pending.count = 0;
+  cursor->pending.capacity = 0;
 }
-token *peek_token(token **token_pointer) {
-  token *current_token = &(**token_pointer);
+
+// Errors that leave nothing sensible to parse after them. They go back to
+// wherever cursor->bail says, parser() sets that up and hands back NULL.
+// Anyone calling a parse function directly has to set one up first, one
+// that isn't there is a bug in the caller, not an error in the file.
+void parse_error(token_cursor *cursor, const char *message, ...) {
+  va_list arguments;
+  va_start(arguments, message);
+  fprintf(cursor->errors, "Error: ");
+  vfprintf(cursor->errors, message, arguments);
+  fprintf(cursor->errors, "\n");
+  va_end(arguments);
+  cursor->error_count += 1;
+  if (cursor->bail == NULL) {
+    fprintf(stderr, "parse_error: the cursor has no bail, set one up with setjmp before parsing\n");
+    abort();
+  }
+  longjmp(*cursor->bail, 1);
+}
+
+// TOKEN_END is never stepped over, so the parser can't run off the end
+void advance_token(token_cursor *cursor) {
+  if (cursor->lexer != NULL) {
+    lexer_next(cursor->lexer);
+  } else if (cursor->tokens->types[cursor->position] != TOKEN_END) {
+    cursor->position += 1;
+  }
+}
+token pop_token(token_cursor *cursor) {
+  token current_token = peek_token(cursor);
+  advance_token(cursor);
   return current_token;
 }
-token *expect_token(token_type type, token **token_pointer) {
-  token *current_token = pop_token(token_pointer);
-  if (current_token->type != type) {
-    printf("Token given: %s \n Token expected: %s \n",
-           token_type_to_string(current_token->type),
-           token_type_to_string(type));
+token peek_token(token_cursor *cursor) {
+  if (cursor->lexer != NULL) {
+    return lexer_peek(cursor->lexer, 0);
+  }
+  return token_stream_get(cursor->tokens, cursor->position);
+}
+token expect_token(token_type type, token_cursor *cursor) {
+  token current_token = pop_token(cursor);
+  if (current_token.type != type) {
+    fprintf(cursor->errors, "Token given: %s \n Token expected: %s \n",
+            token_type_to_string(current_token.type),
+            token_type_to_string(type));
+    cursor->error_count += 1;
   }
   return current_token;
 }
-bool is_at_end(token **token_pointer) {
-  return peek_token(token_pointer)->type == TOKEN_END;
+string_slice token_value(token current_token, token_cursor *cursor) {
+  if (current_token.type == TOKEN_NAME) {
+    return symbol_name(cursor->symbols, current_token.symbol);
+  }
+  return token_to_slice(current_token, cursor->source_chars);
+}
+// Names were interned by the lexer, so all the parser keeps is the symbol
+symbol_id expect_name(token_cursor *cursor) {
+  token name_token = expect_token(TOKEN_NAME, cursor);
+  return name_token.type == TOKEN_NAME ? name_token.symbol : NO_SYMBOL;
+}
+bool is_at_end(token_cursor *cursor) {
+  return peek_token(cursor).type == TOKEN_END;
 }
 
-node *create_node(node_type type) {
-  node *current_node = malloc(sizeof(node));
+node *create_node(node_type type, token_cursor *cursor) {
+  node *current_node = arena_allocate(cursor->nodes, sizeof(node));
   current_node->type = type;
-  assert(current_node != NULL);
+  counter_add(COUNTER_NODES, 1);
   return current_node;
 }
 
+// Where this list's children start on the pending stack
+uint32_t start_list(token_cursor *cursor) {
+  return cursor->pending.count;
+}
+void push_to_list(node *child, token_cursor *cursor) {
+  node_stack *pending = &cursor->pending;
+  if (pending->count == pending->capacity) {
+    pending->capacity = pending->capacity > 0 ? pending->capacity * 2 : 64;
+    pending->nodes = memory_reallocate(pending->nodes, sizeof(node *) * pending->capacity);
+    assert(pending->nodes != NULL);
+  }
+  pending->nodes[pending->count] = child;
+  pending->count += 1;
+}
+// Now that we know how many children there are, they get exactly that much
+// room in the arena, and come off the stack
+node_list finish_list(uint32_t start, token_cursor *cursor) {
+  node_stack *pending = &cursor->pending;
+  assert(start <= pending->count);
+  node_list list = { .nodes = NULL, .count = pending->count - start };
+  if (list.count > 0) {
+    list.nodes = arena_allocate(cursor->nodes, sizeof(node *) * list.count);
+    memcpy(list.nodes, pending->nodes + start, sizeof(node *) * list.count);
+  }
+  pending->count = start;
+  return list;
+}
+
 // Types
 
-int compare_typedef_entries(const void *a, const void *b, void *udata) {
+// Entries are keyed by symbol, so there's no text to compare or hash
+int compare_scope_entries(const void *a, const void *b, void *udata) {
   (void)udata;
-  const char_vector name1 = ((typedef_entry *)a)->name;
-  const char_vector name2 = ((typedef_entry *)b)->name;
-  if (vector_size((vector *)&name1) != vector_size((vector *)&name2)){
-    return 1;
-  }
-  return strncmp(name1, name2, vector_size((vector *)&name1));
+  return ((scope_entry *)a)->name != ((scope_entry *)b)->name;
 }
-uint64_t hash_typedef_entry(const void *data, uint64_t seed0, uint64_t seed1) {
-  const char_vector name = ((typedef_entry *)data)->name;
-  return hashmap_sip(name, vector_size((vector *)&name), seed0, seed1);
+uint64_t hash_scope_entry(const void *data, uint64_t seed0, uint64_t seed1) {
+  (void)seed0;
+  (void)seed1;
+  // Symbols are dense, multiplying by an odd number spreads them out enough
+  return (uint64_t)((scope_entry *)data)->name * 0x9E3779B97F4A7C15ull;
 }
-void create_or_clear_context(scope_context context) {
-  if (vector_has((vector *)&context.typedef_hashmaps, context.depth)) {
-    struct hashmap *type_hashmap = *(struct hashmap**)vector_get(&context.typedef_hashmaps, context.depth);
-    hashmap_clear(type_hashmap, true);
-  } else {
-    struct hashmap *type_hashmap = hashmap_new(sizeof(typedef_entry), 1, 0, 0, hash_typedef_entry, compare_typedef_entries, NULL, NULL);
-    vector_insert(&context.typedef_hashmaps, context.depth, type_hashmap);
-    assert(*(struct hashmap**)vector_get(&context.typedef_hashmaps, context.depth) == type_hashmap);
-  }
+
+scope_context create_scope_context(void) {
+  scope_context context = {
+    .visible = hashmap_new_with_allocator(memory_allocate, memory_reallocate, memory_free, sizeof(scope_entry), 64, 0, 0, hash_scope_entry, compare_scope_entries, NULL, NULL),
+    .bindings = vector_create(),
+    .scope_starts = vector_create(),
+    .parent = NULL,
+    .parent_bindings = 0,
+  };
+  assert(context.visible != NULL);
+  return context;
+}
+
+void free_scope_context(scope_context *context) {
+  hashmap_free(context->visible);
+  vector_free((vector *)&context->bindings);
+  vector_free((vector *)&context->scope_starts);
+  context->visible = NULL;
 }
 
-void add_type_to_context(typedef_entry object, scope_context context) {
-  // Just a reminder, 'hashmap_set' takes in hashmap and object.
-  // Object has the key (usually object.name), and itself as the value.
-  // That is why it is only the 'key' instead of 'key:value'
-  hashmap_set(context.typedef_hashmaps[context.depth], &object);
-  typedef_entry *debug_object = (typedef_entry *)hashmap_get(context.typedef_hashmaps[context.depth], &object);
-  assert(debug_object != NULL);
-  assert(vector_compare((vector *)&debug_object->name, (vector *)&object.name) == 0);
+void enter_scope(scope_context *context) {
+  assert(vector_size((vector *)&context->scope_starts) < UNREASONABLE_CONTEXT_NUMBER);
+  vector_add(&context->scope_starts, vector_size((vector *)&context->bindings));
+  counter_add(COUNTER_SCOPE_PUSHES, 1);
 }
 
-bool is_type(char_vector name, scope_context context) {
-  hashmap_vector typedef_hashmaps = context.typedef_hashmaps;
-  assert(typedef_hashmaps[0] == context.typedef_hashmaps[0]);
-  for (vec_size_t i = 0; i <= (vec_size_t)context.depth; i++) {
-    if (hashmap_get(typedef_hashmaps[i], &(typedef_entry){ .name=name }) != NULL) {
-      return true;
+// Undo every binding the scope made, newest first, so a name that got
+// shadowed twice ends up back at the outermost one
+void exit_scope(scope_context *context) {
+  vec_size_t scope_count = vector_size((vector *)&context->scope_starts);
+  assert(scope_count > 0);
+  uint32_t scope_start = context->scope_starts[scope_count - 1];
+  vector_remove(&context->scope_starts, scope_count - 1);
+
+  vec_size_t binding_count = vector_size((vector *)&context->bindings);
+  while (binding_count > scope_start) {
+    binding_count -= 1;
+    typedef_entry *binding = &context->bindings[binding_count];
+    counter_add(COUNTER_HASHMAP_PROBES, 1);
+    if (binding->shadowed == NO_BINDING) {
+      hashmap_delete(context->visible, &(scope_entry){ .name = binding->name });
     } else {
-      printf("Info: '%.*s' isn't in context/type hashmaps\n", (int)vector_size((vector*)&name), name);
+      hashmap_set(context->visible, &(scope_entry){ .name = binding->name, .binding = binding->shadowed });
     }
+    vector_remove(&context->bindings, binding_count);
+  }
+}
+
+// An entry that doesn't say how it lines up lines up anywhere, that way
+// nothing laid out with it ever gets lined up to 0
+void add_type_to_context(typedef_entry object, scope_context *context) {
+  if (object.alignment == 0) {
+    object.alignment = 1;
+  }
+  scope_entry entry = {
+    .name = object.name,
+    .binding = vector_size((vector *)&context->bindings),
+  };
+  // 'hashmap_set' hands back what was there before, which is what we're shadowing
+  const scope_entry *previous = hashmap_set(context->visible, &entry);
+  counter_add(COUNTER_HASHMAP_PROBES, 1);
+  object.shadowed = previous != NULL ? previous->binding : NO_BINDING;
+  vector_add(&context->bindings, object);
+}
+
+// The parent is only read from, and never changes while children are using
+// it, so any number of threads can look things up in it at once
+static typedef_entry *find_parent_type(symbol_id name, const scope_context *parent, uint32_t visible_bindings) {
+  const scope_entry *entry = hashmap_get(parent->visible, &(scope_entry){ .name = name });
+  counter_add(COUNTER_HASHMAP_PROBES, 1);
+  // Bindings made after the child's spot in the file don't count, the ones
+  // they hid are what it would've seen
+  uint32_t binding = entry != NULL ? entry->binding : NO_BINDING;
+  while (binding != NO_BINDING && binding >= visible_bindings) {
+    binding = parent->bindings[binding].shadowed;
+  }
+  if (binding != NO_BINDING) {
+    return &parent->bindings[binding];
+  }
+  if (parent->parent != NULL) {
+    return find_parent_type(name, parent->parent, parent->parent_bindings);
+  }
+  return NULL;
+}
+
+typedef_entry *find_type(symbol_id name, scope_context *context) {
+  const scope_entry *entry = hashmap_get(context->visible, &(scope_entry){ .name = name });
+  counter_add(COUNTER_HASHMAP_PROBES, 1);
+  if (entry != NULL) {
+    return &context->bindings[entry->binding];
+  }
+  if (context->parent != NULL) {
+    return find_parent_type(name, context->parent, context->parent_bindings);
   }
+  return NULL;
+}
+
+bool is_type(symbol_id name, scope_context *context) {
+  if (find_type(name, context) != NULL) {
+    return true;
+  }
+  verbose(VERBOSITY_INFO, "Info: symbol %u isn't in context/type hashmaps\n", name);
   return false;
 }
 
 // Parse and collect struct members
-node_vector collect_members(scope_context context, token **token_pointer) {
+node_list collect_members(scope_context *context, token_cursor *cursor) {
   token_type right_break_token = TOKEN_RIGHT_BRACE;
-  node_vector members = vector_create(); 
-  while (!is_at_end(token_pointer) &&
-      peek_token(token_pointer)->type != right_break_token) {
-    node *member = parse_type_expression(context, token_pointer);
-    vector_add(&members, member);
-    assert((*(node **)vector_last(&members))->type == member->type);
+  uint32_t members = start_list(cursor);
+  while (!is_at_end(cursor) &&
+      peek_token(cursor).type != right_break_token) {
+    node *member = parse_type_expression(context, cursor);
+    push_to_list(member, cursor);
 
-    expect_token(TOKEN_SEMI_COLON, token_pointer);
+    expect_token(TOKEN_SEMI_COLON, cursor);
   }
-  return members;
+  return finish_list(members, cursor);
 }
 
 // Parse and collect typed nodes separated by commas
 // Ex: (int i, struct Point {...}, ...)
-node_vector collect_parameters(scope_context context, token **token_pointer) {
+node_list collect_parameters(scope_context *context, token_cursor *cursor) {
   token_type right_break_token = TOKEN_RIGHT_PARENTHESES;
-  node_vector parameters = vector_create(); 
-  while (!is_at_end(token_pointer) &&
-      peek_token(token_pointer)->type != right_break_token) {
-    node *parameter = parse_type_expression(context, token_pointer);
-    vector_add(&parameters, parameter);
-    assert((*(node **)vector_last(&parameters))->type == parameter->type);
-
-    token *current_token = peek_token(token_pointer);
-    if (current_token->type == TOKEN_COMMA) {
-      expect_token(TOKEN_COMMA, token_pointer);
+  uint32_t parameters = start_list(cursor);
+  while (!is_at_end(cursor) &&
+      peek_token(cursor).type != right_break_token) {
+    node *parameter = parse_type_expression(context, cursor);
+    push_to_list(parameter, cursor);
+
+    token current_token = peek_token(cursor);
+    if (current_token.type == TOKEN_COMMA) {
+      expect_token(TOKEN_COMMA, cursor);
       continue;
-    } else if (current_token->type == right_break_token) {
+    } else if (current_token.type == right_break_token) {
       continue;
     } else {
-      error("Expected ',' or '%s', got '%s'",
+      parse_error(cursor, "Expected ',' or '%s', got '%s'",
             token_type_to_string(right_break_token),
-            token_type_to_string(current_token->type));
+            token_type_to_string(current_token.type));
     }
   }
-  return parameters;
+  return finish_list(parameters, cursor);
 }
 
 // Parses pointers for types if they are there
-node *parse_pointers(node *type_node, token **token_pointer) {
+node *parse_pointers(node *type_node, token_cursor *cursor) {
   // For each star, create a type node, point to type, then set type to the pointer to do it again
-  while (peek_token(token_pointer)->type == TOKEN_STAR) {
-    expect_token(TOKEN_STAR, token_pointer);
-    node *pointer = create_node(NODE_POINTER);
-    pointer->pointer.to = type_node;
+  while (peek_token(cursor).type == TOKEN_STAR) {
+    expect_token(TOKEN_STAR, cursor);
+    node key = { .type = NODE_POINTER, .pointer = { .to = type_node } };
+    node *pointer = cursor->types != NULL ? find_interned_type(cursor->types, &key) : NULL;
+    if (pointer == NULL) {
+      pointer = create_node(NODE_POINTER, cursor);
+      pointer->pointer.to = type_node;
+      pointer->pointer.id = NO_TYPE;
+      if (cursor->types != NULL) {
+        intern_type(cursor->types, pointer);
+      }
+    }
     type_node = pointer;
   }
   return type_node;
 }
 
 // Just parses "int" into a type
-node *parse_base_type(scope_context context, token **token_pointer) {
-  token *type_token = expect_token(TOKEN_NAME, token_pointer);
-  if (is_type(type_token->value, context)) {
-    node *type_node = create_node(NODE_BASE_TYPE);
-    type_node->base_type.name = type_token->value;
+node *parse_base_type(scope_context *context, token_cursor *cursor) {
+  token type_token = expect_token(TOKEN_NAME, cursor);
+  typedef_entry *entry = find_type(type_token.symbol, context);
+  if (entry != NULL) {
+    // Only a name and a typedef say which base type it is
+    node key = { .type = NODE_BASE_TYPE, .base_type = { .name = type_token.symbol, .definition = entry->type } };
+    node *type_node = cursor->types != NULL ? find_interned_type(cursor->types, &key) : NULL;
+    if (type_node == NULL) {
+      type_node = create_node(NODE_BASE_TYPE, cursor);
+      type_node->base_type.name = type_token.symbol;
+      type_node->base_type.id = NO_TYPE;
+      resolve_base_type(type_node, entry);
+      if (cursor->types != NULL) {
+        intern_type(cursor->types, type_node);
+      }
+    }
     return type_node;
   } else {
-    error("Supposed '%s' is not a type.", type_token->value);
+    string_slice type_name = token_value(type_token, cursor);
+    parse_error(cursor, "Supposed '%.*s' is not a type.", (int)type_name.length, type_name.chars);
   }
 }
 
 // Parse structs
-node *parse_structure_type(scope_context context, token **token_pointer) {
-  expect_token(TOKEN_STRUCT, token_pointer);
-  node *struct_node = create_node(NODE_STRUCTURE);
-  token *current_token = peek_token(token_pointer);
+node *parse_structure_type(scope_context *context, token_cursor *cursor) {
+  expect_token(TOKEN_STRUCT, cursor);
+  node *struct_node = create_node(NODE_STRUCTURE, cursor);
+  token current_token = peek_token(cursor);
 
-  if (current_token->type == TOKEN_NAME) {
-    struct_node->structure.name = expect_token(TOKEN_NAME, token_pointer)->value;
+  if (current_token.type == TOKEN_NAME) {
+    struct_node->structure.name = expect_name(cursor);
   } else {
-    struct_node->structure.name = NULL;
+    struct_node->structure.name = NO_SYMBOL;
   }
 
-  expect_token(TOKEN_LEFT_BRACE, token_pointer);
-  struct_node->structure.members = collect_members(context, token_pointer);
-  expect_token(TOKEN_RIGHT_BRACE, token_pointer);
+  expect_token(TOKEN_LEFT_BRACE, cursor);
+  struct_node->structure.members = collect_members(context, cursor);
+  expect_token(TOKEN_RIGHT_BRACE, cursor);
+  lay_out_structure(struct_node);
+  struct_node->structure.id = NO_TYPE;
+  if (cursor->types != NULL) {
+    intern_type(cursor->types, struct_node);
+  }
   return struct_node;
 }
 
 // Parse a type like an `int**` or a `struct`, and nothing more
-node *parse_type(scope_context context, token **token_pointer) {
+node *parse_type(scope_context *context, token_cursor *cursor) {
   node *type_node = NULL;
-  token_type type = peek_token(token_pointer)->type;
+  token_type type = peek_token(cursor).type;
 
   assert(type < UNREASONABLE_TYPE_NUMBER);
 
   switch (type) {
   case TOKEN_STRUCT:
-    type_node = parse_structure_type(context, token_pointer);
+    type_node = parse_structure_type(context, cursor);
     break;
   case TOKEN_NAME:
-    type_node = parse_base_type(context, token_pointer);
+    type_node = parse_base_type(context, cursor);
     break;
   default:
-    error("Unknown type '%s', perhaps I haven't implemented it yet?", 
+    parse_error(cursor, "Unknown type '%s', perhaps I haven't implemented it yet?",
         token_type_to_string(type));
   }
 
-  type_node = parse_pointers(type_node, token_pointer);
+  type_node = parse_pointers(type_node, cursor);
 
   return type_node;
 }
@@ -223,40 +435,39 @@ node *parse_type(scope_context context, token **token_pointer) {
 // For structs, `struct Point {...};` is totally valid, not a variable declaration and is a type
 
 // Parses a type and possibly the expression after it
-node *parse_type_expression(scope_context context, token **token_pointer) {
-  node *type = parse_type(context, token_pointer);
+node *parse_type_expression(scope_context *context, token_cursor *cursor) {
+  node *type = parse_type(context, cursor);
   // The type variable is located in the same place for functions and variable_declarations
   // TODO: Make struct specific path where it can have no name, and it's just the type definition.
   // Structs can have no name
   if (type->type == NODE_STRUCTURE) {
     return type;
   }
-  node *type_expression = create_node(NODE_NONE);
+  node *type_expression = create_node(NODE_NONE, cursor);
   type_expression->variable_declaration.type = type;
-  type_expression->variable_declaration.name = expect_token(TOKEN_NAME, token_pointer)->value;
+  type_expression->variable_declaration.name = expect_name(cursor);
 
   assert(type_expression->variable_declaration.type != NULL);
 
-  switch (peek_token(token_pointer)->type) {
+  switch (peek_token(cursor).type) {
   case TOKEN_EQUALS:
-    expect_token(TOKEN_EQUALS, token_pointer);
+    expect_token(TOKEN_EQUALS, cursor);
     type_expression->type = NODE_VARIABLE_DECLARATION;
-    type_expression->variable_declaration.value = parse_expression(PRECEDENCE_ASSIGNMENT, token_pointer);
+    type_expression->variable_declaration.offset = NO_OFFSET;
+    type_expression->variable_declaration.value = parse_expression(PRECEDENCE_ASSIGNMENT, cursor);
     break;
   case TOKEN_COMMA:
-    type_expression->type = NODE_VARIABLE_DECLARATION;
-    type_expression->variable_declaration.value = NULL;
-    break;
   case TOKEN_SEMI_COLON:
+  case TOKEN_RIGHT_PARENTHESES: // Last function parameter // Last function parameter
     type_expression->type = NODE_VARIABLE_DECLARATION;
+    type_expression->variable_declaration.offset = NO_OFFSET;
     type_expression->variable_declaration.value = NULL;
     break;
   case TOKEN_LEFT_PARENTHESES:
-    type_expression = parse_function(type_expression, context, token_pointer);
+    type_expression = parse_function(type_expression, context, cursor);
     break;
   default:
-    error("Unknown token: '%s'", token_type_to_string(peek_token(token_pointer)->type));
-    return type_expression;
+    parse_error(cursor, "Unknown token: '%s'", token_type_to_string(peek_token(cursor).type));
   }
 
   assert(type_expression != NULL);
@@ -265,348 +476,303 @@ node *parse_type_expression(scope_context context, token **token_pointer) {
 
 // Parsing helpers
 
-precedence get_precedence(token_type type) {
-  precedence precedence = PRECEDENCE_ASSIGNMENT;
-  switch (type) {
-  default:
-    precedence = PRECEDENCE_NONE;
-    break;
-  // If there's a while(condition), the right parentheses should not be used in the loop
-  case TOKEN_RIGHT_PARENTHESES:
-    precedence = PRECEDENCE_NONE;
-    break;
-  case TOKEN_EQUALS:
-  case TOKEN_PLUS_EQUALS:
-  case TOKEN_MINUS_EQUALS:
-  case TOKEN_PLUS_PLUS:
-  case TOKEN_MINUS_MINUS:
-    precedence = PRECEDENCE_ASSIGNMENT;
-    break;
-  case TOKEN_OR:
-    precedence = PRECEDENCE_OR;
-    break;
-  case TOKEN_AND:
-    precedence = PRECEDENCE_AND;
-    break;
-  case TOKEN_EQUALS_EQUALS:
-  case TOKEN_NOT_EQUALS:
-    precedence = PRECEDENCE_EQUALITY;
-    break;
-  case TOKEN_LESS_THAN:
-  case TOKEN_GREATER_THAN:
-  case TOKEN_LESS_THAN_EQUALS:
-  case TOKEN_GREATER_THAN_EQUALS:
-    precedence = PRECEDENCE_COMPARISON;
-    break;
-  case TOKEN_PLUS:
-  case TOKEN_MINUS:
-    precedence = PRECEDENCE_TERM;
-    break;
-  case TOKEN_STAR:
-  case TOKEN_SLASH:
-    precedence = PRECEDENCE_FACTOR;
-    break;
-  case TOKEN_NOT:
-    precedence = PRECEDENCE_UNARY;
-    break;
-  case TOKEN_DOT:
-  case TOKEN_LEFT_PARENTHESES:
-    precedence = PRECEDENCE_CALL;
-    break;
-  case TOKEN_NAME:
-  case TOKEN_STRING:
-  case TOKEN_NUMBER:
-    precedence = PRECEDENCE_PRIMARY;
-    break;
-  }
-  return precedence;
-}
-
-operator_type get_binary_type(token_type type) {
-  operator_type operator;
-  switch (type) {
-  // All of these technically reassign a variable, but categories like ++ and -=
-  // must have their own edge cases to be parsed correctly
-  case TOKEN_EQUALS:
-  case TOKEN_PLUS_EQUALS:
-  case TOKEN_MINUS_EQUALS:
-  case TOKEN_PLUS_PLUS:
-  case TOKEN_MINUS_MINUS:
-    operator = OPERATOR_ASSIGN;
-    break;
-  case TOKEN_PLUS:
-    operator = OPERATOR_ADD;
-    break;
-  case TOKEN_MINUS:
-    operator = OPERATOR_SUBTRACT;
-    break;
-  case TOKEN_STAR:
-    operator = OPERATOR_MULTIPLY;
-    break;
-  case TOKEN_SLASH:
-    operator = OPERATOR_DIVIDE;
-    break;
-  case TOKEN_AMPERSAND:
-    operator = OPERATOR_AND;
-    break;
-  case TOKEN_PIPE:
-    operator = OPERATOR_OR;
-    break;
-  case TOKEN_CARET:
-    operator = OPERATOR_XOR;
-    break;
-  case TOKEN_NOT:
-    operator = OPERATOR_NOT;
-    break;
-  case TOKEN_NOT_EQUALS:
-    operator = OPERATOR_NOT_EQUALS;
-    break;
-  case TOKEN_EQUALS_EQUALS:
-    operator = OPERATOR_EQUALS_EQUALS;
-    break;
-  case TOKEN_LESS_THAN:
-    operator = OPERATOR_LESS_THAN;
-    break;
-  case TOKEN_LESS_THAN_EQUALS:
-    operator = OPERATOR_LESS_THAN_EQUALS;
-    break;
-  case TOKEN_GREATER_THAN:
-    operator = OPERATOR_GREATER_THAN;
-    break;
-  case TOKEN_GREATER_THAN_EQUALS:
-    operator = OPERATOR_GREATER_THAN_EQUALS;
-    break;
-  case TOKEN_AND:
-    operator = OPERATOR_BOOLEAN_AND;
-    break;
-  case TOKEN_OR:
-    operator = OPERATOR_BOOLEAN_OR;
-    break;
-  default:
-    error("Unknown operator '%s'\n", token_type_to_string(type));
-    operator = OPERATOR_ADD;
-    break;
-  }
-  return operator;
-}
-
-bool should_parse_unary(token_type type) {
-  switch (type) {
-  default:
-    return false;
-  case TOKEN_MINUS:
-  case TOKEN_PLUS:
-  case TOKEN_NOT:
-    return true;
-  }
-}
-
-node *create_equation_equals_equation_and_next(node *last_expression, node *next_expression, operator_type operator) {
+// Everything parse_expression needs to know about a token, in one lookup.
+// The table is generated from ITERATE_TOKENS_AND, so every token needs a
+// RULE_ line here (in the lexer's order) and a new token without one won't
+// compile. NO_RULE tokens can't be in an expression, and end it.
+#define NO_RULE {0}
+
+#define RULE_TOKEN_END NO_RULE
+
+#define RULE_TOKEN_VOLATILE NO_RULE
+#define RULE_TOKEN_UNSIGNED NO_RULE
+#define RULE_TOKEN_CONST NO_RULE
+#define RULE_TOKEN_REGISTER NO_RULE
+
+#define RULE_TOKEN_TRUE NO_RULE
+#define RULE_TOKEN_FALSE NO_RULE
+#define RULE_TOKEN_NULL NO_RULE
+
+#define RULE_TOKEN_SIZEOF NO_RULE
+#define RULE_TOKEN_TYPEOF NO_RULE
+#define RULE_TOKEN_TYPEDEF NO_RULE
+
+#define RULE_TOKEN_STRUCT NO_RULE
+#define RULE_TOKEN_ENUM NO_RULE
+#define RULE_TOKEN_UNION NO_RULE
+
+#define RULE_TOKEN_DO NO_RULE
+#define RULE_TOKEN_WHILE NO_RULE
+#define RULE_TOKEN_FOR NO_RULE
+#define RULE_TOKEN_BREAK NO_RULE
+#define RULE_TOKEN_CONTINUE NO_RULE
+
+#define RULE_TOKEN_IF NO_RULE
+#define RULE_TOKEN_ELSE NO_RULE
+#define RULE_TOKEN_SWITCH NO_RULE
+#define RULE_TOKEN_CASE NO_RULE
+#define RULE_TOKEN_DEFAULT NO_RULE
+
+#define RULE_TOKEN_INLINE NO_RULE
+
+#define RULE_TOKEN_NUMBER { .prefix = parse_number }
+#define RULE_TOKEN_STRING { .prefix = parse_string }
+#define RULE_TOKEN_NAME { .prefix = parse_variable_expression }
+
+// All of these reassign a variable, and they group right to left
+#define RULE_TOKEN_EQUALS { .infix = parse_binary, .precedence = PRECEDENCE_ASSIGNMENT, .operator = OPERATOR_ASSIGN }
+#define RULE_TOKEN_PLUS_EQUALS { .infix = parse_compound_assignment, .precedence = PRECEDENCE_ASSIGNMENT, .operator = OPERATOR_ADD }
+#define RULE_TOKEN_MINUS_EQUALS { .infix = parse_compound_assignment, .precedence = PRECEDENCE_ASSIGNMENT, .operator = OPERATOR_SUBTRACT }
+
+#define RULE_TOKEN_EQUALS_EQUALS { .infix = parse_binary, .precedence = PRECEDENCE_EQUALITY, .operator = OPERATOR_EQUALS_EQUALS }
+#define RULE_TOKEN_NOT { .prefix = parse_unary, .prefix_operator = OPERATOR_NOT }
+#define RULE_TOKEN_NOT_EQUALS { .infix = parse_binary, .precedence = PRECEDENCE_EQUALITY, .operator = OPERATOR_NOT_EQUALS }
+
+#define RULE_TOKEN_LESS_THAN { .infix = parse_binary, .precedence = PRECEDENCE_COMPARISON, .operator = OPERATOR_LESS_THAN }
+#define RULE_TOKEN_LESS_THAN_EQUALS { .infix = parse_binary, .precedence = PRECEDENCE_COMPARISON, .operator = OPERATOR_LESS_THAN_EQUALS }
+#define RULE_TOKEN_GREATER_THAN { .infix = parse_binary, .precedence = PRECEDENCE_COMPARISON, .operator = OPERATOR_GREATER_THAN }
+#define RULE_TOKEN_GREATER_THAN_EQUALS { .infix = parse_binary, .precedence = PRECEDENCE_COMPARISON, .operator = OPERATOR_GREATER_THAN_EQUALS }
+#define RULE_TOKEN_SHIFT_LEFT { .infix = parse_binary, .precedence = PRECEDENCE_SHIFT, .operator = OPERATOR_SHIFT_LEFT }
+#define RULE_TOKEN_SHIFT_RIGHT { .infix = parse_binary, .precedence = PRECEDENCE_SHIFT, .operator = OPERATOR_SHIFT_RIGHT }
+
+#define RULE_TOKEN_AMPERSAND { .prefix = parse_unary, .prefix_operator = OPERATOR_REFERENCE, .infix = parse_binary, .precedence = PRECEDENCE_BITWISE_AND, .operator = OPERATOR_AND }
+#define RULE_TOKEN_AND { .infix = parse_binary, .precedence = PRECEDENCE_AND, .operator = OPERATOR_BOOLEAN_AND }
+#define RULE_TOKEN_PIPE { .infix = parse_binary, .precedence = PRECEDENCE_BITWISE_OR, .operator = OPERATOR_OR }
+#define RULE_TOKEN_OR { .infix = parse_binary, .precedence = PRECEDENCE_OR, .operator = OPERATOR_BOOLEAN_OR }
+#define RULE_TOKEN_CARET { .infix = parse_binary, .precedence = PRECEDENCE_BITWISE_XOR, .operator = OPERATOR_XOR }
+
+#define RULE_TOKEN_PLUS { .prefix = parse_unary_plus, .infix = parse_binary, .precedence = PRECEDENCE_TERM, .operator = OPERATOR_ADD }
+#define RULE_TOKEN_PLUS_PLUS { .infix = parse_postfix, .precedence = PRECEDENCE_CALL, .operator = OPERATOR_ADD }
+#define RULE_TOKEN_MINUS { .prefix = parse_unary, .prefix_operator = OPERATOR_NEGATE, .infix = parse_binary, .precedence = PRECEDENCE_TERM, .operator = OPERATOR_SUBTRACT }
+#define RULE_TOKEN_MINUS_MINUS { .infix = parse_postfix, .precedence = PRECEDENCE_CALL, .operator = OPERATOR_SUBTRACT }
+#define RULE_TOKEN_STAR { .prefix = parse_unary, .prefix_operator = OPERATOR_DEREFERENCE, .infix = parse_binary, .precedence = PRECEDENCE_FACTOR, .operator = OPERATOR_MULTIPLY }
+#define RULE_TOKEN_SLASH { .infix = parse_binary, .precedence = PRECEDENCE_FACTOR, .operator = OPERATOR_DIVIDE }
+#define RULE_TOKEN_PERCENT { .infix = parse_binary, .precedence = PRECEDENCE_FACTOR, .operator = OPERATOR_MODULO }
+
+#define RULE_TOKEN_DOT { .infix = parse_struct_member_get, .precedence = PRECEDENCE_CALL }
+#define RULE_TOKEN_ARROW { .infix = parse_struct_member_dereference_get, .precedence = PRECEDENCE_CALL }
+#define RULE_TOKEN_COMMA NO_RULE
+#define RULE_TOKEN_SEMI_COLON NO_RULE
+#define RULE_TOKEN_COLON NO_RULE
+#define RULE_TOKEN_QUESTION { .infix = parse_ternary, .precedence = PRECEDENCE_TERNARY }
+#define RULE_TOKEN_LEFT_PARENTHESES { .prefix = parse_grouping, .infix = parse_function_call, .precedence = PRECEDENCE_CALL }
+#define RULE_TOKEN_RIGHT_PARENTHESES NO_RULE
+#define RULE_TOKEN_LEFT_BRACKET NO_RULE
+#define RULE_TOKEN_RIGHT_BRACKET NO_RULE
+#define RULE_TOKEN_LEFT_BRACE NO_RULE
+#define RULE_TOKEN_RIGHT_BRACE NO_RULE
+
+#define RULE_TOKEN_HASH NO_RULE
+#define RULE_TOKEN_HASH_HASH NO_RULE
+
+#define GENERATE_RULE(token) [token] = RULE_##token,
+static const parse_rule parse_rules[TOKEN_COUNT] = { ITERATE_TOKENS_AND(GENERATE_RULE) };
+
+node *create_equation_equals_equation_and_next(node *last_expression, node *next_expression, operator_type operator, token_cursor *cursor) {
   // i + <EXPRESSION>
-  node *plus_expression = create_node(NODE_EQUATION); // Idk what to name this
+  node *plus_expression = create_node(NODE_EQUATION, cursor); // Idk what to name this
   plus_expression->equation.operator = operator;
   plus_expression->equation.left = last_expression;
   plus_expression->equation.right = next_expression;
 
   // i = i + <EXPRESSION>
-  node *current_expression = create_node(NODE_EQUATION);
+  node *current_expression = create_node(NODE_EQUATION, cursor);
   current_expression->equation.operator = OPERATOR_ASSIGN;
   current_expression->equation.left = last_expression;
   current_expression->equation.right = plus_expression;
   return current_expression;
 }
 
-node *create_struct_member_get(node *from_expression, token **token_pointer) {
-  node *current_node = create_node(NODE_STRUCT_MEMBER_GET);
+node *create_struct_member_get(node *from_expression, token_cursor *cursor) {
+  node *current_node = create_node(NODE_STRUCT_MEMBER_GET, cursor);
   current_node->struct_member_get.from = from_expression;
   // Get the name from the next token, that is the member we're trying to get
-  current_node->struct_member_get.name = expect_token(TOKEN_NAME, token_pointer)->value;
+  current_node->struct_member_get.name = expect_name(cursor);
+  current_node->struct_member_get.offset = NO_OFFSET;
+  current_node->struct_member_get.member = NULL;
+  current_node->struct_member_get.through_pointer = false;
   return current_node;
 }
 
 // Parsing (yay finally after 350 lines!!!)
 
-node *parse_string(token **token_pointer) {
-  node *string_node = create_node(NODE_STRING);
-  string_node->string.value = expect_token(TOKEN_STRING, token_pointer)->value;
+node *parse_string(token_cursor *cursor) {
+  node *string_node = create_node(NODE_STRING, cursor);
+  string_node->string.value = token_value(expect_token(TOKEN_STRING, cursor), cursor);
+  if (cursor->copy_strings) {
+    char *copy = arena_allocate(cursor->nodes, string_node->string.value.length);
+    memcpy(copy, string_node->string.value.chars, string_node->string.value.length);
+    string_node->string.value.chars = copy;
+  }
   return string_node;
 }
 
-node *parse_number(token **token_pointer) {
-  node *number_node = create_node(NODE_NUMBER_LITERAL);
-  int value = atoi(expect_token(TOKEN_NUMBER, token_pointer)->value);
+node *parse_number(token_cursor *cursor) {
+  node *number_node = create_node(NODE_NUMBER_LITERAL, cursor);
+  string_slice digits = token_value(expect_token(TOKEN_NUMBER, cursor), cursor);
+  int value = 0;
+  for (uint32_t i = 0; i < digits.length; i++) {
+    value = value * 10 + (digits.chars[i] - '0');
+  }
   number_node->number_literal.value = value;
 
   return number_node;
 }
 
-// `i->foo.function()`
-node *parse_variable_expression(token **token_pointer) {
-  node *current_expression = create_node(NODE_VARIABLE);
-  current_expression->variable.name = expect_token(TOKEN_NAME, token_pointer)->value;
-
-  while(true) {
-    token *operator_token = peek_token(token_pointer);
-    switch (operator_token->type){
-    default:
-      return current_expression;
-    case TOKEN_ARROW:
-      expect_token(TOKEN_ARROW, token_pointer);
-      current_expression = parse_struct_member_dereference_get(current_expression, token_pointer);
-      break;
-    case TOKEN_DOT:
-      expect_token(TOKEN_DOT, token_pointer);
-      current_expression = parse_struct_member_get(current_expression, token_pointer);
-      break;
-    case TOKEN_LEFT_PARENTHESES:
-      expect_token(TOKEN_LEFT_PARENTHESES, token_pointer);
-      current_expression = parse_function_call(current_expression, token_pointer);
-      expect_token(TOKEN_RIGHT_PARENTHESES, token_pointer);
-      break;
-    }
-  }
+// `i` (the `->foo.function()` after it is parsed as infix)
+node *parse_variable_expression(token_cursor *cursor) {
+  node *current_expression = create_node(NODE_VARIABLE, cursor);
+  current_expression->variable.name = expect_name(cursor);
+  return current_expression;
 }
 
 // `variable.member` <- This last part
-node *parse_struct_member_get(node *from_expression, token **token_pointer) {
-  expect_token(TOKEN_DOT, token_pointer);
-  return create_struct_member_get(from_expression, token_pointer);
+node *parse_struct_member_get(node *from_expression, token_cursor *cursor) {
+  expect_token(TOKEN_DOT, cursor);
+  return create_struct_member_get(from_expression, cursor);
 }
 
-node *parse_struct_member_dereference_get(node *from_expression, token **token_pointer) {
-  node *current_expression = create_node(NODE_EQUATION);
+node *parse_struct_member_dereference_get(node *from_expression, token_cursor *cursor) {
+  expect_token(TOKEN_ARROW, cursor);
+  node *current_expression = create_node(NODE_EQUATION, cursor);
   current_expression->equation.operator = OPERATOR_DEREFERENCE;
-  current_expression->equation.left = create_struct_member_get(from_expression, token_pointer);
+  current_expression->equation.left = create_struct_member_get(from_expression, cursor);
+  current_expression->equation.left->struct_member_get.through_pointer = true;
   current_expression->equation.right = NULL;
   return current_expression;
 }
 
 // Parse the actual function
-node *parse_function(node *function_expression, scope_context context, token **token_pointer) {
-  expect_token(TOKEN_LEFT_PARENTHESES, token_pointer);
-  function_expression->function.parameters = collect_parameters(context, token_pointer);
-  expect_token(TOKEN_RIGHT_PARENTHESES, token_pointer);
-  function_expression->function.body = parse_block(context, token_pointer);
+node *parse_function(node *function_expression, scope_context *context, token_cursor *cursor) {
+  expect_token(TOKEN_LEFT_PARENTHESES, cursor);
+  function_expression->type = NODE_FUNCTION_DECLARATION;
+  function_expression->function.parameters = collect_parameters(context, cursor);
+  expect_token(TOKEN_RIGHT_PARENTHESES, cursor);
+  expect_token(TOKEN_LEFT_BRACE, cursor);
+  function_expression->function.lazy_body = NO_LAZY_BODY;
+  if (cursor->deferred != NULL && vector_size((vector *)&context->scope_starts) == 1) {
+    defer_body(function_expression, context, cursor);
+  } else {
+    function_expression->function.body = parse_block(context, cursor);
+  }
+  expect_token(TOKEN_RIGHT_BRACE, cursor);
   return function_expression;
 }
 
 // variable.function_pointer(expression, expression)
 // We don't care about what's after this call
-node *parse_function_call(node *from_expression, token **token_pointer) {
+node *parse_function_call(node *from_expression, token_cursor *cursor) {
   assert(from_expression != NULL);
+  expect_token(TOKEN_LEFT_PARENTHESES, cursor);
 
-  node *current_node = create_node(NODE_FUNCTION_CALL);
+  node *current_node = create_node(NODE_FUNCTION_CALL, cursor);
   current_node->function_call.function_expression = from_expression;
-  current_node->function_call.inputs = vector_create();
+  uint32_t inputs = start_list(cursor);
 
   // Loop till end or TOKEN_RIGHT_PARENTHESES
   // Example: `func(1 + 5 + a, "string");`
-  while (!is_at_end(token_pointer) && peek_token(token_pointer)->type != TOKEN_RIGHT_PARENTHESES) {
-    node *parameter_expression = parse_expression(PRECEDENCE_ASSIGNMENT, token_pointer);
-    vector_add(&current_node->function_call.inputs, parameter_expression);
-    assert(*(node **)vector_last(&current_node->function_call.inputs) == parameter_expression);
+  while (!is_at_end(cursor) && peek_token(cursor).type != TOKEN_RIGHT_PARENTHESES) {
+    node *parameter_expression = parse_expression(PRECEDENCE_ASSIGNMENT, cursor);
+    push_to_list(parameter_expression, cursor);
     // If we parse expression and token on right is anything but comma or parentheses, syntax error
-    if (peek_token(token_pointer)->type != TOKEN_RIGHT_PARENTHESES) {
-      expect_token(TOKEN_COMMA, token_pointer);
+    if (peek_token(cursor).type != TOKEN_RIGHT_PARENTHESES) {
+      expect_token(TOKEN_COMMA, cursor);
     }
   }
+  current_node->function_call.inputs = finish_list(inputs, cursor);
+  expect_token(TOKEN_RIGHT_PARENTHESES, cursor);
 
   return current_node;
 }
 
-node *parse_grouping(token **token_pointer) {
-  expect_token(TOKEN_LEFT_PARENTHESES, token_pointer);
-  node *expression = parse_expression(PRECEDENCE_ASSIGNMENT, token_pointer);
-  expect_token(TOKEN_RIGHT_PARENTHESES, token_pointer);
+node *parse_grouping(token_cursor *cursor) {
+  expect_token(TOKEN_LEFT_PARENTHESES, cursor);
+  node *expression = parse_expression(PRECEDENCE_ASSIGNMENT, cursor);
+  expect_token(TOKEN_RIGHT_PARENTHESES, cursor);
   return expression;
 }
 
-node *parse_binary(node *last_expression, token **token_pointer) {
-  token *operator_token = pop_token(token_pointer);
+// Assignment groups right to left (`a = b = c` is `a = (b = c)`), everything
+// else left to right
+precedence right_side_precedence(precedence operator_precedence) {
+  if (operator_precedence == PRECEDENCE_ASSIGNMENT) {
+    return operator_precedence;
+  }
+  return operator_precedence + 1;
+}
 
-  operator_type operator = get_binary_type(operator_token->type);
-  node *next_expression = parse_expression(get_precedence(operator_token->type) + 1, token_pointer);
+node *parse_binary(node *last_expression, token_cursor *cursor) {
+  token operator_token = pop_token(cursor);
+  const parse_rule *rule = &parse_rules[operator_token.type];
+  node *next_expression = parse_expression(right_side_precedence(rule->precedence), cursor);
 
   assert(last_expression != NULL);
   assert(next_expression != NULL);
-  assert(operator_token->type < UNREASONABLE_TYPE_NUMBER);
 
-  node *current_node = create_node(NODE_EQUATION);
+  node *current_node = create_node(NODE_EQUATION, cursor);
+  current_node->equation.operator = rule->operator;
+  current_node->equation.left = last_expression;
+  current_node->equation.right = next_expression;
+  return current_node;
+}
 
-  switch (operator_token->type) {
-  case TOKEN_PLUS_EQUALS:
-    current_node = create_equation_equals_equation_and_next(last_expression, next_expression, OPERATOR_ADD);
-    break;
-  case TOKEN_MINUS_EQUALS:
-    current_node = create_equation_equals_equation_and_next(last_expression, next_expression, OPERATOR_SUBTRACT);
-    break;
-  default:
-    current_node->equation.operator = operator;
-    current_node->equation.left = last_expression;
-    current_node->equation.right = next_expression;
-    break;
-  }
+// `i += 2` becomes `i = i + 2`
+node *parse_compound_assignment(node *last_expression, token_cursor *cursor) {
+  token operator_token = pop_token(cursor);
+  const parse_rule *rule = &parse_rules[operator_token.type];
+  node *next_expression = parse_expression(right_side_precedence(rule->precedence), cursor);
+
+  assert(last_expression != NULL);
+  assert(next_expression != NULL);
+
+  return create_equation_equals_equation_and_next(last_expression, next_expression, rule->operator, cursor);
+}
 
+// `condition ? success : fail`, which is an if that has a value, so it's
+// stored like one
+node *parse_ternary(node *condition, token_cursor *cursor) {
+  expect_token(TOKEN_QUESTION, cursor);
+  node *current_node = create_node(NODE_IF, cursor);
+  current_node->if_statement.condition = condition;
+  current_node->if_statement.success = parse_expression(PRECEDENCE_ASSIGNMENT, cursor);
+  expect_token(TOKEN_COLON, cursor);
+  // `a ? b : c ? d : e` is `a ? b : (c ? d : e)`
+  current_node->if_statement.fail = parse_expression(PRECEDENCE_TERNARY, cursor);
   return current_node;
 }
 
-node *parse_unary(token **token_pointer) {
-  token *operator_token = pop_token(token_pointer);
-  operator_type operator = OPERATOR_NEGATE;
-  assert(operator_token->type < UNREASONABLE_TYPE_NUMBER);
-  switch (operator_token->type) {
-  case TOKEN_PLUS:
-    // +NUMBER does nothing
-    return parse_expression(PRECEDENCE_UNARY, token_pointer);
-  case TOKEN_MINUS:
-    operator = OPERATOR_NEGATE;
-    break;
-  case TOKEN_NOT:
-    operator = OPERATOR_NOT;
-    break;
-  case TOKEN_STAR:
-    operator = OPERATOR_DEREFERENCE;
-    break;
-  default:
-    error("Unknown operator '%s'\n", token_type_to_string(operator_token->type));
-    return parse_expression(PRECEDENCE_UNARY, token_pointer);
-  }
+node *parse_unary(token_cursor *cursor) {
+  token operator_token = pop_token(cursor);
 
-  node *current_expression = create_node(NODE_EQUATION);
-  current_expression->equation.operator = operator;
-  current_expression->equation.left = parse_expression(PRECEDENCE_UNARY, token_pointer);
+  node *current_expression = create_node(NODE_EQUATION, cursor);
+  current_expression->equation.operator = parse_rules[operator_token.type].prefix_operator;
+  current_expression->equation.left = parse_expression(PRECEDENCE_UNARY, cursor);
   current_expression->equation.right = NULL;
   assert(current_expression->equation.left != NULL);
-  assert(current_expression->equation.right == NULL);
   return current_expression;
 }
 
-node *parse_postfix(node *last_expression, token **token_pointer) {
-  token *operator_token = pop_token(token_pointer);
-  operator_type operator = OPERATOR_SUBTRACT;
-  switch (operator_token->type) {
-  default:
-    error("Unknown operator '%s'\n", token_type_to_string(operator_token->type));
-    break;
-  case TOKEN_PLUS_PLUS:
-    operator = OPERATOR_ADD;
-    break;
-  case TOKEN_MINUS_MINUS:
-    operator = OPERATOR_SUBTRACT;
-    break;
-  }
+// +NUMBER does nothing
+node *parse_unary_plus(token_cursor *cursor) {
+  expect_token(TOKEN_PLUS, cursor);
+  return parse_expression(PRECEDENCE_UNARY, cursor);
+}
+
+node *parse_postfix(node *last_expression, token_cursor *cursor) {
+  token operator_token = pop_token(cursor);
+  operator_type operator = parse_rules[operator_token.type].operator;
   // `1`
-  node *one = create_node(NODE_NUMBER_LITERAL);
+  node *one = create_node(NODE_NUMBER_LITERAL, cursor);
   one->number_literal.value = 1;
 
   // `i + 1`
-  node *plus_expression = create_node(NODE_EQUATION); // Idk what to name this
+  node *plus_expression = create_node(NODE_EQUATION, cursor); // Idk what to name this
   plus_expression->equation.operator = operator;
   plus_expression->equation.left = last_expression;
   plus_expression->equation.right = one;
 
   // `i = i + 1`
-  node *current_expression = create_node(NODE_EQUATION);
+  node *current_expression = create_node(NODE_EQUATION, cursor);
   current_expression->equation.operator = OPERATOR_ASSIGN;
   current_expression->equation.left = last_expression;
   current_expression->equation.right = plus_expression;
@@ -614,161 +780,99 @@ node *parse_postfix(node *last_expression, token **token_pointer) {
 }
 
 
-node *switch_expression(node *last_expression, node *current_expression, token_type type, token **token_pointer) {
-  switch (type) {
-  case TOKEN_COMMA:
-  case TOKEN_SEMI_COLON:
-  case TOKEN_RIGHT_PARENTHESES:
-    // If this path is taken, it means a function overstepped it's boundaries and met
-    // a semicolon, right parentheses, or a comma. For now, an expression is numbers, variables, and function
-    // calls, and commas do not mean you can put several expressions in the same place.
-    error("This path is not supposed to be reached.");
-    break;
-
-  case TOKEN_NAME:
-    // TODO: Eventually, put "int" type expression parsing in here.
-    // We can check the semantics later, functions in functions are not a problem.
-    current_expression = parse_variable_expression(token_pointer);
-    break;
-
-  case TOKEN_STRING:
-    current_expression = parse_string(token_pointer);
-    break;
-
-  case TOKEN_NUMBER:
-    current_expression = parse_number(token_pointer);
-    break;
-
-  case TOKEN_LEFT_PARENTHESES:
-    current_expression = parse_grouping(token_pointer);
-    break;
-
-  case TOKEN_PLUS_PLUS:
-  case TOKEN_MINUS_MINUS:
-    current_expression = parse_postfix(last_expression, token_pointer);
-    break;
-
-  case TOKEN_EQUALS:
-  case TOKEN_PLUS_EQUALS:
-  case TOKEN_MINUS_EQUALS:
-  case TOKEN_EQUALS_EQUALS:
-  case TOKEN_NOT_EQUALS:
-  case TOKEN_LESS_THAN:
-  case TOKEN_LESS_THAN_EQUALS:
-  case TOKEN_GREATER_THAN:
-  case TOKEN_GREATER_THAN_EQUALS:
-  case TOKEN_AMPERSAND:
-  case TOKEN_AND:
-  case TOKEN_PIPE:
-  case TOKEN_OR:
-  case TOKEN_CARET:
-  case TOKEN_PLUS:
-  case TOKEN_MINUS:
-  case TOKEN_STAR:
-  case TOKEN_SLASH:
-  case TOKEN_PERCENT:
-    current_expression = parse_binary(last_expression, token_pointer);
-    break;
-
-  default:
-    // TODO: Better error handling
-    printf("Error when parsing expression: Unknown token '%s'\n", token_type_to_string(type));
-    return current_expression;
-  }
-  return current_expression;
-}
-
 // Used to be "parse_precedence" but I renamed it for clarity.
 // Parses equal or higher precedense values (to ensure correct evaluation order)
 // Example of what it will parse: variable.add_function(2, 3) * -12 + -i++
-node *parse_expression(precedence precedence, token **token_pointer) {
-  token *current_token = peek_token(token_pointer);
-
-  if (should_parse_unary(current_token->type)) {
-    return parse_unary(token_pointer);
+node *parse_expression(precedence precedence, token_cursor *cursor) {
+  token current_token = peek_token(cursor);
+  prefix_handler prefix = parse_rules[current_token.type].prefix;
+  // Everything that asks for an expression reads what it gets back, so
+  // there's no handing back nothing, the file just stops here
+  if (prefix == NULL) {
+    parse_error(cursor, "Expected an expression, got '%s'", token_type_to_string(current_token.type));
   }
+  node *current_expression = prefix(cursor);
 
-  node *current_expression = NULL;
-  node *last_expression = NULL;
-
-  while (precedence <= get_precedence(current_token->type)) {
-    current_expression = switch_expression(current_expression, last_expression, current_token->type, token_pointer);
-    last_expression = current_expression;
-    current_token = peek_token(token_pointer);
+  // Keep taking operators for as long as they bind at least as tight as ours
+  current_token = peek_token(cursor);
+  while (precedence <= parse_rules[current_token.type].precedence) {
+    current_expression = parse_rules[current_token.type].infix(current_expression, cursor);
+    current_token = peek_token(cursor);
   }
-  
   return current_expression;
 }
 
-node *parse_do_while(scope_context context, token **token_pointer) {
-  node *current_node = create_node(NODE_DO_WHILE);
-  expect_token(TOKEN_DO, token_pointer);
-  expect_token(TOKEN_LEFT_BRACE, token_pointer);
-  current_node->do_while_loop.body = parse_block(context, token_pointer);
-  expect_token(TOKEN_RIGHT_BRACE, token_pointer);
-  expect_token(TOKEN_WHILE, token_pointer);
-  expect_token(TOKEN_LEFT_PARENTHESES, token_pointer);
-  current_node->do_while_loop.condition = parse_expression(PRECEDENCE_ASSIGNMENT, token_pointer);
-  expect_token(TOKEN_RIGHT_PARENTHESES, token_pointer);
-  expect_token(TOKEN_SEMI_COLON, token_pointer);
+node *parse_do_while(scope_context *context, token_cursor *cursor) {
+  node *current_node = create_node(NODE_DO_WHILE, cursor);
+  expect_token(TOKEN_DO, cursor);
+  expect_token(TOKEN_LEFT_BRACE, cursor);
+  current_node->do_while_loop.body = parse_block(context, cursor);
+  expect_token(TOKEN_RIGHT_BRACE, cursor);
+  expect_token(TOKEN_WHILE, cursor);
+  expect_token(TOKEN_LEFT_PARENTHESES, cursor);
+  current_node->do_while_loop.condition = parse_expression(PRECEDENCE_ASSIGNMENT, cursor);
+  expect_token(TOKEN_RIGHT_PARENTHESES, cursor);
+  expect_token(TOKEN_SEMI_COLON, cursor);
   assert(current_node != NULL);
   return current_node;
 }
 
-node *parse_while(scope_context context, token **token_pointer) {
-  node *current_node = create_node(NODE_WHILE);
-  expect_token(TOKEN_WHILE, token_pointer);
-  expect_token(TOKEN_LEFT_PARENTHESES, token_pointer);
-  current_node->while_loop.condition = parse_expression(PRECEDENCE_ASSIGNMENT, token_pointer);
-  expect_token(TOKEN_RIGHT_PARENTHESES, token_pointer);
-  expect_token(TOKEN_LEFT_BRACE, token_pointer);
-  current_node->while_loop.body = parse_block(context, token_pointer);
-  expect_token(TOKEN_RIGHT_BRACE, token_pointer);
+node *parse_while(scope_context *context, token_cursor *cursor) {
+  node *current_node = create_node(NODE_WHILE, cursor);
+  expect_token(TOKEN_WHILE, cursor);
+  expect_token(TOKEN_LEFT_PARENTHESES, cursor);
+  current_node->while_loop.condition = parse_expression(PRECEDENCE_ASSIGNMENT, cursor);
+  expect_token(TOKEN_RIGHT_PARENTHESES, cursor);
+  expect_token(TOKEN_LEFT_BRACE, cursor);
+  current_node->while_loop.body = parse_block(context, cursor);
+  expect_token(TOKEN_RIGHT_BRACE, cursor);
   assert(current_node != NULL);
   return current_node;
 }
 
-node *parse_for(scope_context context, token **token_pointer) {
-  node *current_node = create_node(NODE_FOR);
-  expect_token(TOKEN_FOR, token_pointer);
-  expect_token(TOKEN_LEFT_PARENTHESES, token_pointer);
+node *parse_for(scope_context *context, token_cursor *cursor) {
+  node *current_node = create_node(NODE_FOR, cursor);
+  expect_token(TOKEN_FOR, cursor);
+  expect_token(TOKEN_LEFT_PARENTHESES, cursor);
   // `int i = 0;`
-  if (is_type(peek_token(token_pointer)->value, context)) {
-    current_node->for_loop.index_declaration = parse_type_expression(context, token_pointer);
+  token current_token = peek_token(cursor);
+  if (current_token.type == TOKEN_NAME && is_type(current_token.symbol, context)) {
+    current_node->for_loop.index_declaration = parse_type_expression(context, cursor);
+    expect_token(TOKEN_SEMI_COLON, cursor);
   } else {
-    current_node->for_loop.index_declaration = parse_expression(PRECEDENCE_ASSIGNMENT, token_pointer);
-    expect_token(TOKEN_SEMI_COLON, token_pointer);
+    current_node->for_loop.index_declaration = parse_expression(PRECEDENCE_ASSIGNMENT, cursor);
+    expect_token(TOKEN_SEMI_COLON, cursor);
   }
   assert(current_node->for_loop.index_declaration->type == NODE_VARIABLE_DECLARATION);
-  current_node->for_loop.condition = parse_expression(PRECEDENCE_ASSIGNMENT, token_pointer);
-  expect_token(TOKEN_SEMI_COLON, token_pointer);
+  current_node->for_loop.condition = parse_expression(PRECEDENCE_ASSIGNMENT, cursor);
+  expect_token(TOKEN_SEMI_COLON, cursor);
   assert(current_node->for_loop.condition->type == NODE_EQUATION);
   // `i++;`
-  current_node->for_loop.index_assignment = parse_expression(PRECEDENCE_ASSIGNMENT, token_pointer);
+  current_node->for_loop.index_assignment = parse_expression(PRECEDENCE_ASSIGNMENT, cursor);
   assert(current_node->for_loop.index_assignment->equation.operator == OPERATOR_ASSIGN);
-  expect_token(TOKEN_RIGHT_PARENTHESES, token_pointer);
-  expect_token(TOKEN_LEFT_BRACE, token_pointer);
-  current_node->for_loop.body = parse_block(context, token_pointer);
-  expect_token(TOKEN_RIGHT_BRACE, token_pointer);
+  expect_token(TOKEN_RIGHT_PARENTHESES, cursor);
+  expect_token(TOKEN_LEFT_BRACE, cursor);
+  current_node->for_loop.body = parse_block(context, cursor);
+  expect_token(TOKEN_RIGHT_BRACE, cursor);
   assert(current_node != NULL);
   return current_node;
 }
 
 // if(condition) {}  (NO IF-ELSE STATEMENTS RN)
-node *parse_if(scope_context context, token **token_pointer) {
-  node *current_node = create_node(NODE_IF);
-  expect_token(TOKEN_IF, token_pointer);
-  expect_token(TOKEN_LEFT_PARENTHESES, token_pointer);
-  current_node->if_statement.condition = parse_expression(PRECEDENCE_ASSIGNMENT, token_pointer);
-  expect_token(TOKEN_RIGHT_PARENTHESES, token_pointer);
-  expect_token(TOKEN_LEFT_BRACE, token_pointer);
-  current_node->if_statement.success = parse_block(context, token_pointer);
-  expect_token(TOKEN_RIGHT_BRACE, token_pointer);
-  if (peek_token(token_pointer)->type == TOKEN_ELSE) {
-    expect_token(TOKEN_ELSE, token_pointer);
-    expect_token(TOKEN_LEFT_BRACE, token_pointer);
-    current_node->if_statement.fail = parse_block(context, token_pointer);
-    expect_token(TOKEN_RIGHT_BRACE, token_pointer);
+node *parse_if(scope_context *context, token_cursor *cursor) {
+  node *current_node = create_node(NODE_IF, cursor);
+  expect_token(TOKEN_IF, cursor);
+  expect_token(TOKEN_LEFT_PARENTHESES, cursor);
+  current_node->if_statement.condition = parse_expression(PRECEDENCE_ASSIGNMENT, cursor);
+  expect_token(TOKEN_RIGHT_PARENTHESES, cursor);
+  expect_token(TOKEN_LEFT_BRACE, cursor);
+  current_node->if_statement.success = parse_block(context, cursor);
+  expect_token(TOKEN_RIGHT_BRACE, cursor);
+  if (peek_token(cursor).type == TOKEN_ELSE) {
+    expect_token(TOKEN_ELSE, cursor);
+    expect_token(TOKEN_LEFT_BRACE, cursor);
+    current_node->if_statement.fail = parse_block(context, cursor);
+    expect_token(TOKEN_RIGHT_BRACE, cursor);
   } else {
     current_node->if_statement.fail = NULL;
   }
@@ -776,221 +880,441 @@ node *parse_if(scope_context context, token **token_pointer) {
   return current_node;
 }
 
+// One statement of a block (anything but a typedef, which only changes the
+// scope). Whatever it made for the tree comes back.
+node *parse_statement(scope_context *context, token_cursor *cursor) {
+  node *current_node = NULL;
+  token current_token = peek_token(cursor);
+  switch (current_token.type) {
+  case TOKEN_END:
+    expect_token(TOKEN_END, cursor);
+    current_node = create_node(NODE_END, cursor);
+    break;
+
+  case TOKEN_STRUCT:
+    current_node = parse_type_expression(context, cursor);
+    expect_token(TOKEN_SEMI_COLON, cursor);
+    break;
+
+  case TOKEN_DO:
+    current_node = parse_do_while(context, cursor);
+    break;
+  case TOKEN_WHILE:
+    current_node = parse_while(context, cursor);
+    break;
+  case TOKEN_FOR:
+    current_node = parse_for(context, cursor);
+    break;
+
+  case TOKEN_IF:
+    current_node = parse_if(context, cursor);
+    break;
+
+  case TOKEN_LEFT_BRACE:
+    expect_token(TOKEN_LEFT_BRACE, cursor);
+    current_node = parse_block(context, cursor);
+    expect_token(TOKEN_RIGHT_BRACE, cursor);
+    break;
+  default:
+    if (current_token.type == TOKEN_NAME && is_type(current_token.symbol, context)) {
+      current_node = parse_type_expression(context, cursor);
+      // Functions end at their brace, variables need a semicolon
+      if (current_node->type == NODE_VARIABLE_DECLARATION) {
+        expect_token(TOKEN_SEMI_COLON, cursor);
+      }
+    } else {
+      current_node = parse_expression(PRECEDENCE_ASSIGNMENT, cursor);
+      expect_token(TOKEN_SEMI_COLON, cursor);
+    }
+    break;
+  }
+  assert(current_node != NULL);
+  return current_node;
+}
+
 // Parses a block of tokens between (and excluding) braces, and turns it into an abstract syntax tree.
-node *parse_block(scope_context context, token **token_pointer) {
-  assert(vector_size((vector *)&context.typedef_hashmaps) > 0);
-  assert(context.depth < UNREASONABLE_CONTEXT_NUMBER);
-  assert(token_pointer != NULL);
+node *parse_block(scope_context *context, token_cursor *cursor) {
+  assert(context != NULL);
+  assert(cursor != NULL);
 
-  // Create new scope space
-  context.depth += 1;
-  create_or_clear_context(context);
+  // Types made in here are gone once the block ends
+  enter_scope(context);
 
-  node *ast = create_node(NODE_BLOCK);
-  ast->block.nodes = vector_create();
-  node *current_node = NULL;
-  token *current_token = peek_token(token_pointer);
+  node *ast = create_node(NODE_BLOCK, cursor);
+  uint32_t statements = start_list(cursor);
+  token current_token = peek_token(cursor);
 
   // Keep parsing individual statements until end of scope
-  while (current_token->type != TOKEN_END && current_token->type != TOKEN_RIGHT_BRACE) {
-    switch (current_token->type) {
-    case TOKEN_END:
-      expect_token(TOKEN_END, token_pointer);
-      current_node = create_node(NODE_END);
-      break;
-
-    case TOKEN_TYPEDEF:
-      parse_typedef(context, token_pointer);
-      break;
-
-    case TOKEN_STRUCT:
-      current_node = parse_type_expression(context, token_pointer);
-      expect_token(TOKEN_SEMI_COLON, token_pointer);
-      break;
-
-    case TOKEN_DO:
-      current_node = parse_do_while(context, token_pointer);
-      break;
-    case TOKEN_WHILE:
-      current_node = parse_while(context, token_pointer);
-      break;
-    case TOKEN_FOR:
-      current_node = parse_for(context, token_pointer);
-      break;
-
-    case TOKEN_IF:
-      current_node = parse_if(context, token_pointer);
-      break;
-
-    case TOKEN_LEFT_BRACE:
-      expect_token(TOKEN_LEFT_BRACE, token_pointer);
-      current_node = parse_block(context, token_pointer);
-      break;
-    default:
-      if (is_type(current_token->value, context)) {
-        current_node = parse_type_expression(context, token_pointer);
-      } else {
-        current_node = parse_expression(PRECEDENCE_ASSIGNMENT, token_pointer);
-        expect_token(TOKEN_SEMI_COLON, token_pointer);
-      }
-      break;
+  while (current_token.type != TOKEN_END && current_token.type != TOKEN_RIGHT_BRACE) {
+    if (current_token.type == TOKEN_TYPEDEF) {
+      // Typedefs only change the scope, nothing goes in the tree
+      parse_typedef(context, cursor);
+    } else {
+      push_to_list(parse_statement(context, cursor), cursor);
+    }
+    current_token = peek_token(cursor);
+  }
+
+  // Bodies skipped at the top level get parsed now (or put away for later),
+  // before leaving the top level takes away the types they can see
+  bool top_level = vector_size((vector *)&context->scope_starts) == 1;
+  if (cursor->deferred != NULL && top_level) {
+    if (cursor->lazy != NULL) {
+      keep_lazy_bodies(context, cursor);
+    } else {
+      parse_deferred_bodies(context, cursor);
+    }
+  }
+  // Builtins too, so a scope made out of these is everything the top level saw
+  if (cursor->kept_types != NULL && top_level) {
+    for (uint32_t i = 0; i < vector_size((vector *)&context->bindings); i++) {
+      vector_add(&cursor->kept_types, context->bindings[i]);
     }
-    assert(current_node != NULL);
-    vector_add(&ast->block.nodes, current_node);
-    current_token = peek_token(token_pointer);
   }
 
+  ast->block.nodes = finish_list(statements, cursor);
+  exit_scope(context);
   return ast;
 }
 
-// Just puts a type into the type hashmap
-void parse_typedef(scope_context context, token **token_pointer) {
-  expect_token(TOKEN_TYPEDEF, token_pointer); 
-  node *type = parse_type(context, token_pointer);
+// Just puts a type into the type hashmap, with its size worked out once
+void parse_typedef(scope_context *context, token_cursor *cursor) {
+  expect_token(TOKEN_TYPEDEF, cursor); 
+  node *type = parse_type(context, cursor);
+  type_layout layout = layout_of_type(type);
 
   typedef_entry entry = {
     .type = type,
-    .name = expect_token(TOKEN_NAME, token_pointer)->value,
-    .size_bytes = 8, // TODO: Calculate bytes by looking at all the base types inside of the type node
+    .name = expect_name(cursor),
+    .size_bytes = layout.size_bytes,
+    .alignment = layout.alignment,
   };
   add_type_to_context(entry, context);
+  expect_token(TOKEN_SEMI_COLON, cursor);
 }
 
-void print_indents(int indent_level) {
-  for (int i = 0; i < indent_level; i++) {
-    putchar('\t');
-  }
+// Jumps straight to the body's closing brace (the lexer paired them up), without
+// parsing anything, and leaves a note to come back to it
+void defer_body(node *function_expression, scope_context *context, token_cursor *cursor) {
+  deferred_body body = {
+    .function = function_expression,
+    .start = cursor->position,
+    .end = token_stream_matching_brace(cursor->tokens, cursor->position - 1),
+    .visible_bindings = vector_size((vector *)&context->bindings),
+  };
+  cursor->position = body.end;
+  function_expression->function.body = NULL;
+  vector_add(&cursor->deferred, body);
 }
 
-void print_block(node *ast, int indent_level) {
-  if (ast == NULL) {
-    return;
+// A run of deferred bodies that one task parses, into an arena of its own
+typedef struct {
+  const token_cursor *from;
+  const scope_context *top_level;
+  deferred_body *bodies;
+  uint32_t count;
+  arena nodes;
+  type_table *types; // In `nodes`, on top of the top level's, only types the top level didn't have
+  uint32_t error_count;
+  bool failed;
+  uint64_t counted[COUNTER_COUNT]; // Counters are per thread, these move to the thread the parse is for
+} body_chunk;
+
+// Bodies in a chunk add up to about this many tokens, unless there's a lot
+// more work than workers
+#define CHUNK_TOKENS 4096
+
+static void parse_body_chunk(void *argument) {
+  body_chunk *chunk = argument;
+  uint64_t counted_before[COUNTER_COUNT];
+  memcpy(counted_before, counters, sizeof(counted_before));
+
+  chunk->nodes = arena_create();
+  scope_context context = create_scope_context();
+  context.parent = chunk->top_level;
+
+  token_cursor cursor = *chunk->from;
+  cursor.nodes = &chunk->nodes;
+  cursor.pending = (node_stack){ .nodes = NULL, .count = 0, .capacity = 0 };
+  cursor.error_count = 0;
+  cursor.pool = NULL;
+  cursor.deferred = NULL;
+  cursor.lazy = NULL;
+  chunk->types = type_table_create(&chunk->nodes, chunk->from->types);
+  cursor.types = chunk->types;
+  jmp_buf bail;
+  cursor.bail = &bail;
+
+  if (setjmp(bail) == 0) {
+    for (uint32_t i = 0; i < chunk->count; i++) {
+      deferred_body *body = &chunk->bodies[i];
+      cursor.position = body->start;
+      context.parent_bindings = body->visible_bindings;
+      body->function->function.body = parse_block(&context, &cursor);
+      if (cursor.position != body->end) {
+        parse_error(&cursor, "Function body didn't end at its closing brace");
+      }
+    }
+  } else {
+    chunk->failed = true;
   }
 
-  print_indents(indent_level); printf("%s\n", node_type_to_string(ast->type));
+  chunk->error_count = cursor.error_count;
+  free_cursor(&cursor);
+  free_scope_context(&context);
+  arena_disown(&chunk->nodes);
+  for (int i = 0; i < COUNTER_COUNT; i++) {
+    chunk->counted[i] = counters[i] - counted_before[i];
+    counters[i] = counted_before[i];
+  }
+}
 
-  switch (ast->type) {
-  default:
-    error("Undefined node '%s'.", node_type_to_string(ast->type));
-    break;
-  case NODE_BLOCK:
-    for (int i = 0; i < (int)vector_size((vector *)&ast->block.nodes); i++) {
-      print_block(ast->block.nodes[i], indent_level + 1);
+// Splits the bodies into chunks, parses them on the pool (this thread helps),
+// and takes their nodes into the cursor's arena. The AST comes out the same
+// as parsing them in order would've made it, and so do its types: the ones
+// a chunk made get merged in chunk order, and a body whose chunk made one
+// another chunk made first gets pointed at that one instead.
+void parse_deferred_bodies(const scope_context *context, token_cursor *cursor) {
+  uint32_t body_count = vector_size((vector *)&cursor->deferred);
+  if (body_count == 0) {
+    return;
+  }
+  uint64_t total_tokens = 0;
+  for (uint32_t i = 0; i < body_count; i++) {
+    total_tokens += cursor->deferred[i].end - cursor->deferred[i].start;
+  }
+  // A few chunks per worker, so one that's slow can be made up for
+  uint64_t chunk_tokens = total_tokens / (cursor->pool->worker_count * 4);
+  chunk_tokens = chunk_tokens > CHUNK_TOKENS ? chunk_tokens : CHUNK_TOKENS;
+
+  body_chunk *chunks = memory_allocate(sizeof(body_chunk) * body_count);
+  uint32_t chunk_count = 0;
+  for (uint32_t i = 0; i < body_count;) {
+    body_chunk *chunk = &chunks[chunk_count++];
+    *chunk = (body_chunk){ .from = cursor, .top_level = context, .bodies = &cursor->deferred[i] };
+    uint64_t tokens = 0;
+    while (i < body_count && (chunk->count == 0 || tokens < chunk_tokens)) {
+      tokens += cursor->deferred[i].end - cursor->deferred[i].start;
+      chunk->count += 1;
+      i += 1;
     }
-    break;
-  case NODE_STRING:
-    print_indents(indent_level); printf(": \""); vector_print_string(&ast->string.value); printf("\"\n");
-    break;
-  case NODE_NUMBER_LITERAL:
-    print_indents(indent_level); printf(": %d\n", ast->number_literal.value);
-    break;
-  case NODE_VARIABLE:
-    print_indents(indent_level); printf(": "); vector_print_string(&ast->variable.name); printf("\n");
-    break;
-  case NODE_STRUCTURE:
-    if (ast->structure.name != NULL) {
-      print_indents(indent_level); printf(": "); vector_print_string(&ast->structure.name); printf("\n");
+  }
+
+  task_group group = { .remaining = 0 };
+  for (uint32_t i = 0; i < chunk_count; i++) {
+    pool_submit_to_group(cursor->pool, &group, parse_body_chunk, &chunks[i]);
+  }
+  pool_wait_for_group(cursor->pool, &group);
+
+  bool failed = false;
+  for (uint32_t i = 0; i < chunk_count; i++) {
+    arena_adopt(cursor->nodes, &chunks[i].nodes);
+    cursor->error_count += chunks[i].error_count;
+    failed |= chunks[i].failed;
+    for (int counter = 0; counter < COUNTER_COUNT; counter++) {
+      counters[counter] += chunks[i].counted[counter];
     }
-    for (int i = 0; i < (int)vector_size((vector *)&ast->structure.members); i++) {
-      print_block(ast->structure.members[i], indent_level + 1);
+  }
+  for (uint32_t i = 0; i < chunk_count && !failed; i++) {
+    if (merge_types(cursor->types, chunks[i].types)) {
+      for (uint32_t body = 0; body < chunks[i].count; body++) {
+        redirect_merged_types(chunks[i].bodies[body].function->function.body, chunks[i].types);
+      }
     }
-    break;
-  case NODE_EQUATION:
-    print_indents(indent_level); printf(": %s\n", operator_type_to_string(ast->equation.operator));
+  }
+  memory_free(chunks);
+  if (failed) {
+    longjmp(*cursor->bail, 1);
+  }
+}
 
-    print_block(ast->equation.left, indent_level + 1);
-    print_block(ast->equation.right, indent_level + 1);
-    break;
-  case NODE_POINTER:
-    print_block(ast->pointer.to, indent_level + 1);
-    break;
-  case NODE_BASE_TYPE:
-    print_indents(indent_level); printf(": "); vector_print_string(&ast->base_type.name); printf("\n");
-    break;
-  case NODE_FUNCTION_CALL: 
-    print_indents(indent_level); printf("Inputs:\n");
-    for (int i = 0; i < (int)vector_size((vector *)&ast->function_call.inputs); i++) {
-      print_block(ast->function_call.inputs[i], indent_level + 1);
-    }
+// Hands the skipped bodies over to cursor->lazy, along with a copy of the top
+// level's types (the real ones are about to be popped)
+void keep_lazy_bodies(const scope_context *context, token_cursor *cursor) {
+  lazy_bodies *lazy = cursor->lazy;
+  lazy->bodies = cursor->deferred;
+  cursor->deferred = NULL;
+  for (uint32_t i = 0; i < vector_size((vector *)&lazy->bodies); i++) {
+    lazy->bodies[i].function->function.lazy_body = i;
+  }
 
-    print_indents(indent_level); printf("Body:\n"); 
-    print_block(ast->function_call.function_expression, indent_level + 1);
-    break;
-  case NODE_WHILE:
-    print_indents(indent_level); printf("Condition:\n"); 
-    print_block(ast->while_loop.condition, indent_level + 1);
-    print_indents(indent_level); printf("Body:\n"); 
-    print_block(ast->while_loop.body, indent_level + 1);
-    break;
-  case NODE_DO_WHILE:
-    print_indents(indent_level); printf("Condition:\n"); 
-    print_block(ast->do_while_loop.condition, indent_level + 1);
-    print_indents(indent_level); printf("Body:\n"); 
-    print_block(ast->do_while_loop.body, indent_level + 1);
-    break;
-  case NODE_FOR:
-    print_indents(indent_level); printf("Index Declaration:\n"); 
-    print_block(ast->for_loop.index_declaration, indent_level + 1);
-    print_indents(indent_level); printf("Condition:\n"); 
-    print_block(ast->for_loop.condition, indent_level + 1);
-    print_indents(indent_level); printf("Index Reassignment:\n"); 
-    print_block(ast->for_loop.index_assignment, indent_level + 1);
-    print_indents(indent_level); printf("Body:\n"); 
-    print_block(ast->for_loop.body, indent_level + 1);
-    break;
-  case NODE_IF:
-    print_indents(indent_level); printf("Condition:\n"); 
-    print_block(ast->if_statement.condition, indent_level + 1);
-    print_indents(indent_level); printf("Success Path:\n"); 
-    print_block(ast->if_statement.success, indent_level + 1);
-    if (ast->if_statement.fail != NULL) {
-      print_indents(indent_level); printf("Fail Path:\n"); 
-      print_block(ast->if_statement.fail, indent_level + 1);
+  // Adding the bindings back in the order they were made leaves every name
+  // pointing at its newest one, same as the original
+  lazy->top_level = create_scope_context();
+  lazy->top_level.parent = context->parent;
+  lazy->top_level.parent_bindings = context->parent_bindings;
+  for (uint32_t i = 0; i < vector_size((vector *)&context->bindings); i++) {
+    vector_add(&lazy->top_level.bindings, context->bindings[i]);
+    hashmap_set(lazy->top_level.visible, &(scope_entry){ .name = context->bindings[i].name, .binding = i });
+  }
+
+  lazy->cursor = *cursor;
+  lazy->cursor.pending = (node_stack){ .nodes = NULL, .count = 0, .capacity = 0 };
+  lazy->cursor.error_count = 0;
+  lazy->cursor.bail = NULL;
+  lazy->cursor.pool = NULL;
+  lazy->cursor.lazy = NULL;
+}
+
+// Lazy bodies
+
+// Parses a function's body if it's still waiting, and hands it back. A body
+// that doesn't parse comes back NULL, and isn't tried again.
+node *function_body(lazy_bodies *lazy, node *function) {
+  assert(function->type == NODE_FUNCTION_DECLARATION);
+  if (function->function.lazy_body == NO_LAZY_BODY) {
+    return function->function.body;
+  }
+  deferred_body *body = &lazy->bodies[function->function.lazy_body];
+  function->function.lazy_body = NO_LAZY_BODY;
+
+  scope_context context = create_scope_context();
+  context.parent = &lazy->top_level;
+  context.parent_bindings = body->visible_bindings;
+  token_cursor *cursor = &lazy->cursor;
+  cursor->position = body->start;
+  cursor->pending.count = 0;
+  jmp_buf bail;
+  cursor->bail = &bail;
+
+  if (setjmp(bail) == 0) {
+    function->function.body = parse_block(&context, cursor);
+    if (cursor->position != body->end) {
+      parse_error(cursor, "Function body didn't end at its closing brace");
     }
-    break;
-  case NODE_VARIABLE_DECLARATION:
-    print_indents(indent_level); printf("Type:\n"); 
-    print_block(ast->variable_declaration.type, indent_level + 1);
-    print_indents(indent_level); printf("Name:\n"); 
-    print_indents(indent_level); printf(": "); vector_print_string(&ast->variable_declaration.name); printf("\n");
-    print_block(ast->variable_declaration.value, indent_level + 1);
-    break;
+  } else {
+    function->function.body = NULL;
   }
+  cursor->bail = NULL;
+  free_scope_context(&context);
+  return function->function.body;
 }
 
+// Parses the body of `entry`, and of everything it can end up calling, and
+// leaves the rest alone. Calls are found in the tokens, any name right before
+// a '(' counts. Gives back how many bodies got parsed.
+uint32_t parse_reachable_bodies(lazy_bodies *lazy, symbol_id entry) {
+  TIME_SCOPE("parse bodies");
+  uint32_t body_count = lazy->bodies != NULL ? vector_size((vector *)&lazy->bodies) : 0;
+  if (body_count == 0) {
+    return 0;
+  }
+  const token_stream *tokens = lazy->cursor.tokens;
 
-// Takes in tokens, outputs an Abstract Syntax Tree (AST)
-node *parser(token *tokens) {
-  // Check if token at end is end token.
-  assert(((token *)vector_last(&tokens))->type == TOKEN_END);
+  // Symbols are numbered from 0 up, so an array finds a function by name
+  uint32_t symbols = symbol_count(lazy->cursor.symbols);
+  uint32_t *body_of_symbol = memory_allocate(sizeof(uint32_t) * symbols);
+  for (uint32_t i = 0; i < symbols; i++) {
+    body_of_symbol[i] = NO_LAZY_BODY;
+  }
+  for (uint32_t i = 0; i < body_count; i++) {
+    body_of_symbol[lazy->bodies[i].function->function.name] = i;
+  }
 
-  // Pointer to pointer so we can store state of which token we're on
-  token **token_pointer = &tokens;
+  // Every body goes on the stack at most once
+  bool *reached = memory_allocate(sizeof(bool) * body_count);
+  memset(reached, 0, sizeof(bool) * body_count);
+  uint32_t *stack = memory_allocate(sizeof(uint32_t) * body_count);
+  uint32_t stack_count = 0;
+  if (entry < symbols && body_of_symbol[entry] != NO_LAZY_BODY) {
+    reached[body_of_symbol[entry]] = true;
+    stack[stack_count++] = body_of_symbol[entry];
+  }
 
-  scope_context context = {
-    .typedef_hashmaps = vector_create(),
-    .depth = 0,
-  };
+  uint32_t parsed = 0;
+  while (stack_count > 0) {
+    deferred_body *body = &lazy->bodies[stack[--stack_count]];
+    function_body(lazy, body->function);
+    parsed += 1;
+    for (uint32_t i = body->start; i + 1 < body->end; i++) {
+      if (tokens->types[i] != TOKEN_NAME || tokens->types[i + 1] != TOKEN_LEFT_PARENTHESES) {
+        continue;
+      }
+      symbol_id callee = tokens->lengths[i];
+      uint32_t callee_body = callee < symbols ? body_of_symbol[callee] : NO_LAZY_BODY;
+      if (callee_body != NO_LAZY_BODY && !reached[callee_body]) {
+        reached[callee_body] = true;
+        stack[stack_count++] = callee_body;
+      }
+    }
+  }
 
-  create_or_clear_context(context);
+  memory_free(body_of_symbol);
+  memory_free(reached);
+  memory_free(stack);
+  return parsed;
+}
+
+// Bodies that never got asked for just stay NULL
+void free_lazy_bodies(lazy_bodies *lazy) {
+  if (lazy->bodies != NULL) {
+    vector_free((vector *)&lazy->bodies);
+    lazy->bodies = NULL;
+  }
+  if (lazy->top_level.visible != NULL) {
+    free_scope_context(&lazy->top_level);
+  }
+  free_cursor(&lazy->cursor);
+}
 
+// Builtins go in before any scope opens, so nothing can pop them
+void add_builtin_types(scope_context *context, symbol_table *symbols) {
   typedef_entry int_entry = {
-    .name = _vector_from("int", sizeof(char), 4),
+    .name = intern_symbol(symbols, SLICE("int")),
     .size_bytes = 4,
+    .alignment = 4,
     .type = NULL,
   };
   typedef_entry char_entry = {
-    .name = _vector_from("char", sizeof(char), 5),
+    .name = intern_symbol(symbols, SLICE("char")),
     .size_bytes = 1,
+    .alignment = 1,
     .type = NULL,
   }; 
-
   add_type_to_context(int_entry, context);
   add_type_to_context(char_entry, context);
+}
+
+// Takes in tokens, outputs an Abstract Syntax Tree (AST)
+node *parser(token_cursor *cursor) {
+  TIME_SCOPE("parse");
+  scope_context context = create_scope_context();
+  // A starting scope already has the builtins, in front of whatever it added
+  if (cursor->starting_scope != NULL) {
+    context.parent = cursor->starting_scope;
+    context.parent_bindings = vector_size((vector *)&cursor->starting_scope->bindings);
+  } else {
+    add_builtin_types(&context, cursor->symbols);
+  }
+  // In the arena, so lazy bodies parsed after this returns can carry on with it
+  if (cursor->types == NULL) {
+    cursor->types = type_table_create(cursor->nodes, NULL);
+  }
 
-  node *ast = parse_block(context, token_pointer);
+  // Errors the parser can't get past land back here, with whatever scopes
+  // and half-built lists they left behind
+  jmp_buf bail;
+  cursor->bail = &bail;
+  // With a pool, function bodies wait till the top level is done, then get
+  // parsed all at once. Lazily, they wait till someone asks for them. Both
+  // need tokens that can be jumped around in.
+  if (cursor->lazy != NULL) {
+    *cursor->lazy = (lazy_bodies){ .bodies = NULL, .top_level = { .visible = NULL }, .cursor = { .pending = { .nodes = NULL } } };
+  }
+  if ((cursor->pool != NULL || cursor->lazy != NULL) && cursor->tokens != NULL) {
+    cursor->deferred = vector_create();
+  }
+  node *ast = NULL;
+  if (setjmp(bail) == 0) {
+    ast = parse_block(&context, cursor);
+  }
+  cursor->bail = NULL;
+  if (cursor->deferred != NULL) {
+    vector_free((vector *)&cursor->deferred);
+    cursor->deferred = NULL;
+  }
 
-  print_block(ast, 0);
+  free_scope_context(&context);
 
   return ast;
 }
@@ -1,8 +1,10 @@
 #ifndef parser_h
 #define parser_h
+#include "arena.h"
 #include "c-hashmap/hashmap.h"
 #include "enum_utilities.h"
 #include "lexer.h"
+#include <setjmp.h>
 #include <stdio.h>
 
 #define ITERATE_NODES_AND(X)                                                   \
@@ -44,11 +46,14 @@
   X(OPERATOR_SUBTRACT)                                                         \
   X(OPERATOR_MULTIPLY)                                                         \
   X(OPERATOR_DIVIDE)                                                           \
+  X(OPERATOR_MODULO)                                                           \
   X(OPERATOR_NEGATE)                                                           \
   X(OPERATOR_NOT)                                                              \
   X(OPERATOR_AND)                                                              \
   X(OPERATOR_OR)                                                               \
   X(OPERATOR_XOR)                                                              \
+  X(OPERATOR_SHIFT_LEFT)                                                       \
+  X(OPERATOR_SHIFT_RIGHT)                                                      \
   X(OPERATOR_EQUALS_EQUALS)                                                    \
   X(OPERATOR_NOT_EQUALS)                                                       \
   X(OPERATOR_LESS_THAN)                                                        \
@@ -69,36 +74,54 @@ extern const char *operator_type_strings[];
 
 typedef enum {
   PRECEDENCE_NONE,
-  PRECEDENCE_ASSIGNMENT, // =
-  PRECEDENCE_OR,         // or
-  PRECEDENCE_AND,        // and
-  PRECEDENCE_EQUALITY,   // == !=
-  PRECEDENCE_COMPARISON, // < > <= >=
-  PRECEDENCE_TERM,       // + -
-  PRECEDENCE_FACTOR,     // * /
-  PRECEDENCE_UNARY,      // ! -
-  PRECEDENCE_CALL,       // . ()
+  PRECEDENCE_ASSIGNMENT,  // = += -=
+  PRECEDENCE_TERNARY,     // ?:
+  PRECEDENCE_OR,          // ||
+  PRECEDENCE_AND,         // &&
+  PRECEDENCE_BITWISE_OR,  // |
+  PRECEDENCE_BITWISE_XOR, // ^
+  PRECEDENCE_BITWISE_AND, // &
+  PRECEDENCE_EQUALITY,    // == !=
+  PRECEDENCE_COMPARISON,  // < > <= >=
+  PRECEDENCE_SHIFT,       // << >>
+  PRECEDENCE_TERM,        // + -
+  PRECEDENCE_FACTOR,      // * / %
+  PRECEDENCE_UNARY,       // ! - * &
+  PRECEDENCE_CALL,        // . -> () ++ --
   PRECEDENCE_PRIMARY,
 } precedence;
 
-typedef struct node **node_vector;
-typedef struct hashmap **hashmap_vector;
+// Which distinct type a type node is (see type_table in semantic.h)
+typedef uint32_t type_id;
+
+// For types that weren't interned, like a header image's built back up
+#define NO_TYPE UINT32_MAX
+
+// Children of a node, an array that lives in the arena
+typedef struct {
+  struct node **nodes;
+  uint32_t count;
+} node_list;
 
 typedef struct node {
   node_type type;
   union {
     struct {
-      char_vector value;
+      string_slice value;
     } string;
     struct {
       int value;
     } number_literal;
     struct {
-      char_vector name;
+      symbol_id name;
     } variable;
     struct {
-      char_vector name; // Optional (Nameless structs)
-      node_vector members;
+      symbol_id name; // Optional (Nameless structs are NO_SYMBOL)
+      uint32_t size_bytes; // Laid out as soon as its members are parsed (see semantic.h)
+      node_list members;
+      uint32_t alignment;
+      uint32_t offset; // Where it is in the struct it's in, if it's a nameless member of one
+      type_id id;
     } structure;
 
     // Operator is binary operator (+-*/%^&=) or unary operator
@@ -112,22 +135,31 @@ typedef struct node {
     // Type-building nodes
     // This refers to typedef map, with types like "int"
     struct {
-      char_vector name;
+      symbol_id name;
+      uint32_t size_bytes; // What its typedef said, as it was parsed
+      struct node *definition; // The typedef's type, NULL for builtins
+      uint32_t alignment;
+      type_id id;
       // bool is_constant;
     } base_type;
     struct {
       struct node *to;
+      type_id id;
     } pointer;
 
     // A variable declared from a type
     struct {
       struct node *type; // Type node (Required)
-      char_vector name;
+      symbol_id name;
+      uint32_t offset; // From the start of the struct, for struct members
       struct node *value; // Equation after the equals (=) sign (Optional)
     } variable_declaration;
     struct {
-      char_vector name;
+      symbol_id name;
+      uint32_t offset; // NO_OFFSET till resolve_members works out what it's getting
       struct node *from;
+      struct node *member; // The member's declaration, once it's resolved
+      bool through_pointer; // `a->b`, which is parsed as a dereference of this
     } struct_member_get;
     struct {
       struct node *index_expression;
@@ -154,92 +186,211 @@ typedef struct node {
     } for_loop;
     struct {
       struct node *type;
-      char_vector name;
-      node_vector parameters;
-      struct node *body;
+      symbol_id name;
+      uint32_t lazy_body; // Where its skipped body is in lazy_bodies, NO_LAZY_BODY if it isn't waiting
+      node_list parameters;
+      struct node *body; // NULL while it's waiting to be parsed lazily
     } function;
     struct {
       struct node *function_expression;
-      node_vector inputs;
+      node_list inputs;
     } function_call;
     struct {
-      node_vector nodes;
+      node_list nodes;
     } block;
   };
 } node;
 
+// One binding of a type name. If it hides a binding from an outer scope,
+// `shadowed` is where that one is, so leaving the scope can bring it back.
 typedef struct {
-  char_vector name;
+  symbol_id name;
   node *type;
   int size_bytes;
+  uint32_t alignment;
+  uint32_t shadowed;
 } typedef_entry;
 
+#define NO_BINDING UINT32_MAX
+
+// For member gets that aren't resolved, and declarations that aren't struct members
+#define NO_OFFSET UINT32_MAX
+
+// What the hashmap holds: a name and where its innermost binding is
+typedef struct {
+  symbol_id name;
+  uint32_t binding;
+} scope_entry;
+
+// Lists being parsed push their children here, then move them into the arena
+// once they're done. A nested list pushes on top and is gone again before the
+// outer list carries on, so one stack covers everything.
+typedef struct {
+  struct node **nodes;
+  uint32_t count;
+  uint32_t capacity;
+} node_stack;
+
+// A top-level function whose body got skipped over, to be parsed once the
+// rest of the top level is done (and on another thread, if there's a pool)
 typedef struct {
-  hashmap_vector typedef_hashmaps;
-  vec_size_t depth; // It is mainly used with vectors so vec_size_t for squashing warnings
+  struct node *function; // Its body gets filled in
+  uint32_t start; // First token after the opening brace
+  uint32_t end; // The closing brace
+  uint32_t visible_bindings; // How many top-level bindings there were at it
+} deferred_body;
+
+#define NO_LAZY_BODY UINT32_MAX
+
+// Where the parser is in the tokens. It either walks a vector the lexer made
+// up front, or pulls tokens from a streaming lexer as it needs them (which
+// keeps memory the same no matter how big the file is).
+//
+// Everything a parse needs is in here, nothing is global, so separate
+// cursors can parse on separate threads.
+typedef struct {
+  lexer_state *lexer; // Streaming if not NULL
+  const token_stream *tokens;
+  uint32_t position;
+  const char *source_chars; // What token offsets are relative to
+  symbol_table *symbols; // What name tokens' symbols are from
+  arena *nodes; // Where the AST goes
+  node_stack pending; // Children of lists that aren't finished yet
+  FILE *errors; // stderr unless whoever's compiling wants them somewhere else
+  uint32_t error_count;
+  jmp_buf *bail; // Where an error the parser can't carry on from goes
+  struct thread_pool *pool; // Top-level function bodies get parsed on this if it isn't NULL
+  deferred_body *deferred; // Vector, only while the top level is parsed with a pool (or lazily)
+  struct lazy_bodies *lazy; // Top-level function bodies are skipped and left in here if it isn't NULL
+  bool copy_strings; // String literals get copied into the arena, for text that's going to change under the tree
+  const struct scope_context *starting_scope; // The top level's read-only parent (a precompiled header's), instead of the builtins
+  typedef_entry *kept_types; // Vector (or NULL), gets every binding the top level could see before they're popped
+  struct type_table *types; // Types get interned here, parser() makes one in the arena if it's NULL
+} token_cursor;
+
+// How an expression token gets parsed, one of these per token type. `prefix`
+// is for when the token starts an expression, `infix` is for when it comes
+// after one, and only tokens with an infix handler have a precedence.
+typedef struct node *(*prefix_handler)(token_cursor *cursor);
+typedef struct node *(*infix_handler)(struct node *last_expression, token_cursor *cursor);
+typedef struct {
+  prefix_handler prefix;
+  infix_handler infix;
+  precedence precedence;
+  operator_type operator; // What the infix handler builds
+  operator_type prefix_operator; // What the prefix handler builds
+} parse_rule;
+
+// Every scope shares one hashmap, so finding a name is one lookup no matter
+// how deep we are. Bindings get pushed in the order they're made, which makes
+// that vector the undo log too: leaving a scope pops back to where it started,
+// and puts back whatever the popped bindings were hiding.
+//
+// A function body parsed off on its own thread gets a context of its own,
+// with the top level as a read-only parent. Only the parent's first
+// `parent_bindings` bindings count, the ones that were there at the body.
+// The top level can have a parent too, a precompiled header's scope that
+// every file using it shares.
+typedef struct scope_context {
+  struct hashmap *visible; // symbol_id -> scope_entry
+  typedef_entry *bindings; // Vector, innermost last
+  uint32_t *scope_starts; // Vector, how many bindings there were when each scope opened
+  const struct scope_context *parent;
+  uint32_t parent_bindings;
 } scope_context;
 
+// Top-level function bodies that were skipped, and don't get parsed until
+// something asks for one (function_body). The top level's types are kept, so
+// a body parsed later sees what it would've seen in order.
+//
+// Whatever the parse used has to outlive this: the tokens, the symbols, and
+// the arena, which is where bodies parsed later go too.
+typedef struct lazy_bodies {
+  deferred_body *bodies; // Vector, in file order, a function's lazy_body is its index
+  scope_context top_level; // The top level's types, as they were by the end of it
+  token_cursor cursor; // What later parses read from and put nodes in
+} lazy_bodies;
+
 // FUNCTION PROTOTYPES
 // Helpful debugging functions
 const char *node_type_to_string(node_type type);
 const char *operator_type_to_string(operator_type type);
 
 // Base functions
-void advance_token(token **token_pointer);
-void return_token(token **token_pointer);
-token *pop_token(token **token_pointer);
-token *peek_token(token** token_pointer);
-token *expect_token(token_type type, token **token_pointer);
-bool is_at_end(token **token_pointer);
-node *create_node(node_type type);
+token_cursor cursor_from_tokens(const token_stream *tokens, source_file source, symbol_table *symbols, arena *nodes);
+token_cursor cursor_from_lexer(lexer_state *lexer, arena *nodes);
+void free_cursor(token_cursor *cursor);
+__attribute__((noreturn, format(printf, 2, 3)))
+void parse_error(token_cursor *cursor, const char *message, ...);
+void advance_token(token_cursor *cursor);
+token pop_token(token_cursor *cursor);
+token peek_token(token_cursor *cursor);
+token expect_token(token_type type, token_cursor *cursor);
+string_slice token_value(token current_token, token_cursor *cursor);
+symbol_id expect_name(token_cursor *cursor);
+bool is_at_end(token_cursor *cursor);
+node *create_node(node_type type, token_cursor *cursor);
+uint32_t start_list(token_cursor *cursor);
+void push_to_list(node *child, token_cursor *cursor);
+node_list finish_list(uint32_t start, token_cursor *cursor);
 
 // Types
-int compare_typedef_entries(const void *a, const void *b, void *udata);
-uint64_t hash_typedef_entry(const void *data, uint64_t seed0, uint64_t seed1);
-void create_or_clear_context(scope_context context);
-void add_type_to_context(typedef_entry object, scope_context context);
-bool is_type(char_vector name, scope_context context);
-node_vector collect_members(scope_context context, token **token_pointer);
-node_vector collect_parameterss(scope_context context, token **token_pointer);
-node *parse_pointers(node *type_node, token **token_pointer);
-node *parse_base_type(scope_context context, token **token_pointer);
-node *parse_structure_type(scope_context context, token **token_pointer);
-node *parse_type(scope_context context, token **token_pointer);
-node *parse_type_expression(scope_context context, token **token_pointer);
+int compare_scope_entries(const void *a, const void *b, void *udata);
+uint64_t hash_scope_entry(const void *data, uint64_t seed0, uint64_t seed1);
+scope_context create_scope_context(void);
+void free_scope_context(scope_context *context);
+void enter_scope(scope_context *context);
+void exit_scope(scope_context *context);
+void add_type_to_context(typedef_entry object, scope_context *context);
+typedef_entry *find_type(symbol_id name, scope_context *context);
+bool is_type(symbol_id name, scope_context *context);
+node_list collect_members(scope_context *context, token_cursor *cursor);
+node_list collect_parameters(scope_context *context, token_cursor *cursor);
+node *parse_pointers(node *type_node, token_cursor *cursor);
+node *parse_base_type(scope_context *context, token_cursor *cursor);
+node *parse_structure_type(scope_context *context, token_cursor *cursor);
+node *parse_type(scope_context *context, token_cursor *cursor);
+node *parse_type_expression(scope_context *context, token_cursor *cursor);
 
 // Parsing helpers
-precedence get_precedence(token_type type);
-operator_type get_binary_type(token_type type);
-bool should_parse_unary(token_type type);
-node *create_equation_equals_equation_and_next(node *last_expression, node *next_expression, operator_type operator);
-node *create_struct_member_get(node *from_expression, token **token_pointer);
+precedence right_side_precedence(precedence operator_precedence);
+node *create_equation_equals_equation_and_next(node *last_expression, node *next_expression, operator_type operator, token_cursor *cursor);
+node *create_struct_member_get(node *from_expression, token_cursor *cursor);
 
 // Parsing
-node *parse_string(token **token_pointer);
-node *parse_number(token **token_pointer);
-node *parse_variable_expression(token **token_pointer);
-node *parse_struct_member_get(node *from_expression, token **token_pointer);
-node *parse_struct_member_dereference_get(node *from_expression, token **token_pointer);
-node *parse_function_call(node *from_expression, token **token_pointer);
-node *parse_grouping(token **token_pointer);
-node *parse_binary(node *last_expression, token **token_pointer);
-node *parse_unary(token **token_pointer);
-node *parse_postfix(node *last_expression, token **token_pointer);
-node *switch_expression(node *last_expression, node *current_expression, token_type type, token **token_pointer);
-node *parse_expression(precedence precedence, token **token_pointer);
-node *parse_function(node *function_expression, scope_context context, token **token_pointer);
-node *parse_do_while(scope_context context, token **token_pointer);
-node *parse_while(scope_context context, token **token_pointer);
-node *parse_for(scope_context context, token **token_pointer);
-node *parse_if(scope_context context, token **token_pointer);
-node *parse_block(scope_context context, token **token_pointer);
-void parse_typedef(scope_context context, token **token_pointer);
-
-// Parsing visualizers
-void print_indents(int indent_level);
-void print_block(node *ast, int indent_level);
+node *parse_string(token_cursor *cursor);
+node *parse_number(token_cursor *cursor);
+node *parse_variable_expression(token_cursor *cursor);
+node *parse_struct_member_get(node *from_expression, token_cursor *cursor);
+node *parse_struct_member_dereference_get(node *from_expression, token_cursor *cursor);
+node *parse_function_call(node *from_expression, token_cursor *cursor);
+node *parse_grouping(token_cursor *cursor);
+node *parse_binary(node *last_expression, token_cursor *cursor);
+node *parse_compound_assignment(node *last_expression, token_cursor *cursor);
+node *parse_ternary(node *condition, token_cursor *cursor);
+node *parse_unary(token_cursor *cursor);
+node *parse_unary_plus(token_cursor *cursor);
+node *parse_postfix(node *last_expression, token_cursor *cursor);
+node *parse_expression(precedence precedence, token_cursor *cursor);
+node *parse_function(node *function_expression, scope_context *context, token_cursor *cursor);
+node *parse_do_while(scope_context *context, token_cursor *cursor);
+node *parse_while(scope_context *context, token_cursor *cursor);
+node *parse_for(scope_context *context, token_cursor *cursor);
+node *parse_if(scope_context *context, token_cursor *cursor);
+node *parse_statement(scope_context *context, token_cursor *cursor);
+node *parse_block(scope_context *context, token_cursor *cursor);
+void parse_typedef(scope_context *context, token_cursor *cursor);
+void defer_body(node *function_expression, scope_context *context, token_cursor *cursor);
+void parse_deferred_bodies(const scope_context *context, token_cursor *cursor);
+void keep_lazy_bodies(const scope_context *context, token_cursor *cursor);
+
+// Lazy bodies
+node *function_body(lazy_bodies *lazy, node *function);
+uint32_t parse_reachable_bodies(lazy_bodies *lazy, symbol_id entry);
+void free_lazy_bodies(lazy_bodies *lazy);
 
 // Main function
-node *parser(token *tokens);
+void add_builtin_types(scope_context *context, symbol_table *symbols);
+node *parser(token_cursor *cursor);
 
 #endif
@@ -0,0 +1,213 @@
+// Inputs = tasks, outputs = tasks run, on however many threads there are
+#include "pool.h"
+#include "instrument.h"
+#include "c-tests/test.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Which pool and deque the running thread works for, so tasks submitted
+// from a task stay on the worker that made them
+static _Thread_local task_deque *own_deque = NULL;
+
+uint32_t pool_default_worker_count(void) {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  return cores > 0 ? (uint32_t)cores : 1;
+}
+
+// The deques are plain malloc: they're touched by every worker, and the
+// memory ledger wants things freed on the thread that allocated them
+static void deque_push_bottom(task_deque *deque, task new_task) {
+  pthread_mutex_lock(&deque->lock);
+  if (deque->count == deque->capacity) {
+    uint32_t capacity = deque->capacity > 0 ? deque->capacity * 2 : 64;
+    task *tasks = malloc(sizeof(task) * capacity);
+    assert(tasks != NULL);
+    for (uint32_t i = 0; i < deque->count; i++) {
+      tasks[i] = deque->tasks[(deque->top + i) & (deque->capacity - 1)];
+    }
+    free(deque->tasks);
+    deque->tasks = tasks;
+    deque->top = 0;
+    deque->capacity = capacity;
+  }
+  deque->tasks[(deque->top + deque->count) & (deque->capacity - 1)] = new_task;
+  deque->count += 1;
+  pthread_mutex_unlock(&deque->lock);
+}
+
+static bool deque_pop_bottom(task_deque *deque, task *taken) {
+  pthread_mutex_lock(&deque->lock);
+  bool found = deque->count > 0;
+  if (found) {
+    deque->count -= 1;
+    *taken = deque->tasks[(deque->top + deque->count) & (deque->capacity - 1)];
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+static bool deque_steal_top(task_deque *deque, task *taken) {
+  pthread_mutex_lock(&deque->lock);
+  bool found = deque->count > 0;
+  if (found) {
+    *taken = deque->tasks[deque->top];
+    deque->top = (deque->top + 1) & (deque->capacity - 1);
+    deque->count -= 1;
+  }
+  pthread_mutex_unlock(&deque->lock);
+  return found;
+}
+
+// The caller already claimed one of the queued tasks, so there's one in some
+// deque. Our own first (if we're a worker), then everyone else's starting
+// from our neighbour.
+static task take_task(thread_pool *pool, task_deque *own) {
+  uint32_t first = own != NULL ? own->worker : 0;
+  task taken;
+  for (;;) {
+    if (own != NULL && deque_pop_bottom(own, &taken)) {
+      return taken;
+    }
+    for (uint32_t i = 0; i < pool->worker_count; i++) {
+      task_deque *victim = &pool->deques[(first + i) % pool->worker_count];
+      if (victim != own && deque_steal_top(victim, &taken)) {
+        return taken;
+      }
+    }
+  }
+}
+
+static void run_task(thread_pool *pool, task taken) {
+  taken.function(taken.argument);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->unfinished -= 1;
+  if (taken.group != NULL) {
+    taken.group->remaining -= 1;
+  }
+  pthread_cond_broadcast(&pool->task_finished);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker_main(void *argument) {
+  task_deque *deque = argument;
+  thread_pool *pool = deque->pool;
+  own_deque = deque;
+  // Its phases go in the trace with everyone else's
+  instrument_thread_begin();
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queued == 0 && !pool->stopping) {
+      pthread_cond_wait(&pool->work_available, &pool->lock);
+    }
+    if (pool->queued == 0) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    pool->queued -= 1;
+    pthread_mutex_unlock(&pool->lock);
+
+    run_task(pool, take_task(pool, deque));
+  }
+  instrument_thread_end();
+  return NULL;
+}
+
+thread_pool *pool_create(uint32_t worker_count) {
+  thread_pool *pool = malloc(sizeof(thread_pool));
+  assert(pool != NULL);
+  worker_count = worker_count > 0 ? worker_count : 1;
+  *pool = (thread_pool){
+    .threads = malloc(sizeof(pthread_t) * worker_count),
+    .deques = calloc(worker_count, sizeof(task_deque)),
+    .worker_count = worker_count,
+    .queued = 0,
+    .unfinished = 0,
+    .next_deque = 0,
+    .stopping = false,
+  };
+  assert(pool->threads != NULL && pool->deques != NULL);
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_available, NULL);
+  pthread_cond_init(&pool->task_finished, NULL);
+
+  for (uint32_t i = 0; i < worker_count; i++) {
+    pool->deques[i].pool = pool;
+    pool->deques[i].worker = i;
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+  }
+  // Deques are all set up before any worker could go stealing from them
+  for (uint32_t i = 0; i < worker_count; i++) {
+    pthread_create(&pool->threads[i], NULL, worker_main, &pool->deques[i]);
+  }
+  return pool;
+}
+
+void pool_submit(thread_pool *pool, task_function function, void *argument) {
+  pool_submit_to_group(pool, NULL, function, argument);
+}
+
+void pool_submit_to_group(thread_pool *pool, task_group *group, task_function function, void *argument) {
+  if (group != NULL) {
+    pthread_mutex_lock(&pool->lock);
+    group->remaining += 1;
+    pthread_mutex_unlock(&pool->lock);
+  }
+  task_deque *deque = own_deque;
+  if (deque == NULL || deque->pool != pool) {
+    uint32_t next = __atomic_fetch_add(&pool->next_deque, 1, __ATOMIC_RELAXED);
+    deque = &pool->deques[next % pool->worker_count];
+  }
+  deque_push_bottom(deque, (task){ .function = function, .argument = argument, .group = group });
+
+  pthread_mutex_lock(&pool->lock);
+  pool->queued += 1;
+  pool->unfinished += 1;
+  pthread_cond_signal(&pool->work_available);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(thread_pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->unfinished > 0) {
+    pthread_cond_wait(&pool->task_finished, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait_for_group(thread_pool *pool, task_group *group) {
+  task_deque *own = own_deque != NULL && own_deque->pool == pool ? own_deque : NULL;
+  pthread_mutex_lock(&pool->lock);
+  while (group->remaining > 0) {
+    if (pool->queued > 0) {
+      pool->queued -= 1;
+      pthread_mutex_unlock(&pool->lock);
+      run_task(pool, take_task(pool, own));
+      pthread_mutex_lock(&pool->lock);
+    } else {
+      pthread_cond_wait(&pool->task_finished, &pool->lock);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_free(thread_pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->work_available);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (uint32_t i = 0; i < pool->worker_count; i++) {
+    pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].tasks);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work_available);
+  pthread_cond_destroy(&pool->task_finished);
+  free(pool->threads);
+  free(pool->deques);
+  free(pool);
+}
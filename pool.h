@@ -0,0 +1,67 @@
+#ifndef pool_h
+#define pool_h
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Work-stealing thread pool. Every worker has its own deque of tasks: it
+// takes from the bottom of its own (newest first, so what it just made is
+// still in cache), and when that runs dry it steals from the top of someone
+// else's (oldest first, which tends to be the biggest piece of work).
+//
+// Tasks can submit more tasks, those go on the submitting worker's deque.
+// Tasks submitted from outside the pool get dealt out round-robin.
+
+typedef void (*task_function)(void *argument);
+
+// Some tasks that can be waited on together, without waiting on everything
+// else the pool is doing
+typedef struct {
+  uint32_t remaining; // Guarded by the pool's lock
+} task_group;
+
+typedef struct {
+  task_function function;
+  void *argument;
+  task_group *group; // NULL if it isn't in one
+} task;
+
+typedef struct {
+  struct thread_pool *pool; // Whose worker this deque belongs to
+  uint32_t worker; // Which one
+  pthread_mutex_t lock;
+  task *tasks; // Ring buffer
+  uint32_t top; // Where stealing takes from
+  uint32_t count;
+  uint32_t capacity; // Power of 2
+} task_deque;
+
+typedef struct thread_pool {
+  pthread_t *threads;
+  task_deque *deques; // One per worker
+  uint32_t worker_count;
+
+  pthread_mutex_t lock; // For everything below
+  pthread_cond_t work_available;
+  pthread_cond_t task_finished;
+  uint32_t queued; // In a deque, nobody's started them
+  uint32_t unfinished; // Queued or running
+  uint32_t next_deque; // Where the next task from outside goes
+  bool stopping;
+} thread_pool;
+
+// How many workers to use when nobody says, one per core
+uint32_t pool_default_worker_count(void);
+
+thread_pool *pool_create(uint32_t worker_count);
+void pool_submit(thread_pool *pool, task_function function, void *argument);
+void pool_submit_to_group(thread_pool *pool, task_group *group, task_function function, void *argument);
+// Blocks until every task submitted so far (and everything they submitted)
+// is finished
+void pool_wait(thread_pool *pool);
+// Runs queued tasks while it waits for the group, so it's fine to call from
+// inside a task (and the calling thread isn't just sitting there)
+void pool_wait_for_group(thread_pool *pool, task_group *group);
+void pool_free(thread_pool *pool);
+
+#endif
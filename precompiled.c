@@ -0,0 +1,537 @@
+// Inputs = a header, outputs = an image of it that files can start from without lexing or parsing it
+#include "precompiled.h"
+#include "instrument.h"
+#include "memory.h"
+#include "semantic.h"
+#include "c-hashmap/hashmap.h"
+#include "c-tests/test.h"
+#include "c-vector/vec.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char image_magic[8] = "MCCPCH\0";
+
+// The same as what the cache keys on, an image from another build could
+// have nodes this one doesn't
+static const char compiler_version[] = COMPILER_VERSION;
+
+// Where each section starts, from the counts in the header
+typedef struct {
+  size_t dependencies;
+  size_t symbols;
+  size_t strings;
+  size_t macros;
+  size_t parameters;
+  size_t bindings;
+  size_t nodes;
+  size_t extra;
+  size_t tokens;
+  size_t macro_tokens;
+  size_t body_parameters;
+  size_t names;
+  size_t text;
+  size_t total;
+} image_layout;
+
+static size_t align_to_8(size_t size) {
+  return (size + 7) & ~(size_t)7;
+}
+
+// Offsets, then lengths, then types, the same as a token_stream's one allocation
+static size_t token_bytes(uint32_t count) {
+  return (size_t)count * (sizeof(uint32_t) * 2 + sizeof(uint8_t));
+}
+
+static image_layout layout_of(const image_header *header) {
+  image_layout layout;
+  layout.dependencies = align_to_8(sizeof(image_header));
+  layout.symbols = align_to_8(layout.dependencies + (size_t)header->dependency_count * sizeof(image_dependency));
+  layout.strings = align_to_8(layout.symbols + (size_t)header->symbol_count * sizeof(cached_text));
+  layout.macros = align_to_8(layout.strings + (size_t)header->string_count * sizeof(cached_text));
+  layout.parameters = align_to_8(layout.macros + (size_t)header->macro_count * sizeof(image_macro));
+  layout.bindings = align_to_8(layout.parameters + (size_t)header->parameter_count * sizeof(symbol_id));
+  layout.nodes = align_to_8(layout.bindings + (size_t)header->binding_count * sizeof(image_binding));
+  layout.extra = align_to_8(layout.nodes + (size_t)header->node_count * sizeof(flat_node));
+  layout.tokens = align_to_8(layout.extra + (size_t)header->extra_count * sizeof(uint32_t));
+  layout.macro_tokens = align_to_8(layout.tokens + token_bytes(header->token_count));
+  layout.body_parameters = align_to_8(layout.macro_tokens + token_bytes(header->macro_token_count));
+  layout.names = align_to_8(layout.body_parameters + (size_t)header->macro_token_count * sizeof(uint32_t));
+  layout.text = align_to_8(layout.names + header->names_size);
+  layout.total = layout.text + header->text_size + 1;
+  return layout;
+}
+
+static uint64_t image_key(void) {
+  return hashmap_xxhash3(compiler_version, sizeof(compiler_version) - 1, HEADER_IMAGE_FORMAT_VERSION, 0);
+}
+
+// -- Building
+
+// Zeroes from the end of a section `size` bytes long up to the next multiple of 8
+static void write_padding(FILE *file, size_t size) {
+  static const char zeroes[8] = { 0 };
+  fwrite(zeroes, 1, align_to_8(size) - size, file);
+}
+
+// Writes `size` bytes, then the padding
+static void write_section(FILE *file, const void *data, size_t size) {
+  if (size > 0) {
+    fwrite(data, 1, size, file);
+  }
+  write_padding(file, size);
+}
+
+// Just the arrays, the padding comes after all of them
+static void write_tokens(FILE *file, const token_stream *tokens, uint32_t count) {
+  fwrite(tokens->offsets, sizeof(uint32_t), count, file);
+  fwrite(tokens->lengths, sizeof(uint32_t), count, file);
+  fwrite(tokens->types, sizeof(uint8_t), count, file);
+}
+
+static cached_text add_name(string_slice **names, uint32_t *names_size, string_slice name) {
+  cached_text text = { .offset = *names_size, .length = name.length };
+  vector_add(names, name);
+  *names_size += name.length;
+  return text;
+}
+
+// Everything the image needs, gathered up before anything's written so the
+// header can have the counts
+typedef struct {
+  image_header header;
+  image_dependency *dependencies; // Vector
+  cached_text *symbols; // Vector
+  cached_text *strings; // Vector
+  image_macro *macros; // Vector
+  symbol_id *parameters; // Vector
+  image_binding *bindings; // Vector
+  token_stream macro_tokens; // Only the macros still defined, back to back
+  uint32_t *body_parameters; // Vector
+  string_slice *names; // Vector, what goes in the names section, in order
+} image_contents;
+
+static bool add_dependency(image_contents *contents, const char *path) {
+  struct stat file_stats;
+  if (stat(path, &file_stats) != 0) {
+    return false;
+  }
+  image_dependency dependency = {
+    .path = add_name(&contents->names, &contents->header.names_size, (string_slice){ .chars = path, .length = strlen(path) }),
+    .size = (uint64_t)file_stats.st_size,
+    .modified_seconds = file_stats.st_mtim.tv_sec,
+    .modified_nanoseconds = file_stats.st_mtim.tv_nsec,
+  };
+  vector_add(&contents->dependencies, dependency);
+  return true;
+}
+
+// Only macros that are still defined by the end of the header, #undef'd and
+// replaced ones are left behind
+static void gather_macros(image_contents *contents, const preprocessor *state) {
+  for (uint32_t symbol = 0; symbol < vector_size((vector *)&state->macro_of_symbol); symbol++) {
+    uint32_t index = state->macro_of_symbol[symbol];
+    if (index == NO_MACRO) {
+      continue;
+    }
+    const macro_definition *macro = &state->macros[index];
+    image_macro saved = {
+      .name = macro->name,
+      .function_like = macro->function_like,
+      .variadic = macro->variadic,
+      .unused = 0,
+      .parameter_start = vector_size((vector *)&contents->parameters),
+      .parameter_count = vector_size((vector *)&macro->parameters),
+      .body_start = contents->macro_tokens.count,
+      .body_count = macro->body_count,
+    };
+    for (uint32_t i = 0; i < saved.parameter_count; i++) {
+      vector_add(&contents->parameters, macro->parameters[i]);
+    }
+    for (uint32_t i = macro->body_start; i < macro->body_start + macro->body_count; i++) {
+      token_stream_push(&contents->macro_tokens, token_stream_get(&state->macro_tokens, i));
+      vector_add(&contents->body_parameters, state->body_parameters[i]);
+    }
+    vector_add(&contents->macros, saved);
+  }
+}
+
+// Written under another name and renamed once it's all there, like the AST cache
+static bool write_image(const char *image_path, image_contents *contents, const flat_ast *flat,
+                        const preprocessor *state) {
+  const image_header *header = &contents->header;
+  char temporary[PATH_MAX + 32];
+  snprintf(temporary, sizeof(temporary), "%s.%d.tmp", image_path, (int)getpid());
+  FILE *file = fopen(temporary, "wb");
+  if (file == NULL) {
+    return false;
+  }
+  write_section(file, header, sizeof(*header));
+  write_section(file, contents->dependencies, (size_t)header->dependency_count * sizeof(image_dependency));
+  write_section(file, contents->symbols, (size_t)header->symbol_count * sizeof(cached_text));
+  write_section(file, contents->strings, (size_t)header->string_count * sizeof(cached_text));
+  write_section(file, contents->macros, (size_t)header->macro_count * sizeof(image_macro));
+  write_section(file, contents->parameters, (size_t)header->parameter_count * sizeof(symbol_id));
+  write_section(file, contents->bindings, (size_t)header->binding_count * sizeof(image_binding));
+  write_section(file, flat->nodes, (size_t)header->node_count * sizeof(flat_node));
+  write_section(file, flat->extra, (size_t)header->extra_count * sizeof(uint32_t));
+  write_tokens(file, &state->tokens, header->token_count);
+  write_padding(file, token_bytes(header->token_count));
+  write_tokens(file, &contents->macro_tokens, header->macro_token_count);
+  write_padding(file, token_bytes(header->macro_token_count));
+  write_section(file, contents->body_parameters, (size_t)header->macro_token_count * sizeof(uint32_t));
+  for (uint32_t i = 0; i < vector_size((vector *)&contents->names); i++) {
+    fwrite(contents->names[i].chars, 1, contents->names[i].length, file);
+  }
+  write_padding(file, header->names_size);
+  fwrite(state->text, 1, header->text_size + 1, file);
+
+  bool written = ferror(file) == 0;
+  written &= fclose(file) == 0;
+  if (!written || rename(temporary, image_path) != 0) {
+    remove(temporary);
+    return false;
+  }
+  return true;
+}
+
+static void free_contents(image_contents *contents) {
+  vector_free((vector *)&contents->dependencies);
+  vector_free((vector *)&contents->symbols);
+  vector_free((vector *)&contents->strings);
+  vector_free((vector *)&contents->macros);
+  vector_free((vector *)&contents->parameters);
+  vector_free((vector *)&contents->bindings);
+  vector_free((vector *)&contents->body_parameters);
+  vector_free((vector *)&contents->names);
+  token_stream_free(&contents->macro_tokens);
+}
+
+static bool save_image(const char *header_path, const char *image_path, const preprocessor *state,
+                       const symbol_table *symbols, node *ast, const typedef_entry *kept_types, FILE *errors) {
+  image_contents contents = {
+    .dependencies = vector_create(),
+    .symbols = vector_create(),
+    .strings = vector_create(),
+    .macros = vector_create(),
+    .parameters = vector_create(),
+    .bindings = vector_create(),
+    .macro_tokens = { 0 },
+    .body_parameters = vector_create(),
+    .names = vector_create(),
+  };
+  image_header *header = &contents.header;
+  memcpy(header->magic, image_magic, sizeof(header->magic));
+  header->format_version = HEADER_IMAGE_FORMAT_VERSION;
+  header->key = image_key();
+
+  // The header and whatever it pulled in, any of them changing makes the image stale
+  char resolved[PATH_MAX];
+  bool found = add_dependency(&contents, realpath(header_path, resolved) != NULL ? resolved : header_path);
+  for (uint32_t i = 0; i < vector_size((vector *)&state->included); i++) {
+    found &= add_dependency(&contents, state->included[i].header->path);
+  }
+
+  // Types go in after the tree, so the tree's indices are the same as a plain flatten's
+  flat_ast flat = flatten_ast(ast);
+  for (uint32_t i = 0; i < vector_size((vector *)&kept_types); i++) {
+    image_binding binding = {
+      .name = kept_types[i].name,
+      .size_bytes = kept_types[i].size_bytes,
+      .type = flatten_into(&flat, kept_types[i].type),
+      .alignment = kept_types[i].alignment,
+    };
+    vector_add(&contents.bindings, binding);
+  }
+  for (uint32_t i = 0; i < symbol_count(symbols); i++) {
+    vector_add(&contents.symbols, add_name(&contents.names, &header->names_size, symbol_name(symbols, i)));
+  }
+  for (uint32_t i = 0; i < vector_size((vector *)&flat.strings); i++) {
+    vector_add(&contents.strings, add_name(&contents.names, &header->names_size, flat.strings[i]));
+  }
+  gather_macros(&contents, state);
+
+  header->root = flat.root;
+  header->dependency_count = vector_size((vector *)&contents.dependencies);
+  header->symbol_count = vector_size((vector *)&contents.symbols);
+  header->string_count = vector_size((vector *)&contents.strings);
+  header->macro_count = vector_size((vector *)&contents.macros);
+  header->parameter_count = vector_size((vector *)&contents.parameters);
+  header->binding_count = vector_size((vector *)&contents.bindings);
+  header->node_count = vector_size((vector *)&flat.nodes);
+  header->extra_count = vector_size((vector *)&flat.extra);
+  header->token_count = state->tokens.count - 1;
+  header->macro_token_count = contents.macro_tokens.count;
+  header->text_size = state->text_size;
+
+  bool written = false;
+  if (!found) {
+    fprintf(errors, "Couldn't look at a file %s included\n", header_path);
+  } else if (!write_image(image_path, &contents, &flat, state)) {
+    fprintf(errors, "Couldn't write header image: %s\n", image_path);
+  } else {
+    written = true;
+  }
+  flat_ast_free(&flat);
+  free_contents(&contents);
+  return written;
+}
+
+bool header_image_build(const char *header_path, char **include_directories, const char *image_path, FILE *errors) {
+  TIME_SCOPE("build header image");
+  source_file source = source_from_path(header_path);
+  if (source.chars == NULL) {
+    fprintf(errors, "Couldn't find file: %s\n", header_path);
+    return false;
+  }
+  symbol_table symbols = symbol_table_create();
+  arena nodes = arena_create();
+  preprocessor state = preprocessor_create(&symbols, errors);
+  state.include_directories = include_directories;
+  preprocess(&state, source, header_path);
+
+  // Parsed the way any file is, except the top level's types get kept
+  token_cursor cursor = cursor_from_tokens(&state.tokens, preprocessed_source(&state), &symbols, &nodes);
+  cursor.errors = errors;
+  cursor.kept_types = vector_create();
+  node *ast = parser(&cursor);
+
+  bool built = false;
+  if (ast != NULL && state.error_count + cursor.error_count == 0) {
+    built = save_image(header_path, image_path, &state, &symbols, ast, cursor.kept_types, errors);
+  }
+  vector_free((vector *)&cursor.kept_types);
+  free_cursor(&cursor);
+  arena_free(&nodes);
+  preprocessor_free(&state);
+  symbol_table_free(&symbols);
+  source_close(&source);
+  return built;
+}
+
+// -- Loading
+
+// Everything that's read later gets checked against the file's size first
+static bool texts_are_usable(const cached_text *texts, uint32_t count, uint32_t names_size) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (texts[i].offset > names_size || texts[i].length > names_size - texts[i].offset) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool contents_are_usable(const image_header *header, const image_layout *layout, const char *mapping) {
+  const image_macro *macros = (const image_macro *)(mapping + layout->macros);
+  for (uint32_t i = 0; i < header->macro_count; i++) {
+    if (macros[i].parameter_start > header->parameter_count ||
+        macros[i].parameter_count > header->parameter_count - macros[i].parameter_start ||
+        macros[i].body_start > header->macro_token_count ||
+        macros[i].body_count > header->macro_token_count - macros[i].body_start ||
+        macros[i].name >= header->symbol_count) {
+      return false;
+    }
+  }
+  const image_binding *bindings = (const image_binding *)(mapping + layout->bindings);
+  for (uint32_t i = 0; i < header->binding_count; i++) {
+    if ((bindings[i].type != NO_NODE && bindings[i].type >= header->node_count) ||
+        bindings[i].name >= header->symbol_count) {
+      return false;
+    }
+  }
+  return texts_are_usable((const cached_text *)(mapping + layout->symbols), header->symbol_count, header->names_size) &&
+         texts_are_usable((const cached_text *)(mapping + layout->strings), header->string_count, header->names_size) &&
+         mapping[layout->text + header->text_size] == '\0';
+}
+
+// Puts the first file that isn't how it was in `path`, false if they all are
+static bool stale_dependency(const image_header *header, const image_layout *layout, const char *mapping,
+                             char *path) {
+  const image_dependency *dependencies = (const image_dependency *)(mapping + layout->dependencies);
+  const char *names = mapping + layout->names;
+  for (uint32_t i = 0; i < header->dependency_count; i++) {
+    cached_text saved = dependencies[i].path;
+    if (saved.offset > header->names_size || saved.length > header->names_size - saved.offset ||
+        saved.length >= PATH_MAX) {
+      snprintf(path, PATH_MAX, "(a path that doesn't fit)");
+      return true;
+    }
+    snprintf(path, PATH_MAX, "%.*s", (int)saved.length, names + saved.offset);
+    struct stat file_stats;
+    if (stat(path, &file_stats) != 0 || (uint64_t)file_stats.st_size != dependencies[i].size ||
+        file_stats.st_mtim.tv_sec != dependencies[i].modified_seconds ||
+        file_stats.st_mtim.tv_nsec != dependencies[i].modified_nanoseconds) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static token_stream mapped_tokens(const char *mapping, size_t offset, uint32_t count) {
+  token_stream tokens = {
+    .offsets = (uint32_t *)(mapping + offset),
+    .lengths = (uint32_t *)(mapping + offset) + count,
+    .types = (uint8_t *)(mapping + offset + (size_t)count * sizeof(uint32_t) * 2),
+    .count = count,
+    .capacity = count,
+  };
+  return tokens;
+}
+
+bool header_image_load(const char *image_path, header_image *image, FILE *errors) {
+  TIME_SCOPE("load header image");
+  int file_descriptor = open(image_path, O_RDONLY);
+  if (file_descriptor < 0) {
+    fprintf(errors, "Couldn't find header image: %s\n", image_path);
+    return false;
+  }
+  struct stat file_stats;
+  if (fstat(file_descriptor, &file_stats) != 0 || (size_t)file_stats.st_size < sizeof(image_header)) {
+    close(file_descriptor);
+    fprintf(errors, "Not a header image: %s\n", image_path);
+    return false;
+  }
+  size_t size = (size_t)file_stats.st_size;
+  const char *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file_descriptor, 0);
+  close(file_descriptor);
+  if (mapping == MAP_FAILED) {
+    fprintf(errors, "Couldn't map header image: %s\n", image_path);
+    return false;
+  }
+
+  const image_header *header = (const image_header *)mapping;
+  image_layout layout = layout_of(header);
+  char stale[PATH_MAX];
+  bool usable = false;
+  if (memcmp(header->magic, image_magic, sizeof(header->magic)) != 0 ||
+      header->format_version != HEADER_IMAGE_FORMAT_VERSION || header->key != image_key()) {
+    fprintf(errors, "Header image %s is from another compiler, build it again\n", image_path);
+  } else if (layout.total != size || header->root >= header->node_count ||
+             !contents_are_usable(header, &layout, mapping)) {
+    fprintf(errors, "Header image %s is broken, build it again\n", image_path);
+  } else if (stale_dependency(header, &layout, mapping, stale)) {
+    fprintf(errors, "Header image %s is out of date (%s changed), build it again\n", image_path, stale);
+  } else {
+    usable = true;
+  }
+  if (!usable) {
+    munmap((void *)mapping, size);
+    return false;
+  }
+
+  const char *names = mapping + layout.names;
+  const cached_text *symbols = (const cached_text *)(mapping + layout.symbols);
+  const cached_text *strings = (const cached_text *)(mapping + layout.strings);
+  image->mapping = mapping;
+  image->mapped_size = size;
+  image->header = header;
+  image->text = mapping + layout.text;
+  image->tokens = mapped_tokens(mapping, layout.tokens, header->token_count);
+  image->macro_tokens = mapped_tokens(mapping, layout.macro_tokens, header->macro_token_count);
+  image->body_parameters = (const uint32_t *)(mapping + layout.body_parameters);
+  image->macros = (const image_macro *)(mapping + layout.macros);
+  image->parameters = (const symbol_id *)(mapping + layout.parameters);
+
+  // Interned in order, so every id is the one the header had
+  image->symbols = symbol_table_create();
+  for (uint32_t i = 0; i < header->symbol_count; i++) {
+    symbol_id id = intern_symbol(&image->symbols, (string_slice){ .chars = names + symbols[i].offset, .length = symbols[i].length });
+    assert(id == i);
+  }
+  image->declarations = (flat_ast){
+    .nodes = vector_create(),
+    .extra = vector_create(),
+    .strings = vector_create(),
+    .root = header->root,
+  };
+  const flat_node *nodes = (const flat_node *)(mapping + layout.nodes);
+  const uint32_t *extra = (const uint32_t *)(mapping + layout.extra);
+  for (uint32_t i = 0; i < header->node_count; i++) {
+    vector_add(&image->declarations.nodes, nodes[i]);
+  }
+  for (uint32_t i = 0; i < header->extra_count; i++) {
+    vector_add(&image->declarations.extra, extra[i]);
+  }
+  for (uint32_t i = 0; i < header->string_count; i++) {
+    string_slice value = { .chars = names + strings[i].offset, .length = strings[i].length };
+    vector_add(&image->declarations.strings, value);
+  }
+
+  // Types only get built once, and every unit's top level looks them up in
+  // this scope instead of having its own copy. Each one's names mean what
+  // they did when the header made it, which is the scope as it is so far.
+  const image_binding *bindings = (const image_binding *)(mapping + layout.bindings);
+  image->types = arena_create();
+  image->scope = create_scope_context();
+  for (uint32_t i = 0; i < header->binding_count; i++) {
+    typedef_entry binding = {
+      .name = bindings[i].name,
+      .type = unflatten_node(&image->declarations, bindings[i].type, &image->types),
+      .size_bytes = bindings[i].size_bytes,
+      .alignment = bindings[i].alignment,
+    };
+    if (binding.type != NULL) {
+      resolve_type(binding.type, &image->scope);
+    }
+    add_type_to_context(binding, &image->scope);
+  }
+  return true;
+}
+
+void header_image_release(header_image *image) {
+  symbol_table_free(&image->symbols);
+  free_scope_context(&image->scope);
+  flat_ast_free(&image->declarations);
+  arena_free(&image->types);
+  munmap((void *)image->mapping, image->mapped_size);
+  image->mapping = NULL;
+  image->mapped_size = 0;
+  image->header = NULL;
+}
+
+// -- Using
+
+// The unit's text starts with the header's, so the image's offsets (tokens,
+// macro bodies) are already right, and the image's symbols are the unit's
+// base table, so its ids are too
+void header_image_start_unit(const header_image *image, symbol_table *symbols, preprocessor *state) {
+  TIME_SCOPE("start from header image");
+  const image_header *header = image->header;
+  symbol_table_set_base(symbols, &image->symbols);
+
+  assert(state->text_size == 0 && state->tokens.count == 0);
+  state->text_capacity = header->text_size + 1;
+  state->text = memory_allocate(state->text_capacity);
+  memcpy(state->text, image->text, header->text_size + 1);
+  state->text_size = header->text_size;
+  token_stream_splice(&state->tokens, 0, 0, &image->tokens);
+
+  uint32_t body_base = state->macro_tokens.count;
+  token_stream_splice(&state->macro_tokens, body_base, body_base, &image->macro_tokens);
+  for (uint32_t i = 0; i < header->macro_token_count; i++) {
+    vector_add(&state->body_parameters, image->body_parameters[i]);
+  }
+  for (uint32_t i = 0; i < header->macro_count; i++) {
+    const image_macro *saved = &image->macros[i];
+    macro_definition macro = {
+      .name = saved->name,
+      .function_like = saved->function_like,
+      .variadic = saved->variadic,
+      .parameters = vector_create(),
+      .body_start = body_base + saved->body_start,
+      .body_count = saved->body_count,
+    };
+    for (uint32_t p = 0; p < saved->parameter_count; p++) {
+      vector_add(&macro.parameters, image->parameters[saved->parameter_start + p]);
+    }
+    while (vector_size((vector *)&state->macro_of_symbol) <= macro.name) {
+      vector_add(&state->macro_of_symbol, NO_MACRO);
+    }
+    state->macro_of_symbol[macro.name] = vector_size((vector *)&state->macros);
+    vector_add(&state->macros, macro);
+  }
+}
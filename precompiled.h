@@ -0,0 +1,128 @@
+#ifndef precompiled_h
+#define precompiled_h
+#include "arena.h"
+#include "ast.h"
+#include "cache.h"
+#include "preprocessor.h"
+#include "symbols.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// A header that every file starts with, preprocessed and parsed once and
+// saved to one file (an image). A file compiled with the image starts off
+// like it had included the header first: its symbols, text, tokens and
+// macros are already there, the header's top-level typedefs are already in
+// scope, and the header's declarations are already in the tree. Only the
+// file's own tokens get lexed and parsed.
+//
+// Like the AST cache, the file is laid out the way the data is in memory,
+// so loading it is mostly mapping it, and it's loaded once for every file
+// that uses it. Units only ever read from it, so any number of threads can.
+//
+// The header and everything it included get their sizes and modification
+// times saved, and an image where any of them changed won't load.
+//
+// Headers with an include guard that the file includes again are skipped,
+// since the guard's macro is already defined. Ones with only #pragma once
+// aren't, the unit doesn't know they were included.
+
+// Bump this when anything below changes shape, or what goes in a flat_node
+// or extra does (3: member gets from `->` say so)
+#define HEADER_IMAGE_FORMAT_VERSION 3
+
+// Every section after it starts 8-byte aligned, in this order:
+//   image_dependency dependencies[dependency_count]
+//   cached_text symbols[symbol_count] (in symbol_id order)
+//   cached_text strings[string_count]
+//   image_macro macros[macro_count]
+//   symbol_id parameters[parameter_count]
+//   image_binding bindings[binding_count]
+//   flat_node nodes[node_count]
+//   uint32_t extra[extra_count]
+//   uint32_t token_offsets[token_count], token_lengths[token_count], uint8_t token_types[token_count]
+//   the same three for macro_token_count
+//   uint32_t body_parameters[macro_token_count]
+//   char names[names_size]            (what paths, symbols and strings point into)
+//   char text[text_size + 1]          (the header's preprocessed text, '\0' on the end)
+typedef struct {
+  char magic[8];
+  uint32_t format_version;
+  uint32_t root;
+  uint64_t key;
+  uint32_t dependency_count;
+  uint32_t symbol_count;
+  uint32_t string_count;
+  uint32_t macro_count;
+  uint32_t parameter_count;
+  uint32_t binding_count;
+  uint32_t node_count;
+  uint32_t extra_count;
+  uint32_t token_count; // Not counting TOKEN_END
+  uint32_t macro_token_count;
+  uint32_t names_size;
+  uint32_t text_size;
+} image_header;
+
+// A file the image was made from, and how it was when it was
+typedef struct {
+  cached_text path;
+  uint64_t size;
+  int64_t modified_seconds;
+  int64_t modified_nanoseconds;
+} image_dependency;
+
+typedef struct {
+  symbol_id name;
+  uint8_t function_like;
+  uint8_t variadic;
+  uint16_t unused;
+  uint32_t parameter_start; // Into parameters
+  uint32_t parameter_count;
+  uint32_t body_start; // Into the macro tokens
+  uint32_t body_count;
+} image_macro;
+
+// A typedef the header's top level made
+typedef struct {
+  symbol_id name;
+  int32_t size_bytes;
+  node_index type; // Into the nodes, outside the tree under root
+  uint32_t alignment;
+} image_binding;
+
+// An image that's been loaded. Tokens, macros and text are used right
+// where they are in the mapping. The rest is built once and shared by every
+// unit using the image: its symbols and typedef scope (whose types are built
+// back up as nodes), and the declarations, which every unit copies into
+// its own tree anyway.
+typedef struct {
+  const char *mapping;
+  size_t mapped_size;
+  const image_header *header;
+  symbol_table symbols; // Memory, every unit's base table
+  token_stream tokens; // In the mapping, offsets are into text
+  token_stream macro_tokens;
+  const uint32_t *body_parameters;
+  const image_macro *macros;
+  const symbol_id *parameters;
+  scope_context scope; // Memory, every unit's top level's parent, builtins first
+  flat_ast declarations;
+  arena types; // Where the bindings' types went
+  const char *text;
+} header_image;
+
+// Preprocesses and parses the header, then saves it to `image_path`.
+// Doesn't write anything if the header had errors (they go to `errors`).
+bool header_image_build(const char *header_path, char **include_directories, const char *image_path, FILE *errors);
+// Says why to `errors` if it can't be used
+bool header_image_load(const char *image_path, header_image *image, FILE *errors);
+void header_image_release(header_image *image);
+
+// Starts a unit off with the image: makes its symbols the base of `symbols`
+// (which should be empty), then gives the preprocessor its text, tokens and
+// macros. Preprocess the unit's own file after, and parse it with the
+// image's scope as the starting scope.
+void header_image_start_unit(const header_image *image, symbol_table *symbols, preprocessor *state);
+
+#endif
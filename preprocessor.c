@@ -0,0 +1,1451 @@
+// Inputs = a file's tokens and the headers it includes, outputs = one token stream for the unit, with no directives left
+#include "preprocessor.h"
+#include "instrument.h"
+#include "memory.h"
+#include "c-hashmap/hashmap.h"
+#include "c-tests/test.h"
+#include "c-vector/vec.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ITERATE_DIRECTIVES_AND(X)                                              \
+  X(DIRECTIVE_INCLUDE, "include")                                              \
+  X(DIRECTIVE_DEFINE, "define")                                                \
+  X(DIRECTIVE_UNDEF, "undef")                                                  \
+  X(DIRECTIVE_IF, "if")                                                        \
+  X(DIRECTIVE_IFDEF, "ifdef")                                                  \
+  X(DIRECTIVE_IFNDEF, "ifndef")                                                \
+  X(DIRECTIVE_ELIF, "elif")                                                    \
+  X(DIRECTIVE_ELSE, "else")                                                    \
+  X(DIRECTIVE_ENDIF, "endif")                                                  \
+  X(DIRECTIVE_PRAGMA, "pragma")                                                \
+  X(DIRECTIVE_ERROR, "error")
+
+#define GENERATE_DIRECTIVE_ENUM(KIND, NAME) KIND,
+#define GENERATE_DIRECTIVE_NAME(KIND, NAME) SLICE(NAME),
+typedef enum { ITERATE_DIRECTIVES_AND(GENERATE_DIRECTIVE_ENUM) DIRECTIVE_UNKNOWN } directive;
+static const string_slice directive_names[] = { ITERATE_DIRECTIVES_AND(GENERATE_DIRECTIVE_NAME) };
+
+// Every header any unit has included. Units on different threads include
+// the same headers, so there's one cache for all of them, and a lock.
+static struct {
+  pthread_mutex_t lock;
+  header_file **headers; // Off everyone's books (see memory_disown), so any thread can add to it
+  uint32_t count;
+  uint32_t capacity;
+} header_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+// One file's tokens, wherever they came from
+typedef struct {
+  const token_stream *tokens;
+  const char *text; // The file's own text, not the unit's
+  const string_slice *names; // What the tokens' symbols are into, NULL if they're already the unit's
+  symbol_id *unit_symbols; // The unit's symbol for each of those, NO_SYMBOL till it's needed
+  uint32_t text_offset; // Where the text went in the unit's
+  uint32_t conditional_depth; // How many #ifs were open when it started
+  const char *path;
+} file_view;
+
+// -- Reading directives out of tokens
+
+static string_slice name_in(const file_view *view, const symbol_table *symbols, symbol_id symbol) {
+  return view->names != NULL ? view->names[symbol] : symbol_name(symbols, symbol);
+}
+
+// Where a token stops in its file's text
+static uint32_t token_end(const file_view *view, const symbol_table *symbols, uint32_t index) {
+  uint32_t offset = view->tokens->offsets[index];
+  uint32_t length = view->tokens->lengths[index];
+  switch (view->tokens->types[index]) {
+  case TOKEN_NAME:
+    return offset + name_in(view, symbols, length).length;
+  case TOKEN_STRING:
+    // Past the closing quote
+    return offset + length + 1;
+  case TOKEN_LEFT_BRACE:
+  case TOKEN_RIGHT_BRACE:
+    return offset + 1;
+  default:
+    return offset + length;
+  }
+}
+
+// Whether a line ends somewhere in the gap between two tokens. Comments are
+// in the gaps too, and a backslash-newline doesn't count.
+static bool newline_between(const char *text, uint32_t from, uint32_t to) {
+  for (uint32_t i = from; i < to; i++) {
+    if (text[i] == '\n') {
+      return true;
+    }
+    if (text[i] == '\\') {
+      i += text[i + 1] == '\r';
+      i += text[i + 1] == '\n';
+    } else if (text[i] == '/' && text[i + 1] == '/') {
+      return true;
+    } else if (text[i] == '/' && text[i + 1] == '*') {
+      const char *close = strstr(text + i + 2, "*/");
+      if (close == NULL) {
+        return false;
+      }
+      i = close - text + 1;
+    }
+  }
+  return false;
+}
+
+static bool starts_line(const file_view *view, const symbol_table *symbols, uint32_t index) {
+  return index == 0 || newline_between(view->text, token_end(view, symbols, index - 1), view->tokens->offsets[index]);
+}
+
+// The first token after the directive starting at `index`
+static uint32_t directive_end(const file_view *view, const symbol_table *symbols, uint32_t index) {
+  uint32_t end = index + 1;
+  while (view->tokens->types[end] != TOKEN_END && !starts_line(view, symbols, end)) {
+    end++;
+  }
+  return end;
+}
+
+// What the word after a '#' says to do. "if" and "else" are keywords, the rest are names.
+static directive directive_kind(const file_view *view, const symbol_table *symbols, uint32_t index) {
+  switch (view->tokens->types[index]) {
+  case TOKEN_IF:
+    return DIRECTIVE_IF;
+  case TOKEN_ELSE:
+    return DIRECTIVE_ELSE;
+  case TOKEN_NAME: {
+    string_slice word = name_in(view, symbols, view->tokens->lengths[index]);
+    for (int kind = 0; kind < DIRECTIVE_UNKNOWN; kind++) {
+      if (slice_equals(word, directive_names[kind])) {
+        return kind;
+      }
+    }
+    return DIRECTIVE_UNKNOWN;
+  }
+  default:
+    return DIRECTIVE_UNKNOWN;
+  }
+}
+
+// -- The header cache
+
+// A guard is #ifndef X, then #define X, then the #endif that goes with the
+// #ifndef is the last thing in the file. Anything with an #else or #elif at
+// the top doesn't count, including it again would get you that part.
+static void find_guard(header_file *header) {
+  file_view view = { .tokens = &header->tokens, .text = header->source.chars, .names = header->names };
+  const token_stream *tokens = &header->tokens;
+  header->guard = (string_slice){ .chars = NULL, .length = 0 };
+  header->pragma_once = false;
+
+  bool guarded = tokens->count >= 6 && tokens->types[0] == TOKEN_HASH &&
+                 directive_kind(&view, NULL, 1) == DIRECTIVE_IFNDEF && tokens->types[2] == TOKEN_NAME &&
+                 directive_end(&view, NULL, 0) == 3 && tokens->types[3] == TOKEN_HASH && starts_line(&view, NULL, 3) &&
+                 directive_kind(&view, NULL, 4) == DIRECTIVE_DEFINE && tokens->types[5] == TOKEN_NAME &&
+                 tokens->lengths[5] == tokens->lengths[2];
+  int depth = 0;
+  for (uint32_t i = 0; tokens->types[i] != TOKEN_END; i++) {
+    if (tokens->types[i] != TOKEN_HASH || !starts_line(&view, NULL, i)) {
+      continue;
+    }
+    directive kind = directive_kind(&view, NULL, i + 1);
+    if (kind == DIRECTIVE_PRAGMA && tokens->types[i + 2] == TOKEN_NAME &&
+        slice_is(header->names[tokens->lengths[i + 2]], "once")) {
+      header->pragma_once = true;
+    } else if (kind == DIRECTIVE_IF || kind == DIRECTIVE_IFDEF || kind == DIRECTIVE_IFNDEF) {
+      depth++;
+    } else if ((kind == DIRECTIVE_ELSE || kind == DIRECTIVE_ELIF) && depth == 1) {
+      guarded = false;
+    } else if (kind == DIRECTIVE_ENDIF && --depth == 0) {
+      // The guard's #endif has to be the end
+      guarded &= tokens->types[directive_end(&view, NULL, i)] == TOKEN_END;
+    }
+  }
+  if (guarded) {
+    header->guard = header->names[tokens->lengths[2]];
+  }
+}
+
+// Lexes a header with a table of its own, so its names don't belong to any one unit
+static header_file *lex_header(const char *path, uint64_t path_hash) {
+  source_file source = source_from_path(path);
+  if (source.chars == NULL) {
+    return NULL;
+  }
+  header_file *header = memory_allocate(sizeof(header_file));
+  size_t path_length = strlen(path);
+  header->path = memory_allocate(path_length + 1);
+  memcpy(header->path, path, path_length + 1);
+  header->path_hash = path_hash;
+  header->source = source;
+
+  symbol_table names = symbol_table_create();
+  size_t errors_size = 0;
+  header->lexer_errors = NULL;
+  FILE *errors = open_memstream(&header->lexer_errors, &errors_size);
+  lexer_state lexer = lexer_create(source, &names);
+  lexer.errors = errors;
+  header->tokens = lex_all(&lexer);
+  fclose(errors);
+  header->lexer_error_count = lexer.error_count;
+
+  // The names point into the header's text, which stays mapped, so only the slices need keeping
+  header->name_count = symbol_count(&names);
+  header->names = memory_allocate(sizeof(string_slice) * (header->name_count + 1));
+  memcpy(header->names, names.names, sizeof(string_slice) * header->name_count);
+  symbol_table_free(&names);
+
+  find_guard(header);
+  counter_add(COUNTER_HEADERS_LEXED, 1);
+  return header;
+}
+
+static void header_free(header_file *header) {
+  token_stream_free(&header->tokens);
+  memory_free(header->names);
+  memory_free(header->path);
+  free(header->lexer_errors);
+  source_close(&header->source);
+  memory_free(header);
+}
+
+// Moving a header between the thread that lexed it and the cache's books (which are nobody's)
+static void header_disown(header_file *header) {
+  memory_disown(header->tokens.offsets);
+  memory_disown(header->names);
+  memory_disown(header->path);
+  memory_disown(header);
+}
+
+static void header_adopt(header_file *header) {
+  memory_adopt(header);
+  memory_adopt(header->tokens.offsets);
+  memory_adopt(header->names);
+  memory_adopt(header->path);
+}
+
+// Only with the lock held
+static header_file *find_header(const char *path, uint64_t path_hash) {
+  for (uint32_t i = 0; i < header_cache.count; i++) {
+    header_file *header = header_cache.headers[i];
+    if (header->path_hash == path_hash && strcmp(header->path, path) == 0) {
+      return header;
+    }
+  }
+  return NULL;
+}
+
+// The header at `path`, lexed by whoever asked first. The lock isn't held
+// while lexing, so two threads can both lex the same header, and the second
+// one to finish throws its copy away.
+static const header_file *cached_header(const char *path) {
+  uint64_t path_hash = hashmap_xxhash3(path, strlen(path), 0, 0);
+  pthread_mutex_lock(&header_cache.lock);
+  header_file *found = find_header(path, path_hash);
+  pthread_mutex_unlock(&header_cache.lock);
+  if (found != NULL) {
+    return found;
+  }
+
+  header_file *lexed = lex_header(path, path_hash);
+  if (lexed == NULL) {
+    return NULL;
+  }
+  pthread_mutex_lock(&header_cache.lock);
+  found = find_header(path, path_hash);
+  if (found == NULL) {
+    if (header_cache.count == header_cache.capacity) {
+      header_cache.capacity = header_cache.capacity == 0 ? 16 : header_cache.capacity * 2;
+      if (header_cache.headers != NULL) {
+        memory_adopt(header_cache.headers);
+      }
+      header_cache.headers = memory_reallocate(header_cache.headers, sizeof(header_file *) * header_cache.capacity);
+      memory_disown(header_cache.headers);
+    }
+    header_disown(lexed);
+    header_cache.headers[header_cache.count++] = lexed;
+  }
+  pthread_mutex_unlock(&header_cache.lock);
+  if (found != NULL) {
+    header_free(lexed);
+    return found;
+  }
+  return lexed;
+}
+
+void header_cache_free(void) {
+  pthread_mutex_lock(&header_cache.lock);
+  for (uint32_t i = 0; i < header_cache.count; i++) {
+    header_adopt(header_cache.headers[i]);
+    header_free(header_cache.headers[i]);
+  }
+  if (header_cache.headers != NULL) {
+    memory_adopt(header_cache.headers);
+    memory_free(header_cache.headers);
+  }
+  header_cache.headers = NULL;
+  header_cache.count = 0;
+  header_cache.capacity = 0;
+  pthread_mutex_unlock(&header_cache.lock);
+}
+
+// -- Building the unit
+
+bool source_has_directives(source_file source) {
+  return source.chars != NULL && memchr(source.chars, '#', source.size) != NULL;
+}
+
+static int compare_hide_set_entries(const void *a, const void *b, void *udata) {
+  (void)udata;
+  const hide_set_entry *left = a;
+  const hide_set_entry *right = b;
+  return left->macro != right->macro || left->rest != right->rest;
+}
+static uint64_t hash_hide_set_entry(const void *data, uint64_t seed0, uint64_t seed1) {
+  const hide_set_entry *entry = data;
+  uint64_t key = (uint64_t)entry->macro << 32 | entry->rest;
+  return hashmap_xxhash3(&key, sizeof(key), seed0, seed1);
+}
+
+preprocessor preprocessor_create(symbol_table *symbols, FILE *errors) {
+  preprocessor state = {
+    .symbols = symbols,
+    .errors = errors,
+    .error_count = 0,
+    .include_directories = NULL,
+    .text = NULL,
+    .text_size = 0,
+    .text_capacity = 0,
+    .tokens = { 0 },
+    .skipped_includes = 0,
+    .included = vector_create(),
+    .macros = vector_create(),
+    .macro_of_symbol = vector_create(),
+    .macro_tokens = { 0 },
+    .body_parameters = vector_create(),
+    .conditionals = vector_create(),
+    .include_depth = 0,
+    .defined_symbol = NO_SYMBOL,
+    .variadic_symbol = NO_SYMBOL,
+    .hide_sets = vector_create(),
+    .hide_set_ids = hashmap_new_with_allocator(memory_allocate, memory_reallocate, memory_free, sizeof(hide_set_entry), 64, 0, 0, hash_hide_set_entry, compare_hide_set_entries, NULL, NULL),
+    .unions = { { 0 } },
+    .pending = { 0 },
+    .arguments = { 0 },
+    .expanded_arguments = { 0 },
+    .substituted = { 0 },
+    .argument_spans = NULL,
+    .argument_count = 0,
+    .argument_capacity = 0,
+    .paste_buffer = NULL,
+    .paste_capacity = 0,
+    .pasted_names = arena_create(),
+  };
+  assert(state.hide_set_ids != NULL);
+  // The empty set doesn't need an entry, it's there so real ones start at 1
+  vector_add(&state.hide_sets, ((hide_set_entry){ .macro = NO_SYMBOL, .rest = EMPTY_HIDE_SET, .id = EMPTY_HIDE_SET }));
+  return state;
+}
+
+static void report(preprocessor *state, const char *path, const char *message) {
+  fprintf(state->errors, "%s (in %s)\n", message, path);
+  state->error_count += 1;
+}
+
+// Makes room for `size` more chars on the end of the unit's text, and says where they start
+static uint32_t extend_text(preprocessor *state, size_t size) {
+  uint32_t offset = state->text_size;
+  if (offset + size + 1 > state->text_capacity) {
+    uint32_t capacity = state->text_capacity * 2 > offset + size + 1 ? state->text_capacity * 2 : offset + size + 1;
+    state->text = memory_reallocate(state->text, capacity);
+    state->text_capacity = capacity;
+  }
+  state->text_size = offset + size;
+  state->text[state->text_size] = '\0';
+  return offset;
+}
+
+// Copies a file's text onto the end of the unit's, and says where it went
+static uint32_t append_text(preprocessor *state, const char *chars, size_t size) {
+  uint32_t offset = extend_text(state, size);
+  memcpy(state->text + offset, chars, size);
+  return offset;
+}
+
+// The unit's symbol for a name in some file
+static symbol_id unit_symbol(preprocessor *state, const file_view *view, symbol_id symbol) {
+  if (view->names == NULL) {
+    return symbol;
+  }
+  if (view->unit_symbols[symbol] == NO_SYMBOL) {
+    view->unit_symbols[symbol] = intern_symbol(state->symbols, view->names[symbol]);
+  }
+  return view->unit_symbols[symbol];
+}
+
+// A file's token, moved into the unit's text and symbols
+static token unit_token(preprocessor *state, const file_view *view, uint32_t index) {
+  token moved = token_stream_get(view->tokens, index);
+  moved.offset += view->text_offset;
+  if (moved.type == TOKEN_NAME) {
+    moved.symbol = unit_symbol(state, view, moved.symbol);
+  }
+  return moved;
+}
+
+static uint32_t find_macro(const preprocessor *state, symbol_id name) {
+  return name < vector_size((vector *)&state->macro_of_symbol) ? state->macro_of_symbol[name] : NO_MACRO;
+}
+
+static bool is_active(const preprocessor *state) {
+  uint32_t depth = vector_size((vector *)&state->conditionals);
+  return depth == 0 || state->conditionals[depth - 1].active;
+}
+
+static void push_conditional(preprocessor *state, bool condition) {
+  bool outer_active = is_active(state);
+  conditional pushed = {
+    .active = outer_active && condition,
+    .taken = outer_active && condition,
+    .outer_active = outer_active,
+    .seen_else = false,
+  };
+  vector_add(&state->conditionals, pushed);
+}
+
+// -- Hide sets
+
+static hide_set intern_hide_set(preprocessor *state, symbol_id macro, hide_set rest) {
+  hide_set_entry entry = { .macro = macro, .rest = rest, .id = vector_size((vector *)&state->hide_sets) };
+  const hide_set_entry *found = hashmap_get(state->hide_set_ids, &entry);
+  if (found != NULL) {
+    return found->id;
+  }
+  hashmap_set(state->hide_set_ids, &entry);
+  vector_add(&state->hide_sets, entry);
+  return entry.id;
+}
+
+static bool hide_set_has(const preprocessor *state, hide_set set, symbol_id macro) {
+  // Biggest first, so once they're smaller it isn't there
+  while (set != EMPTY_HIDE_SET && state->hide_sets[set].macro >= macro) {
+    if (state->hide_sets[set].macro == macro) {
+      return true;
+    }
+    set = state->hide_sets[set].rest;
+  }
+  return false;
+}
+
+static hide_set hide_set_with(preprocessor *state, hide_set set, symbol_id macro) {
+  if (set == EMPTY_HIDE_SET || state->hide_sets[set].macro < macro) {
+    return intern_hide_set(state, macro, set);
+  }
+  // A copy, interning can move the entries
+  hide_set_entry entry = state->hide_sets[set];
+  if (entry.macro == macro) {
+    return set;
+  }
+  return intern_hide_set(state, entry.macro, hide_set_with(state, entry.rest, macro));
+}
+
+static hide_set hide_set_union(preprocessor *state, hide_set a, hide_set b) {
+  if (a == EMPTY_HIDE_SET || a == b) {
+    return b;
+  }
+  hide_set_union_memo *memo = &state->unions[(a * 2654435761u ^ b) & (UNION_MEMO_SIZE - 1)];
+  if (memo->a == a && memo->b == b) {
+    return memo->both;
+  }
+  hide_set both = a;
+  for (hide_set rest = b; rest != EMPTY_HIDE_SET; rest = state->hide_sets[rest].rest) {
+    both = hide_set_with(state, both, state->hide_sets[rest].macro);
+  }
+  *memo = (hide_set_union_memo){ .a = a, .b = b, .both = both };
+  return both;
+}
+
+static hide_set hide_set_intersection(preprocessor *state, hide_set a, hide_set b) {
+  if (a == b) {
+    return a;
+  }
+  hide_set both = EMPTY_HIDE_SET;
+  for (; a != EMPTY_HIDE_SET; a = state->hide_sets[a].rest) {
+    if (hide_set_has(state, b, state->hide_sets[a].macro)) {
+      both = hide_set_with(state, both, state->hide_sets[a].macro);
+    }
+  }
+  return both;
+}
+
+// -- Expanding
+
+static void push_expanded(expanded_tokens *buffer, expanded_token pushed) {
+  if (buffer->count == buffer->capacity) {
+    buffer->capacity = buffer->capacity == 0 ? 64 : buffer->capacity * 2;
+    buffer->tokens = memory_reallocate(buffer->tokens, sizeof(expanded_token) * buffer->capacity);
+    assert(buffer->tokens != NULL);
+  }
+  buffer->tokens[buffer->count++] = pushed;
+}
+
+// Where expansion gets its next token: whatever's pending first, then the
+// rest of the file, if there is one
+typedef struct {
+  file_view *view; // NULL for just the pending tokens (an argument, an #if)
+  uint32_t *position; // The file's next token
+  uint32_t floor; // Pending tokens below this belong to whoever was reading before
+  bool in_condition; // What comes after `defined` stays as it is
+  const char *path; // For errors
+} token_reader;
+
+static bool reader_next(preprocessor *state, token_reader *reader, expanded_token *next) {
+  if (state->pending.count > reader->floor) {
+    *next = state->pending.tokens[--state->pending.count];
+    return true;
+  }
+  if (reader->view == NULL) {
+    return false;
+  }
+  // A directive stops anything, even a macro call that hasn't got its ')' yet
+  uint32_t position = *reader->position;
+  token_type type = reader->view->tokens->types[position];
+  if (type == TOKEN_END || (type == TOKEN_HASH && starts_line(reader->view, state->symbols, position))) {
+    return false;
+  }
+  *next = (expanded_token){ .value = unit_token(state, reader->view, position), .hidden = EMPTY_HIDE_SET };
+  *reader->position = position + 1;
+  return true;
+}
+
+static token_type reader_peek(preprocessor *state, const token_reader *reader) {
+  if (state->pending.count > reader->floor) {
+    return state->pending.tokens[state->pending.count - 1].value.type;
+  }
+  if (reader->view == NULL) {
+    return TOKEN_END;
+  }
+  uint32_t position = *reader->position;
+  token_type type = reader->view->tokens->types[position];
+  return type == TOKEN_HASH && starts_line(reader->view, state->symbols, position) ? TOKEN_END : type;
+}
+
+// The text a token was written as, wherever it ended up
+static string_slice token_spelling(const preprocessor *state, token spelled) {
+  switch (spelled.type) {
+  case TOKEN_NAME:
+    return symbol_name(state->symbols, spelled.symbol);
+  case TOKEN_STRING:
+    // With its quotes
+    return (string_slice){ .chars = state->text + spelled.offset - 1, .length = spelled.length + 2 };
+  case TOKEN_LEFT_BRACE:
+  case TOKEN_RIGHT_BRACE:
+    return (string_slice){ .chars = state->text + spelled.offset, .length = 1 };
+  default:
+    return (string_slice){ .chars = state->text + spelled.offset, .length = spelled.length };
+  }
+}
+
+// Whether something came between two tokens of an argument, for #
+static bool spaced_apart(const preprocessor *state, token before, token after) {
+  string_slice spelling = token_spelling(state, before);
+  uint32_t start = before.type == TOKEN_NAME ? before.offset : (uint32_t)(spelling.chars - state->text);
+  return start + spelling.length != after.offset;
+}
+
+// #parameter: the argument as it was written, in quotes. It's measured first,
+// since making room for it can move the text it's copied from.
+static expanded_token stringize(preprocessor *state, macro_argument argument) {
+  const expanded_token *tokens = state->arguments.tokens;
+  uint32_t length = 0;
+  for (uint32_t i = argument.start; i < argument.end; i++) {
+    string_slice spelling = token_spelling(state, tokens[i].value);
+    length += spelling.length + (i > argument.start && spaced_apart(state, tokens[i - 1].value, tokens[i].value));
+    for (uint32_t c = 0; tokens[i].value.type == TOKEN_STRING && c < spelling.length; c++) {
+      length += spelling.chars[c] == '"' || spelling.chars[c] == '\\';
+    }
+  }
+  uint32_t offset = extend_text(state, length + 2);
+  char *written = state->text + offset;
+  *written++ = '"';
+  for (uint32_t i = argument.start; i < argument.end; i++) {
+    if (i > argument.start && spaced_apart(state, tokens[i - 1].value, tokens[i].value)) {
+      *written++ = ' ';
+    }
+    string_slice spelling = token_spelling(state, tokens[i].value);
+    for (uint32_t c = 0; c < spelling.length; c++) {
+      if (tokens[i].value.type == TOKEN_STRING && (spelling.chars[c] == '"' || spelling.chars[c] == '\\')) {
+        *written++ = '\\';
+      }
+      *written++ = spelling.chars[c];
+    }
+  }
+  *written = '"';
+  token string = { .type = TOKEN_STRING, .offset = offset + 1, .length = length };
+  return (expanded_token){ .value = string, .hidden = EMPTY_HIDE_SET };
+}
+
+// Zeroes after a pasted token, and how it's aligned. The lexer reads whole
+// aligned blocks (see incremental.c).
+#define PASTE_PADDING 64
+#define PASTE_ALIGNMENT 32
+
+// left ## right: their spellings stuck together and lexed again, which
+// should come out as one token. It replaces the last one in `into`.
+static void paste(preprocessor *state, expanded_tokens *into, token right, const char *path) {
+  string_slice left_spelling = token_spelling(state, into->tokens[into->count - 1].value);
+  string_slice right_spelling = token_spelling(state, right);
+  uint32_t length = left_spelling.length + right_spelling.length;
+  if (length + PASTE_PADDING + PASTE_ALIGNMENT > state->paste_capacity) {
+    memory_free(state->paste_buffer);
+    state->paste_capacity = (length + PASTE_PADDING + PASTE_ALIGNMENT) * 2;
+    state->paste_buffer = memory_allocate(state->paste_capacity);
+    assert(state->paste_buffer != NULL);
+  }
+  char *buffer = (char *)(((uintptr_t)state->paste_buffer + PASTE_ALIGNMENT - 1) & ~(uintptr_t)(PASTE_ALIGNMENT - 1));
+  memcpy(buffer, left_spelling.chars, left_spelling.length);
+  memcpy(buffer + left_spelling.length, right_spelling.chars, right_spelling.length);
+  memset(buffer + length, 0, PASTE_PADDING);
+  // And into the unit's text too, so the token has somewhere to point
+  uint32_t offset = append_text(state, buffer, length);
+
+  source_file source = { .chars = buffer, .size = length, .mapped_size = 0 };
+  lexer_state lexer = lexer_create(source, state->symbols);
+  lexer.errors = state->errors;
+  // The buffer gets used again, a new name needs a copy of its own
+  arena *name_storage = state->symbols->name_storage;
+  state->symbols->name_storage = &state->pasted_names;
+  token pasted = lexer_next(&lexer);
+  bool one_token = pasted.type != TOKEN_END && lexer_peek(&lexer, 0).type == TOKEN_END;
+  state->symbols->name_storage = name_storage;
+  state->error_count += lexer.error_count;
+  if (!one_token) {
+    fprintf(state->errors, "Pasting gives \"%.*s\", which isn't one token (in %s)\n", (int)length, buffer, path);
+    state->error_count += 1;
+  }
+  if (pasted.type == TOKEN_END) {
+    into->count -= 1;
+    return;
+  }
+  pasted.offset += offset;
+  into->tokens[into->count - 1].value = pasted;
+}
+
+static void push_argument(preprocessor *state) {
+  if (state->argument_count == state->argument_capacity) {
+    state->argument_capacity = state->argument_capacity == 0 ? 16 : state->argument_capacity * 2;
+    state->argument_spans = memory_reallocate(state->argument_spans, sizeof(macro_argument) * state->argument_capacity);
+    assert(state->argument_spans != NULL);
+  }
+  state->argument_spans[state->argument_count++] = (macro_argument){
+    .start = state->arguments.count,
+    .end = state->arguments.count,
+    .expanded_start = NOT_EXPANDED,
+    .expanded_end = NOT_EXPANDED,
+    .as_written = false,
+  };
+}
+
+// From the '(' to the ')' of a call. Commas inside parentheses don't split
+// arguments, and neither do the ones in what a variadic macro's ... gets.
+static bool collect_arguments(preprocessor *state, token_reader *reader, const macro_definition *macro,
+                              expanded_token *closing) {
+  uint32_t parameter_count = vector_size((vector *)&macro->parameters);
+  uint32_t first = state->argument_count;
+  uint32_t depth = 0;
+  string_slice name;
+  reader_next(state, reader, closing);
+  push_argument(state);
+  while (true) {
+    expanded_token next;
+    if (!reader_next(state, reader, &next)) {
+      name = symbol_name(state->symbols, macro->name);
+      fprintf(state->errors, "Call to %.*s doesn't have a ')' (in %s)\n", (int)name.length, name.chars, reader->path);
+      state->error_count += 1;
+      return false;
+    }
+    token_type type = next.value.type;
+    if (depth == 0 && type == TOKEN_RIGHT_PARENTHESES) {
+      *closing = next;
+      break;
+    }
+    if (depth == 0 && type == TOKEN_COMMA && !(macro->variadic && state->argument_count - first == parameter_count)) {
+      push_argument(state);
+      continue;
+    }
+    depth += type == TOKEN_LEFT_PARENTHESES;
+    depth -= type == TOKEN_RIGHT_PARENTHESES;
+    push_expanded(&state->arguments, next);
+    state->argument_spans[state->argument_count - 1].end = state->arguments.count;
+  }
+
+  uint32_t count = state->argument_count - first;
+  // M() is one empty argument, which for a macro without parameters is none
+  if (parameter_count == 0 && count == 1 && state->argument_spans[first].start == state->argument_spans[first].end) {
+    state->argument_count -= 1;
+    count = 0;
+  }
+  // And the ... can be left out altogether
+  if (macro->variadic && count + 1 == parameter_count) {
+    push_argument(state);
+    count += 1;
+  }
+  if (count != parameter_count) {
+    name = symbol_name(state->symbols, macro->name);
+    fprintf(state->errors, "%.*s takes %u arguments, not %u (in %s)\n", (int)name.length, name.chars, parameter_count,
+            count, reader->path);
+    state->error_count += 1;
+    return false;
+  }
+  return true;
+}
+
+static void expand_tokens(preprocessor *state, token_reader *reader, expanded_tokens *output);
+
+// An argument with its own macros expanded, done the first time a body wants
+// it that way and kept till the call's done
+static macro_argument expanded_argument(preprocessor *state, uint32_t index, const char *path) {
+  if (state->argument_spans[index].expanded_start == NOT_EXPANDED) {
+    macro_argument argument = state->argument_spans[index];
+    // Most arguments don't have a macro in them, and those don't need copying
+    bool has_macro = false;
+    for (uint32_t i = argument.start; i < argument.end && !has_macro; i++) {
+      token written = state->arguments.tokens[i].value;
+      has_macro = written.type == TOKEN_NAME && find_macro(state, written.symbol) != NO_MACRO;
+    }
+    if (!has_macro) {
+      state->argument_spans[index].expanded_start = argument.start;
+      state->argument_spans[index].expanded_end = argument.end;
+      state->argument_spans[index].as_written = true;
+      return state->argument_spans[index];
+    }
+    uint32_t floor = state->pending.count;
+    for (uint32_t i = argument.end; i > argument.start; i--) {
+      push_expanded(&state->pending, state->arguments.tokens[i - 1]);
+    }
+    token_reader reader = { .view = NULL, .position = NULL, .floor = floor, .in_condition = false, .path = path };
+    uint32_t start = state->expanded_arguments.count;
+    expand_tokens(state, &reader, &state->expanded_arguments);
+    state->argument_spans[index].expanded_start = start;
+    state->argument_spans[index].expanded_end = state->expanded_arguments.count;
+  }
+  return state->argument_spans[index];
+}
+
+static void push_substituted(preprocessor *state, expanded_token pushed, hide_set hidden) {
+  pushed.hidden = hide_set_union(state, pushed.hidden, hidden);
+  push_expanded(&state->substituted, pushed);
+}
+
+// The body with the arguments put in, onto the pending stack to be looked at
+// again. Every token gets the call's hide set added to its own.
+static void substitute(preprocessor *state, const macro_definition *macro, uint32_t first_argument, hide_set hidden,
+                       const char *path) {
+  uint32_t result_start = state->substituted.count;
+  uint32_t expanded_mark = state->expanded_arguments.count;
+  const token_stream *body = &state->macro_tokens;
+  uint32_t body_end = macro->body_start + macro->body_count;
+  // The last thing was an argument with no tokens, so a ## after it has nothing to paste onto
+  bool previous_empty = false;
+  for (uint32_t i = macro->body_start; i < body_end; i++) {
+    token_type type = body->types[i];
+    uint32_t parameter = state->body_parameters[i];
+    if (type == TOKEN_HASH_HASH && i + 1 < body_end) {
+      i++;
+      uint32_t right_parameter = state->body_parameters[i];
+      expanded_token right = { .value = token_stream_get(body, i), .hidden = EMPTY_HIDE_SET };
+      uint32_t rest_start = 0;
+      uint32_t rest_end = 0;
+      if (right_parameter != NO_PARAMETER) {
+        macro_argument argument = state->argument_spans[first_argument + right_parameter];
+        if (argument.start == argument.end) {
+          continue;
+        }
+        right = state->arguments.tokens[argument.start];
+        rest_start = argument.start + 1;
+        rest_end = argument.end;
+      }
+      if (previous_empty || state->substituted.count == result_start) {
+        push_substituted(state, right, hidden);
+      } else {
+        paste(state, &state->substituted, right.value, path);
+      }
+      for (uint32_t j = rest_start; j < rest_end; j++) {
+        push_substituted(state, state->arguments.tokens[j], hidden);
+      }
+      previous_empty = false;
+      continue;
+    }
+    if (type == TOKEN_HASH && macro->function_like && i + 1 < body_end &&
+        state->body_parameters[i + 1] != NO_PARAMETER) {
+      i++;
+      push_substituted(state, stringize(state, state->argument_spans[first_argument + state->body_parameters[i]]),
+                       hidden);
+      previous_empty = false;
+      continue;
+    }
+    if (parameter != NO_PARAMETER) {
+      // Next to a ## it's the tokens as they were written, anywhere else they're expanded first
+      bool pasting = i + 1 < body_end && body->types[i + 1] == TOKEN_HASH_HASH;
+      uint32_t start;
+      uint32_t end;
+      const expanded_tokens *from;
+      if (pasting) {
+        start = state->argument_spans[first_argument + parameter].start;
+        end = state->argument_spans[first_argument + parameter].end;
+        from = &state->arguments;
+      } else {
+        macro_argument argument = expanded_argument(state, first_argument + parameter, path);
+        start = argument.expanded_start;
+        end = argument.expanded_end;
+        from = argument.as_written ? &state->arguments : &state->expanded_arguments;
+      }
+      for (uint32_t j = start; j < end; j++) {
+        push_substituted(state, from->tokens[j], hidden);
+      }
+      previous_empty = start == end;
+      continue;
+    }
+    push_substituted(state, (expanded_token){ .value = token_stream_get(body, i), .hidden = EMPTY_HIDE_SET }, hidden);
+    previous_empty = false;
+  }
+
+  // Read again from the front, so they go on the stack back to front
+  for (uint32_t i = state->substituted.count; i > result_start; i--) {
+    push_expanded(&state->pending, state->substituted.tokens[i - 1]);
+  }
+  state->substituted.count = result_start;
+  state->expanded_arguments.count = expanded_mark;
+}
+
+// If `name` is a macro that can expand here, it does, its expansion goes on
+// the pending stack and this says true. A function-like macro eats its
+// arguments from the reader.
+static bool expand_macro(preprocessor *state, token_reader *reader, expanded_token name) {
+  if (name.value.type != TOKEN_NAME) {
+    return false;
+  }
+  uint32_t index = find_macro(state, name.value.symbol);
+  if (index == NO_MACRO || hide_set_has(state, name.hidden, name.value.symbol)) {
+    return false;
+  }
+  const macro_definition *macro = &state->macros[index];
+  uint32_t first_argument = state->argument_count;
+  uint32_t arguments_mark = state->arguments.count;
+  hide_set hidden;
+  if (macro->function_like) {
+    // Without a '(' it's just a name
+    if (reader_peek(state, reader) != TOKEN_LEFT_PARENTHESES) {
+      return false;
+    }
+    expanded_token closing;
+    bool called = collect_arguments(state, reader, macro, &closing);
+    if (!called) {
+      state->argument_count = first_argument;
+      state->arguments.count = arguments_mark;
+      return true;
+    }
+    hidden = hide_set_with(state, hide_set_intersection(state, name.hidden, closing.hidden), macro->name);
+  } else {
+    hidden = hide_set_with(state, name.hidden, macro->name);
+  }
+  substitute(state, macro, first_argument, hidden, reader->path);
+  state->argument_count = first_argument;
+  state->arguments.count = arguments_mark;
+  counter_add(COUNTER_MACRO_EXPANSIONS, 1);
+  return true;
+}
+
+// Everything the reader has, with every macro expanded, onto the end of `output`
+static void expand_tokens(preprocessor *state, token_reader *reader, expanded_tokens *output) {
+  expanded_token next;
+  while (reader_next(state, reader, &next)) {
+    if (reader->in_condition && next.value.type == TOKEN_NAME && next.value.symbol == state->defined_symbol) {
+      // defined X or defined(X), where X is asked about, not expanded
+      push_expanded(output, next);
+      while (reader_next(state, reader, &next)) {
+        push_expanded(output, next);
+        if (next.value.type != TOKEN_LEFT_PARENTHESES) {
+          break;
+        }
+      }
+      continue;
+    }
+    if (!expand_macro(state, reader, next)) {
+      push_expanded(output, next);
+    }
+  }
+}
+
+// -- #if expressions
+
+typedef struct {
+  preprocessor *state;
+  const expanded_token *tokens; // Already expanded
+  uint32_t position;
+  uint32_t count;
+  bool failed;
+} condition_parser;
+
+static token_type condition_peek(const condition_parser *parser) {
+  return parser->position < parser->count ? parser->tokens[parser->position].value.type : TOKEN_END;
+}
+
+static int64_t number_value(const char *text, uint32_t offset, uint32_t length) {
+  int64_t value = 0;
+  for (uint32_t i = 0; i < length && text[offset + i] >= '0' && text[offset + i] <= '9'; i++) {
+    value = value * 10 + (text[offset + i] - '0');
+  }
+  return value;
+}
+
+static int binary_precedence(token_type type) {
+  switch (type) {
+  case TOKEN_OR:
+    return 1;
+  case TOKEN_AND:
+    return 2;
+  case TOKEN_EQUALS_EQUALS:
+  case TOKEN_NOT_EQUALS:
+    return 3;
+  case TOKEN_LESS_THAN:
+  case TOKEN_LESS_THAN_EQUALS:
+  case TOKEN_GREATER_THAN:
+  case TOKEN_GREATER_THAN_EQUALS:
+    return 4;
+  case TOKEN_PLUS:
+  case TOKEN_MINUS:
+    return 5;
+  default:
+    return 0;
+  }
+}
+
+static int64_t parse_condition(condition_parser *parser, int min_precedence);
+
+static int64_t parse_condition_operand(condition_parser *parser) {
+  token_type type = condition_peek(parser);
+  token current = parser->tokens[parser->position].value;
+  parser->position++;
+  switch (type) {
+  case TOKEN_NUMBER:
+    return number_value(parser->state->text, current.offset, current.length);
+  case TOKEN_NOT:
+    return !parse_condition_operand(parser);
+  case TOKEN_MINUS:
+    return -parse_condition_operand(parser);
+  case TOKEN_PLUS:
+    return parse_condition_operand(parser);
+  case TOKEN_TRUE:
+    return 1;
+  case TOKEN_FALSE:
+    return 0;
+  case TOKEN_LEFT_PARENTHESES: {
+    int64_t value = parse_condition(parser, 1);
+    if (condition_peek(parser) != TOKEN_RIGHT_PARENTHESES) {
+      parser->failed = true;
+      return 0;
+    }
+    parser->position++;
+    return value;
+  }
+  case TOKEN_NAME: {
+    // Anything still a name after expanding is 0
+    if (current.symbol != parser->state->defined_symbol) {
+      return 0;
+    }
+    bool parenthesized = condition_peek(parser) == TOKEN_LEFT_PARENTHESES;
+    parser->position += parenthesized;
+    if (condition_peek(parser) != TOKEN_NAME) {
+      parser->failed = true;
+      return 0;
+    }
+    symbol_id defined = parser->tokens[parser->position++].value.symbol;
+    if (parenthesized && condition_peek(parser) != TOKEN_RIGHT_PARENTHESES) {
+      parser->failed = true;
+      return 0;
+    }
+    parser->position += parenthesized;
+    return find_macro(parser->state, defined) != NO_MACRO;
+  }
+  default:
+    parser->failed = true;
+    return 0;
+  }
+}
+
+static int64_t parse_condition(condition_parser *parser, int min_precedence) {
+  int64_t left = parse_condition_operand(parser);
+  while (!parser->failed) {
+    token_type operator = condition_peek(parser);
+    int precedence = binary_precedence(operator);
+    if (precedence < min_precedence || precedence == 0) {
+      break;
+    }
+    parser->position++;
+    int64_t right = parse_condition(parser, precedence + 1);
+    switch (operator) {
+    case TOKEN_OR: left = left || right; break;
+    case TOKEN_AND: left = left && right; break;
+    case TOKEN_EQUALS_EQUALS: left = left == right; break;
+    case TOKEN_NOT_EQUALS: left = left != right; break;
+    case TOKEN_LESS_THAN: left = left < right; break;
+    case TOKEN_LESS_THAN_EQUALS: left = left <= right; break;
+    case TOKEN_GREATER_THAN: left = left > right; break;
+    case TOKEN_GREATER_THAN_EQUALS: left = left >= right; break;
+    case TOKEN_PLUS: left = left + right; break;
+    case TOKEN_MINUS: left = left - right; break;
+    default: break;
+    }
+  }
+  return left;
+}
+
+// Tokens [start, end) of an #if or #elif, expanded first. Anything it can't
+// make sense of is false.
+static bool evaluate_condition(preprocessor *state, const file_view *view, uint32_t start, uint32_t end) {
+  uint32_t floor = state->pending.count;
+  for (uint32_t i = end; i > start; i--) {
+    push_expanded(&state->pending, (expanded_token){ .value = unit_token(state, view, i - 1), .hidden = EMPTY_HIDE_SET });
+  }
+  token_reader reader = { .view = NULL, .position = NULL, .floor = floor, .in_condition = true, .path = view->path };
+  uint32_t output_start = state->expanded_arguments.count;
+  expand_tokens(state, &reader, &state->expanded_arguments);
+
+  condition_parser parser = {
+    .state = state,
+    .tokens = state->expanded_arguments.tokens + output_start,
+    .position = 0,
+    .count = state->expanded_arguments.count - output_start,
+    .failed = false,
+  };
+  int64_t value = parser.count > 0 ? parse_condition(&parser, 1) : 0;
+  state->expanded_arguments.count = output_start;
+  if (parser.count == 0 || parser.failed || parser.position != parser.count) {
+    report(state, view->path, "Couldn't work out an #if");
+    return false;
+  }
+  return value != 0;
+}
+
+// -- Directives
+
+// #define NAME body, or #define NAME(parameters) body with the '(' right
+// after the name. Which body tokens are parameters is worked out now, so
+// expanding doesn't have to look.
+static void define_macro(preprocessor *state, const file_view *view, uint32_t start, uint32_t end) {
+  const token_stream *tokens = view->tokens;
+  if (start + 1 >= end || tokens->types[start + 1] != TOKEN_NAME) {
+    report(state, view->path, "#define needs a name");
+    return;
+  }
+  symbol_id name = unit_symbol(state, view, tokens->lengths[start + 1]);
+  macro_definition macro = {
+    .name = name,
+    .function_like = false,
+    .variadic = false,
+    .parameters = vector_create(),
+    .body_start = 0,
+    .body_count = 0,
+  };
+  uint32_t body = start + 2;
+  if (body < end && tokens->types[body] == TOKEN_LEFT_PARENTHESES &&
+      tokens->offsets[body] == token_end(view, state->symbols, start + 1)) {
+    macro.function_like = true;
+    body++;
+    bool closed = body < end && tokens->types[body] == TOKEN_RIGHT_PARENTHESES;
+    while (body < end && !closed) {
+      if (tokens->types[body] == TOKEN_NAME) {
+        vector_add(&macro.parameters, unit_symbol(state, view, tokens->lengths[body]));
+        body++;
+      } else if (body + 2 < end && tokens->types[body] == TOKEN_DOT && tokens->types[body + 1] == TOKEN_DOT &&
+                 tokens->types[body + 2] == TOKEN_DOT) {
+        // There's no ... token, it's three dots
+        macro.variadic = true;
+        vector_add(&macro.parameters, state->variadic_symbol);
+        body += 3;
+      } else {
+        break;
+      }
+      if (body < end && tokens->types[body] == TOKEN_RIGHT_PARENTHESES) {
+        closed = true;
+      } else if (!macro.variadic && body < end && tokens->types[body] == TOKEN_COMMA) {
+        body++;
+      } else {
+        break;
+      }
+    }
+    if (!closed) {
+      report(state, view->path, "Couldn't read a macro's parameters");
+      vector_free((vector *)&macro.parameters);
+      return;
+    }
+    body++;
+  }
+
+  uint32_t parameter_count = vector_size((vector *)&macro.parameters);
+  if (body < end && (tokens->types[body] == TOKEN_HASH_HASH || tokens->types[end - 1] == TOKEN_HASH_HASH)) {
+    report(state, view->path, "## can't be at either end of a macro");
+    vector_free((vector *)&macro.parameters);
+    return;
+  }
+  macro.body_start = state->macro_tokens.count;
+  macro.body_count = end - body;
+  for (uint32_t i = body; i < end; i++) {
+    token moved = unit_token(state, view, i);
+    uint32_t parameter = NO_PARAMETER;
+    for (uint32_t p = 0; moved.type == TOKEN_NAME && p < parameter_count; p++) {
+      parameter = macro.parameters[p] == moved.symbol ? p : parameter;
+    }
+    token_stream_push(&state->macro_tokens, moved);
+    vector_add(&state->body_parameters, parameter);
+  }
+  for (uint32_t i = macro.body_start; macro.function_like && i < macro.body_start + macro.body_count; i++) {
+    if (state->macro_tokens.types[i] == TOKEN_HASH &&
+        (i + 1 == macro.body_start + macro.body_count || state->body_parameters[i + 1] == NO_PARAMETER)) {
+      report(state, view->path, "# has to be followed by a parameter");
+      break;
+    }
+  }
+
+  // Defining it again replaces it
+  uint32_t existing = find_macro(state, name);
+  if (existing != NO_MACRO) {
+    vector_free((vector *)&state->macros[existing].parameters);
+    state->macros[existing] = macro;
+    return;
+  }
+  while (vector_size((vector *)&state->macro_of_symbol) <= name) {
+    vector_add(&state->macro_of_symbol, NO_MACRO);
+  }
+  state->macro_of_symbol[name] = vector_size((vector *)&state->macros);
+  vector_add(&state->macros, macro);
+}
+
+static void undefine_macro(preprocessor *state, const file_view *view, uint32_t start, uint32_t end) {
+  if (start + 1 >= end || view->tokens->types[start + 1] != TOKEN_NAME) {
+    report(state, view->path, "#undef needs a name");
+    return;
+  }
+  symbol_id name = unit_symbol(state, view, view->tokens->lengths[start + 1]);
+  uint32_t existing = find_macro(state, name);
+  if (existing != NO_MACRO) {
+    // The definition stays where it is, it's just not found any more
+    state->macro_of_symbol[name] = NO_MACRO;
+  }
+}
+
+// Where an include points, as a canonical path. "..." looks next to the
+// file that's including it first, <...> only looks in the include directories.
+static bool resolve_include(const preprocessor *state, const char *includer, string_slice spelled, bool angled,
+                            char *resolved) {
+  char candidate[PATH_MAX];
+  if (spelled.length == 0 || spelled.length >= PATH_MAX) {
+    return false;
+  }
+  if (spelled.chars[0] == '/') {
+    snprintf(candidate, sizeof(candidate), "%.*s", (int)spelled.length, spelled.chars);
+    return realpath(candidate, resolved) != NULL;
+  }
+  if (!angled) {
+    const char *slash = strrchr(includer, '/');
+    if (slash != NULL) {
+      snprintf(candidate, sizeof(candidate), "%.*s/%.*s", (int)(slash - includer), includer, (int)spelled.length,
+               spelled.chars);
+    } else {
+      snprintf(candidate, sizeof(candidate), "%.*s", (int)spelled.length, spelled.chars);
+    }
+    if (realpath(candidate, resolved) != NULL) {
+      return true;
+    }
+  }
+  uint32_t directory_count = state->include_directories != NULL ? vector_size((vector *)&state->include_directories) : 0;
+  for (uint32_t i = 0; i < directory_count; i++) {
+    snprintf(candidate, sizeof(candidate), "%s/%.*s", state->include_directories[i], (int)spelled.length,
+             spelled.chars);
+    if (realpath(candidate, resolved) != NULL) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool guard_defined(preprocessor *state, const header_file *header) {
+  if (header->guard.chars == NULL) {
+    return false;
+  }
+  return find_macro(state, intern_symbol(state->symbols, header->guard)) != NO_MACRO;
+}
+
+static void preprocess_file(preprocessor *state, file_view *view);
+
+static void include_file(preprocessor *state, const file_view *view, uint32_t start, uint32_t end) {
+  const token_stream *tokens = view->tokens;
+  string_slice spelled;
+  bool angled = false;
+  if (start + 1 < end && tokens->types[start + 1] == TOKEN_STRING) {
+    spelled = (string_slice){ .chars = view->text + tokens->offsets[start + 1], .length = tokens->lengths[start + 1] };
+  } else if (start + 1 < end && tokens->types[start + 1] == TOKEN_LESS_THAN) {
+    uint32_t close = start + 2;
+    while (close < end && tokens->types[close] != TOKEN_GREATER_THAN) {
+      close++;
+    }
+    if (close == end) {
+      report(state, view->path, "#include <...> needs a '>'");
+      return;
+    }
+    uint32_t from = tokens->offsets[start + 1] + 1;
+    spelled = (string_slice){ .chars = view->text + from, .length = tokens->offsets[close] - from };
+    angled = true;
+  } else {
+    report(state, view->path, "#include needs \"file\" or <file>");
+    return;
+  }
+
+  char resolved[PATH_MAX];
+  if (!resolve_include(state, view->path, spelled, angled, resolved)) {
+    fprintf(state->errors, "Couldn't find include: %.*s (in %s)\n", (int)spelled.length, spelled.chars, view->path);
+    state->error_count += 1;
+    return;
+  }
+  if (state->include_depth >= MAX_INCLUDE_DEPTH) {
+    report(state, view->path, "Includes go too deep, is something including itself?");
+    return;
+  }
+  const header_file *header = cached_header(resolved);
+  if (header == NULL) {
+    fprintf(state->errors, "Couldn't read include: %s (in %s)\n", resolved, view->path);
+    state->error_count += 1;
+    return;
+  }
+
+  included_file *already = NULL;
+  for (uint32_t i = 0; i < vector_size((vector *)&state->included); i++) {
+    if (state->included[i].header == header) {
+      already = &state->included[i];
+      break;
+    }
+  }
+  // The whole point of guards: nothing in it would survive, so it isn't looked at
+  if (guard_defined(state, header) || (already != NULL && header->pragma_once)) {
+    state->skipped_includes += 1;
+    counter_add(COUNTER_INCLUDES_SKIPPED, 1);
+    return;
+  }
+  if (already == NULL) {
+    // Only the first time, its text and names are already the unit's after that
+    included_file first = {
+      .header = header,
+      .text_offset = append_text(state, header->source.chars, header->source.size),
+      .unit_symbols = memory_allocate(sizeof(symbol_id) * (header->name_count + 1)),
+    };
+    memset(first.unit_symbols, 0xff, sizeof(symbol_id) * header->name_count);
+    vector_add(&state->included, first);
+    already = &state->included[vector_size((vector *)&state->included) - 1];
+    if (header->lexer_errors != NULL) {
+      fputs(header->lexer_errors, state->errors);
+    }
+    state->error_count += header->lexer_error_count;
+  }
+
+  file_view header_view = {
+    .tokens = &header->tokens,
+    .text = header->source.chars,
+    .names = header->names,
+    .unit_symbols = already->unit_symbols,
+    .text_offset = already->text_offset,
+    .conditional_depth = vector_size((vector *)&state->conditionals),
+    .path = header->path,
+  };
+  state->include_depth += 1;
+  preprocess_file(state, &header_view);
+  state->include_depth -= 1;
+}
+
+// Tokens [start, end) of a directive, start is the word after the '#'
+static void run_directive(preprocessor *state, file_view *view, uint32_t start, uint32_t end) {
+  if (start == end) {
+    // Just a '#' on its own, which does nothing
+    return;
+  }
+  directive kind = directive_kind(view, state->symbols, start);
+  uint32_t depth = vector_size((vector *)&state->conditionals);
+  conditional *innermost = depth > view->conditional_depth ? &state->conditionals[depth - 1] : NULL;
+  // Skipped lines still have to keep track of #if and #endif
+  bool active = is_active(state);
+  switch (kind) {
+  case DIRECTIVE_IF:
+    push_conditional(state, active && evaluate_condition(state, view, start + 1, end));
+    break;
+  case DIRECTIVE_IFDEF:
+  case DIRECTIVE_IFNDEF:
+    if (start + 1 >= end || view->tokens->types[start + 1] != TOKEN_NAME) {
+      report(state, view->path, "#ifdef and #ifndef need a name");
+      push_conditional(state, false);
+    } else {
+      bool defined = find_macro(state, unit_symbol(state, view, view->tokens->lengths[start + 1])) != NO_MACRO;
+      push_conditional(state, kind == DIRECTIVE_IFDEF ? defined : !defined);
+    }
+    break;
+  case DIRECTIVE_ELIF:
+    if (innermost == NULL || innermost->seen_else) {
+      report(state, view->path, "#elif without an #if");
+    } else if (!innermost->outer_active || innermost->taken) {
+      innermost->active = false;
+    } else {
+      innermost->active = evaluate_condition(state, view, start + 1, end);
+      innermost->taken = innermost->active;
+    }
+    break;
+  case DIRECTIVE_ELSE:
+    if (innermost == NULL || innermost->seen_else) {
+      report(state, view->path, "#else without an #if");
+    } else {
+      innermost->active = innermost->outer_active && !innermost->taken;
+      innermost->taken = true;
+      innermost->seen_else = true;
+    }
+    break;
+  case DIRECTIVE_ENDIF:
+    if (innermost == NULL) {
+      report(state, view->path, "#endif without an #if");
+    } else {
+      vector_remove(&state->conditionals, depth - 1);
+    }
+    break;
+  default:
+    if (!active) {
+      break;
+    }
+    switch (kind) {
+    case DIRECTIVE_INCLUDE:
+      include_file(state, view, start, end);
+      break;
+    case DIRECTIVE_DEFINE:
+      define_macro(state, view, start, end);
+      break;
+    case DIRECTIVE_UNDEF:
+      undefine_macro(state, view, start, end);
+      break;
+    case DIRECTIVE_PRAGMA:
+      // #pragma once was found when the header got lexed, anything else is ignored
+      break;
+    case DIRECTIVE_ERROR: {
+      uint32_t from = view->tokens->offsets[start];
+      uint32_t to = token_end(view, state->symbols, end - 1);
+      fprintf(state->errors, "#%.*s (in %s)\n", (int)(to - from), view->text + from, view->path);
+      state->error_count += 1;
+      break;
+    }
+    default:
+      report(state, view->path, "Unknown directive");
+      break;
+    }
+  }
+}
+
+// Everything outside directives goes into the unit, with macros expanded,
+// unless an #if says not to
+static void preprocess_file(preprocessor *state, file_view *view) {
+  const token_stream *tokens = view->tokens;
+  uint32_t position = 0;
+  token_reader reader = {
+    .view = view,
+    .position = &position,
+    .floor = state->pending.count,
+    .in_condition = false,
+    .path = view->path,
+  };
+  while (true) {
+    // Directives only come up once everything an expansion made has been looked at
+    if (state->pending.count == reader.floor) {
+      token_type type = tokens->types[position];
+      if (type == TOKEN_END) {
+        break;
+      }
+      if (type == TOKEN_HASH && starts_line(view, state->symbols, position)) {
+        uint32_t end = directive_end(view, state->symbols, position);
+        run_directive(state, view, position + 1, end);
+        position = end;
+        continue;
+      }
+      if (!is_active(state)) {
+        position++;
+        continue;
+      }
+    }
+    expanded_token next;
+    reader_next(state, &reader, &next);
+    if (!expand_macro(state, &reader, next)) {
+      token_stream_push(&state->tokens, next.value);
+    }
+  }
+  if (vector_size((vector *)&state->conditionals) > view->conditional_depth) {
+    report(state, view->path, "#if without an #endif");
+    while (vector_size((vector *)&state->conditionals) > view->conditional_depth) {
+      vector_remove(&state->conditionals, vector_size((vector *)&state->conditionals) - 1);
+    }
+  }
+}
+
+void preprocess(preprocessor *state, source_file source, const char *path) {
+  TIME_SCOPE("preprocess");
+  lexer_state lexer = lexer_create(source, state->symbols);
+  lexer.errors = state->errors;
+  token_stream tokens = lex_all(&lexer);
+  state->error_count += lexer.error_count;
+  // After the file's own names, so they get the same ids they would without preprocessing
+  state->defined_symbol = intern_symbol(state->symbols, SLICE("defined"));
+  state->variadic_symbol = intern_symbol(state->symbols, SLICE("__VA_ARGS__"));
+
+  file_view view = {
+    .tokens = &tokens,
+    .text = source.chars,
+    .names = NULL,
+    .unit_symbols = NULL,
+    .text_offset = append_text(state, source.chars, source.size),
+    .conditional_depth = 0,
+    .path = path,
+  };
+  preprocess_file(state, &view);
+  token_stream_free(&tokens);
+
+  token end = { .type = TOKEN_END, .offset = state->text_size, .length = 0 };
+  token_stream_push(&state->tokens, end);
+  // Braces came from all over, so they get paired up again now that they're in one place
+  token_stream_pair_braces(&state->tokens);
+}
+
+source_file preprocessed_source(const preprocessor *state) {
+  source_file source = { .chars = state->text, .size = state->text_size, .mapped_size = 0 };
+  return source;
+}
+
+void preprocessor_free(preprocessor *state) {
+  for (uint32_t i = 0; i < vector_size((vector *)&state->included); i++) {
+    memory_free(state->included[i].unit_symbols);
+  }
+  for (uint32_t i = 0; i < vector_size((vector *)&state->macros); i++) {
+    vector_free((vector *)&state->macros[i].parameters);
+  }
+  vector_free((vector *)&state->included);
+  vector_free((vector *)&state->macros);
+  vector_free((vector *)&state->macro_of_symbol);
+  vector_free((vector *)&state->body_parameters);
+  vector_free((vector *)&state->conditionals);
+  vector_free((vector *)&state->hide_sets);
+  hashmap_free(state->hide_set_ids);
+  memory_free(state->pending.tokens);
+  memory_free(state->arguments.tokens);
+  memory_free(state->expanded_arguments.tokens);
+  memory_free(state->substituted.tokens);
+  memory_free(state->argument_spans);
+  memory_free(state->paste_buffer);
+  arena_free(&state->pasted_names);
+  token_stream_free(&state->tokens);
+  token_stream_free(&state->macro_tokens);
+  memory_free(state->text);
+  state->text = NULL;
+}
@@ -0,0 +1,197 @@
+#ifndef preprocessor_h
+#define preprocessor_h
+#include "arena.h"
+#include "lexer.h"
+#include "source.h"
+#include "symbols.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Runs between the lexer and the parser, over tokens instead of text:
+// #include, #define/#undef, #if/#ifdef/#ifndef/#elif/#else/#endif,
+// #pragma once, and expanding macros. What comes out is one token stream for
+// the whole translation unit, with every directive and macro gone.
+//
+// Tokens point into text by offset, and a unit's tokens come from lots of
+// files, so every file that's included gets its text copied in after the
+// one before it. The unit's text is what the tokens' offsets are into, and
+// what the parser gets as its source. Copying text is a lot cheaper than
+// lexing it.
+//
+// Headers are lexed once per process, not once per unit: the first unit to
+// include one lexes it into a cache every thread shares, later ones copy the
+// tokens out of there, turning the header's names into their own symbols as
+// they go. When a header's lexed, it also gets checked for an include guard
+// (#ifndef X / #define X ... #endif around the whole thing) or #pragma once.
+// Including it again after that is skipped without the header being opened,
+// read or looked at, once the guard's defined (or it's been included, for
+// #pragma once).
+//
+// Lexing is all the cache saves though. Every unit still copies a header's
+// tokens in one at a time, turns its names into the unit's symbols, and
+// parses its declarations again, and that's most of what a header costs.
+// benchmarks/preprocess comes out between 1.06x and 1.56x faster with the
+// cache, depending on the machine and the run. Sending tokens that can't be
+// macros straight past the expansion code didn't measurably change that.
+// What takes the per-unit work away is a precompiled header image
+// (precompiled.h), which is about 16-20x on benchmarks/precompiled.
+
+#define MAX_INCLUDE_DEPTH 200
+
+// Expanding a macro never copies text. Tokens only point into it, so a
+// body's tokens (and its arguments') are copied into the output as they are,
+// still pointing at wherever they were written. The only tokens that need
+// text of their own are the ones # (stringizing) and ## (pasting) make, and
+// that gets added on the end of the unit's text.
+//
+// What stops a macro from expanding inside itself forever is the token's
+// hide set: every macro it came out of. A name whose own macro is in its
+// hide set stays a name. Sets are interned, so a token's is one number,
+// and the same sets come up over and over (every token out of one
+// expansion mostly has the same one).
+
+// A header as it was lexed, shared by every unit that includes it
+typedef struct {
+  char *path; // Canonical, so it's the same however it got included
+  uint64_t path_hash;
+  source_file source; // Mapped till the cache goes away
+  token_stream tokens; // Names are ids into `names`, not into any unit's symbols
+  string_slice *names; // In the header's text
+  uint32_t name_count;
+  string_slice guard; // The include guard's name, empty if there isn't one
+  bool pragma_once;
+  char *lexer_errors; // What lexing it printed (malloc'd), every unit that includes it prints it again
+  uint32_t lexer_error_count;
+} header_file;
+
+// A header included somewhere in this unit, and where its text went
+typedef struct {
+  const header_file *header;
+  uint32_t text_offset;
+  symbol_id *unit_symbols; // This unit's symbol for each of the header's names, NO_SYMBOL till one's needed
+} included_file;
+
+typedef struct {
+  symbol_id name;
+  bool function_like;
+  bool variadic; // The last parameter is __VA_ARGS__, and gets every argument left over
+  symbol_id *parameters; // Vector
+  uint32_t body_start; // Into the preprocessor's macro_tokens
+  uint32_t body_count;
+} macro_definition;
+
+// For body tokens that aren't parameters
+#define NO_PARAMETER UINT32_MAX
+
+// Interned, 0 is the empty set
+typedef uint32_t hide_set;
+#define EMPTY_HIDE_SET 0
+
+// A set is its biggest macro and the set of the rest, so every set is a
+// chain of these, and the same set is always the same chain
+typedef struct {
+  symbol_id macro;
+  hide_set rest;
+  hide_set id;
+} hide_set_entry;
+
+// Unions already worked out, since a whole expansion's tokens get the same one added
+typedef struct {
+  hide_set a;
+  hide_set b;
+  hide_set both;
+} hide_set_union_memo;
+
+#define UNION_MEMO_SIZE 256
+
+typedef struct {
+  token value; // Offsets are into the unit's text, names are the unit's symbols
+  hide_set hidden;
+} expanded_token;
+
+// Plain growable arrays, they're pushed to and cut back constantly
+typedef struct {
+  expanded_token *tokens;
+  uint32_t count;
+  uint32_t capacity;
+} expanded_tokens;
+
+// One argument of a macro call, as tokens in the preprocessor's `arguments`,
+// and once it's needed, expanded in `expanded_arguments`
+typedef struct {
+  uint32_t start;
+  uint32_t end;
+  uint32_t expanded_start; // NOT_EXPANDED till it's needed
+  uint32_t expanded_end;
+  bool as_written; // Nothing in it could expand, so expanded is the same tokens, in `arguments`
+} macro_argument;
+
+#define NOT_EXPANDED UINT32_MAX
+
+// How the #if a line is in is going
+typedef struct {
+  bool active; // This branch's tokens are being kept
+  bool taken; // Some branch of it already was, so the rest can't be
+  bool outer_active; // Whether anything in it could be
+  bool seen_else;
+} conditional;
+
+typedef struct {
+  symbol_table *symbols;
+  FILE *errors;
+  uint32_t error_count;
+  char **include_directories; // Vector (or NULL), searched for <...>, and for "..." after the includer's directory
+
+  // What comes out
+  char *text; // Every file's text back to back, with a '\0' after it
+  uint32_t text_size;
+  uint32_t text_capacity;
+  token_stream tokens;
+  uint32_t skipped_includes; // Guarded headers that didn't have to be looked at again
+
+  included_file *included; // Vector, in the order they were first included
+  macro_definition *macros; // Vector
+  uint32_t *macro_of_symbol; // Vector, symbol_id -> index into macros, NO_MACRO if it isn't one
+  token_stream macro_tokens; // Every macro's body, offsets into text
+  uint32_t *body_parameters; // Vector, for each of macro_tokens, which parameter it is (or NO_PARAMETER)
+  conditional *conditionals; // Vector, innermost last
+  uint32_t include_depth;
+  symbol_id defined_symbol;
+  symbol_id variadic_symbol; // __VA_ARGS__
+
+  // Expanding. Each of these is a stack, an expansion inside another one
+  // only ever adds to the end and cuts back to where it started.
+  hide_set_entry *hide_sets; // Vector, hide_set -> its entry
+  struct hashmap *hide_set_ids; // (macro, rest) -> hide_set_entry
+  hide_set_union_memo unions[UNION_MEMO_SIZE]; // By a hash of both sets, all zeroes is right as it is
+  expanded_tokens pending; // What expansions made, waiting to be looked at again, next one last
+  expanded_tokens arguments; // Every argument of every call being expanded
+  expanded_tokens expanded_arguments;
+  expanded_tokens substituted; // Bodies with their arguments put in
+  macro_argument *argument_spans; // Plain array, where each argument is
+  uint32_t argument_count;
+  uint32_t argument_capacity;
+  char *paste_buffer; // Where ## puts tokens together to lex them again, padded the way the lexer likes
+  uint32_t paste_capacity;
+  arena pasted_names; // Names ## made aren't in any file, so they're kept here
+} preprocessor;
+
+#define NO_MACRO UINT32_MAX
+
+// Only files with a '#' in them need preprocessing
+bool source_has_directives(source_file source);
+
+preprocessor preprocessor_create(symbol_table *symbols, FILE *errors);
+// Lexes the file, follows its directives, and leaves the unit's tokens and
+// text in `tokens` and `text`
+void preprocess(preprocessor *state, source_file source, const char *path);
+// The text the tokens point into, to hand to the parser
+source_file preprocessed_source(const preprocessor *state);
+void preprocessor_free(preprocessor *state);
+
+// Lets go of every cached header. Only once nothing's preprocessing, and
+// nothing's using a symbol table a unit made (names can point into headers).
+void header_cache_free(void);
+
+#endif
@@ -0,0 +1,554 @@
+// Inputs = type nodes and a parsed tree, outputs = sizes, alignments and member offsets, put on their nodes
+#include "semantic.h"
+#include "instrument.h"
+#include "c-tests/test.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t align_up(uint32_t value, uint32_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
+
+type_layout layout_of_type(const node *type) {
+  switch (type->type) {
+  case NODE_BASE_TYPE:
+    return (type_layout){ .size_bytes = type->base_type.size_bytes, .alignment = type->base_type.alignment };
+  case NODE_POINTER:
+    return (type_layout){ .size_bytes = POINTER_BYTES, .alignment = POINTER_BYTES };
+  case NODE_STRUCTURE:
+    return (type_layout){ .size_bytes = type->structure.size_bytes, .alignment = type->structure.alignment };
+  default:
+    return (type_layout){ .size_bytes = 0, .alignment = 1 };
+  }
+}
+
+void resolve_base_type(node *base_type, const typedef_entry *entry) {
+  base_type->base_type.size_bytes = entry->size_bytes;
+  base_type->base_type.alignment = entry->alignment;
+  base_type->base_type.definition = entry->type;
+}
+
+// Members go in order, each lined up to its own alignment, and the struct
+// lines up to its biggest one so an array of them keeps every member lined up
+void lay_out_structure(node *structure) {
+  node_list members = structure->structure.members;
+  uint32_t size = 0;
+  uint32_t alignment = 1;
+  for (uint32_t i = 0; i < members.count; i++) {
+    node *member = members.nodes[i];
+    type_layout layout;
+    if (member->type == NODE_VARIABLE_DECLARATION) {
+      layout = layout_of_type(member->variable_declaration.type);
+    } else if (member->type == NODE_STRUCTURE && member->structure.name == NO_SYMBOL) {
+      // A nameless struct's members are this one's, but they stay together
+      layout = layout_of_type(member);
+    } else {
+      // A named struct in here only declares the type
+      continue;
+    }
+    size = align_up(size, layout.alignment);
+    if (member->type == NODE_VARIABLE_DECLARATION) {
+      member->variable_declaration.offset = size;
+    } else {
+      member->structure.offset = size;
+    }
+    size += layout.size_bytes;
+    alignment = layout.alignment > alignment ? layout.alignment : alignment;
+  }
+  structure->structure.size_bytes = align_up(size, alignment);
+  structure->structure.alignment = alignment;
+  structure->structure.offset = NO_OFFSET;
+}
+
+void resolve_type(node *type, scope_context *context) {
+  switch (type->type) {
+  case NODE_BASE_TYPE: {
+    // It was there when the type was parsed, unless what it was built from is broken
+    typedef_entry *entry = find_type(type->base_type.name, context);
+    if (entry != NULL) {
+      resolve_base_type(type, entry);
+    }
+    break;
+  }
+  case NODE_POINTER:
+    resolve_type(type->pointer.to, context);
+    break;
+  case NODE_STRUCTURE: {
+    node_list members = type->structure.members;
+    for (uint32_t i = 0; i < members.count; i++) {
+      if (members.nodes[i]->type == NODE_VARIABLE_DECLARATION) {
+        resolve_type(members.nodes[i]->variable_declaration.type, context);
+      } else if (members.nodes[i]->type == NODE_STRUCTURE) {
+        resolve_type(members.nodes[i], context);
+      }
+    }
+    lay_out_structure(type);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+node *find_member(const node *structure, symbol_id name, uint32_t *offset) {
+  node_list members = structure->structure.members;
+  for (uint32_t i = 0; i < members.count; i++) {
+    node *member = members.nodes[i];
+    if (member->type == NODE_VARIABLE_DECLARATION && member->variable_declaration.name == name) {
+      *offset = member->variable_declaration.offset;
+      return member;
+    }
+    if (member->type == NODE_STRUCTURE && member->structure.name == NO_SYMBOL) {
+      uint32_t inner_offset;
+      node *found = find_member(member, name, &inner_offset);
+      if (found != NULL) {
+        *offset = member->structure.offset + inner_offset;
+        return found;
+      }
+    }
+  }
+  return NULL;
+}
+
+// Past every typedef name to the type it's for
+static node *underlying_type(node *type) {
+  while (type != NULL && type->type == NODE_BASE_TYPE && type->base_type.definition != NULL) {
+    type = type->base_type.definition;
+  }
+  return type;
+}
+
+// -- Interning types
+
+#define FIRST_TYPE_CAPACITY 64
+
+type_table *type_table_create(arena *memory, const type_table *base) {
+  type_table *table = arena_allocate(memory, sizeof(type_table));
+  *table = (type_table){
+    .memory = memory,
+    .base = base,
+    .first_id = base != NULL ? type_count(base) : 0,
+    .types = NULL,
+    .count = 0,
+    .capacity = 0,
+    .slots = NULL,
+    .slot_count = 0,
+    .merged = NULL,
+  };
+  return table;
+}
+
+uint32_t type_count(const type_table *table) {
+  return table->first_id + table->count;
+}
+
+static type_id id_of_type(const node *type) {
+  switch (type->type) {
+  case NODE_BASE_TYPE:
+    return type->base_type.id;
+  case NODE_POINTER:
+    return type->pointer.id;
+  case NODE_STRUCTURE:
+    return type->structure.id;
+  default:
+    return NO_TYPE;
+  }
+}
+
+// Only what says which type it is goes in: the name and typedef for a base
+// type, where it points for a pointer
+static uint64_t hash_type(const node *type) {
+  uint64_t name = type->type == NODE_BASE_TYPE ? type->base_type.name : NO_SYMBOL;
+  const node *from = type->type == NODE_BASE_TYPE ? type->base_type.definition : type->pointer.to;
+  uint64_t hash = (name * 0x9E3779B97F4A7C15ull ^ (uint64_t)(uintptr_t)from) * 0xBF58476D1CE4E5B9ull;
+  return hash ^ hash >> 32;
+}
+
+static bool same_type_key(const node *a, const node *b) {
+  if (a->type != b->type) {
+    return false;
+  }
+  if (a->type == NODE_BASE_TYPE) {
+    return a->base_type.name == b->base_type.name && a->base_type.definition == b->base_type.definition;
+  }
+  return a->pointer.to == b->pointer.to;
+}
+
+static void put_in_slot(node **slots, uint32_t slot_count, node *type) {
+  uint32_t mask = slot_count - 1;
+  uint32_t slot = hash_type(type) & mask;
+  while (slots[slot] != NULL) {
+    slot = (slot + 1) & mask;
+  }
+  slots[slot] = type;
+}
+
+// Old arrays stay in the arena till the tree goes, which is never more than
+// the newest one again
+static void grow_type_table(type_table *table) {
+  uint32_t capacity = table->capacity > 0 ? table->capacity * 2 : FIRST_TYPE_CAPACITY;
+  node **types = arena_allocate(table->memory, sizeof(node *) * capacity);
+  if (table->count > 0) {
+    memcpy(types, table->types, sizeof(node *) * table->count);
+  }
+  table->types = types;
+  table->capacity = capacity;
+
+  uint32_t slot_count = capacity * 2;
+  node **slots = arena_allocate(table->memory, sizeof(node *) * slot_count);
+  memset(slots, 0, sizeof(node *) * slot_count);
+  for (uint32_t i = 0; i < table->count; i++) {
+    if (table->types[i]->type != NODE_STRUCTURE) {
+      put_in_slot(slots, slot_count, table->types[i]);
+    }
+  }
+  table->slots = slots;
+  table->slot_count = slot_count;
+}
+
+node *find_interned_type(const type_table *table, const node *key) {
+  uint64_t hash = hash_type(key);
+  for (; table != NULL; table = table->base) {
+    if (table->slot_count == 0) {
+      continue;
+    }
+    uint32_t mask = table->slot_count - 1;
+    for (uint32_t slot = hash & mask; table->slots[slot] != NULL; slot = (slot + 1) & mask) {
+      if (same_type_key(table->slots[slot], key)) {
+        return table->slots[slot];
+      }
+    }
+  }
+  return NULL;
+}
+
+void intern_type(type_table *table, node *type) {
+  if (type->type != NODE_BASE_TYPE && type->type != NODE_POINTER && type->type != NODE_STRUCTURE) {
+    return;
+  }
+  // Slots are twice as many as types, so they're never more than half full
+  if (table->count == table->capacity) {
+    grow_type_table(table);
+  }
+  type_id id = type_count(table);
+  table->types[table->count++] = type;
+  switch (type->type) {
+  case NODE_STRUCTURE:
+    // Never the same as another, nothing looks it up
+    type->structure.id = id;
+    return;
+  case NODE_BASE_TYPE:
+    type->base_type.id = id;
+    break;
+  default:
+    type->pointer.id = id;
+    break;
+  }
+  put_in_slot(table->slots, table->slot_count, type);
+}
+
+bool types_match(const node *a, const node *b) {
+  a = underlying_type((node *)a);
+  b = underlying_type((node *)b);
+  if (a == b) {
+    return true;
+  }
+  // `name *` and `char **` are different nodes if `name` is a `char *`
+  return a != NULL && b != NULL && a->type == NODE_POINTER && b->type == NODE_POINTER &&
+         types_match(a->pointer.to, b->pointer.to);
+}
+
+// A type's own, and not the base's or one made somewhere else, if the table
+// has it at its id
+static bool is_from_table(const type_table *table, const node *type) {
+  type_id id = id_of_type(type);
+  return id != NO_TYPE && id >= table->first_id && id - table->first_id < table->count &&
+         table->types[id - table->first_id] == type;
+}
+
+node *merged_type(const type_table *from, node *type) {
+  assert(from->merged != NULL);
+  if (type == NULL || !is_from_table(from, type)) {
+    return type;
+  }
+  return from->merged[id_of_type(type) - from->first_id];
+}
+
+bool merge_types(type_table *into, type_table *from) {
+  assert(from->base == into);
+  from->merged = arena_allocate(into->memory, sizeof(node *) * (from->count > 0 ? from->count : 1));
+  bool duplicates = false;
+  for (uint32_t i = 0; i < from->count; i++) {
+    // What a type's made from was made before it, so it's merged already.
+    // It has to be pointed at what was kept before it can be looked up.
+    node *type = from->types[i];
+    node *kept = NULL;
+    switch (type->type) {
+    case NODE_BASE_TYPE:
+      type->base_type.definition = merged_type(from, type->base_type.definition);
+      kept = find_interned_type(into, type);
+      break;
+    case NODE_POINTER:
+      type->pointer.to = merged_type(from, type->pointer.to);
+      kept = find_interned_type(into, type);
+      break;
+    default: {
+      // A struct's members aren't in any body's statements if it was typedef'd
+      node_list members = type->structure.members;
+      for (uint32_t m = 0; m < members.count; m++) {
+        if (members.nodes[m]->type == NODE_VARIABLE_DECLARATION) {
+          node *member = members.nodes[m];
+          member->variable_declaration.type = merged_type(from, member->variable_declaration.type);
+        }
+      }
+      break;
+    }
+    }
+    if (kept != NULL) {
+      from->merged[i] = kept;
+      duplicates = true;
+    } else {
+      from->merged[i] = type;
+      intern_type(into, type);
+    }
+  }
+  return duplicates;
+}
+
+// Only statements declare things, expressions are skipped over
+void redirect_merged_types(node *subtree, const type_table *from) {
+  if (subtree == NULL) {
+    return;
+  }
+  switch (subtree->type) {
+  case NODE_VARIABLE_DECLARATION:
+    subtree->variable_declaration.type = merged_type(from, subtree->variable_declaration.type);
+    break;
+  case NODE_FUNCTION_DECLARATION: {
+    subtree->function.type = merged_type(from, subtree->function.type);
+    node_list parameters = subtree->function.parameters;
+    for (uint32_t i = 0; i < parameters.count; i++) {
+      redirect_merged_types(parameters.nodes[i], from);
+    }
+    redirect_merged_types(subtree->function.body, from);
+    break;
+  }
+  case NODE_BLOCK: {
+    node_list statements = subtree->block.nodes;
+    for (uint32_t i = 0; i < statements.count; i++) {
+      redirect_merged_types(statements.nodes[i], from);
+    }
+    break;
+  }
+  case NODE_IF:
+    redirect_merged_types(subtree->if_statement.success, from);
+    redirect_merged_types(subtree->if_statement.fail, from);
+    break;
+  case NODE_WHILE:
+    redirect_merged_types(subtree->while_loop.body, from);
+    break;
+  case NODE_DO_WHILE:
+    redirect_merged_types(subtree->do_while_loop.body, from);
+    break;
+  case NODE_FOR:
+    redirect_merged_types(subtree->for_loop.index_declaration, from);
+    redirect_merged_types(subtree->for_loop.body, from);
+    break;
+  default:
+    // Structs' members were done as they were merged
+    break;
+  }
+}
+
+// -- Resolving member gets
+
+// Variables' types are scoped just like typedefs are, so they go in a
+// scope_context too. A function's name is bound to its declaration, so a
+// call can tell what it gives back.
+typedef struct {
+  scope_context variables;
+  const symbol_table *symbols;
+  FILE *errors;
+  uint32_t error_count;
+} member_pass;
+
+static void bind_variable(member_pass *pass, symbol_id name, node *type) {
+  typedef_entry binding = { .name = name, .type = type };
+  add_type_to_context(binding, &pass->variables);
+}
+
+// `a->b` is parsed as `*(a.b)`, with the get marked as going through a
+// pointer, so it gets the member through the pointer. `.` only works on a
+// struct and `->` only on a pointer to one. Hands back the member's type.
+static node *resolve_member_get(member_pass *pass, node *get, node *from_type) {
+  node *structure = underlying_type(from_type);
+  if (structure == NULL) {
+    // Nothing to go on, like a call to a function that hasn't been declared
+    return NULL;
+  }
+  string_slice member_name = symbol_name(pass->symbols, get->struct_member_get.name);
+  bool through_pointer = get->struct_member_get.through_pointer;
+  if (structure->type == NODE_POINTER && !through_pointer) {
+    fprintf(pass->errors, "Error: Can't get member '%.*s' from a pointer with '.', that's what '->' is for\n",
+            (int)member_name.length, member_name.chars);
+    pass->error_count += 1;
+    return NULL;
+  }
+  if (structure->type != NODE_POINTER && through_pointer) {
+    fprintf(pass->errors, "Error: Can't get member '%.*s' with '->' from something that isn't a pointer\n",
+            (int)member_name.length, member_name.chars);
+    pass->error_count += 1;
+    return NULL;
+  }
+  if (structure->type == NODE_POINTER) {
+    structure = underlying_type(structure->pointer.to);
+  }
+  if (structure->type != NODE_STRUCTURE) {
+    fprintf(pass->errors, "Error: Can't get member '%.*s' from something that isn't a struct\n",
+            (int)member_name.length, member_name.chars);
+    pass->error_count += 1;
+    return NULL;
+  }
+  uint32_t offset;
+  node *member = find_member(structure, get->struct_member_get.name, &offset);
+  if (member == NULL) {
+    string_slice struct_name = structure->structure.name != NO_SYMBOL
+                                   ? symbol_name(pass->symbols, structure->structure.name)
+                                   : SLICE("(nameless)");
+    fprintf(pass->errors, "Error: Struct '%.*s' has no member '%.*s'\n", (int)struct_name.length,
+            struct_name.chars, (int)member_name.length, member_name.chars);
+    pass->error_count += 1;
+    return NULL;
+  }
+  get->struct_member_get.member = member;
+  get->struct_member_get.offset = offset;
+  return member->variable_declaration.type;
+}
+
+// Resolves everything under the node, and hands back its type if it's an
+// expression whose type can be worked out (NULL otherwise)
+static node *resolve_node(member_pass *pass, node *current_node) {
+  if (current_node == NULL) {
+    return NULL;
+  }
+  switch (current_node->type) {
+  case NODE_VARIABLE: {
+    typedef_entry *binding = find_type(current_node->variable.name, &pass->variables);
+    return binding != NULL ? binding->type : NULL;
+  }
+  case NODE_STRUCT_MEMBER_GET:
+    return resolve_member_get(pass, current_node, resolve_node(pass, current_node->struct_member_get.from));
+  case NODE_EQUATION: {
+    node *left = current_node->equation.left;
+    operator_type operator = current_node->equation.operator;
+    bool unary = operator == OPERATOR_NEGATE || operator == OPERATOR_NOT || operator == OPERATOR_DEREFERENCE ||
+                 operator == OPERATOR_REFERENCE;
+    // Only a parse that went wrong leaves these out, but nothing after it gets to read through them
+    if (left == NULL || (!unary && current_node->equation.right == NULL)) {
+      fprintf(pass->errors, "Error: '%s' is missing what it works on\n", operator_type_to_string(operator));
+      pass->error_count += 1;
+      return NULL;
+    }
+    switch (operator) {
+    case OPERATOR_DEREFERENCE: {
+      // The `->` shape, its member get already went through the pointer
+      if (left->type == NODE_STRUCT_MEMBER_GET && left->struct_member_get.through_pointer) {
+        return resolve_member_get(pass, left, resolve_node(pass, left->struct_member_get.from));
+      }
+      node *pointer = underlying_type(resolve_node(pass, left));
+      return pointer != NULL && pointer->type == NODE_POINTER ? pointer->pointer.to : NULL;
+    }
+    case OPERATOR_ASSIGN:
+    case OPERATOR_ADD: // Pointer arithmetic keeps the pointer's type
+    case OPERATOR_SUBTRACT: {
+      node *left_type = resolve_node(pass, left);
+      resolve_node(pass, current_node->equation.right);
+      return left_type;
+    }
+    default:
+      // Nothing else makes a struct or a pointer (a reference would need a type node made for it)
+      resolve_node(pass, left);
+      resolve_node(pass, current_node->equation.right);
+      return NULL;
+    }
+  }
+  case NODE_ARRAY_GET: {
+    node *pointer = underlying_type(resolve_node(pass, current_node->array_get.from));
+    resolve_node(pass, current_node->array_get.index_expression);
+    return pointer != NULL && pointer->type == NODE_POINTER ? pointer->pointer.to : NULL;
+  }
+  case NODE_FUNCTION_CALL: {
+    node *function = resolve_node(pass, current_node->function_call.function_expression);
+    node_list inputs = current_node->function_call.inputs;
+    for (uint32_t i = 0; i < inputs.count; i++) {
+      resolve_node(pass, inputs.nodes[i]);
+    }
+    return function != NULL && function->type == NODE_FUNCTION_DECLARATION ? function->function.type : NULL;
+  }
+  case NODE_VARIABLE_DECLARATION:
+    resolve_node(pass, current_node->variable_declaration.value);
+    bind_variable(pass, current_node->variable_declaration.name, current_node->variable_declaration.type);
+    return NULL;
+  case NODE_FUNCTION_DECLARATION: {
+    // Bound before the body, so it can call itself
+    bind_variable(pass, current_node->function.name, current_node);
+    enter_scope(&pass->variables);
+    node_list parameters = current_node->function.parameters;
+    for (uint32_t i = 0; i < parameters.count; i++) {
+      resolve_node(pass, parameters.nodes[i]);
+    }
+    // NULL if it was skipped and never asked for
+    resolve_node(pass, current_node->function.body);
+    exit_scope(&pass->variables);
+    return NULL;
+  }
+  case NODE_BLOCK: {
+    enter_scope(&pass->variables);
+    node_list statements = current_node->block.nodes;
+    for (uint32_t i = 0; i < statements.count; i++) {
+      resolve_node(pass, statements.nodes[i]);
+    }
+    exit_scope(&pass->variables);
+    return NULL;
+  }
+  case NODE_IF:
+    resolve_node(pass, current_node->if_statement.condition);
+    resolve_node(pass, current_node->if_statement.success);
+    resolve_node(pass, current_node->if_statement.fail);
+    return NULL;
+  case NODE_WHILE:
+    resolve_node(pass, current_node->while_loop.condition);
+    resolve_node(pass, current_node->while_loop.body);
+    return NULL;
+  case NODE_DO_WHILE:
+    resolve_node(pass, current_node->do_while_loop.body);
+    resolve_node(pass, current_node->do_while_loop.condition);
+    return NULL;
+  case NODE_FOR:
+    // The index is only in scope for the loop
+    enter_scope(&pass->variables);
+    resolve_node(pass, current_node->for_loop.index_declaration);
+    resolve_node(pass, current_node->for_loop.condition);
+    resolve_node(pass, current_node->for_loop.index_assignment);
+    resolve_node(pass, current_node->for_loop.body);
+    exit_scope(&pass->variables);
+    return NULL;
+  default:
+    // Literals, and types (structs are laid out already)
+    return NULL;
+  }
+}
+
+uint32_t resolve_members(node *ast, const symbol_table *symbols, FILE *errors) {
+  TIME_SCOPE("resolve members");
+  member_pass pass = {
+    .variables = create_scope_context(),
+    .symbols = symbols,
+    .errors = errors,
+    .error_count = 0,
+  };
+  resolve_node(&pass, ast);
+  free_scope_context(&pass.variables);
+  return pass.error_count;
+}
@@ -0,0 +1,106 @@
+#ifndef semantic_h
+#define semantic_h
+#include "arena.h"
+#include "parser.h"
+#include "symbols.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// What a backend needs to know about types: how big each one is, what it
+// lines up to, and where every struct member is.
+//
+// Types get laid out once, when they're made. What a type name means is
+// only known while the parser still has its scope (typedefs don't go in the
+// tree), so a base type copies its typedef's size, alignment and type as
+// it's parsed, a struct gets laid out as soon as its members are, and a
+// typedef keeps its type's size and alignment. After that, how big any type
+// is, is two numbers on its node, however many typedefs deep it is.
+//
+// A member get (`a.b`, `a->b`) needs the type of what it's getting from,
+// which needs every variable's type, so those get resolved by one pass over
+// the whole tree after it's parsed. A resolved one has the member's offset
+// on it, and nothing has to look the member up by name again.
+
+#define POINTER_BYTES 8
+
+typedef struct {
+  uint32_t size_bytes;
+  uint32_t alignment;
+} type_layout;
+
+// Only reads the node, the type has to be resolved already. Something that
+// isn't a type is 0 bytes, lined up to 1.
+type_layout layout_of_type(const node *type);
+// What a base type is, from the typedef it names
+void resolve_base_type(node *base_type, const typedef_entry *entry);
+// Its members' types have to be resolved already
+void lay_out_structure(node *structure);
+// For types built back up instead of parsed (a header image's): resolves
+// their base types in `context` and lays their structs out again
+void resolve_type(node *type, scope_context *context);
+// The member called `name`, looking inside nameless struct members too, and
+// where it is from the start of `structure`. NULL if there isn't one.
+node *find_member(const node *structure, symbol_id name, uint32_t *offset);
+
+// -- Interning types
+//
+// A type that's written the same way twice, with the same typedefs in
+// scope, is one node: base types are the same if they name the same typedef,
+// pointers are if they point to the same type, and every struct is its own.
+// The parser makes a type once and hands back that node every time after, so
+// two types are the same if they're the same node, and there are only as many
+// type nodes as distinct types, however many declarations share them. Every
+// type gets an id too, from 0 up in the order they're made, for anything
+// that wants an array indexed by type.
+//
+// A typedef name isn't the same node as the type it's for, since the tree
+// keeps how a type was written. types_match sees through typedefs.
+//
+// A table goes in the arena its tree is in, so it's there as long as the
+// nodes are, and there's nothing to free. Bodies parsed on other threads get
+// tables of their own, on top of the top level's (which doesn't change while
+// they're parsed), that are merged back after.
+typedef struct type_table {
+  arena *memory;
+  const struct type_table *base; // Read-only, types it already has don't get made again
+  type_id first_id; // How many types the base had, this table's come after
+  node **types; // By id - first_id
+  uint32_t count;
+  uint32_t capacity;
+  node **slots; // Open addressing over base types and pointers, NULL is empty
+  uint32_t slot_count; // A power of two, kept at most half full
+  node **merged; // Once it's merged, where each of its types went (by id - first_id)
+} type_table;
+
+type_table *type_table_create(arena *memory, const type_table *base);
+// The type that's the same as `key` (a base type's name and definition, or
+// a pointer's `to`, nothing else is read), NULL if there isn't one yet
+node *find_interned_type(const type_table *table, const node *key);
+// Gives a type that was just made its id, and makes it the one that's found
+// for types like it after (only base types, pointers and structs, anything
+// else is left alone)
+void intern_type(type_table *table, node *type);
+// The base's types included
+uint32_t type_count(const type_table *table);
+// Whether they're the same type once typedef names are seen through
+bool types_match(const node *a, const node *b);
+// Adds the types `from` made that `into` doesn't have yet to it, in the
+// order they were made. Ones it already had are duplicates, which nothing in
+// `into` points to, but declarations parsed with `from` might. Gives back
+// whether there were any (merged_type says what they should've been).
+bool merge_types(type_table *into, type_table *from);
+// What a type made with a table that's been merged is now
+node *merged_type(const type_table *from, node *type);
+// Points every declaration under `subtree` that has a duplicate type at the
+// one that got kept instead
+void redirect_merged_types(node *subtree, const type_table *from);
+
+// Resolves every member get it can work out the type of. Getting a member a
+// struct doesn't have, one from something that isn't a struct, `.` on a
+// pointer or `->` on something that isn't one are errors, and so is an
+// operator missing what it works on. They're said to `errors`, and it hands
+// back how many there were.
+uint32_t resolve_members(node *ast, const symbol_table *symbols, FILE *errors);
+
+#endif
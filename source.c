@@ -0,0 +1,80 @@
+// Inputs = file path, outputs = the file's characters, mapped into memory
+#include "source.h"
+#include "instrument.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// We map one page more than the file needs (rounded up), and put the file on
+// top of it. Whatever the file doesn't cover stays as zero pages, which means
+// the source is always null terminated, even when its size is a multiple of
+// the page size.
+source_file source_from_path(const char *path) {
+  TIME_SCOPE("load");
+  source_file source = { .chars = NULL, .size = 0, .mapped_size = 0 };
+
+  int file_descriptor = open(path, O_RDONLY);
+  if (file_descriptor < 0) {
+    return source;
+  }
+  struct stat file_stats;
+  if (fstat(file_descriptor, &file_stats) != 0) {
+    close(file_descriptor);
+    return source;
+  }
+
+  size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+  size_t size = (size_t)file_stats.st_size;
+  // Size + 1 for null terminator
+  size_t mapped_size = (size + 1 + page_size - 1) / page_size * page_size;
+
+  char *zeroes = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (zeroes == MAP_FAILED) {
+    close(file_descriptor);
+    return source;
+  }
+  if (size > 0) {
+    void *file_chars = mmap(zeroes, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, file_descriptor, 0);
+    if (file_chars == MAP_FAILED) {
+      munmap(zeroes, mapped_size);
+      close(file_descriptor);
+      return source;
+    }
+    // We only ever read it front to back
+    madvise(file_chars, size, MADV_SEQUENTIAL);
+  }
+  // The mapping stays valid after the file is closed
+  close(file_descriptor);
+
+  source.chars = zeroes;
+  source.size = size;
+  source.mapped_size = mapped_size;
+  return source;
+}
+
+void source_close(source_file *source) {
+  if (source->chars != NULL) {
+    munmap((void *)source->chars, source->mapped_size);
+  }
+  source->chars = NULL;
+  source->size = 0;
+  source->mapped_size = 0;
+}
+
+bool slice_equals(string_slice a, string_slice b) {
+  // Strings with different sizes are, by definition, different
+  if (a.length != b.length) {
+    return false;
+  }
+  return memcmp(a.chars, b.chars, a.length) == 0;
+}
+
+// Shortcut for comparing a slice against a normal C string
+bool slice_is(string_slice slice, const char *to_compare) {
+  if (slice.length != strlen(to_compare)) {
+    return false;
+  }
+  return memcmp(slice.chars, to_compare, slice.length) == 0;
+}
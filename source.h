@@ -0,0 +1,32 @@
+#ifndef source_h
+#define source_h
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A source file mapped straight into memory (read only, never copied).
+// There is always at least one '\0' after the last char, so the lexer can
+// peek one char past the end without checking bounds.
+typedef struct {
+  const char *chars; // NULL if the file couldn't be opened
+  size_t size;
+  size_t mapped_size;
+} source_file;
+
+// A view into characters owned by someone else (usually a source_file).
+// Not null terminated, so print it with "%.*s".
+typedef struct {
+  const char *chars;
+  uint32_t length;
+} string_slice;
+
+// Makes a slice out of a string literal, like `SLICE("int")`
+#define SLICE(literal) ((string_slice){ .chars = (literal), .length = sizeof(literal) - 1 })
+
+source_file source_from_path(const char *path);
+void source_close(source_file *source);
+
+bool slice_equals(string_slice a, string_slice b);
+bool slice_is(string_slice slice, const char *to_compare);
+
+#endif
@@ -0,0 +1,88 @@
+// Inputs = identifier text, outputs = the same small number for the same text
+#include "symbols.h"
+#include "instrument.h"
+#include "memory.h"
+#include "c-tests/test.h"
+#include "c-vector/vec.h"
+#include <string.h>
+
+// Names only get hashed here, once per identifier token. Everything after
+// the lexer works on the ids.
+static int compare_symbol_entries(const void *a, const void *b, void *udata) {
+  (void)udata;
+  const string_slice name1 = ((symbol_entry *)a)->name;
+  const string_slice name2 = ((symbol_entry *)b)->name;
+  if (name1.length != name2.length) {
+    return 1;
+  }
+  return memcmp(name1.chars, name2.chars, name1.length);
+}
+static uint64_t hash_symbol_entry(const void *data, uint64_t seed0, uint64_t seed1) {
+  const string_slice name = ((symbol_entry *)data)->name;
+  return hashmap_xxhash3(name.chars, name.length, seed0, seed1);
+}
+
+symbol_table symbol_table_create(void) {
+  symbol_table symbols = {
+    .ids = hashmap_new_with_allocator(memory_allocate, memory_reallocate, memory_free, sizeof(symbol_entry), 256, 0, 0, hash_symbol_entry, compare_symbol_entries, NULL, NULL),
+    .names = vector_create(),
+    .name_storage = NULL,
+    .base = NULL,
+    .base_count = 0,
+  };
+  assert(symbols.ids != NULL);
+  return symbols;
+}
+
+void symbol_table_set_base(symbol_table *symbols, const symbol_table *base) {
+  assert(symbol_count(symbols) == 0);
+  symbols->base = base;
+  symbols->base_count = symbol_count(base);
+}
+
+void symbol_table_free(symbol_table *symbols) {
+  hashmap_free(symbols->ids);
+  vector_free((vector *)&symbols->names);
+  symbols->ids = NULL;
+  symbols->names = NULL;
+}
+
+// The names are slices of whatever the caller handed in, so the source they
+// came from has to outlive the table (unless there's name_storage).
+symbol_id intern_symbol(symbol_table *symbols, string_slice name) {
+  symbol_entry new_entry = { .name = name, .id = symbol_count(symbols) };
+  // The base is only read, so any number of tables can share it across threads
+  const symbol_entry *found = symbols->base != NULL ? hashmap_get(symbols->base->ids, &new_entry) : NULL;
+  if (found == NULL) {
+    found = hashmap_get(symbols->ids, &new_entry);
+  }
+  counter_add(COUNTER_HASHMAP_PROBES, 1);
+  if (found != NULL) {
+    return found->id;
+  }
+  if (symbols->name_storage != NULL) {
+    char *copy = arena_allocate(symbols->name_storage, name.length);
+    memcpy(copy, name.chars, name.length);
+    name.chars = copy;
+    new_entry.name = name;
+  }
+  hashmap_set(symbols->ids, &new_entry);
+  counter_add(COUNTER_HASHMAP_PROBES, 1);
+  vector_add(&symbols->names, name);
+  return new_entry.id;
+}
+
+string_slice symbol_name(const symbol_table *symbols, symbol_id id) {
+  if (id == NO_SYMBOL) {
+    return (string_slice){ .chars = NULL, .length = 0 };
+  }
+  assert(id < symbol_count(symbols));
+  if (id < symbols->base_count) {
+    return symbol_name(symbols->base, id);
+  }
+  return symbols->names[id - symbols->base_count];
+}
+
+uint32_t symbol_count(const symbol_table *symbols) {
+  return symbols->base_count + vector_size((vector *)&symbols->names);
+}
@@ -0,0 +1,40 @@
+#ifndef symbols_h
+#define symbols_h
+#include "arena.h"
+#include "c-hashmap/hashmap.h"
+#include "source.h"
+#include <stdint.h>
+
+// Every distinct identifier gets a small number the first time the lexer sees
+// it. After that, comparing or hashing a name is just comparing or hashing
+// that number.
+typedef uint32_t symbol_id;
+
+// For optional names, like nameless structs
+#define NO_SYMBOL UINT32_MAX
+
+// A table can start from a base table that it only reads from (a
+// precompiled header's, shared by every unit that uses it). The base's
+// names keep their ids, and names the base doesn't have get ids after them.
+typedef struct symbol_table {
+  struct hashmap *ids; // Name -> symbol_entry, only the names that aren't in the base
+  string_slice *names; // Vector, symbol_id - base_count -> name
+  arena *name_storage; // If not NULL, new names get copied in here, for text that's going to change
+  const struct symbol_table *base; // NULL if there isn't one
+  uint32_t base_count;
+} symbol_table;
+
+typedef struct {
+  string_slice name;
+  symbol_id id;
+} symbol_entry;
+
+symbol_table symbol_table_create(void);
+// Has to be empty, and the base has to outlive it without changing
+void symbol_table_set_base(symbol_table *symbols, const symbol_table *base);
+void symbol_table_free(symbol_table *symbols);
+symbol_id intern_symbol(symbol_table *symbols, string_slice name);
+string_slice symbol_name(const symbol_table *symbols, symbol_id id);
+uint32_t symbol_count(const symbol_table *symbols);
+
+#endif
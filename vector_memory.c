@@ -0,0 +1,12 @@
+// c-vector doesn't take an allocator, so it gets compiled from here with
+// ours swapped in for malloc/realloc/free. Build this instead of
+// c-vector/vec.c. The standard headers go first so their declarations
+// don't get renamed too.
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define malloc memory_allocate
+#define realloc memory_reallocate
+#define free memory_free
+#include "c-vector/vec.c"
@@ -0,0 +1,69 @@
+// Inputs = a flat AST and what to do at each node, outputs = that, done at each node
+#include "walk.h"
+#include "memory.h"
+#include "c-tests/test.h"
+
+typedef struct {
+  ast_visit visit;
+  uint32_t next_child;
+  uint32_t children_to_visit; // 0 if enter said to skip them
+} walk_frame;
+
+// Every node goes through here, so it's a plain array rather than a vector
+typedef struct {
+  walk_frame *frames;
+  uint32_t count;
+  uint32_t capacity;
+} walk_stack;
+
+static void enter_node(const flat_ast *ast, ast_walker *walker, walk_stack *stack, ast_visit visit) {
+  bool descend = visit.index != NO_NODE;
+  if (walker->enter != NULL) {
+    descend &= walker->enter(walker, ast, visit);
+  }
+  if (stack->count == stack->capacity) {
+    stack->capacity *= 2;
+    stack->frames = memory_reallocate(stack->frames, sizeof(walk_frame) * stack->capacity);
+    assert(stack->frames != NULL);
+  }
+  stack->frames[stack->count++] = (walk_frame){
+    .visit = visit,
+    .next_child = 0,
+    .children_to_visit = descend ? visit.child_count : 0,
+  };
+}
+
+void walk_ast(const flat_ast *ast, node_index root, ast_walker *walker) {
+  if (root == NO_NODE) {
+    return;
+  }
+  walk_stack stack = { .frames = memory_allocate(sizeof(walk_frame) * 64), .count = 0, .capacity = 64 };
+  assert(stack.frames != NULL);
+  ast_visit root_visit = { .index = root, .parent = NO_NODE, .position = 0, .depth = 0, .child_count = ast_child_count(ast, root) };
+  enter_node(ast, walker, &stack, root_visit);
+
+  while (stack.count > 0) {
+    walk_frame *top = &stack.frames[stack.count - 1];
+    if (top->next_child < top->children_to_visit) {
+      uint32_t position = top->next_child++;
+      node_index child = ast_nth_child(ast, top->visit.index, position);
+      if (child != NO_NODE || walker->visit_missing) {
+        // `top` can move once something's pushed, so it's copied out first
+        ast_visit visit = {
+          .index = child,
+          .parent = top->visit.index,
+          .position = position,
+          .depth = top->visit.depth + 1,
+          .child_count = child != NO_NODE ? ast_child_count(ast, child) : 0,
+        };
+        enter_node(ast, walker, &stack, visit);
+      }
+    } else {
+      stack.count -= 1;
+      if (walker->leave != NULL) {
+        walker->leave(walker, ast, top->visit);
+      }
+    }
+  }
+  memory_free(stack.frames);
+}
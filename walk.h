@@ -0,0 +1,32 @@
+#ifndef walk_h
+#define walk_h
+#include "ast.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+// Goes over a flat AST calling back before and after each node's children.
+// The nodes waiting to be finished are kept in a vector instead of on the C
+// stack, so however deep the tree goes, the walk doesn't overflow anything.
+// Children come in ast_nth_child order.
+
+// Where the walk is
+typedef struct {
+  node_index index; // NO_NODE for a child that isn't there (see visit_missing)
+  node_index parent; // NO_NODE for the node the walk started at
+  uint32_t position; // Which of the parent's children this is
+  uint32_t depth; // 0 for the node the walk started at
+  uint32_t child_count; // ast_child_count, 0 for a missing child
+} ast_visit;
+
+typedef struct ast_walker {
+  // Before the node's children. Giving back false skips them, leave still
+  // gets called. Either callback can be NULL.
+  bool (*enter)(struct ast_walker *walker, const flat_ast *ast, ast_visit visit);
+  void (*leave)(struct ast_walker *walker, const flat_ast *ast, ast_visit visit);
+  bool visit_missing; // Optional children that aren't there get called back for too
+  void *data; // Whatever the callbacks want
+} ast_walker;
+
+void walk_ast(const flat_ast *ast, node_index root, ast_walker *walker);
+
+#endif